@@ -42,9 +42,30 @@ size_t FasttrieUnicode_CharSize(PyObject *o)
 int _initialize(void)
 {
     // module initialization
+    trie_simd_init();
     return 1;
 }
 
+static PyObject *Fasttrie_simd_level(PyObject *self, PyObject *args)
+{
+    int level = -1;
+
+    if (!PyArg_ParseTuple(args, "|i", &level)) {
+        return NULL;
+    }
+    return Py_BuildValue("i", trie_simd_set(level));
+}
+
+static PyObject *Fasttrie_batch_lanes(PyObject *self, PyObject *args)
+{
+    int lanes = -1;
+
+    if (!PyArg_ParseTuple(args, "|i", &lanes)) {
+        return NULL;
+    }
+    return Py_BuildValue("i", trie_batch_lanes_set(lanes));
+}
+
 int _IsValid_Unicode(PyObject *s)
 {
     if (PyBytes_Check(s)) {
@@ -87,6 +108,50 @@ trie_key_t _PyUnicode_AS_TKEY(PyObject *s)
     return k;
 }
 
+// Lookups, adds and deletes call the trie loop matching the kind of the key
+// string directly, so the key width is switched on once per call.
+trie_node_t *_TKEY_SEARCH(trie_t *t, trie_key_t *k)
+{
+    switch(k->char_size)
+    {
+        case 1:
+            return trie_search_ucs1(t, (const uint8_t *)k->s, k->size);
+        case 2:
+            return trie_search_ucs2(t, (const uint16_t *)k->s, k->size);
+        case 4:
+            return trie_search_ucs4(t, (const uint32_t *)k->s, k->size);
+    }
+    return trie_search(t, k);
+}
+
+int _TKEY_ADD(trie_t *t, trie_key_t *k, TRIE_DATA value)
+{
+    switch(k->char_size)
+    {
+        case 1:
+            return trie_add_ucs1(t, (const uint8_t *)k->s, k->size, value);
+        case 2:
+            return trie_add_ucs2(t, (const uint16_t *)k->s, k->size, value);
+        case 4:
+            return trie_add_ucs4(t, (const uint32_t *)k->s, k->size, value);
+    }
+    return trie_add(t, k, value);
+}
+
+int _TKEY_DEL(trie_t *t, trie_key_t *k)
+{
+    switch(k->char_size)
+    {
+        case 1:
+            return trie_del_ucs1(t, (const uint8_t *)k->s, k->size);
+        case 2:
+            return trie_del_ucs2(t, (const uint16_t *)k->s, k->size);
+        case 4:
+            return trie_del_ucs4(t, (const uint32_t *)k->s, k->size);
+    }
+    return trie_del(t, k);
+}
+
 PyObject *_TKEY_AS_PyUnicode(trie_key_t *k)
 {
     PyObject *r;
@@ -104,8 +169,134 @@ PyObject *_TKEY_AS_PyUnicode(trie_key_t *k)
 typedef struct {
     PyObject_HEAD
     trie_t *ptrie;
+    trie_da_t *pda; // set instead of ptrie while frozen, see Trie_freeze()
+    trie_louds_t *plouds; // same, for freeze("louds")
+    trie_dawg_t *pdawg; // same, for freeze("dawg")
+    unsigned long iter_count; // live iterators, they point into ptrie
+    unsigned long dump_count; // dumps in progress, writes raise meanwhile
 } TrieObject;
 
+// Reads of a frozen trie go to its double array, LOUDS or automaton form, 
+// writes raise until thaw().
+static int _Trie_frozen(TrieObject *mp)
+{
+    return mp->pda || mp->plouds || mp->pdawg;
+}
+
+static int _Trie_writable(TrieObject *mp)
+{
+    if (_Trie_frozen(mp)) {
+        PyErr_SetString(FasttrieError, "trie is frozen, call thaw() first.");
+        return 0;
+    }
+    if (mp->dump_count) {
+        PyErr_SetString(PyExc_RuntimeError, "trie cannot be changed during a dump.");
+        return 0;
+    }
+    return 1;
+}
+
+// Value of key k, 0 if it is not in the trie.
+static TRIE_DATA _Trie_lookup(TrieObject *mp, trie_key_t *k)
+{
+    trie_node_t *w;
+
+    if (mp->pda) {
+        return trie_da_search(mp->pda, k);
+    }
+    if (mp->plouds) {
+        return trie_louds_search(mp->plouds, k);
+    }
+    if (mp->pdawg) {
+        return trie_dawg_search(mp->pdawg, k);
+    }
+    w = _TKEY_SEARCH(mp->ptrie, k);
+    return w ? w->value : 0;
+}
+
+// Whether key k is in the trie. A mapped trie does not load its value.
+static int _Trie_has_key(TrieObject *mp, trie_key_t *k)
+{
+    if (mp->pda) {
+        return trie_da_contains(mp->pda, k);
+    }
+    return _Trie_lookup(mp, k) != 0;
+}
+
+// With keys_only the callback reads no value, so a mapped trie loads none.
+// A damaged mapped file stops the walk with an exception.
+static void _Trie_suffixes(TrieObject *mp, trie_key_t *k, 
+    unsigned long max_depth, int keys_only, trie_enum_cbk_t cbk, void *arg)
+{
+    if (mp->pda) {
+        if (!trie_da_suffixes(mp->pda, k, max_depth, keys_only, cbk, arg) &&
+            !PyErr_Occurred()) {
+            PyErr_SetString(FasttrieError, "corrupt trie file.");
+        }
+    } else if (mp->plouds) {
+        trie_louds_suffixes(mp->plouds, k, max_depth, cbk, arg);
+    } else if (mp->pdawg) {
+        trie_dawg_suffixes(mp->pdawg, k, max_depth, cbk, arg);
+    } else {
+        trie_suffixes(mp->ptrie, k, max_depth, cbk, arg);
+    }
+}
+
+static unsigned long _Trie_height(TrieObject *mp)
+{
+    if (mp->pda) {
+        return mp->pda->height;
+    }
+    if (mp->pdawg) {
+        return mp->pdawg->height;
+    }
+    return mp->plouds ? mp->plouds->height : mp->ptrie->height;
+}
+
+// A new pointer trie with the keys of a frozen one. A damaged mapped file
+// fails it with an exception.
+static trie_t *_Trie_thawed(TrieObject *mp)
+{
+    trie_t *t;
+    int damaged;
+
+    if (mp->pdawg) {
+        return trie_dawg_thaw(mp->pdawg);
+    }
+    if (mp->pda) {
+        t = trie_da_thaw(mp->pda, &damaged);
+        if (!t && damaged && !PyErr_Occurred()) {
+            PyErr_SetString(FasttrieError, "corrupt trie file.");
+        }
+        return t;
+    }
+    return trie_louds_thaw(mp->plouds);
+}
+
+// Frees the frozen form, ptrie is left NULL.
+static void _Trie_drop_frozen(TrieObject *mp)
+{
+    if (mp->pda) {
+        trie_da_destroy(mp->pda);
+        mp->pda = NULL;
+    }
+    if (mp->plouds) {
+        trie_louds_destroy(mp->plouds);
+        mp->plouds = NULL;
+    }
+    if (mp->pdawg) {
+        trie_dawg_destroy(mp->pdawg);
+        mp->pdawg = NULL;
+    }
+}
+
+// What a view or an iterator over suffixes yields.
+typedef enum {
+    TRIE_KEYS = 0,
+    TRIE_VALUES,
+    TRIE_ITEMS
+} trie_view_kind_t;
+
 typedef struct {
     PyObject_HEAD
 
@@ -117,6 +308,8 @@ typedef struct {
 
     TrieObject *_trieobj; // used for Reference Count
     iter_t *_iter;
+    trie_view_kind_t kind; // values and items need an iterator setting value
+    Py_ssize_t chunk; // > 0 to yield lists of up to chunk elements
 } TrieIteratorObject;
 
 static void Trieiter_dealloc(TrieIteratorObject *tio)
@@ -124,33 +317,95 @@ static void Trieiter_dealloc(TrieIteratorObject *tio)
     if (tio->_iter) {
         tio->iter_deinit_func(tio->_iter);
     }
+    tio->_trieobj->iter_count--;
     Py_XDECREF(tio->_trieobj);
     PyObject_GC_Del(tio);
 }
 
+// The element for the key iter is on.
+static PyObject *_Trieiter_element(TrieIteratorObject *tio, iter_t *iter)
+{
+    PyObject *ks, *r;
+
+    if (tio->kind == TRIE_VALUES) {
+        r = (PyObject *)iter->value;
+        Py_INCREF(r);
+        return r;
+    }
+
+    ks = _TKEY_AS_PyUnicode(iter->key);
+    if (!ks || tio->kind == TRIE_KEYS) {
+        return ks;
+    }
+    r = PyTuple_Pack(2, ks, (PyObject *)iter->value);
+    Py_DECREF(ks);
+    return r;
+}
+
 static PyObject *Trieiter_next(TrieIteratorObject *tio)
 {
-    PyObject *ks;
+    PyObject *l, *e;
     iter_t *iter;
 
     if (!tio->_iter) {
         return NULL;
     }
     
-    iter = tio->iter_next_func(tio->_iter);
-    if (iter->fail) {
-        PyErr_SetString(PyExc_RuntimeError, "trie changed during iteration.");
-        return NULL;
-    }
-    
-    if (iter->last) {
-        tio->iter_reset_func(tio->_iter);
-        return NULL;
-    }
+    l = NULL;
+    for (;;) {
+        iter = tio->iter_next_func(tio->_iter);
+        if (iter->fail) {
+            if (iter->fail_reason == CORRUPT_FORM) {
+                PyErr_SetString(FasttrieError, "corrupt trie file.");
+            } else if (iter->fail_reason != LOAD_FAILED) {
+                PyErr_SetString(PyExc_RuntimeError, "trie changed during iteration.");
+            }
+            Py_XDECREF(l);
+            return NULL;
+        }
+        
+        if (iter->last) {
+            // a last partial chunk, the next call resets
+            if (l && PyList_GET_SIZE(l)) {
+                return l;
+            }
+            Py_XDECREF(l);
+            tio->iter_reset_func(tio->_iter);
+            return NULL;
+        }
 
-    ks = _TKEY_AS_PyUnicode(iter->key);
+        e = _Trieiter_element(tio, iter);
+        if (!tio->chunk || !e) {
+            if (!e) {
+                Py_XDECREF(l);
+            }
+            return e;
+        }
+
+        // chunks are filled here without a round trip per element
+        if (!l) {
+            l = PyList_New(0);
+            if (!l) {
+                Py_DECREF(e);
+                return NULL;
+            }
+        }
+        if (PyList_Append(l, e) < 0) {
+            Py_DECREF(e);
+            Py_DECREF(l);
+            return NULL;
+        }
+        Py_DECREF(e);
+        if (PyList_GET_SIZE(l) == tio->chunk) {
+            return l;
+        }
+    }
+}
 
-    return ks;
+static int Trieiter_traverse(TrieIteratorObject *tio, visitproc visit, void *arg)
+{
+    Py_VISIT(tio->_trieobj);
+    return 0;
 }
 
 PyObject *Trieiter_selfiter(PyObject *obj)
@@ -192,7 +447,7 @@ PyTypeObject TrieIteratorType = {
     0,                              /* tp_as_buffer */
     Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
     0,                              /* tp_doc */
-    0,                              /* tp_traverse */
+    (traverseproc)Trieiter_traverse, /* tp_traverse */
     0,                              /* tp_clear */
     0,                              /* tp_richcompare */
     0,                              /* tp_weaklistoffset */
@@ -205,14 +460,19 @@ PyTypeObject TrieIteratorType = {
 // Trie methods
 static Py_ssize_t Trie_length(TrieObject *mp)
 {
-    return mp->ptrie->item_count;
+    if (mp->pda) {
+        return mp->pda->item_count;
+    }
+    if (mp->pdawg) {
+        return mp->pdawg->item_count;
+    }
+    return mp->plouds ? mp->plouds->item_count : mp->ptrie->item_count;
 }
 
 static PyObject *Trie_subscript(TrieObject *mp, PyObject *key)
 {
     trie_key_t k;
     PyObject *v;
-    trie_node_t *w;
 
     if (!_IsValid_Unicode(key)) {
         PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
@@ -220,13 +480,15 @@ static PyObject *Trie_subscript(TrieObject *mp, PyObject *key)
     }
     
     k = _PyUnicode_AS_TKEY(_Coerce_Unicode(key));
-    w = trie_search(mp->ptrie, &k);
-    if (!w) {
+    v = (PyObject *)_Trie_lookup(mp, &k);
+    if (!v) {
+        if (PyErr_Occurred()) {
+            return NULL; // a mapped value failed to load
+        }
         PyErr_SetObject(PyExc_KeyError, key);
         return NULL;
     }
     
-    v = (PyObject *)w->value;
     Py_INCREF(v);
     return v;
 }
@@ -237,6 +499,10 @@ static int Trie_ass_sub(TrieObject *mp, PyObject *key, PyObject *val)
     trie_key_t k;
     trie_node_t *w;
     
+    if (!_Trie_writable(mp)) {
+        return -1;
+    }
+
     if (!_IsValid_Unicode(key)) {
         PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
         return -1;
@@ -245,16 +511,16 @@ static int Trie_ass_sub(TrieObject *mp, PyObject *key, PyObject *val)
     k = _PyUnicode_AS_TKEY(_Coerce_Unicode(key));
     if (val == NULL) {
         //search and dec. ref. count
-        w = trie_search(mp->ptrie, &k);
+        w = _TKEY_SEARCH(mp->ptrie, &k);
         if(!w) {
             PyErr_SetObject(PyExc_KeyError, key);
             return -1;
         }
         Py_DECREF((PyObject *)w->value);
         
-        trie_del(mp->ptrie, &k);// no need for ret check as we already done above.
+        _TKEY_DEL(mp->ptrie, &k);// no need for ret check as we already done above.
     } else {
-        if(!trie_add(mp->ptrie, &k, (TRIE_DATA)val)) {
+        if(!_TKEY_ADD(mp->ptrie, &k, (TRIE_DATA)val)) {
             PyErr_SetString(FasttrieError, "key cannot be added.");
             return -1;
         }
@@ -265,246 +531,2318 @@ static int Trie_ass_sub(TrieObject *mp, PyObject *key, PyObject *val)
 
 static PyObject* Trie_mem_usage(TrieObject* self)
 {
+    if (self->pda) {
+        return Py_BuildValue("l", self->pda->mem_usage);
+    }
+    if (self->plouds) {
+        return Py_BuildValue("l", self->plouds->mem_usage);
+    }
+    if (self->pdawg) {
+        return Py_BuildValue("l", self->pdawg->mem_usage);
+    }
     return Py_BuildValue("l", trie_mem_usage(self->ptrie));
 }
 
+// States of the double array or automaton, or LOUDS nodes while frozen.
 static PyObject* Trie_node_count(TrieObject* self)
 {
+    if (self->pda) {
+        return Py_BuildValue("l", self->pda->state_count);
+    }
+    if (self->plouds) {
+        return Py_BuildValue("l", self->plouds->node_count);
+    }
+    if (self->pdawg) {
+        return Py_BuildValue("l", self->pdawg->state_count);
+    }
     return Py_BuildValue("l", self->ptrie->node_count);
 }
 
-static PyObject *Trie_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+static PyObject *Trie_thaw(PyObject* selfobj)
 {
-    TrieObject *self;
+    TrieObject *mp = (TrieObject *)selfobj;
+    trie_t *t;
 
-    self = (TrieObject *)type->tp_alloc(type, 0);
-    if (self != NULL) {
-        self->ptrie = trie_create();
-        if (!self->ptrie) {
-            return NULL;
-        }
+    if (!_Trie_frozen(mp)) {
+        Py_RETURN_NONE;
+    }
+    if (mp->iter_count) {
+        PyErr_SetString(PyExc_RuntimeError, "trie cannot be thawed during iteration.");
+        return NULL;
+    }
+    t = _Trie_thawed(mp);
+    if (!t) {
+        // or a mapped value failed to load
+        return PyErr_Occurred() ? NULL : PyErr_NoMemory();
     }
+    _Trie_drop_frozen(mp);
+    mp->ptrie = t;
 
-    return (PyObject *)self;
+    Py_RETURN_NONE;
 }
 
-static int Trie_init(PyObject *self, PyObject *args, PyObject *kwds) 
+static PyObject *Trie_freeze(PyObject* selfobj, PyObject *args)
 {
-    PyObject *result;
-    // Temporarily increase refcount so args and kwds doesn't get GC'd
-    Py_XINCREF(args);
-    Py_XINCREF(kwds);
-
-    result = Trie_update(self, args, kwds);
-    if (result == NULL || PyErr_Occurred())
-        return -1;
-
-    Py_XDECREF(args);
-    Py_XDECREF(kwds);
-    return 0;
-}
+    TrieObject *mp = (TrieObject *)selfobj;
+    const char *kind = "da";
+    trie_da_t *da;
+    trie_louds_t *l;
+    trie_dawg_t *d;
+    PyObject *r;
+    int louds, dawg;
 
-// Return 1 if `key` is in trie `op`, 0 if not, and -1 on error. 
-int Trie_contains(PyObject *op, PyObject *key)
-{
-    trie_key_t k;
-    TrieObject *mp;
-    
-    mp = (TrieObject *)op;
-    
-    if (!_IsValid_Unicode(key)) {
-        return 0; // do not return exception here.
+    if (!PyArg_ParseTuple(args, "|s", &kind)) {
+        return NULL;
     }
-    
-    k = _PyUnicode_AS_TKEY(_Coerce_Unicode(key));
-    
-    if(!trie_search(mp->ptrie, &k)) {
-        return 0;
+    louds = strcmp(kind, "louds") == 0;
+    dawg = strcmp(kind, "dawg") == 0;
+    if (!louds && !dawg && strcmp(kind, "da") != 0) {
+        PyErr_SetString(PyExc_ValueError, "frozen form must be 'da', 'louds' or 'dawg'.");
+        return NULL;
     }
-    
-    return 1;
-}
-
-static PyObject *_create_iterator(TrieObject *trieobj, trie_key_t *key, 
-    unsigned long max_depth, trie_iter_init_func_t init_func, 
-    trie_iter_next_func_t next_func, trie_iter_reset_func_t reset_func,
-    trie_iter_deinit_func_t deinit_func)
-{
-    TrieIteratorObject *tio;
-    
-    tio = PyObject_GC_New(TrieIteratorObject, &TrieIteratorType);
-    if (tio == NULL) {
+    if ((louds && mp->plouds) || (dawg && mp->pdawg) || 
+        (!louds && !dawg && mp->pda)) {
+        Py_RETURN_NONE;
+    }
+    if (mp->iter_count) {
+        PyErr_SetString(PyExc_RuntimeError, "trie cannot be frozen during iteration.");
         return NULL;
     }
-    
-    tio->_trieobj = trieobj;
-    Py_INCREF(tio->_trieobj);
-    PyObject_GC_Track(tio);
+    if (_Trie_frozen(mp)) {
+        r = Trie_thaw(selfobj);
+        if (!r) {
+            return NULL;
+        }
+        Py_DECREF(r);
+    }
 
-    tio->iter_init_func = init_func;
-    tio->iter_next_func = next_func;
-    tio->iter_reset_func = reset_func;
-    tio->iter_deinit_func = deinit_func;
-    tio->_iter = init_func(trieobj->ptrie, key, max_depth);
+    // the values are owned by the frozen form from now on
+    if (louds) {
+        l = trie_louds_build(mp->ptrie);
+        if (!l) {
+            return PyErr_NoMemory();
+        }
+        mp->plouds = l;
+    } else if (dawg) {
+        d = trie_dawg_build(mp->ptrie);
+        if (!d) {
+            return PyErr_NoMemory();
+        }
+        mp->pdawg = d;
+    } else {
+        da = trie_da_build(mp->ptrie);
+        if (!da) {
+            return PyErr_NoMemory();
+        }
+        mp->pda = da;
+    }
+    trie_destroy(mp->ptrie);
+    mp->ptrie = NULL;
 
-    return (PyObject *)tio;
+    Py_RETURN_NONE;
 }
 
-int _parse_traverse_args(TrieObject *t, PyObject *args, trie_key_t *k, 
-    unsigned long *d)
+// Value tags of the payloads written by save().
+#define PAYLOAD_NONE 'n'
+#define PAYLOAD_INT 'i' // int64
+#define PAYLOAD_FLOAT 'f'
+#define PAYLOAD_BYTES 'b'
+#define PAYLOAD_STR 'u' // utf-8
+#define PAYLOAD_PICKLE 'p' // anything else
+
+static PyObject *_pickle_call(const char *name, PyObject *arg)
 {
-    PyObject *pfx;
-    unsigned long max_depth;
-#ifdef IS_PEP393_AVAILABLE
-    Py_UCS4 *_ucs4_buf;
-#endif
+    PyObject *pickle, *r;
 
-    max_depth = 0;
-    pfx = NULL;
-    if (!PyArg_ParseTuple(args, "|Ok", &pfx, &max_depth)) {
-        return 0;
+    pickle = PyImport_ImportModule("pickle");
+    if (!pickle) {
+        return NULL;
     }
-
-    // if max_depth == zero, set it to trie height which is the max. possible
-    // depth. 
-    if(!max_depth || max_depth > t->ptrie->height) {
-        max_depth = t->ptrie->height;
+    if (arg && strcmp(name, "dumps") == 0) {
+        r = PyObject_CallMethod(pickle, (char *)name, "Oi", arg, 2);
+    } else {
+        r = PyObject_CallMethod(pickle, (char *)name, "O", arg);
     }
-    *d = max_depth;
-    
-    if (!pfx) {
-        memset(k, 0, sizeof(trie_key_t));
+    Py_DECREF(pickle);
+    return r;
+}
+
+// Appends the tagged payload of value v to the buffer *buf of *len bytes.
+static int _pack_value(PyObject *v, char **buf, uint64_t *len, uint64_t *cap)
+{
+    PyObject *o = NULL;
+    const char *p = NULL;
+    Py_ssize_t n = 0;
+    long long i;
+    double f;
+    int overflow = 0;
+    char tag, *nbuf;
+
+    if (v == Py_None) {
+        tag = PAYLOAD_NONE;
+#ifndef IS_PY3K
+    } else if (PyInt_CheckExact(v)) {
+        tag = PAYLOAD_INT;
+        i = PyInt_AS_LONG(v);
+        p = (const char *)&i;
+        n = sizeof(i);
+#endif
+    } else if (PyLong_CheckExact(v) && 
+        (i = PyLong_AsLongLongAndOverflow(v, &overflow), !overflow)) {
+        if (i == -1 && PyErr_Occurred()) {
+            return 0;
+        }
+        tag = PAYLOAD_INT;
+        p = (const char *)&i;
+        n = sizeof(i);
+    } else if (PyFloat_CheckExact(v)) {
+        tag = PAYLOAD_FLOAT;
+        f = PyFloat_AS_DOUBLE(v);
+        p = (const char *)&f;
+        n = sizeof(f);
+    } else if (PyBytes_CheckExact(v)) {
+        tag = PAYLOAD_BYTES;
+        p = PyBytes_AS_STRING(v);
+        n = PyBytes_GET_SIZE(v);
+    } else if (PyUnicode_CheckExact(v)) {
+        tag = PAYLOAD_STR;
+        o = PyUnicode_AsUTF8String(v);
+        if (!o) {
+            return 0;
+        }
+        p = PyBytes_AS_STRING(o);
+        n = PyBytes_GET_SIZE(o);
     } else {
-        if (!_IsValid_Unicode(pfx)) {
-            PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
+        tag = PAYLOAD_PICKLE;
+        o = _pickle_call("dumps", v);
+        if (!o) {
             return 0;
         }
-        
-#ifdef IS_PEP393_AVAILABLE
-        // if PEP393 is available, we try to create a UCS4 buffer from the given 
-        // string object. Some computation heavy functions in the Trie manipulates 
-        // the key buffer, and so we make this conversion to simplify the process.
-        // With this conversion we can safely write from TRIE_CHAR(trie) to 
-        // trie_key_t (our out key) Otherwise, copying key buffers will be 
-        // complex and slow.
-        _ucs4_buf = PyUnicode_AsUCS4Copy(pfx);
-        if (!_ucs4_buf) {
-            return 0; // exception was set above. 
+        p = PyBytes_AS_STRING(o);
+        n = PyBytes_GET_SIZE(o);
+    }
+
+    while (*len + 1 + n > *cap) {
+        *cap = *cap ? *cap * 2 : 4096;
+        nbuf = (char *)PyMem_Realloc(*buf, *cap);
+        if (!nbuf) {
+            Py_XDECREF(o);
+            PyErr_NoMemory();
+            return 0;
         }
-        
-        k->s = (char *)_ucs4_buf;
-        k->size = FasttrieUnicode_Size(pfx);
-        k->char_size = sizeof(Py_UCS4);
-#else
-        *k = _PyUnicode_AS_TKEY(_Coerce_Unicode(pfx));
-#endif
+        *buf = nbuf;
     }
-    
+    (*buf)[(*len)++] = tag;
+    if (n) {
+        memcpy(*buf + *len, p, n);
+        *len += n;
+    }
+    Py_XDECREF(o);
     return 1;
 }
 
-int _enum_keys(trie_key_t *k, trie_node_t *n, void *arg)
+// trie_da_t.load of a mapped trie: decodes the payload of leaf and keeps the
+// value, which the trie owns from then on, in the values cache. Unpickling 
+// runs Python code, so the trie is pinned like during save(): nothing can 
+// free the double array the caller is walking.
+static TRIE_DATA _Trie_load_value(trie_da_t *da, unsigned long leaf)
+{
+    TrieObject *mp = (TrieObject *)da->owner;
+    const char *p;
+    Py_ssize_t n;
+    PyObject *v, *b;
+    long long i;
+    double f;
+
+    if (da->payload_index[leaf] >= da->payload_index[leaf + 1] || 
+        da->payload_index[leaf + 1] > da->payload_index[da->leaf_count]) {
+        goto corrupt;
+    }
+    p = da->payload + da->payload_index[leaf];
+    n = (Py_ssize_t)(da->payload_index[leaf + 1] - da->payload_index[leaf]) - 1;
+    switch (*p++) {
+    case PAYLOAD_NONE:
+        v = Py_None;
+        Py_INCREF(v);
+        break;
+    case PAYLOAD_INT:
+        if (n != sizeof(i)) {
+            goto corrupt;
+        }
+        memcpy(&i, p, sizeof(i));
+        v = PyLong_FromLongLong(i);
+        break;
+    case PAYLOAD_FLOAT:
+        if (n != sizeof(f)) {
+            goto corrupt;
+        }
+        memcpy(&f, p, sizeof(f));
+        v = PyFloat_FromDouble(f);
+        break;
+    case PAYLOAD_BYTES:
+        v = PyBytes_FromStringAndSize(p, n);
+        break;
+    case PAYLOAD_STR:
+        v = PyUnicode_DecodeUTF8(p, n, NULL);
+        break;
+    case PAYLOAD_PICKLE:
+        b = PyBytes_FromStringAndSize(p, n);
+        if (!b) {
+            return 0;
+        }
+        mp->dump_count++;
+        mp->iter_count++;
+        v = _pickle_call("loads", b);
+        mp->iter_count--;
+        mp->dump_count--;
+        Py_DECREF(b);
+        break;
+    default:
+        goto corrupt;
+    }
+    if (!v) {
+        return 0;
+    }
+    // a lookup made by the unpickled object may have loaded it already
+    if (da->values[leaf]) {
+        Py_DECREF(v);
+        return da->values[leaf];
+    }
+    da->values[leaf] = (TRIE_DATA)v;
+    return (TRIE_DATA)v;
+
+corrupt:
+    PyErr_SetString(FasttrieError, "corrupt trie file payload.");
+    return 0;
+}
+
+#ifdef IS_PY3K
+// PyUnicode_FSConverter for a path that may be None, which converts to NULL.
+static int _fs_converter_or_none(PyObject *o, void *addr)
+{
+    if (!o) {
+        Py_CLEAR(*(PyObject **)addr);
+        return 1;
+    }
+    if (o == Py_None) {
+        *(PyObject **)addr = NULL;
+        return 1;
+    }
+    return PyUnicode_FSConverter(o, addr);
+}
+#endif
+
+static PyObject *Trie_save(PyObject* selfobj, PyObject *args)
+{
+    TrieObject *mp = (TrieObject *)selfobj;
+    const char *path;
+    trie_da_t *da;
+    trie_t *t = NULL;
+    char *payload = NULL;
+    uint64_t *index = NULL, len = 0, cap = 0;
+    unsigned long leaf;
+    PyObject *v, *r = NULL;
+    int saved;
+#ifdef IS_PY3K
+    PyObject *bpath;
+
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &bpath)) {
+        return NULL;
+    }
+    path = PyBytes_AS_STRING(bpath);
+#else
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return NULL;
+    }
+#endif
+
+    // Values are pickled with the GIL and the file is written without it. 
+    // Until save() returns the trie can neither be changed, which frees 
+    // values the double array borrows, nor frozen, thawed or cleared, which
+    // frees the double array itself.
+    mp->dump_count++;
+    mp->iter_count++;
+
+    // always written as a double array, so the file maps without a build
+    da = mp->pda;
+    if (!da) {
+        if (_Trie_frozen(mp)) {
+            t = _Trie_thawed(mp);
+            if (!t) {
+                PyErr_NoMemory();
+                goto out;
+            }
+        }
+        da = trie_da_build(t ? t : mp->ptrie);
+        if (!da) {
+            PyErr_NoMemory();
+            goto out;
+        }
+    }
+
+    index = (uint64_t *)PyMem_Malloc((da->leaf_count + 1) * sizeof(uint64_t));
+    if (!index) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    for (leaf = 0; leaf < da->leaf_count; leaf++) {
+        index[leaf] = len;
+        v = (PyObject *)trie_da_value(da, leaf);
+        if (!v || !_pack_value(v, &payload, &len, &cap)) {
+            goto out;
+        }
+    }
+    index[da->leaf_count] = len;
+
+    Py_BEGIN_ALLOW_THREADS
+    saved = trie_da_save(da, path, payload ? payload : "", index);
+    Py_END_ALLOW_THREADS
+    if (!saved) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        goto out;
+    }
+    r = Py_None;
+    Py_INCREF(r);
+
+out:
+    PyMem_Free(index);
+    PyMem_Free(payload);
+    if (da && da != mp->pda) {
+        trie_da_destroy(da);
+    }
+    if (t) {
+        trie_destroy(t);
+    }
+    mp->iter_count--;
+    mp->dump_count--;
+#ifdef IS_PY3K
+    Py_DECREF(bpath);
+#endif
+    return r;
+}
+
+static PyObject *Trie_mmap(PyObject *cls, PyObject *args)
+{
+    TrieObject *mp;
+    trie_da_t *da;
+    const char *path;
+    int bad_format;
+#ifdef IS_PY3K
+    PyObject *bpath;
+
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &bpath)) {
+        return NULL;
+    }
+    path = PyBytes_AS_STRING(bpath);
+#else
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return NULL;
+    }
+#endif
+
+    da = trie_da_map(path, &bad_format);
+    if (!da) {
+        if (bad_format) {
+            PyErr_Format(FasttrieError, "%s is not a trie file of this version.", path);
+        } else if (errno == ENOMEM) {
+            PyErr_NoMemory();
+        } else {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        }
+#ifdef IS_PY3K
+        Py_DECREF(bpath);
+#endif
+        return NULL;
+    }
+#ifdef IS_PY3K
+    Py_DECREF(bpath);
+#endif
+    da->load = _Trie_load_value;
+
+    mp = (TrieObject *)PyObject_CallObject(cls, NULL);
+    if (!mp) {
+        trie_da_destroy(da);
+        return NULL;
+    }
+    trie_destroy(mp->ptrie);
+    mp->ptrie = NULL;
+    mp->pda = da;
+    da->owner = mp;
+
+    return (PyObject *)mp;
+}
+
+static PyObject *Trie_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    TrieObject *self;
+
+    self = (TrieObject *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+        self->ptrie = trie_create();
+        if (!self->ptrie) {
+            return NULL;
+        }
+    }
+
+    return (PyObject *)self;
+}
+
+static int Trie_init(PyObject *self, PyObject *args, PyObject *kwds) 
+{
+    PyObject *result;
+    // Temporarily increase refcount so args and kwds doesn't get GC'd
+    Py_XINCREF(args);
+    Py_XINCREF(kwds);
+
+    result = Trie_update(self, args, kwds);
+    if (result == NULL || PyErr_Occurred())
+        return -1;
+
+    Py_XDECREF(args);
+    Py_XDECREF(kwds);
+    return 0;
+}
+
+// Return 1 if `key` is in trie `op`, 0 if not, and -1 on error. 
+int Trie_contains(PyObject *op, PyObject *key)
+{
+    trie_key_t k;
+    TrieObject *mp;
+    
+    mp = (TrieObject *)op;
+    
+    if (!_IsValid_Unicode(key)) {
+        return 0; // do not return exception here.
+    }
+    
+    k = _PyUnicode_AS_TKEY(_Coerce_Unicode(key));
+    
+    return _Trie_has_key(mp, &k);
+}
+
+// Wraps iter, the iterator of a trie or of its frozen form, in a
+// TrieIteratorObject. iter may be NULL when there is nothing to iterate.
+static PyObject *_wrap_iterator(TrieObject *trieobj, iter_t *iter,
+    trie_iter_next_func_t next_func, trie_iter_reset_func_t reset_func,
+    trie_iter_deinit_func_t deinit_func)
+{
+    TrieIteratorObject *tio;
+    
+    tio = PyObject_GC_New(TrieIteratorObject, &TrieIteratorType);
+    if (tio == NULL) {
+        if (iter) {
+            deinit_func(iter);
+        }
+        return NULL;
+    }
+    
+    tio->_trieobj = trieobj;
+    Py_INCREF(tio->_trieobj);
+    trieobj->iter_count++;
+    PyObject_GC_Track(tio);
+
+    tio->iter_init_func = NULL;
+    tio->iter_next_func = next_func;
+    tio->iter_reset_func = reset_func;
+    tio->iter_deinit_func = deinit_func;
+    tio->_iter = iter;
+    tio->kind = TRIE_KEYS;
+    tio->chunk = 0;
+
+    return (PyObject *)tio;
+}
+
+static PyObject *_create_iterator(TrieObject *trieobj, trie_key_t *key, 
+    unsigned long max_depth, trie_iter_init_func_t init_func, 
+    trie_iter_next_func_t next_func, trie_iter_reset_func_t reset_func,
+    trie_iter_deinit_func_t deinit_func)
+{
+    PyObject *r;
+
+    r = _wrap_iterator(trieobj, NULL, next_func, reset_func, deinit_func);
+    if (r) {
+        ((TrieIteratorObject *)r)->iter_init_func = init_func;
+        ((TrieIteratorObject *)r)->_iter = init_func(trieobj->ptrie, key, 
+            max_depth);
+    }
+    return r;
+}
+
+// An iterator over the keys starting with k, at most max_depth chars longer,
+// in whichever form the trie is. It yields what kind says.
+static PyObject *_Trie_iterator(TrieObject *mp, trie_key_t *k, 
+    unsigned long max_depth, trie_view_kind_t kind)
+{
+    PyObject *r;
+
+    if (mp->pda) {
+        r = _wrap_iterator(mp, trie_da_iter_init(mp->pda, k, max_depth), 
+            trie_da_iter_next, trie_da_iter_reset, trie_da_iter_deinit);
+    } else if (mp->plouds) {
+        r = _wrap_iterator(mp, trie_louds_iter_init(mp->plouds, k, max_depth), 
+            trie_louds_iter_next, trie_louds_iter_reset, trie_louds_iter_deinit);
+    } else if (mp->pdawg) {
+        r = _wrap_iterator(mp, trie_dawg_iter_init(mp->pdawg, k, max_depth), 
+            trie_dawg_iter_next, trie_dawg_iter_reset, trie_dawg_iter_deinit);
+    } else {
+        r = _create_iterator(mp, k, max_depth, trie_itersuffixes_init, 
+            trie_itersuffixes_next, trie_itersuffixes_reset, 
+            trie_itersuffixes_deinit);
+    }
+    if (r) {
+        ((TrieIteratorObject *)r)->kind = kind;
+        if (((TrieIteratorObject *)r)->_iter) {
+            ((TrieIteratorObject *)r)->_iter->keys_only = kind == TRIE_KEYS;
+        }
+    }
+    return r;
+}
+
+int _parse_traverse_args(TrieObject *t, PyObject *args, trie_key_t *k, 
+    unsigned long *d)
+{
+    PyObject *pfx;
+    unsigned long max_depth;
+#ifdef IS_PEP393_AVAILABLE
+    Py_UCS4 *_ucs4_buf;
+#endif
+
+    max_depth = 0;
+    pfx = NULL;
+    if (!PyArg_ParseTuple(args, "|Ok", &pfx, &max_depth)) {
+        return 0;
+    }
+
+    // if max_depth == zero, set it to trie height which is the max. possible
+    // depth. 
+    if(!max_depth || max_depth > _Trie_height(t)) {
+        max_depth = _Trie_height(t);
+    }
+    *d = max_depth;
+    
+    if (!pfx) {
+        memset(k, 0, sizeof(trie_key_t));
+    } else {
+        if (!_IsValid_Unicode(pfx)) {
+            PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
+            return 0;
+        }
+        
+#ifdef IS_PEP393_AVAILABLE
+        // if PEP393 is available, we try to create a UCS4 buffer from the given 
+        // string object. Some computation heavy functions in the Trie manipulates 
+        // the key buffer, and so we make this conversion to simplify the process.
+        // With this conversion we can safely write from TRIE_CHAR(trie) to 
+        // trie_key_t (our out key) Otherwise, copying key buffers will be 
+        // complex and slow.
+        _ucs4_buf = PyUnicode_AsUCS4Copy(pfx);
+        if (!_ucs4_buf) {
+            return 0; // exception was set above. 
+        }
+        
+        k->s = (char *)_ucs4_buf;
+        k->size = FasttrieUnicode_Size(pfx);
+        k->char_size = sizeof(Py_UCS4);
+#else
+        *k = _PyUnicode_AS_TKEY(_Coerce_Unicode(pfx));
+#endif
+    }
+    
+    return 1;
+}
+
+int _enum_keys(trie_key_t *k, trie_node_t *n, void *arg)
 {
     PyList_Append((PyObject *)arg, _TKEY_AS_PyUnicode(k));
     return 0;
 }
 
-int _enum_items(trie_key_t *k, trie_node_t *n, void *arg)
+int _set_items(trie_key_t *k, trie_node_t *n, void *arg)
+{
+    Trie_ass_sub((TrieObject *) arg, _TKEY_AS_PyUnicode(k), (PyObject *)n->value);
+    return 0;
+}
+
+int _dec_ref_count(trie_key_t *k, trie_node_t *n, void *arg)
+{
+    Py_XDECREF((PyObject *)n->value);
+    return 0;
+}
+
+int _count_keys(trie_key_t *k, trie_node_t *n, void *arg)
+{
+    (*(Py_ssize_t *)arg)++;
+    return 0;
+}
+
+// Drops the references the trie holds to the values of the keys starting 
+// with k. A mapped trie holds only the values loaded so far, all of them 
+// are dropped and none is loaded for it.
+static void _Trie_release_values(TrieObject *mp, trie_key_t *k, 
+    unsigned long max_depth)
+{
+    unsigned long leaf;
+
+    if (mp->pda && mp->pda->map) {
+        for (leaf = 0; leaf < mp->pda->leaf_count; leaf++) {
+            Py_XDECREF((PyObject *)mp->pda->values[leaf]);
+            mp->pda->values[leaf] = 0;
+        }
+        return;
+    }
+    _Trie_suffixes(mp, k, max_depth, 0, _dec_ref_count, NULL);
+}
+
+// keys(), values() and items() return views: nothing is enumerated until
+// they are iterated, and they always reflect the current keys of the trie.
+typedef struct {
+    PyObject_HEAD
+    TrieObject *trieobj;
+    PyObject *prefix; // NULL for all keys
+    unsigned long max_depth; // 0 for the height of the trie
+    trie_view_kind_t kind;
+} TrieViewObject;
+
+static PyTypeObject TrieViewType;
+
+static const char *_view_names[] = {"trie_keys", "trie_values", "trie_items"};
+
+// The prefix of v as a key and its depth, clamped to the height the trie 
+// has now. Free the key with _TrieView_key_free().
+static int _TrieView_key(TrieViewObject *v, trie_key_t *k, 
+    unsigned long *max_depth)
+{
+    unsigned long height;
+
+    height = _Trie_height(v->trieobj);
+    *max_depth = v->max_depth;
+    if (!*max_depth || *max_depth > height) {
+        *max_depth = height;
+    }
+
+    memset(k, 0, sizeof(trie_key_t));
+    if (!v->prefix) {
+        return 1;
+    }
+#ifdef IS_PEP393_AVAILABLE
+    // a UCS4 copy for the same reason as in _parse_traverse_args()
+    k->s = (char *)PyUnicode_AsUCS4Copy(v->prefix);
+    if (!k->s) {
+        return 0;
+    }
+    k->size = FasttrieUnicode_Size(v->prefix);
+    k->char_size = sizeof(Py_UCS4);
+#else
+    *k = _PyUnicode_AS_TKEY(v->prefix);
+#endif
+    return 1;
+}
+
+static void _TrieView_key_free(trie_key_t *k)
+{
+#ifdef IS_PEP393_AVAILABLE
+    PyMem_Free(k->s);
+#endif
+}
+
+// Whether key is one of the keys of v, -1 on errors. Its value is stored in
+// *value, unless value is NULL and a mapped trie then does not load it.
+static int _TrieView_lookup(TrieViewObject *v, PyObject *key, 
+    PyObject **value)
+{
+    trie_key_t k;
+    Py_ssize_t n, size;
+    PyObject *u;
+    int r;
+
+    if (!_IsValid_Unicode(key)) {
+        return 0;
+    }
+    u = _Coerce_Unicode(key);
+    if (!u) {
+        return -1;
+    }
+
+    r = 0;
+    n = v->prefix ? FasttrieUnicode_Size(v->prefix) : 0;
+    size = FasttrieUnicode_Size(u);
+    if ((!v->prefix || PyUnicode_Tailmatch(u, v->prefix, 0, n, -1) == 1) &&
+        (!v->max_depth || size - n <= (Py_ssize_t)v->max_depth)) {
+        k = _PyUnicode_AS_TKEY(u);
+        if (!value) {
+            r = _Trie_has_key(v->trieobj, &k);
+        } else {
+            *value = (PyObject *)_Trie_lookup(v->trieobj, &k);
+            r = *value ? 1 : PyErr_Occurred() ? -1 : 0;
+        }
+    }
+    if (u != key) {
+        Py_DECREF(u);
+    }
+    return r;
+}
+
+static Py_ssize_t TrieView_length(TrieViewObject *v)
+{
+    trie_key_t k;
+    unsigned long max_depth;
+    Py_ssize_t n;
+
+    if (!v->prefix && (!v->max_depth || 
+        v->max_depth >= _Trie_height(v->trieobj))) {
+        return Trie_length(v->trieobj);
+    }
+    if (!_TrieView_key(v, &k, &max_depth)) {
+        return -1;
+    }
+    n = 0;
+    _Trie_suffixes(v->trieobj, &k, max_depth, 1, _count_keys, &n);
+    _TrieView_key_free(&k);
+    return PyErr_Occurred() ? -1 : n;
+}
+
+static PyObject *TrieView_iter(TrieViewObject *v)
+{
+    trie_key_t k;
+    unsigned long max_depth;
+    PyObject *r;
+
+    if (!_TrieView_key(v, &k, &max_depth)) {
+        return NULL;
+    }
+    r = _Trie_iterator(v->trieobj, &k, max_depth, v->kind);
+    _TrieView_key_free(&k);
+    return r;
+}
+
+// Keys and items are looked up, values have no index and are scanned.
+static int TrieView_contains(TrieViewObject *v, PyObject *x)
+{
+    PyObject *it, *value;
+    int r;
+
+    if (v->kind == TRIE_VALUES) {
+        it = TrieView_iter(v);
+        if (!it) {
+            return -1;
+        }
+        r = 0;
+        while (!r && (value = PyIter_Next(it))) {
+            r = PyObject_RichCompareBool(value, x, Py_EQ);
+            Py_DECREF(value);
+        }
+        Py_DECREF(it);
+        return PyErr_Occurred() ? -1 : r;
+    }
+
+    if (v->kind == TRIE_ITEMS) {
+        if (!PyTuple_Check(x) || PyTuple_GET_SIZE(x) != 2) {
+            return 0;
+        }
+        r = _TrieView_lookup(v, PyTuple_GET_ITEM(x, 0), &value);
+        if (r <= 0) {
+            return r;
+        }
+        return PyObject_RichCompareBool(value, PyTuple_GET_ITEM(x, 1), Py_EQ);
+    }
+
+    return _TrieView_lookup(v, x, NULL);
+}
+
+// Views compare equal to lists, tuples and views of the same elements in 
+// the same order.
+static PyObject *TrieView_richcompare(PyObject *self, PyObject *other, int op)
+{
+    PyObject *l, *o, *r;
+
+    if ((op != Py_EQ && op != Py_NE) || !(PyList_Check(other) || 
+        PyTuple_Check(other) || PyObject_TypeCheck(other, &TrieViewType))) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    l = PySequence_List(self);
+    if (!l) {
+        return NULL;
+    }
+    o = PySequence_List(other);
+    if (!o) {
+        Py_DECREF(l);
+        return NULL;
+    }
+    r = PyObject_RichCompare(l, o, op);
+    Py_DECREF(l);
+    Py_DECREF(o);
+    return r;
+}
+
+static PyObject *TrieView_repr(TrieViewObject *v)
+{
+    PyObject *l, *r;
+
+    l = PySequence_List((PyObject *)v);
+    if (!l) {
+        return NULL;
+    }
+    r = PyUnicode_FromFormat("%s(%R)", _view_names[v->kind], l);
+    Py_DECREF(l);
+    return r;
+}
+
+static void TrieView_dealloc(TrieViewObject *v)
+{
+    Py_DECREF(v->trieobj);
+    Py_XDECREF(v->prefix);
+    PyObject_Del(v);
+}
+
+static PySequenceMethods TrieView_as_sequence = {
+    (lenfunc)TrieView_length,       /* sq_length */
+    0,                              /* sq_concat */
+    0,                              /* sq_repeat */
+    0,                              /* sq_item */
+    0,                              /* sq_slice */
+    0,                              /* sq_ass_item */
+    0,                              /* sq_ass_slice */
+    (objobjproc)TrieView_contains,  /* sq_contains */
+    0,                              /* sq_inplace_concat */
+    0,                              /* sq_inplace_repeat */
+};
+
+static PyTypeObject TrieViewType = {
+#ifdef IS_PY3K
+    PyVarObject_HEAD_INIT(NULL, 0)
+#else
+    PyObject_HEAD_INIT(NULL)
+    0,                              /*ob_size*/
+#endif
+    "TrieView",                     /* tp_name */
+    sizeof(TrieViewObject),         /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)TrieView_dealloc,   /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    (reprfunc)TrieView_repr,        /* tp_repr */
+    0,                              /* tp_as_number */
+    &TrieView_as_sequence,          /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    PyObject_HashNotImplemented,    /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    PyObject_GenericGetAttr,        /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    "Live view on the keys, values or items of a trie", /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    TrieView_richcompare,           /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    (getiterfunc)TrieView_iter,     /* tp_iter */
+    0,                              /* tp_iternext */
+    0,                              /* tp_methods */
+    0,
+};
+
+static PyObject *_Trie_view(PyObject *selfobj, PyObject *args, 
+    trie_view_kind_t kind)
+{
+    TrieViewObject *v;
+    PyObject *pfx;
+    unsigned long max_depth;
+
+    pfx = NULL;
+    max_depth = 0;
+    if (!PyArg_ParseTuple(args, "|Ok", &pfx, &max_depth)) {
+        return NULL;
+    }
+    if (pfx && !_IsValid_Unicode(pfx)) {
+        PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
+        return NULL;
+    }
+
+    v = PyObject_New(TrieViewObject, &TrieViewType);
+    if (!v) {
+        return NULL;
+    }
+    v->trieobj = (TrieObject *)selfobj;
+    Py_INCREF(selfobj);
+    v->prefix = NULL;
+    if (pfx && PyBytes_Check(pfx)) {
+        v->prefix = _Coerce_Unicode(pfx);
+        if (!v->prefix) {
+            Py_DECREF(v);
+            return NULL;
+        }
+    } else if (pfx && FasttrieUnicode_Size(pfx)) {
+        v->prefix = pfx;
+        Py_INCREF(pfx);
+    }
+    v->max_depth = max_depth;
+    v->kind = kind;
+    return (PyObject *)v;
+}
+
+static PyObject *Trie_keys(PyObject* selfobj, PyObject *args)
+{
+    return _Trie_view(selfobj, args, TRIE_KEYS);
+}
+
+static PyObject *Trie_items(PyObject *selfobj, PyObject *args)
+{
+    return _Trie_view(selfobj, args, TRIE_ITEMS);
+}
+
+static PyObject *Trie_values(PyObject* selfobj, PyObject *args)
+{
+    return _Trie_view(selfobj, args, TRIE_VALUES);
+}
+
+// Default length of the lists iter_chunks() and items_chunks() yield.
+#define ITER_CHUNK 1024
+
+// An iterator of the view kind of (prefix, max_depth) that yields lists of up
+// to n elements, each filled by one call into the trie iterator.
+static PyObject *_Trie_chunks(PyObject *selfobj, PyObject *args, 
+    PyObject *kwds, trie_view_kind_t kind)
+{
+    static char *kwlist[] = {"prefix", "n", "max_depth", NULL};
+    PyObject *pfx, *vargs, *view, *r;
+    Py_ssize_t n;
+    unsigned long max_depth;
+
+    pfx = NULL;
+    n = ITER_CHUNK;
+    max_depth = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Onk", kwlist, &pfx, &n, 
+        &max_depth)) {
+        return NULL;
+    }
+    if (n <= 0) {
+        PyErr_SetString(PyExc_ValueError, "n must be positive.");
+        return NULL;
+    }
+
+    vargs = pfx ? Py_BuildValue("(Ok)", pfx, max_depth) : 
+        Py_BuildValue("(sk)", "", max_depth);
+    if (!vargs) {
+        return NULL;
+    }
+    view = _Trie_view(selfobj, vargs, kind);
+    Py_DECREF(vargs);
+    if (!view) {
+        return NULL;
+    }
+    r = TrieView_iter((TrieViewObject *)view);
+    Py_DECREF(view);
+    if (r) {
+        ((TrieIteratorObject *)r)->chunk = n;
+    }
+    return r;
+}
+
+static PyObject *Trie_iter_chunks(PyObject *selfobj, PyObject *args, 
+    PyObject *kwds)
+{
+    return _Trie_chunks(selfobj, args, kwds, TRIE_KEYS);
+}
+
+static PyObject *Trie_items_chunks(PyObject *selfobj, PyObject *args, 
+    PyObject *kwds)
+{
+    return _Trie_chunks(selfobj, args, kwds, TRIE_ITEMS);
+}
+
+// Cursors stand on a key and move both ways in key order, see Note 17 in
+// trie.h. Like iterators they keep the trie from being frozen, thawed or 
+// cleared, and fail if a key is added or deleted until they seek again.
+typedef struct {
+    PyObject_HEAD
+    TrieObject *trieobj;
+    trie_cursor_t *cursor;
+} TrieCursorObject;
+
+static trie_cursor_t *_Trie_cursor(TrieObject *mp)
+{
+    if (mp->pda) {
+        return trie_da_cursor(mp->pda);
+    }
+    if (mp->plouds) {
+        return trie_louds_cursor(mp->plouds);
+    }
+    if (mp->pdawg) {
+        return trie_dawg_cursor(mp->pdawg);
+    }
+    return trie_cursor(mp->ptrie);
+}
+
+// r of a cursor function as a bool, NULL with an exception if it failed.
+static PyObject *_cursor_result(trie_cursor_t *c, int r)
+{
+    if (r < 0) {
+        if (c->fail_reason == CHG_WHILE_ITER) {
+            PyErr_SetString(PyExc_RuntimeError, "trie changed during iteration.");
+        } else if (c->fail_reason == CORRUPT_FORM) {
+            PyErr_SetString(FasttrieError, "corrupt trie file.");
+        } else if (!PyErr_Occurred()) {
+            PyErr_NoMemory();
+        }
+        return NULL;
+    }
+    return PyBool_FromLong(r);
+}
+
+// Seeks the first key not less than key, NULL key for the first key.
+static int _cursor_seek(trie_cursor_t *c, PyObject *key)
+{
+    trie_key_t k;
+    PyObject *u;
+    int r;
+
+    if (!key) {
+        memset(&k, 0, sizeof(trie_key_t));
+        return trie_cursor_seek(c, &k);
+    }
+    u = _Coerce_Unicode(key);
+    if (!u) {
+        c->fail = 1;
+        c->fail_reason = UNDEFINED;
+        return -1;
+    }
+    k = _PyUnicode_AS_TKEY(u);
+    r = trie_cursor_seek(c, &k);
+    if (u != key) {
+        Py_DECREF(u);
+    }
+    return r;
+}
+
+static PyObject *TrieCursor_seek(TrieCursorObject *co, PyObject *args)
+{
+    PyObject *key;
+
+    if (!PyArg_ParseTuple(args, "O", &key)) {
+        return NULL;
+    }
+    if (!_IsValid_Unicode(key)) {
+        PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
+        return NULL;
+    }
+    return _cursor_result(co->cursor, _cursor_seek(co->cursor, key));
+}
+
+static PyObject *TrieCursor_next(TrieCursorObject *co)
+{
+    return _cursor_result(co->cursor, trie_cursor_next(co->cursor));
+}
+
+static PyObject *TrieCursor_prev(TrieCursorObject *co)
+{
+    return _cursor_result(co->cursor, trie_cursor_prev(co->cursor));
+}
+
+// Whether the cursor is on a key, -1 if the trie changed under it.
+static int _cursor_on_key(trie_cursor_t *c)
+{
+    if (c->version_at && *c->version_at != c->version) {
+        PyErr_SetString(PyExc_RuntimeError, "trie changed during iteration.");
+        return -1;
+    }
+    return c->depth != 0;
+}
+
+static PyObject *TrieCursor_key(TrieCursorObject *co, void *closure)
+{
+    int on;
+
+    on = _cursor_on_key(co->cursor);
+    if (on < 0) {
+        return NULL;
+    }
+    if (!on) {
+        Py_RETURN_NONE;
+    }
+    return _TKEY_AS_PyUnicode(&co->cursor->key);
+}
+
+static PyObject *TrieCursor_value(TrieCursorObject *co, void *closure)
+{
+    PyObject *v;
+    int on;
+
+    on = _cursor_on_key(co->cursor);
+    if (on < 0) {
+        return NULL;
+    }
+    v = on ? (PyObject *)co->cursor->value : Py_None;
+    Py_INCREF(v);
+    return v;
+}
+
+static void TrieCursor_dealloc(TrieCursorObject *co)
+{
+    trie_cursor_destroy(co->cursor);
+    co->trieobj->iter_count--;
+    Py_DECREF(co->trieobj);
+    PyObject_Del(co);
+}
+
+static PyMethodDef TrieCursor_methods[] = {
+    {"seek", (PyCFunction)TrieCursor_seek, METH_VARARGS, 
+        "C.seek(key) -> move to the first key not less than key, False if "
+        "there is none"},
+    {"next", (PyCFunction)TrieCursor_next, METH_NOARGS, 
+        "C.next() -> move to the next key, False past the last one"},
+    {"prev", (PyCFunction)TrieCursor_prev, METH_NOARGS, 
+        "C.prev() -> move to the previous key, False before the first one"},
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef TrieCursor_getset[] = {
+    {"key", (getter)TrieCursor_key, NULL, 
+        "Key the cursor is on, None if it is on none", NULL},
+    {"value", (getter)TrieCursor_value, NULL, 
+        "Value of the key the cursor is on, None if it is on none", NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject TrieCursorType = {
+#ifdef IS_PY3K
+    PyVarObject_HEAD_INIT(NULL, 0)
+#else
+    PyObject_HEAD_INIT(NULL)
+    0,                              /*ob_size*/
+#endif
+    "TrieCursor",                   /* tp_name */
+    sizeof(TrieCursorObject),       /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)TrieCursor_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    PyObject_GenericGetAttr,        /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    "Ordered cursor over the keys of a trie", /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    TrieCursor_methods,             /* tp_methods */
+    0,                              /* tp_members */
+    TrieCursor_getset,              /* tp_getset */
+};
+
+static PyObject *Trie_cursor(PyObject *selfobj)
+{
+    TrieCursorObject *co;
+
+    co = PyObject_New(TrieCursorObject, &TrieCursorType);
+    if (!co) {
+        return NULL;
+    }
+    co->cursor = _Trie_cursor((TrieObject *)selfobj);
+    if (!co->cursor) {
+        PyObject_Del(co);
+        return PyErr_NoMemory();
+    }
+    co->trieobj = (TrieObject *)selfobj;
+    Py_INCREF(selfobj);
+    co->trieobj->iter_count++;
+    return (PyObject *)co;
+}
+
+// Pages of a cursor: seek lo, then take keys while they are less than hi.
+static PyObject *Trie_range(PyObject *selfobj, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"lo", "hi", "limit", NULL};
+    PyObject *lo, *hi, *u, *l, *ks, *item;
+    Py_ssize_t limit;
+    trie_cursor_t *c;
+    int r, cmp;
+
+    lo = hi = Py_None;
+    limit = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOn", kwlist, &lo, &hi, 
+        &limit)) {
+        return NULL;
+    }
+    if ((lo != Py_None && !_IsValid_Unicode(lo)) || 
+        (hi != Py_None && !_IsValid_Unicode(hi))) {
+        PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
+        return NULL;
+    }
+    if (limit < 0) {
+        PyErr_SetString(PyExc_ValueError, "limit must not be negative.");
+        return NULL;
+    }
+
+    u = hi == Py_None ? NULL : _Coerce_Unicode(hi);
+    if (hi != Py_None && !u) {
+        return NULL;
+    }
+    c = _Trie_cursor((TrieObject *)selfobj);
+    l = c ? PyList_New(0) : PyErr_NoMemory();
+    if (!l) {
+        goto out;
+    }
+
+    r = _cursor_seek(c, lo == Py_None ? NULL : lo);
+    while (r > 0 && (!limit || PyList_GET_SIZE(l) < limit)) {
+        ks = _TKEY_AS_PyUnicode(&c->key);
+        if (!ks) {
+            break;
+        }
+        cmp = u ? PyUnicode_Compare(ks, u) : -1;
+        if (cmp >= 0 || PyErr_Occurred()) {
+            Py_DECREF(ks);
+            break;
+        }
+        item = PyTuple_Pack(2, ks, (PyObject *)c->value);
+        Py_DECREF(ks);
+        if (!item || PyList_Append(l, item) < 0) {
+            Py_XDECREF(item);
+            break;
+        }
+        Py_DECREF(item);
+        r = trie_cursor_next(c);
+    }
+    if (r < 0) {
+        _cursor_result(c, r);
+    }
+    if (PyErr_Occurred()) {
+        Py_CLEAR(l);
+    }
+
+out:
+    if (c) {
+        trie_cursor_destroy(c);
+    }
+    if (u && u != hi) {
+        Py_DECREF(u);
+    }
+    return l;
+}
+
+static PyObject *Trie_get(PyObject* selfobj, PyObject *args, PyObject *kwds)
+{
+    const PyObject *default_value = Py_None;
+    char *key;
+    PyObject *value;
+    static char *kwlist[] = {"key", "default", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &key, &default_value)) {
+        return NULL;
+    }
+    // Get value using subscript func
+    value = Trie_subscript(selfobj, key);
+    if (value == NULL) {
+        PyErr_Clear();
+        value = default_value;
+        Py_INCREF(value);
+    }
+    
+    return value;
+}
+
+// Key of a batch lookup, 0 if key is not a string. A bytes key is decoded 
+// into *tmp, to be released after the lookup.
+static int _Batch_key(PyObject *key, trie_key_t *k, PyObject **tmp)
+{
+    *tmp = NULL;
+    if (!_IsValid_Unicode(key)) {
+        return 0;
+    }
+    if (PyBytes_Check(key)) {
+        key = *tmp = _Coerce_Unicode(key);
+        if (!key || !_IsValid_Unicode(key)) {
+            Py_XDECREF(*tmp);
+            *tmp = NULL;
+            PyErr_Clear();
+            return 0;
+        }
+    }
+    *k = _PyUnicode_AS_TKEY(key);
+    return 1;
+}
+
+#define BATCH_CHUNK 256
+
+// Values of the keys items[0, n), 0 for the missing ones. A key that is not
+// a string raises if strict, else it is missing. With keys_only the values 
+// only tell which keys are there, so a mapped trie loads none. Pointer 
+// tries look up all keys with the interleaved trie_search_many(), or with 
+// the merge walk of trie_search_sorted() if sort is set.
+static int _Batch_lookup(TrieObject *mp, PyObject **items, Py_ssize_t n, 
+    TRIE_DATA *values, int strict, int keys_only, int sort)
+{
+    trie_key_t skeys[BATCH_CHUNK], *keys;
+    trie_node_t *snodes[BATCH_CHUNK], **nodes;
+    PyObject *stmps[BATCH_CHUNK], **tmps;
+    Py_ssize_t spos[BATCH_CHUNK], *pos, i, nkeys;
+    char *block = NULL;
+    int ok = 1;
+
+    keys = skeys;
+    nodes = snodes;
+    tmps = stmps;
+    pos = spos;
+    if (n > BATCH_CHUNK) {
+        block = (char *)PyMem_Malloc(n * (sizeof(trie_key_t) + 
+            sizeof(trie_node_t *) + sizeof(PyObject *) + sizeof(Py_ssize_t)));
+        if (!block) {
+            PyErr_NoMemory();
+            return 0;
+        }
+        keys = (trie_key_t *)block;
+        nodes = (trie_node_t **)(keys + n);
+        tmps = (PyObject **)(nodes + n);
+        pos = (Py_ssize_t *)(tmps + n);
+    }
+
+    nkeys = 0;
+    for (i = 0; i < n; i++) {
+        values[i] = 0;
+        if (_Batch_key(items[i], &keys[nkeys], &tmps[nkeys])) {
+            pos[nkeys++] = i;
+        } else if (strict) {
+            PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
+            ok = 0;
+            goto out;
+        }
+    }
+
+    if (!_Trie_frozen(mp)) {
+        if (sort) {
+            if (!trie_search_sorted(mp->ptrie, keys, nkeys, nodes)) {
+                PyErr_NoMemory();
+                ok = 0;
+                goto out;
+            }
+        } else {
+            trie_search_many(mp->ptrie, keys, nkeys, nodes);
+        }
+        for (i = 0; i < nkeys; i++) {
+            values[pos[i]] = nodes[i] ? nodes[i]->value : 0;
+        }
+    } else if (keys_only) {
+        for (i = 0; i < nkeys; i++) {
+            values[pos[i]] = (TRIE_DATA)_Trie_has_key(mp, &keys[i]);
+        }
+    } else {
+        for (i = 0; i < nkeys; i++) {
+            values[pos[i]] = _Trie_lookup(mp, &keys[i]);
+            if (!values[pos[i]] && PyErr_Occurred()) {
+                ok = 0; // a mapped value failed to load
+                goto out;
+            }
+        }
+    }
+
+out:
+    for (i = 0; i < nkeys; i++) {
+        Py_XDECREF(tmps[i]);
+    }
+    PyMem_Free(block);
+    return ok;
+}
+
+// Whether more than 1 in 16 of the first BATCH_CHUNK keys are out of order.
+// Sorting such a batch costs more than the merge walk saves over the 
+// interleaved lookups.
+static int _Batch_unsorted(PyObject **items, Py_ssize_t n)
+{
+    Py_ssize_t i, descents = 0;
+
+    n = n < BATCH_CHUNK ? n : BATCH_CHUNK;
+    for (i = 1; i < n; i++) {
+        if (PyUnicode_CheckExact(items[i - 1]) && 
+            PyUnicode_CheckExact(items[i]) && 
+            PyUnicode_Compare(items[i - 1], items[i]) > 0) {
+            descents++;
+        }
+    }
+    PyErr_Clear();
+    return descents > n / 16;
+}
+
+// Keys are looked up BATCH_CHUNK at a time, or all at once if they are 
+// sorted. sort is cleared for a batch that does not come mostly sorted. 
+// Returns the values array to use, NULL if out of memory.
+static TRIE_DATA *_Batch_values(PyObject **items, Py_ssize_t n, int *sort, 
+    TRIE_DATA *buf, Py_ssize_t *chunk)
+{
+    TRIE_DATA *values = buf;
+
+    *chunk = BATCH_CHUNK;
+    if (*sort && _Batch_unsorted(items, n)) {
+        *sort = 0;
+    }
+    if (*sort) {
+        *chunk = n;
+        if (n > BATCH_CHUNK) {
+            values = (TRIE_DATA *)PyMem_Malloc(n * sizeof(TRIE_DATA));
+            if (!values) {
+                PyErr_NoMemory();
+            }
+        }
+    }
+    return values;
+}
+
+// Batch lookups loop over a list or tuple in C: misses take the default 
+// without a KeyError ever being created. With sort=True a batch that comes
+// sorted or nearly so is sorted and the trie is walked once, sharing the 
+// path of common prefixes; the results are in the order of keys either way.
+static PyObject *Trie_get_many(PyObject* selfobj, PyObject *args, PyObject *kwds)
+{
+    TrieObject *mp = (TrieObject *)selfobj;
+    PyObject *keys, *seq, **items, *r, *v;
+    PyObject *default_value = Py_None;
+    static char *kwlist[] = {"keys", "default", "sort", NULL};
+    TRIE_DATA buf[BATCH_CHUNK], *values;
+    Py_ssize_t i, j, m, n, chunk;
+    int sort = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oi", kwlist, &keys, 
+        &default_value, &sort)) {
+        return NULL;
+    }
+    seq = PySequence_Fast(keys, "keys must be a sequence.");
+    if (!seq) {
+        return NULL;
+    }
+    n = PySequence_Fast_GET_SIZE(seq);
+    items = PySequence_Fast_ITEMS(seq);
+    values = _Batch_values(items, n, &sort, buf, &chunk);
+    r = values ? PyList_New(n) : NULL;
+    if (!r) {
+        goto fail;
+    }
+    for (i = 0; i < n; i += m) {
+        m = n - i < chunk ? n - i : chunk;
+        if (!_Batch_lookup(mp, items + i, m, values, 1, 0, sort)) {
+            Py_CLEAR(r);
+            goto fail;
+        }
+        for (j = 0; j < m; j++) {
+            v = values[j] ? (PyObject *)values[j] : default_value;
+            Py_INCREF(v);
+            PyList_SET_ITEM(r, i + j, v);
+        }
+    }
+
+fail:
+    if (values != buf) {
+        PyMem_Free(values);
+    }
+    Py_DECREF(seq);
+    return r;
+}
+
+// One byte per key, 1 if it is in the trie. Keys that are not strings are 
+// not in it, as with the in operator.
+static PyObject *Trie_contains_many(PyObject* selfobj, PyObject *args, PyObject *kwds)
+{
+    TrieObject *mp = (TrieObject *)selfobj;
+    PyObject *keys, *seq, **items, *r;
+    static char *kwlist[] = {"keys", "sort", NULL};
+    TRIE_DATA buf[BATCH_CHUNK], *values;
+    Py_ssize_t i, j, m, n, chunk;
+    int sort = 0;
+    char *hits;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &keys, &sort)) {
+        return NULL;
+    }
+    seq = PySequence_Fast(keys, "keys must be a sequence.");
+    if (!seq) {
+        return NULL;
+    }
+    n = PySequence_Fast_GET_SIZE(seq);
+    items = PySequence_Fast_ITEMS(seq);
+    values = _Batch_values(items, n, &sort, buf, &chunk);
+    r = values ? PyBytes_FromStringAndSize(NULL, n) : NULL;
+    if (!r) {
+        goto fail;
+    }
+    hits = PyBytes_AS_STRING(r);
+    for (i = 0; i < n; i += m) {
+        m = n - i < chunk ? n - i : chunk;
+        if (!_Batch_lookup(mp, items + i, m, values, 0, 1, sort)) {
+            Py_CLEAR(r);
+            goto fail;
+        }
+        for (j = 0; j < m; j++) {
+            hits[i + j] = values[j] != 0;
+        }
+    }
+
+fail:
+    if (values != buf) {
+        PyMem_Free(values);
+    }
+    Py_DECREF(seq);
+    return r;
+}
+
+// With more than one thread the pairs are collected first: the keys are 
+// handed to trie_build_parallel() as views of their strings, which are held
+// along with the values until the build is done, with the GIL released.
+static PyObject *_Trie_build_parallel(TrieObject *mp, PyObject *pairs, 
+    int threads)
+{
+    PyObject *seq, *pair, **owners, *key;
+    trie_key_t *keys;
+    TRIE_DATA *values;
+    Py_ssize_t i, n;
+    trie_t *trie;
+    int status;
+
+    seq = PySequence_Fast(pairs, "pairs must be iterable.");
+    if (!seq) {
+        Py_DECREF(mp);
+        return NULL;
+    }
+    n = PySequence_Fast_GET_SIZE(seq);
+    keys = (trie_key_t *)PyMem_Malloc(n * sizeof(trie_key_t) + 1);
+    values = (TRIE_DATA *)PyMem_Malloc(n * sizeof(TRIE_DATA) + 1);
+    owners = (PyObject **)PyMem_Malloc(n * sizeof(PyObject *) + 1);
+    trie = NULL;
+    if (!keys || !values || !owners) {
+        PyErr_NoMemory();
+        n = 0;
+    }
+    for (i = 0; i < n; i++) {
+        pair = PySequence_Fast(PySequence_Fast_GET_ITEM(seq, i), 
+            "trie items must be (key, value) pairs.");
+        if (pair && PySequence_Fast_GET_SIZE(pair) != 2) {
+            PyErr_SetString(PyExc_ValueError, "trie items must be (key, value) pairs.");
+            Py_CLEAR(pair);
+        }
+        if (!pair) {
+            break;
+        }
+        key = PySequence_Fast_GET_ITEM(pair, 0);
+        if (!_Batch_key(key, &keys[i], &owners[i])) {
+            PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
+            Py_DECREF(pair);
+            break;
+        }
+        if (!owners[i]) {
+            owners[i] = key;
+            Py_INCREF(key);
+        }
+        values[i] = (TRIE_DATA)PySequence_Fast_GET_ITEM(pair, 1);
+        Py_INCREF((PyObject *)values[i]);
+        Py_DECREF(pair);
+    }
+
+    if (!PyErr_Occurred()) {
+        Py_BEGIN_ALLOW_THREADS
+        trie = trie_build_parallel(keys, values, n, threads, &status);
+        Py_END_ALLOW_THREADS
+        if (!trie) {
+            if (status < 0) {
+                PyErr_SetString(FasttrieError, 
+                    "keys must be in strictly increasing order.");
+            } else {
+                PyErr_NoMemory();
+            }
+        }
+    }
+    // on success the values are the trie's now
+    n = i;
+    for (i = 0; i < n; i++) {
+        Py_DECREF(owners[i]);
+        if (!trie) {
+            Py_DECREF((PyObject *)values[i]);
+        }
+    }
+    PyMem_Free(keys);
+    PyMem_Free(values);
+    PyMem_Free(owners);
+    Py_DECREF(seq);
+
+    if (!trie) {
+        Py_DECREF(mp);
+        return NULL;
+    }
+    trie_destroy(mp->ptrie);
+    mp->ptrie = trie;
+    return (PyObject *)mp;
+}
+
+// Trie.from_sorted(pairs) builds the trie bottom-up in a single pass over 
+// (key, value) pairs in strictly increasing key order, see Note 12 in 
+// trie.c. The pairs are streamed, only the trie itself is held.
+static PyObject *Trie_from_sorted(PyObject *cls, PyObject *args, PyObject *kwds)
+{
+    PyObject *pairs, *it, *item, *pair, *key, *value, *tmp;
+    static char *kwlist[] = {"pairs", "threads", NULL};
+    TrieObject *mp;
+    trie_builder_t *b;
+    trie_t *trie;
+    trie_key_t k;
+    int added, threads = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &pairs, 
+        &threads)) {
+        return NULL;
+    }
+    mp = (TrieObject *)PyObject_CallObject(cls, NULL);
+    if (!mp) {
+        return NULL;
+    }
+    if (threads > 1) {
+        return _Trie_build_parallel(mp, pairs, threads);
+    }
+    it = PyObject_GetIter(pairs);
+    b = it ? trie_builder_create() : NULL;
+    if (!b) {
+        Py_XDECREF(it);
+        Py_DECREF(mp);
+        return PyErr_Occurred() ? NULL : PyErr_NoMemory();
+    }
+
+    while ((item = PyIter_Next(it))) {
+        pair = PySequence_Fast(item, "trie items must be (key, value) pairs.");
+        Py_DECREF(item);
+        if (!pair) {
+            break;
+        }
+        if (PySequence_Fast_GET_SIZE(pair) != 2) {
+            PyErr_SetString(PyExc_ValueError, "trie items must be (key, value) pairs.");
+            Py_DECREF(pair);
+            break;
+        }
+        key = PySequence_Fast_GET_ITEM(pair, 0);
+        value = PySequence_Fast_GET_ITEM(pair, 1);
+        if (!_Batch_key(key, &k, &tmp)) {
+            PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
+            Py_DECREF(pair);
+            break;
+        }
+        added = trie_builder_add(b, &k, (TRIE_DATA)value);
+        Py_XDECREF(tmp);
+        if (added == 1) {
+            Py_INCREF(value);
+        } else if (added < 0) {
+            PyErr_Format(FasttrieError, "keys must be in strictly increasing "
+                "order, %R is not.", key);
+        } else {
+            PyErr_NoMemory();
+        }
+        Py_DECREF(pair);
+        if (added != 1) {
+            break;
+        }
+    }
+    Py_DECREF(it);
+
+    // on error too, so that the values added so far are released with mp
+    trie = trie_builder_finish(b);
+    if (trie) {
+        trie_destroy(mp->ptrie);
+        mp->ptrie = trie;
+    } else if (!PyErr_Occurred()) {
+        PyErr_NoMemory();
+    }
+    if (PyErr_Occurred()) {
+        Py_DECREF(mp);
+        return NULL;
+    }
+    return (PyObject *)mp;
+}
+
+// Raises the error of a failed external build from errno.
+static PyObject *_external_error(const char *path)
+{
+    switch (errno) {
+    case ENOMEM:
+        return PyErr_NoMemory();
+    case EILSEQ:
+        PyErr_SetString(FasttrieError, "key cannot be encoded to UTF-8.");
+        return NULL;
+    case EFBIG:
+        PyErr_SetString(FasttrieError, "too many keys for a trie file.");
+        return NULL;
+    default:
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    }
+}
+
+static int _external_add(trie_key_t *key, const char *payload, 
+    unsigned long len, void *arg)
+{
+    int r;
+
+    r = trie_da_writer_add((trie_da_writer_t *)arg, key, payload, len);
+    if (r < 0) {
+        errno = EIO; // the merge hands keys in order
+    }
+    return r == 1;
+}
+
+// Trie.build_external(pairs, path) writes the file save() would for the 
+// (key, value) pairs, which come in any order and need not fit in memory, 
+// and maps it. Pairs are sorted into runs of about memory bytes, see Note 
+// 15 in trie.h, which are merged into a writer of the file, see Note 16 in
+// trie_da.c. Only reading the pairs needs the GIL.
+static PyObject *Trie_build_external(PyObject *cls, PyObject *args, 
+    PyObject *kwds)
+{
+    PyObject *pairs, *it, *item, *pair, *key, *tmp, *r = NULL;
+    static char *kwlist[] = {"pairs", "path", "memory", "tmpdir", NULL};
+    unsigned long memory = TRIE_EXTERNAL_MEMORY;
+    const char *path, *tmpdir = NULL;
+    trie_sorter_t *s;
+    trie_da_writer_t *w;
+    trie_key_t k;
+    char *payload = NULL;
+    uint64_t len, cap = 0;
+    int ok, saved_errno;
+#ifdef IS_PY3K
+    PyObject *bpath, *btmpdir = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO&|kO&", kwlist, &pairs,
+        PyUnicode_FSConverter, &bpath, &memory, _fs_converter_or_none,
+        &btmpdir)) {
+        return NULL;
+    }
+    path = PyBytes_AS_STRING(bpath);
+    if (btmpdir) {
+        tmpdir = PyBytes_AS_STRING(btmpdir);
+    }
+#else
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Os|kz", kwlist, &pairs,
+        &path, &memory, &tmpdir)) {
+        return NULL;
+    }
+#endif
+    it = PyObject_GetIter(pairs);
+    if (!it) {
+        goto out;
+    }
+    s = trie_sorter_create(tmpdir, memory);
+    if (!s) {
+        Py_DECREF(it);
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    while ((item = PyIter_Next(it))) {
+        pair = PySequence_Fast(item, "trie items must be (key, value) pairs.");
+        Py_DECREF(item);
+        if (!pair) {
+            break;
+        }
+        if (PySequence_Fast_GET_SIZE(pair) != 2) {
+            PyErr_SetString(PyExc_ValueError, "trie items must be (key, value) pairs.");
+            Py_DECREF(pair);
+            break;
+        }
+        key = PySequence_Fast_GET_ITEM(pair, 0);
+        if (!_Batch_key(key, &k, &tmp)) {
+            PyErr_SetString(FasttrieError, "key must be a valid unicode string.");
+            Py_DECREF(pair);
+            break;
+        }
+        len = 0;
+        ok = _pack_value(PySequence_Fast_GET_ITEM(pair, 1), &payload, &len, 
+            &cap);
+        if (ok && !trie_sorter_add(s, &k, payload, (unsigned long)len)) {
+            _external_error(path);
+            ok = 0;
+        }
+        Py_XDECREF(tmp);
+        Py_DECREF(pair);
+        if (!ok) {
+            break;
+        }
+        if (trie_sorter_full(s)) {
+            Py_BEGIN_ALLOW_THREADS
+            ok = trie_sorter_spill(s);
+            Py_END_ALLOW_THREADS
+            if (!ok) {
+                _external_error(path);
+                break;
+            }
+        }
+    }
+    Py_DECREF(it);
+    PyMem_Free(payload);
+
+    if (!PyErr_Occurred()) {
+        Py_BEGIN_ALLOW_THREADS
+        w = trie_da_writer_create(tmpdir, memory);
+        ok = w && trie_sorter_merge(s, _external_add, w) && 
+            trie_da_writer_finish(w, path);
+        saved_errno = errno;
+        if (w) {
+            trie_da_writer_destroy(w);
+        }
+        errno = saved_errno;
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            _external_error(path);
+        }
+    }
+    trie_sorter_destroy(s);
+    if (!PyErr_Occurred()) {
+#ifdef IS_PY3K
+        r = PyObject_CallMethod(cls, "mmap", "O", bpath);
+#else
+        r = PyObject_CallMethod(cls, "mmap", "s", path);
+#endif
+    }
+
+out:
+#ifdef IS_PY3K
+    Py_DECREF(bpath);
+    Py_XDECREF(btmpdir);
+#endif
+    return r;
+}
+
+// A file loaded by trie_load() holds record tags instead of values, see 
+// Note 13 in trie.h. They are turned into objects with the GIL held, one 
+// per key that is left: a key repeated in the file costs no object.
+typedef struct {
+    trie_load_t *load;
+    PyObject *value; // of every key, for TRIE_LOAD_KEYS
+    trie_t *into; // the trie the loaded keys are merged into
+    int failed;
+} _LoadArg;
+
+static int _load_value(trie_key_t *k, trie_node_t *n, void *arg)
 {
-    PyObject *tup = PyTuple_New(2);
-    PyTuple_SetItem(tup, 0, _TKEY_AS_PyUnicode(k));
-    PyTuple_SetItem(tup, 1, (PyObject *)n->value);
-    PyList_Append((PyObject *)arg, tup);
+    _LoadArg *a = (_LoadArg *)arg;
+    trie_load_t *l = a->load;
+    unsigned long i;
+    PyObject *v;
+
+    i = TRIE_LOAD_RECORD(n->value);
+    v = NULL;
+    if (!a->failed) {
+        switch(l->kind)
+        {
+            case TRIE_LOAD_INT:
+                v = PyLong_FromLongLong(l->ints[i]);
+                break;
+            case TRIE_LOAD_BYTES:
+                v = PyBytes_FromStringAndSize(l->blob + l->offsets[i], 
+                    (Py_ssize_t)(l->offsets[i+1] - l->offsets[i]));
+                break;
+            default:
+                v = a->value;
+                Py_INCREF(v);
+                break;
+        }
+    }
+    if (!v) {
+        // every node gets an object, so the trie can be released as usual
+        a->failed = 1;
+        v = Py_None;
+        Py_INCREF(v);
+    }
+    n->value = (TRIE_DATA)v;
     return 0;
 }
 
-int _enum_values(trie_key_t *k, trie_node_t *n, void *arg)
+// Moves the value of a loaded key into a->into, replacing the one there.
+static int _load_merge(trie_key_t *k, trie_node_t *n, void *arg)
 {
-    PyList_Append((PyObject *)arg, (PyObject *)n->value);
+    _LoadArg *a = (_LoadArg *)arg;
+    trie_node_t *w;
+    PyObject *old;
+
+    w = trie_search(a->into, k);
+    if (w && w->value) {
+        old = (PyObject *)w->value;
+        w->value = n->value;
+        Py_DECREF(old);
+    } else if (a->failed || !trie_add(a->into, k, n->value)) {
+        a->failed = 1;
+        Py_DECREF((PyObject *)n->value);
+    }
+    n->value = 0;
     return 0;
 }
 
-int _set_items(trie_key_t *k, trie_node_t *n, void *arg)
+// Loads path into mp with the GIL released and no Python object per line.
+// An empty trie takes the loaded one as it is, otherwise the keys are 
+// merged in and replace the values of the keys that are there.
+static PyObject *_Trie_load(TrieObject *mp, const char *path, 
+    trie_load_kind_t kind, PyObject *value)
 {
-    Trie_ass_sub((TrieObject *) arg, _TKEY_AS_PyUnicode(k), (PyObject *)n->value);
-    return 0;
+    trie_load_error_t err;
+    trie_load_t l;
+    trie_key_t k;
+    _LoadArg a;
+    PyObject *r = NULL;
+
+    if (!_Trie_writable(mp)) {
+        return NULL;
+    }
+
+    // The file is read without the GIL and the values are made, and the old
+    // ones released, with it. Until load returns the trie can neither be 
+    // changed by another thread nor frozen, thawed or cleared, which would 
+    // free ptrie under the merge below.
+    mp->dump_count++;
+    mp->iter_count++;
+
+    Py_BEGIN_ALLOW_THREADS
+    err = trie_load(path, kind, &l);
+    Py_END_ALLOW_THREADS
+    switch(err)
+    {
+        case TRIE_LOAD_OK:
+            break;
+        case TRIE_LOAD_IOERROR:
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+            goto out;
+        case TRIE_LOAD_NOMEM:
+            PyErr_NoMemory();
+            goto out;
+        case TRIE_LOAD_BADUTF8:
+            PyErr_Format(FasttrieError, "%s:%lu: invalid UTF-8.", path, l.line);
+            goto out;
+        case TRIE_LOAD_BADVALUE:
+            PyErr_Format(FasttrieError, "%s:%lu: expected key<TAB>%s.", 
+                path, l.line, kind == TRIE_LOAD_INT ? "integer" : "value");
+            goto out;
+    }
+
+    memset(&k, 0, sizeof(trie_key_t));
+    a.load = &l;
+    a.value = value;
+    a.into = NULL;
+    a.failed = 0;
+    trie_suffixes(l.trie, &k, l.trie->height, _load_value, &a);
+    trie_load_release(&l);
+    if (a.failed) {
+        trie_suffixes(l.trie, &k, l.trie->height, _dec_ref_count, NULL);
+        trie_destroy(l.trie);
+        goto out;
+    }
+
+    // the pin above is the only iterator, none points into ptrie
+    if (mp->iter_count == 1 && !mp->ptrie->item_count) {
+        trie_destroy(mp->ptrie);
+        mp->ptrie = l.trie;
+    } else {
+        a.into = mp->ptrie;
+        trie_suffixes(l.trie, &k, l.trie->height, _load_merge, &a);
+        trie_destroy(l.trie);
+        if (a.failed) {
+            PyErr_NoMemory();
+            goto out;
+        }
+    }
+    r = Py_None;
+    Py_INCREF(r);
+
+out:
+    mp->iter_count--;
+    mp->dump_count--;
+    return r;
 }
 
-int _dec_ref_count(trie_key_t *k, trie_node_t *n, void *arg)
+static PyObject *Trie_load_lines(PyObject* selfobj, PyObject *args)
 {
-    Py_XDECREF((PyObject *)n->value);
+    PyObject *value = Py_None, *r;
+    const char *path;
+#ifdef IS_PY3K
+    PyObject *bpath;
+
+    if (!PyArg_ParseTuple(args, "O&|O", PyUnicode_FSConverter, &bpath, 
+        &value)) {
+        return NULL;
+    }
+    path = PyBytes_AS_STRING(bpath);
+#else
+    if (!PyArg_ParseTuple(args, "s|O", &path, &value)) {
+        return NULL;
+    }
+#endif
+    r = _Trie_load((TrieObject *)selfobj, path, TRIE_LOAD_KEYS, value);
+#ifdef IS_PY3K
+    Py_DECREF(bpath);
+#endif
+    return r;
 }
 
-static PyObject *Trie_keys(PyObject* selfobj, PyObject *args)
+// The kind of the values of a tsv file, 'int' or 'bytes'. 
+static int _parse_tsv_values(const char *values, trie_load_kind_t *kind)
 {
-    trie_key_t k;
-    unsigned long max_depth;
-    PyObject *sfxs;
+    if (strcmp(values, "int") == 0) {
+        *kind = TRIE_LOAD_INT;
+    } else if (strcmp(values, "bytes") == 0) {
+        *kind = TRIE_LOAD_BYTES;
+    } else {
+        PyErr_Format(PyExc_ValueError, "unknown value type '%s', expected "
+            "'int' or 'bytes'.", values);
+        return 0;
+    }
+    return 1;
+}
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
-    {
+static PyObject *Trie_load_tsv(PyObject* selfobj, PyObject *args)
+{
+    const char *path, *values = "int";
+    trie_load_kind_t kind;
+    PyObject *r = NULL;
+#ifdef IS_PY3K
+    PyObject *bpath;
+
+    if (!PyArg_ParseTuple(args, "O&|s", PyUnicode_FSConverter, &bpath, 
+        &values)) {
         return NULL;
     }
-    
-    sfxs = PyList_New(0);
-    trie_suffixes(((TrieObject *)selfobj)->ptrie, &k, max_depth, _enum_keys, sfxs);
-    
-    return sfxs;
+    path = PyBytes_AS_STRING(bpath);
+#else
+    if (!PyArg_ParseTuple(args, "s|s", &path, &values)) {
+        return NULL;
+    }
+#endif
+    if (_parse_tsv_values(values, &kind)) {
+        r = _Trie_load((TrieObject *)selfobj, path, kind, NULL);
+    }
+#ifdef IS_PY3K
+    Py_DECREF(bpath);
+#endif
+    return r;
 }
 
-static PyObject *Trie_items(PyObject *selfobj, PyObject *args)
+// Writes the keys of a trie, and their values, as the lines that load_lines()
+// and load_tsv() read, see Note 14 in trie.h. The walk holds the GIL, the
+// lines are written without it once the buffer fills.
+typedef struct {
+    trie_dump_t dump;
+    trie_load_kind_t kind;
+    const char *path; // NULL when writing to file
+    PyObject *file;
+    int failed;
+} _DumpArg;
+
+static int _dump_flush(_DumpArg *a)
 {
-    trie_key_t k;
-    unsigned long max_depth;
-    PyObject *values;
+    PyObject *b, *r;
+    int ok;
+
+    if (!a->file) {
+        Py_BEGIN_ALLOW_THREADS
+        ok = trie_dump_flush(&a->dump);
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, a->path);
+        }
+        return ok;
+    }
+    b = PyBytes_FromStringAndSize(a->dump.buf, (Py_ssize_t)a->dump.len);
+    a->dump.len = 0;
+    if (!b) {
+        return 0;
+    }
+    r = PyObject_CallMethod(a->file, "write", "O", b);
+    Py_DECREF(b);
+    Py_XDECREF(r);
+    return r != NULL;
+}
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
-    {
-        return NULL;
+// Appends the text of value v, as load_tsv() parses it.
+static int _dump_value(_DumpArg *a, PyObject *v)
+{
+    char num[32];
+    const char *p;
+    Py_ssize_t n;
+    long long i;
+    int overflow = 0, isint;
+
+    if (a->kind == TRIE_LOAD_INT) {
+#ifdef IS_PY3K
+        isint = PyLong_Check(v);
+#else
+        isint = PyLong_Check(v) || PyInt_Check(v);
+#endif
+        i = isint ? PyLong_AsLongLongAndOverflow(v, &overflow) : -1;
+        if (i == -1 && PyErr_Occurred()) {
+            return 0;
+        }
+        if (!isint || overflow) {
+            PyErr_SetString(FasttrieError, "values must be 64 bit integers.");
+            return 0;
+        }
+        PyOS_snprintf(num, sizeof(num), "%lld", i);
+        p = num;
+        n = (Py_ssize_t)strlen(num);
+    } else {
+        if (!PyBytes_Check(v)) {
+            PyErr_SetString(FasttrieError, "values must be bytes.");
+            return 0;
+        }
+        p = PyBytes_AS_STRING(v);
+        n = PyBytes_GET_SIZE(v);
+        if (memchr(p, '\n', n) || (n && p[n-1] == '\r')) {
+            PyErr_SetString(FasttrieError, "values cannot hold line ends.");
+            return 0;
+        }
     }
-    
-    values = PyList_New(0);
-    trie_suffixes(((TrieObject *)selfobj)->ptrie, &k, max_depth, _enum_items, values);
-    
-    return values;
+    if (!trie_dump_bytes(&a->dump, "\t", 1) || 
+        !trie_dump_bytes(&a->dump, p, (unsigned long)n)) {
+        PyErr_NoMemory();
+        return 0;
+    }
+    return 1;
 }
 
-static PyObject *Trie_values(PyObject* selfobj, PyObject *args)
+static int _dump_item(trie_key_t *k, trie_node_t *n, void *arg)
+{
+    _DumpArg *a = (_DumpArg *)arg;
+    unsigned long start;
+    int r;
+
+    if (a->failed) {
+        return 0;
+    }
+    start = a->dump.len;
+    r = trie_dump_key(&a->dump, k);
+    if (r <= 0) {
+        if (r) {
+            PyErr_SetString(FasttrieError, "key cannot be encoded to UTF-8.");
+        } else {
+            PyErr_NoMemory();
+        }
+        goto fail;
+    }
+    // no UTF-8 sequence holds these bytes but the chars themselves
+    if (memchr(a->dump.buf + start, '\n', a->dump.len - start) || 
+        (a->kind != TRIE_LOAD_KEYS && 
+        memchr(a->dump.buf + start, '\t', a->dump.len - start))) {
+        PyErr_SetString(FasttrieError, a->kind == TRIE_LOAD_KEYS ? 
+            "keys cannot hold line ends." : "keys cannot hold line ends or tabs.");
+        goto fail;
+    }
+    if ((a->kind != TRIE_LOAD_KEYS && !_dump_value(a, (PyObject *)n->value)) ||
+        !trie_dump_bytes(&a->dump, "\n", 1)) {
+        if (!PyErr_Occurred()) {
+            PyErr_NoMemory();
+        }
+        goto fail;
+    }
+    if (TRIE_DUMP_FULL(&a->dump) && !_dump_flush(a)) {
+        a->failed = 1;
+    }
+    return 0;
+
+fail:
+    // the part of the line written so far is not a line
+    a->dump.len = start;
+    a->failed = 1;
+    return 0;
+}
+
+// Dumps mp in key order. The trie cannot change meanwhile: writes raise, 
+// and the dump counts as an iterator so it is not frozen or thawed either.
+static PyObject *_Trie_dump(TrieObject *mp, const char *path, PyObject *file,
+    const char *values)
 {
     trie_key_t k;
-    unsigned long max_depth;
-    PyObject *values;
+    _DumpArg a;
+    int ok;
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
-    {
+    a.kind = TRIE_LOAD_KEYS;
+    if (values && !_parse_tsv_values(values, &a.kind)) {
         return NULL;
     }
-    
-    values = PyList_New(0);
-    trie_suffixes(((TrieObject *)selfobj)->ptrie, &k, max_depth, _enum_values, values);
-    
-    return values;
+    if (!trie_dump_open(&a.dump, path)) {
+        if (errno == ENOMEM) {
+            return PyErr_NoMemory();
+        }
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    }
+    a.path = path;
+    a.file = file;
+    a.failed = 0;
+
+    memset(&k, 0, sizeof(trie_key_t));
+    mp->dump_count++;
+    mp->iter_count++;
+    _Trie_suffixes(mp, &k, _Trie_height(mp), a.kind == TRIE_LOAD_KEYS, 
+        _dump_item, &a);
+    // the walk stops at a mapped value that fails to load
+    if (!a.failed && PyErr_Occurred()) {
+        a.failed = 1;
+    }
+    if (!a.failed && file && a.dump.len) {
+        a.failed = !_dump_flush(&a);
+    }
+    mp->iter_count--;
+    mp->dump_count--;
+
+    // a failed dump writes out no more lines
+    if (a.failed) {
+        a.dump.len = 0;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    ok = trie_dump_close(&a.dump);
+    Py_END_ALLOW_THREADS
+    if (a.failed) {
+        return NULL;
+    }
+    if (!ok) {
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    }
+    Py_RETURN_NONE;
 }
 
-static PyObject *Trie_get(PyObject* selfobj, PyObject *args, PyObject *kwds)
+static PyObject *Trie_dump(PyObject* selfobj, PyObject *args)
 {
-    const PyObject *default_value = Py_None;
-    char *key;
-    PyObject *value;
-    static char *kwlist[] = {"key", "default", NULL};
+    const char *path, *values = NULL;
+    PyObject *r;
+#ifdef IS_PY3K
+    PyObject *bpath;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &key, &default_value)) {
+    if (!PyArg_ParseTuple(args, "O&|z", PyUnicode_FSConverter, &bpath, 
+        &values)) {
         return NULL;
     }
-    // Get value using subscript func
-    value = Trie_subscript(selfobj, key);
-    if (value == NULL) {
-        PyErr_Clear();
-        value = default_value;
-        Py_INCREF(value);
+    path = PyBytes_AS_STRING(bpath);
+#else
+    if (!PyArg_ParseTuple(args, "s|z", &path, &values)) {
+        return NULL;
     }
-    
-    return value;
+#endif
+    r = _Trie_dump((TrieObject *)selfobj, path, NULL, values);
+#ifdef IS_PY3K
+    Py_DECREF(bpath);
+#endif
+    return r;
+}
+
+static PyObject *Trie_dump_to(PyObject* selfobj, PyObject *args)
+{
+    PyObject *file;
+    const char *values = NULL;
+
+    if (!PyArg_ParseTuple(args, "O|z", &file, &values)) {
+        return NULL;
+    }
+    return _Trie_dump((TrieObject *)selfobj, NULL, file, values);
 }
 
 static PyObject *Trie_update(PyObject* selfobj, PyObject *args, PyObject *kwds)
@@ -519,6 +2857,10 @@ static PyObject *Trie_update(PyObject* selfobj, PyObject *args, PyObject *kwds)
         return NULL;
     }
 
+    if (!_Trie_writable((TrieObject *)selfobj)) {
+        return NULL;
+    }
+
     if (arg) {
         if (PyDict_Check(arg)) {
             pos = 0;
@@ -533,7 +2875,10 @@ static PyObject *Trie_update(PyObject* selfobj, PyObject *args, PyObject *kwds)
             trie_key_t k;
             unsigned long max_depth;
             if (!_parse_traverse_args((TrieObject *)selfobj, PyTuple_New(0), &k, &max_depth)) return NULL;
-            trie_suffixes(((TrieObject *)arg)->ptrie, &k, max_depth, _set_items, selfobj);
+            _Trie_suffixes((TrieObject *)arg, &k, max_depth, 0, _set_items, selfobj);
+            if (PyErr_Occurred()) {
+                return NULL;
+            }
         }
 
         if (PySequence_Check(arg))  {
@@ -568,16 +2913,29 @@ static PyObject *Trie_clear(PyObject* selfobj, PyObject *args)
     trie_key_t k;
     unsigned long max_depth;
 
+    if (((TrieObject *)selfobj)->dump_count) {
+        PyErr_SetString(PyExc_RuntimeError, "trie cannot be changed during a dump.");
+        return NULL;
+    }
+    if (((TrieObject *)selfobj)->iter_count) {
+        // the iterators point into the trie destroyed below
+        PyErr_SetString(PyExc_RuntimeError, "trie cannot be cleared during iteration.");
+        return NULL;
+    }
     if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
     {
         return NULL;
     }
 
     // Decrement refcount for all values in trie
-    trie_suffixes(((TrieObject *)selfobj)->ptrie, &k, max_depth, _dec_ref_count, NULL);
+    _Trie_release_values((TrieObject *)selfobj, &k, max_depth);
 
     // Destroy existing trie and create fresh version
-    trie_destroy(((TrieObject *)selfobj)->ptrie);
+    if (_Trie_frozen((TrieObject *)selfobj)) {
+        _Trie_drop_frozen((TrieObject *)selfobj);
+    } else {
+        trie_destroy(((TrieObject *)selfobj)->ptrie);
+    }
     ((TrieObject *)selfobj)->ptrie = trie_create();
 
     Py_RETURN_NONE;
@@ -589,7 +2947,12 @@ static PyObject *Trie_copy(PyObject* selfobj, PyObject *args)
     trie_key_t k;
     unsigned long max_depth;
     if (!_parse_traverse_args((TrieObject *)selfobj, PyTuple_New(0), &k, &max_depth)) return NULL;
-    trie_suffixes(((TrieObject *)selfobj)->ptrie, &k, max_depth, _set_items, copy);
+    _Trie_suffixes((TrieObject *)selfobj, &k, max_depth, 0, _set_items, copy);
+    if (PyErr_Occurred()) {
+        // a mapped value failed to load
+        Py_DECREF(copy);
+        return NULL;
+    }
     return copy;
 }
 
@@ -606,35 +2969,15 @@ static PyObject *Trie_itersuffixes(PyObject* selfobj, PyObject *args)
         trie_itersuffixes_init, trie_itersuffixes_next, trie_itersuffixes_reset, trie_itersuffixes_deinit);
 }
 
-static PyObject *Trie_prefixes(PyObject* selfobj, PyObject *args)
-{
-    trie_key_t k;
-    unsigned long max_depth;
-    PyObject *sfxs;
-
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
-    {
-        return NULL;
-    }
-    
-    sfxs = PyList_New(0);
-    trie_prefixes(((TrieObject *)selfobj)->ptrie, &k, max_depth, _enum_keys, sfxs);
-    
-    return sfxs;
-}
-
-static PyObject *Trie_iterprefixes(PyObject* selfobj, PyObject *args)
+// Corrections walk the pointer trie. A frozen trie would have to be thawed,
+// values and all, on every call, so they raise until thaw() instead.
+static int _Trie_correctable(TrieObject *mp)
 {
-    trie_key_t k;
-    unsigned long max_depth;
-
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth)) {
-        return NULL;
+    if (_Trie_frozen(mp)) {
+        PyErr_SetString(FasttrieError, "trie is frozen, call thaw() first.");
+        return 0;
     }
-
-    return _create_iterator((TrieObject *)selfobj, &k, max_depth, 
-        trie_iterprefixes_init, trie_iterprefixes_next, trie_iterprefixes_reset, 
-        trie_iterprefixes_deinit);
+    return 1;
 }
 
 static PyObject *Trie_corrections(PyObject* selfobj, PyObject *args)
@@ -643,7 +2986,8 @@ static PyObject *Trie_corrections(PyObject* selfobj, PyObject *args)
     unsigned long max_depth;
     PyObject *sfxs;
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
+    if (!_Trie_correctable((TrieObject *)selfobj) || 
+        !_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth))
     {
         return NULL;
     }
@@ -659,7 +3003,8 @@ static PyObject *Trie_itercorrections(PyObject* selfobj, PyObject *args)
     trie_key_t k;
     unsigned long max_depth;
 
-    if (!_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth)) {
+    if (!_Trie_correctable((TrieObject *)selfobj) || 
+        !_parse_traverse_args((TrieObject *)selfobj, args, &k, &max_depth)) {
         return NULL;
     }
 
@@ -671,98 +3016,159 @@ static PyObject *Trie_itercorrections(PyObject* selfobj, PyObject *args)
 // Iterate keys start from root, depth is trie's height.
 PyObject *Trie_iter(PyObject *obj)
 {
-    TrieObject *self;
     trie_key_t k;
 
-    self = (TrieObject *)obj;
-
-    // create an empty string
-    k.s = "";
-    k.size = 0;
-#ifdef IS_PEP393_AVAILABLE
-    k.char_size = sizeof(Py_UCS4);
-#else
-    k.char_size = sizeof(Py_UNICODE);
-#endif
-    
-    return _create_iterator(self, &k, self->ptrie->height, 
-        trie_itersuffixes_init, trie_itersuffixes_next, trie_itersuffixes_reset, trie_itersuffixes_deinit);
+    memset(&k, 0, sizeof(trie_key_t));
+    return _Trie_iterator((TrieObject *)obj, &k, _Trie_height((TrieObject *)obj), 
+        TRIE_KEYS);
 }
 
 static void Trie_dealloc(TrieObject* self)
 {
-    PyObject *items = Trie_items(self, PyTuple_New(0));
-    for (int i = 0; i < PySequence_Size(items); i++) {
-        Py_DECREF(PySequence_GetItem(items, i));
+    trie_key_t k;
+
+    memset(&k, 0, sizeof(trie_key_t));
+    _Trie_release_values(self, &k, _Trie_height(self));
+    if (_Trie_frozen(self)) {
+        _Trie_drop_frozen(self);
+    } else {
+        trie_destroy(self->ptrie);
     }
-    trie_destroy(self->ptrie);
 }
 
-PyObject *Trie_getstate(PyObject *selfobj)
+// Pickled state is (serialized records, values), see Note 11 in trie.c. 
+// The records are serialized straight into the bytes object, and with 
+// pickle protocol 5 they are handed to pickle as a PickleBuffer, so they can
+// travel out-of-band without another copy.
+static PyObject *_Trie_state(TrieObject *mp, int protocol)
 {
-    trie_t *trie = ((TrieObject *)selfobj)->ptrie;
-    trie_serialized_t *repr = trie_serialize(trie);
+    trie_t *trie = mp->ptrie;
+    PyObject *bytes, *values, *buf, *state;
+    unsigned long size, i;
+
+    if (_Trie_frozen(mp)) {
+        // pickled in the pointer trie format, so it loads unfrozen
+        trie = _Trie_thawed(mp);
+        if (!trie) {
+            return PyErr_Occurred() ? NULL : PyErr_NoMemory();
+        }
+    }
 
-    PyObject *value_tup = PyTuple_New(repr->value_length - 1);
-    for(int i = 1; i < repr->value_length; i++) {
-        Py_INCREF((PyObject *) repr->value_ptrs[i]);
-        PyTuple_SetItem(value_tup, (i - 1), (PyObject *) repr->value_ptrs[i]);
+    state = NULL;
+    size = trie_serialized_size(trie);
+    bytes = size ? PyBytes_FromStringAndSize(NULL, size) : NULL;
+    values = PyTuple_New(trie->item_count);
+    if (!size || !bytes || !values) {
+        if (!PyErr_Occurred()) {
+            PyErr_NoMemory();
+        }
+        goto out;
+    }
+    // the values land in the tuple directly
+    trie_serialize_to(trie, PyBytes_AS_STRING(bytes), 
+        (TRIE_DATA *)&PyTuple_GET_ITEM(values, 0));
+    for (i = 0; i < trie->item_count; i++) {
+        Py_INCREF(PyTuple_GET_ITEM(values, i));
     }
 
-    PyObject *state_tup = PyTuple_New(5);
-    PyTuple_SetItem(state_tup, 0, PyLong_FromUnsignedLong(trie->node_count));
-    PyTuple_SetItem(state_tup, 1, PyLong_FromUnsignedLong(trie->height));
-    PyTuple_SetItem(state_tup, 2, PyLong_FromUnsignedLong(trie->mem_usage));
-    PyTuple_SetItem(state_tup, 3, PyBytes_FromStringAndSize(repr->s, repr->s_length));
-    PyTuple_SetItem(state_tup, 4, value_tup);
-    
-    // TODO: free memory for repr and its items
+    buf = bytes;
+#if PY_VERSION_HEX >= 0x03080000
+    if (protocol >= 5) {
+        buf = PyPickleBuffer_FromObject(bytes);
+        if (!buf) {
+            goto out;
+        }
+        Py_DECREF(bytes);
+        bytes = buf;
+    }
+#endif
+    state = PyTuple_Pack(2, buf, values);
 
-    return state_tup;
+out:
+    Py_XDECREF(bytes);
+    Py_XDECREF(values);
+    if (trie != mp->ptrie) {
+        trie_destroy(trie);
+    }
+    return state;
 }
 
-PyObject *Trie_setstate(PyObject *selfobj, PyObject *args)
+PyObject *Trie_getstate(PyObject *selfobj)
 {
-    PyObject *state;
-    if (!PyArg_ParseTuple(args, "O", &state)) {
-        return -1;
+    return _Trie_state((TrieObject *)selfobj, 0);
+}
+
+// T.__reduce_ex__(protocol) -> (type(T), (), state): what the default 
+// reduce does, but with the records as a PickleBuffer for protocol 5.
+PyObject *Trie_reduce_ex(PyObject *selfobj, PyObject *args)
+{
+    PyObject *state, *r;
+    int protocol = 0;
+
+    if (!PyArg_ParseTuple(args, "|i", &protocol)) {
+        return NULL;
     }
-    unsigned long node_count;
-    unsigned long item_count;
-    unsigned long height;
-    unsigned long mem_usage;
-    PyObject *trie_byte_repr;
-    PyObject *value_list;
-
-    PyArg_ParseTuple(state, "lllOO", &node_count, &height, &mem_usage, 
-        &trie_byte_repr, &value_list);
-
-    trie_t *trie = ((TrieObject *)selfobj)->ptrie;
-    trie_destroy(trie);
-    trie_serialized_t *repr = (trie_serialized_t *)malloc(sizeof(trie_serialized_t));
-    item_count = PySequence_Size(value_list);
-
-    TRIE_DATA *value_ptrs = (TRIE_DATA *)malloc((item_count + 1) * sizeof(TRIE_DATA));
-    value_ptrs[0] = NULL;
-    for(int i = 0; i < item_count; i++) {
-        PyObject *value = (PyObject *)PyTuple_GetItem(value_list, i);
-        Py_INCREF(value);
-        value_ptrs[i+1] = (void *)value;
+    state = _Trie_state((TrieObject *)selfobj, protocol);
+    if (!state) {
+        return NULL;
     }
+    r = Py_BuildValue("(O()N)", (PyObject *)Py_TYPE(selfobj), state);
+    return r;
+}
 
-    repr->s = PyBytes_AsString(trie_byte_repr);
-    repr->s_length = PyBytes_Size(trie_byte_repr);
-    repr->value_ptrs = value_ptrs;
-    repr->value_length = item_count + 1;
+// The records may come in any object with the buffer protocol, like the 
+// out-of-band buffers of pickle protocol 5, and are read in place.
+PyObject *Trie_setstate(PyObject *selfobj, PyObject *args)
+{
+    TrieObject *mp = (TrieObject *)selfobj;
+    PyObject *state, *values;
+    trie_serialized_t repr;
+    trie_key_t k;
+    trie_t *trie;
+    Py_buffer view;
+    Py_ssize_t i;
 
-    trie = trie_deserialize(repr);
+    if (!PyArg_ParseTuple(args, "O", &state)) {
+        return NULL;
+    }
+    if (!PyTuple_Check(state) || PyTuple_GET_SIZE(state) != 2 || 
+        !PyTuple_Check(PyTuple_GET_ITEM(state, 1)) || 
+        PyObject_GetBuffer(PyTuple_GET_ITEM(state, 0), &view, PyBUF_SIMPLE) < 0) {
+        PyErr_Clear();
+        PyErr_SetString(FasttrieError, "unsupported trie pickle format.");
+        return NULL;
+    }
+    if (mp->iter_count) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_RuntimeError, "trie cannot be loaded during iteration.");
+        return NULL;
+    }
+    values = PyTuple_GET_ITEM(state, 1);
+
+    // the values are borrowed from the tuple until the trie is complete
+    repr.s = (char *)view.buf;
+    repr.s_length = view.len;
+    repr.value_ptrs = (TRIE_DATA *)&PyTuple_GET_ITEM(values, 0);
+    repr.value_length = PyTuple_GET_SIZE(values);
+    trie = trie_deserialize(&repr);
+    PyBuffer_Release(&view);
+    if (!trie) {
+        PyErr_SetString(FasttrieError, "corrupt or unsupported trie pickle.");
+        return NULL;
+    }
+    for (i = 0; i < PyTuple_GET_SIZE(values); i++) {
+        Py_INCREF(PyTuple_GET_ITEM(values, i));
+    }
 
-    ((TrieObject *)selfobj)->ptrie = trie;
-    
-    trie->node_count = node_count;
-    trie->item_count = item_count;
-    trie->height = height;
-    trie->mem_usage = mem_usage;
+    // the values of the keys replaced, in whichever form they are
+    memset(&k, 0, sizeof(trie_key_t));
+    _Trie_release_values(mp, &k, _Trie_height(mp));
+    if (_Trie_frozen(mp)) {
+        _Trie_drop_frozen(mp);
+    } else {
+        trie_destroy(mp->ptrie);
+    }
+    mp->ptrie = trie;
 
     Py_RETURN_NONE;
 }
@@ -793,21 +3199,86 @@ static PyMethodDef Trie_methods[] = {
     {"node_count", (PyCFunction)Trie_node_count, METH_NOARGS, 
         "Node count of the trie. Used for debugging purposes."},
 
-    {"keys", Trie_keys, METH_VARARGS, "List of keys"},
-    {"values", Trie_values, METH_VARARGS, "List of values"},
-    {"items", Trie_items, METH_VARARGS, "List of items (key, value)"},
+    {"keys", Trie_keys, METH_VARARGS, 
+        "T.keys([prefix[, max_depth]]) -> a live view on the keys of T starting "
+        "with prefix and at most max_depth chars longer, in key order. "
+        "len() and 'in' do not enumerate the keys."},
+    {"values", Trie_values, METH_VARARGS, 
+        "T.values([prefix[, max_depth]]) -> a live view on the values of the "
+        "keys() view"},
+    {"items", Trie_items, METH_VARARGS, 
+        "T.items([prefix[, max_depth]]) -> a live view on the (key, value) "
+        "pairs of the keys() view"},
+    {"cursor", (PyCFunction)Trie_cursor, METH_NOARGS, 
+        "T.cursor() -> a cursor before the first key of T, that seek(), next() "
+        "and prev() move over the keys in code point order"},
+    {"range", (PyCFunction)Trie_range, METH_VARARGS | METH_KEYWORDS, 
+        "T.range([lo[, hi[, limit]]]) -> list of up to limit (key, value) "
+        "pairs with lo <= key < hi, in key order. lo or hi None leaves that "
+        "side open, limit 0 takes all. The page after the last key k starts "
+        "at lo=k + '\\0'."},
+    {"iter_chunks", (PyCFunction)Trie_iter_chunks, METH_VARARGS | METH_KEYWORDS, 
+        "T.iter_chunks([prefix[, n[, max_depth]]]) -> an iterator over the "
+        "keys of T.keys(prefix, max_depth) in lists of up to n (1024) keys"},
+    {"items_chunks", (PyCFunction)Trie_items_chunks, METH_VARARGS | METH_KEYWORDS, 
+        "T.items_chunks([prefix[, n[, max_depth]]]) -> same as iter_chunks(), "
+        "over (key, value) pairs"},
     {"get", Trie_get, METH_VARARGS | METH_KEYWORDS, "Get an item from the trie"},
+    {"get_many", (PyCFunction)Trie_get_many, METH_VARARGS | METH_KEYWORDS, 
+        "T.get_many(keys[, default[, sort]]) -> list of the values of keys, "
+        "default (None) for the missing ones. sort=True walks the keys in "
+        "sorted order sharing common prefixes, for batches that come sorted "
+        "or nearly so and where many keys share prefixes."},
+    {"contains_many", (PyCFunction)Trie_contains_many, METH_VARARGS | METH_KEYWORDS, 
+        "T.contains_many(keys[, sort]) -> bytes with a 1 for each key in T, "
+        "0 otherwise"},
     {"clear", Trie_clear, METH_VARARGS , "Clear all items from trie"},
     {"update", Trie_update, METH_VARARGS | METH_KEYWORDS, "Update a trie"},
     {"copy", Trie_copy, METH_NOARGS , "Return a shallow copy of trie with all keys/values."},
+    {"freeze", (PyCFunction)Trie_freeze, METH_VARARGS, 
+        "T.freeze([form]) -> compile the trie into a compact read-only form, "
+        "'da' (double array, default), 'louds' (succinct, smaller and slower) "
+        "or 'dawg' (shares equal suffixes). "
+        "Writes raise until thaw()."},
+    {"thaw", (PyCFunction)Trie_thaw, METH_NOARGS, 
+        "Turn a frozen trie back into a writable one."},
+    {"save", (PyCFunction)Trie_save, METH_VARARGS, 
+        "T.save(path) -> write T to path as a double array that Trie.mmap() "
+        "opens without rebuilding it."},
+    {"from_sorted", (PyCFunction)Trie_from_sorted, 
+        METH_VARARGS | METH_KEYWORDS | METH_CLASS, 
+        "Trie.from_sorted(pairs[, threads]) -> a trie of the (key, value) pairs, "
+        "built in one linear pass. Keys shall be in strictly increasing order, "
+        "as sorted() orders str. With threads > 1, keys of different leading "
+        "chars are built in parallel without the GIL."},
+    {"build_external", (PyCFunction)Trie_build_external, 
+        METH_VARARGS | METH_KEYWORDS | METH_CLASS, 
+        "Trie.build_external(pairs, path[, memory, tmpdir]) -> write the file "
+        "save() would for (key, value) pairs in any order, within about memory "
+        "bytes (64 MB, 1 MB at least), with temporary files in tmpdir, and "
+        "mmap() it. A key "
+        "given twice keeps its last value."},
+    {"load_lines", (PyCFunction)Trie_load_lines, METH_VARARGS, 
+        "T.load_lines(path[, value]) -> add each line of a UTF-8 file as a key "
+        "with value (None). Empty lines are skipped."},
+    {"load_tsv", (PyCFunction)Trie_load_tsv, METH_VARARGS, 
+        "T.load_tsv(path[, values]) -> add the key<TAB>value lines of a UTF-8 "
+        "file, values parsed as 'int' (default) or kept as 'bytes'."},
+    {"dump", (PyCFunction)Trie_dump, METH_VARARGS, 
+        "T.dump(path[, values]) -> write the keys of T to path in sorted order, "
+        "one UTF-8 line each as load_lines() reads them. With values 'int' "
+        "or 'bytes' the lines are key<TAB>value, as load_tsv() reads them."},
+    {"dump_to", (PyCFunction)Trie_dump_to, METH_VARARGS, 
+        "T.dump_to(file[, values]) -> same as dump(), written with "
+        "file.write() in chunks of bytes."},
+    {"mmap", (PyCFunction)Trie_mmap, METH_VARARGS | METH_CLASS, 
+        "Trie.mmap(path) -> a frozen trie over a read-only mapping of a file "
+        "written by save(). Values are decoded on first access. Only the "
+        "header is checked, a file damaged past it is not supported."},
     // {"iter_suffixes", Trie_itersuffixes, METH_VARARGS, 
         // "T.iter_suffixes() -> a set-like object providing a view on T's suffixes"},
     // {"suffixes", Trie_keys, METH_VARARGS, 
         // "T.suffixes() -> a list containing T's suffixes"},
-    // {"iter_prefixes", Trie_iterprefixes, METH_VARARGS, 
-        // "T.iter_prefixes() -> a set-like object providing a view on T's prefixes"},
-    // {"prefixes", Trie_prefixes, METH_VARARGS, 
-        // "T.prefixes() -> a list containing T's prefixes"},
     {"iter_corrections", Trie_itercorrections, METH_VARARGS, 
         "T.iter_corrections() -> a set-like object providing a view on T's corrections"},
     {"corrections", Trie_corrections, METH_VARARGS, 
@@ -816,6 +3287,8 @@ static PyMethodDef Trie_methods[] = {
     // Methods for pickling/unpickling
     {"__getstate__", (PyCFunction)Trie_getstate, METH_NOARGS, "Internal state for pickling"},
     {"__setstate__", Trie_setstate, METH_VARARGS, "Return trie from pickled state"},
+    {"__reduce_ex__", Trie_reduce_ex, METH_VARARGS, 
+        "Pickle support, the structure goes out-of-band with protocol 5"},
     {NULL}  /* Sentinel */
 };
 
@@ -866,6 +3339,13 @@ static PyTypeObject TrieType = {
 };
 
 static PyMethodDef Fasttrie_methods[] = {
+    {"simd_level", Fasttrie_simd_level, METH_VARARGS, 
+        "simd_level([level]) -> SIMD level used for child lookup (0: none, "
+        "1: SSE2, 2: AVX2), optionally lowering it. Used for debugging purposes."},
+    {"batch_lanes", Fasttrie_batch_lanes, METH_VARARGS, 
+        "batch_lanes([lanes]) -> lookups get_many() and contains_many() "
+        "interleave, optionally setting it (0: one after the other). Used for "
+        "debugging purposes."},
     {NULL, NULL}      /* sentinel */
 };
 
@@ -893,7 +3373,8 @@ init_fasttrie(void)
 {
     PyObject *m;
     
-    if (PyType_Ready(&TrieType) < 0) {
+    if (PyType_Ready(&TrieType) < 0 || PyType_Ready(&TrieIteratorType) < 0 ||
+        PyType_Ready(&TrieViewType) < 0 || PyType_Ready(&TrieCursorType) < 0) {
 #ifdef IS_PY3K
         return NULL;
 #else
@@ -0,0 +1,71 @@
+#!/usr/bin/env python
+# Per-key cost of contains_many() with the interleaved lookups against the
+# sorted merge walk of sort=True, on batches that arrive sorted, nearly
+# sorted and shuffled.
+#
+# The keys share dense prefixes, like paths or URLs of a few sites, which
+# is what the merge walk reuses. Half of each batch is missing.
+#
+#   python benchmarks/bench_batch.py [keys]
+
+import random
+import sys
+import time
+
+sys.path.insert(0, '.')
+
+import _fasttrie
+
+KEYS = 200000
+REPEAT = 7
+
+
+def make_keys(n, rnd):
+    hosts = ['www.site%d.example' % i for i in range(20)]
+    dirs = ['products', 'users', 'static/img', 'api/v1', 'api/v2', 'blog']
+    keys = set()
+    while len(keys) < n:
+        keys.add('https://%s/%s/%d/%s' % (rnd.choice(hosts),
+            rnd.choice(dirs), rnd.randint(0, 10 ** 5),
+            rnd.choice(['view', 'edit', 'list', ''])))
+    return sorted(keys)
+
+
+def best(f):
+    times = []
+    for _ in range(REPEAT):
+        start = time.perf_counter()
+        f()
+        times.append(time.perf_counter() - start)
+    return min(times)
+
+
+def main():
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else KEYS
+    rnd = random.Random(n)
+    keys = make_keys(2 * n, rnd)
+    t = _fasttrie.Trie()
+    for i, key in enumerate(keys[::2]):
+        t[key] = i
+
+    batch = sorted(keys[:n // 2] + keys[n:n + n // 2])
+    nearly = list(batch)
+    for _ in range(len(nearly) // 100):
+        i = rnd.randrange(len(nearly) - 1)
+        nearly[i], nearly[i + 1] = nearly[i + 1], nearly[i]
+    shuffled = list(batch)
+    rnd.shuffle(shuffled)
+
+    print("%d keys, ns/key" % len(batch))
+    print("%-10s %12s %12s" % ("input", "interleaved", "sort=True"))
+    for name, b in (('sorted', batch), ('nearly', nearly),
+        ('shuffled', shuffled)):
+        assert t.contains_many(b) == t.contains_many(b, sort=True)
+        many = best(lambda: t.contains_many(b))
+        merged = best(lambda: t.contains_many(b, sort=True))
+        print("%-10s %12.0f %12.0f" % (name, many * 1e9 / len(b),
+            merged * 1e9 / len(b)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,66 @@
+#!/usr/bin/env python
+# Per-character child lookup cost for each SIMD level.
+#
+# Builds full `fanout`-ary tries, so every inner node holds a NODE4/NODE16
+# container of `fanout` children, and looks up random keys in them. Random
+# keys keep the branch predictor from learning the path, as a real workload
+# would. Timing the same number of lookups at two depths and taking the slope
+# cancels the per-call interpreter overhead and leaves the cost of one child
+# lookup.
+#
+#   python benchmarks/bench_child_lookup.py
+
+import itertools
+import random
+import sys
+import timeit
+
+sys.path.insert(0, '.')
+
+import _fasttrie
+
+LOOKUPS = 1 << 16
+REPEAT = 5
+LEVELS = {0: 'scalar', 1: 'sse2', 2: 'avx2'}
+# fanout: (short depth, long depth)
+SHAPES = {4: (2, 8), 8: (2, 5), 16: (1, 4)}
+
+
+def full_trie(fanout, depth):
+    alphabet = [chr(0x61 + i) for i in range(fanout)]
+    t = _fasttrie.Trie()
+    for chars in itertools.product(alphabet, repeat=depth):
+        t[u''.join(chars)] = 1
+    rnd = random.Random(fanout * depth)
+    queries = [u''.join(rnd.choice(alphabet) for i in range(depth))
+        for j in range(LOOKUPS)]
+    return t, queries
+
+
+def run(t, queries):
+    get = t.__getitem__
+    for k in queries:
+        get(k)
+
+
+def per_lookup(t, queries):
+    return min(timeit.repeat(lambda: run(t, queries), number=1,
+        repeat=REPEAT)) / len(queries)
+
+
+def main():
+    best = _fasttrie.simd_level()
+    print("%-8s %8s %10s" % ("fanout", "level", "ns/char"))
+    for fanout in sorted(SHAPES):
+        lo, hi = SHAPES[fanout]
+        short = full_trie(fanout, lo)
+        long_ = full_trie(fanout, hi)
+        for level in range(best + 1):
+            _fasttrie.simd_level(level)
+            slope = (per_lookup(*long_) - per_lookup(*short)) / (hi - lo)
+            print("%-8d %8s %10.2f" % (fanout, LEVELS[level], slope * 1e9))
+    _fasttrie.simd_level(best)
+
+
+if __name__ == '__main__':
+    main()
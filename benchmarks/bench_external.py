@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+# Time and peak memory of writing a trie file with Trie.build_external()
+# against building a Trie in memory and save()ing it.
+#
+# The pairs come from a generator, in random order, and take several times
+# the memory budget of the external build as a trie. Each way runs in a
+# process of its own and reports its own ru_maxrss.
+#
+#   python benchmarks/bench_external.py [keys] [memory MB]
+
+import os
+import random
+import resource
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, '.')
+
+import _fasttrie
+
+KEYS = 2000000
+MEMORY = 16
+
+
+def pairs(n):
+    rnd = random.Random(n)
+    letters = 'abcdefghijklmnopqrstuvwxyz'
+    for i in range(n):
+        key = ''.join(rnd.choice(letters) for _ in range(rnd.randint(4, 16)))
+        yield key, i
+
+
+def run(way, n, memory, path):
+    start = time.time()
+    if way == 'external':
+        _fasttrie.Trie.build_external(pairs(n), path, memory=memory << 20)
+    else:
+        t = _fasttrie.Trie()
+        for key, value in pairs(n):
+            t[key] = value
+        t.save(path)
+    print("%f %d" % (time.time() - start,
+        resource.getrusage(resource.RUSAGE_SELF).ru_maxrss))
+
+
+def main():
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else KEYS
+    memory = int(sys.argv[2]) if len(sys.argv) > 2 else MEMORY
+    base = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    print("%d keys, %d MB budget, %d MB to start with" % (n, memory,
+        base // 1024))
+    print("%-10s %10s %10s %10s" % ("way", "seconds", "peak MB", "file MB"))
+    for way in ('external', 'save'):
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        out = subprocess.check_output([sys.executable, __file__, '--run', way,
+            str(n), str(memory), path]).split()
+        print("%-10s %10.2f %10d %10.1f" % (way, float(out[0]),
+            int(out[1]) // 1024,
+            os.path.getsize(path) / 1048576.0))
+        os.remove(path)
+
+
+if __name__ == '__main__':
+    if sys.argv[1:2] == ['--run']:
+        run(sys.argv[2], int(sys.argv[3]), int(sys.argv[4]), sys.argv[5])
+    else:
+        main()
@@ -0,0 +1,48 @@
+#!/usr/bin/env python
+# Per-call cost of search, add and add+del of a single key.
+#
+# These are the loops of the (disabled) test_profile in tests/test_simple.py,
+# run with timeit instead of yappi, once for a key of each string kind so the
+# 1, 2 and 4 byte paths are all covered.
+#
+#   python benchmarks/bench_ops.py
+
+import sys
+import timeit
+
+sys.path.insert(0, '.')
+
+import _fasttrie
+
+NUMBER = 1000000
+REPEAT = 5
+KEYS = [
+    ('ucs1', u'testing'),
+    ('ucs2', u'testing\u0131'),
+    ('ucs4', u'testing\U00010400'),
+]
+
+
+def best(stmt):
+    return min(timeit.repeat(stmt, number=NUMBER, repeat=REPEAT)) / NUMBER
+
+
+def main():
+    print("%-6s %10s %10s %10s" % ("kind", "search", "add", "add+del"))
+    for kind, key in KEYS:
+        t = _fasttrie.Trie()
+        t[key] = 1
+        search = best(lambda: t[key])
+        add = best(lambda: t.__setitem__(key, 1))
+
+        def add_del():
+            t[key] = 1
+            del t[key]
+        add_del_ = best(add_del)
+        print("%-6s %10.1f %10.1f %10.1f" % (kind, search * 1e9, add * 1e9,
+            add_del_ * 1e9))
+    print("(ns per call)")
+
+
+if __name__ == '__main__':
+    main()
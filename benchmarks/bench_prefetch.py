@@ -0,0 +1,80 @@
+#!/usr/bin/env python
+# Per-key cost of contains_many() with the keys looked up one after the other
+# by trie_search() against the interleaved lookups of trie_search_many().
+#
+# Lane counts are switched with _fasttrie.batch_lanes() and alternated in one
+# process, so every count sees the same trie and the same cache state. The 
+# batch is 200k keys drawn at random, all hits or half misses, on the corpus
+# of the tests and on a larger set of URLs that does not fit in cache. Counts
+# above TRIE_BATCH_LANES need a build that raises it, e.g.
+# CFLAGS=-DTRIE_BATCH_LANES=32.
+#
+#   python benchmarks/bench_prefetch.py [urls]
+
+import codecs
+import random
+import sys
+import time
+
+sys.path.insert(0, '.')
+
+import _fasttrie
+
+BATCH = 200000
+URLS = 1000000
+REPEAT = 7
+LANES = (0, 8, 16, 32)
+
+
+def corpus_keys():
+    with codecs.open("tests/out_keys_8859_9", encoding="iso-8859-9") as f:
+        return list(set(f.read().splitlines()))
+
+
+def url_keys(n, rnd):
+    hosts = ['www.site%d.example' % i for i in range(1000)]
+    keys = set()
+    while len(keys) < n:
+        keys.add('https://%s/%s/%d' % (rnd.choice(hosts),
+            rnd.choice(['products', 'users', 'static/img', 'api/v1', 'blog']),
+            rnd.randint(0, 10 ** 9)))
+    return list(keys)
+
+
+def batches(keys, rnd):
+    hits = [rnd.choice(keys) for _ in range(BATCH)]
+    # a miss leaves the trie at its last char, as most real misses do
+    half = hits[:BATCH // 2] + [k + u'\x01' for k in hits[BATCH // 2:]]
+    rnd.shuffle(half)
+    return (('hits', hits), ('50% miss', half))
+
+
+def main():
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else URLS
+    rnd = random.Random(n)
+    default = _fasttrie.batch_lanes()
+    lanes = [l for l in LANES if _fasttrie.batch_lanes(l) == l]
+
+    print("contains_many(), %d keys, best of %d, ns/key" % (BATCH, REPEAT))
+    print("%-26s" % "lanes" + "".join("%8s" % (l or 'seq') for l in lanes))
+    for name, keys in (('out_keys_8859_9', corpus_keys()),
+        ('%d URLs' % n, url_keys(n, rnd))):
+        t = _fasttrie.Trie()
+        for i, key in enumerate(keys):
+            t[key] = i
+        for kind, batch in batches(keys, rnd):
+            best = dict((l, float('inf')) for l in lanes)
+            for _ in range(REPEAT):
+                for l in lanes:
+                    _fasttrie.batch_lanes(l)
+                    start = time.perf_counter()
+                    t.contains_many(batch)
+                    best[l] = min(best[l], time.perf_counter() - start)
+            print("%-26s" % ("%s, %s" % (name, kind)) +
+                "".join("%8.0f" % (best[l] * 1e9 / BATCH) for l in lanes))
+        del t
+    _fasttrie.batch_lanes(default)
+
+
+if __name__ == '__main__':
+    main()
@@ -23,9 +23,58 @@
 #define TRIE_CHAR Py_UNICODE
 #endif
 #define TRIE_DATA uintptr_t
-#define TRIE_NODE_SIZE (sizeof(char) + sizeof(unsigned long) + sizeof(char))  // key + value + children_count
-#define TRIE_MIN_HASH_SIZE 1
-#define TRIE_MAX_HASH_SIZE 32
+
+// Child container limits, see trie_node_kind_t in trie.h.
+#define TRIE_NODE4_MAX 4
+#define TRIE_NODE16_MAX 16
+#define TRIE_NODE48_MAX 48
+#define TRIE_NODE48_MIN 12 // shrink to TRIE_NODE16 at this many children
+#define TRIE_NODE256_MIN 36 // shrink to TRIE_NODE48 at this many children
+#define TRIE_NODE_PAGE_SIZE 256
+
+// Trie memory comes from the raw allocator, which does not need the GIL, so
+// that tries can be built and walked in native threads.
+#if PY_VERSION_HEX >= 0x03040000
+#define TRIE_RAW_MALLOC PyMem_RawMalloc
+#define TRIE_RAW_FREE PyMem_RawFree
+#else
+#define TRIE_RAW_MALLOC malloc
+#define TRIE_RAW_FREE free
+#endif
+
+// Parallel bulk builds, see trie_build_parallel(). At most this many threads
+// build subtries of disjoint leading chars.
+#define TRIE_BUILD_MAX_THREADS 64
+
+// Node arena. Blocks up to TRIE_ARENA_MAX_BLOCK bytes are carved out of slabs
+// and recycled through per-size-class free lists. Slabs start small so empty
+// tries stay cheap and double up to TRIE_ARENA_MAX_SLAB.
+#define TRIE_ARENA_ALIGN 8
+#define TRIE_ARENA_SMALL_BLOCK 256
+#define TRIE_ARENA_MEDIUM_STEP 64
+#define TRIE_ARENA_MAX_BLOCK 1024
+#define TRIE_ARENA_CLASS_COUNT ((TRIE_ARENA_SMALL_BLOCK / TRIE_ARENA_ALIGN) + \
+    ((TRIE_ARENA_MAX_BLOCK - TRIE_ARENA_SMALL_BLOCK) / TRIE_ARENA_MEDIUM_STEP))
+#define TRIE_ARENA_MIN_SLAB (4 * 1024)
+#define TRIE_ARENA_MAX_SLAB (256 * 1024)
+
+// Text files are read this many bytes at a time, see trie_load(). Longer 
+// lines grow the buffer.
+#define TRIE_LOAD_BUFFER (1024 * 1024)
+
+// Lines of a dump are buffered in this many bytes and written out once half
+// of it is used, see Note 14 in trie.h.
+#define TRIE_DUMP_BUFFER (1024 * 1024)
+
+// External builds, see trie_sorter_t in trie.h. Runs are read through 
+// buffers of TRIE_SORTER_READ_BUFFER bytes and merged into one as soon as
+// there are TRIE_SORTER_MAX_RUNS of them, so the merge takes bounded memory
+// and file handles whatever the size of the input. Smaller budgets than
+// TRIE_EXTERNAL_MIN_MEMORY would only make more runs.
+#define TRIE_EXTERNAL_MEMORY (64 * 1024 * 1024)
+#define TRIE_EXTERNAL_MIN_MEMORY (1024 * 1024)
+#define TRIE_SORTER_READ_BUFFER (64 * 1024)
+#define TRIE_SORTER_MAX_RUNS 64
 
 #if defined(MS_WINDOWS)
 #define __WINDOWS
@@ -35,6 +84,31 @@
 #define __UNIX
 #endif
 
+// SIMD child lookup. SSE2 is part of every x86-64 target; AVX2 code is 
+// compiled with a target attribute and only used if the CPU reports it at
+// runtime, see trie_simd_init().
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRIE_HAVE_SSE2
+#endif
+#if defined(TRIE_HAVE_SSE2) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define TRIE_HAVE_AVX2
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TRIE_CTZ64(x) __builtin_ctzll(x)
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+static __inline unsigned int TRIE_CTZ64(unsigned __int64 x)
+{
+    unsigned long r;
+    _BitScanForward64(&r, x);
+    return (unsigned int)r;
+}
+#elif defined(TRIE_HAVE_SSE2)
+#undef TRIE_HAVE_SSE2
+#endif
+
 #ifdef _MSC_VER 
 typedef __int8 int8_t;
 typedef __int16 int16_t;
@@ -48,4 +122,30 @@ typedef unsigned __int64 uint64_t;
 #include "stdint.h"
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+#define TRIE_POPCOUNT64(x) __builtin_popcountll(x)
+#else
+static __inline unsigned int TRIE_POPCOUNT64(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (unsigned int)((x * 0x0101010101010101ULL) >> 56);
+}
+#endif
+
+// Batched lookups, see trie_search_many(). Prefetches are hints only, so 
+// compilers without one get a no-op.
+#ifndef TRIE_BATCH_LANES
+#define TRIE_BATCH_LANES 16
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define TRIE_PREFETCH(p) __builtin_prefetch((const void *)(p))
+#elif defined(_MSC_VER) && defined(TRIE_HAVE_SSE2)
+#include <xmmintrin.h>
+#define TRIE_PREFETCH(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#define TRIE_PREFETCH(p) ((void)(p))
+#endif
+
 #endif
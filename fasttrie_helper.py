@@ -4,6 +4,7 @@ _is_py3k = (sys.version_info >= (3, 0))
 
 if _is_py3k:
     xrange = range
+    unichr = chr
 
 def is_str(s):
     if _is_py3k:
@@ -51,7 +51,8 @@ setup(name=NAME,
     author_email="sumerc@gmail.com",
     ext_modules = [Extension(
         "_fasttrie",
-        sources = ["_fasttrie.c", "trie.c"],
+        sources = ["_fasttrie.c", "trie.c", "trie_da.c", "trie_louds.c", "trie_dawg.c", 
+            "trie_io.c"],
         define_macros = user_macros,
         libraries = user_libraries,
         extra_compile_args = compile_args,
@@ -1,10 +1,16 @@
 import string
 import itertools
+import random
 import sys
 import fasttrie
 import _fasttrie
 import unittest
 import codecs
+import os
+import pickle
+import struct
+import tempfile
+import io
 import multiprocessing # added to fix http://bugs.python.org/issue15881 for Py2.6
 from fasttrie_helper import *
 
@@ -84,6 +90,53 @@ def _print_keys_as_hex(keys):
 def _read_lines(path, encoding):
     with codecs.open(path, encoding=encoding) as f:
         return f.read().splitlines()
+
+# The word corpus plus keys with chars of every width and, unless empty is 
+# False, the empty key.
+def _corpus_keys(empty=True):
+    keys = _read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9")
+    keys += [uni_escape("testing\u0131"), uni_escape("testing\U00010400")]
+    if empty:
+        keys.append(uni_escape(""))
+    return keys
+
+# A trie of keys, each to value(index) of it.
+def _corpus_trie(keys, value=lambda i: i):
+    tr = fasttrie.Trie()
+    for i, key in enumerate(keys):
+        tr[key] = value(i)
+    return tr
+
+# Unpickles a value of a mapped trie while trying to free its double array.
+_mapped = []
+def _load_thawing():
+    assert _mapped[0][uni_escape("mixed-reduce")] == 7
+    for f in (_mapped[0].thaw, _mapped[0].clear):
+        try:
+            f()
+        except RuntimeError:
+            pass
+        else:
+            raise AssertionError("mapped trie freed while loading")
+    return 7
+
+class _Thawing(object):
+    def __reduce__(self):
+        return (_load_thawing, ())
+
+# Counts the values of a mapped trie that are unpickled, None fails to load.
+_loads = [0]
+def _load_counted(value):
+    _loads[0] += 1
+    if value is None:
+        raise ValueError("cannot load")
+    return value
+
+class _Counted(object):
+    def __init__(self, value):
+        self.value = value
+    def __reduce__(self):
+        return (_load_counted, (self.value,))
         
 class TestBasic(unittest.TestCase):
 
@@ -158,7 +211,7 @@ class TestBasic(unittest.TestCase):
             tr[line] = 2
 
         self.assertEqual(len(tr), 82489)
-        self.assertEqual(tr.node_count(), 310764)
+        self.assertEqual(tr.node_count(), 102610)
         self.assertEqual(tr[uni_escape("ramazan")], 2)
         self.assertEqual(len(tr.corrections(uni_escape("ra"), 3)), 5639)
         self.assertEqual(len(set(list(tr.iter_corrections(uni_escape("ra"), 3)))), 5639)
@@ -494,6 +547,59 @@ class TestBasic(unittest.TestCase):
         self.assertEqual(tr.get('d', 'foo'), 'foo')
         self.assertEqual(tr.get('a', 'foo'), 1)
 
+    def test_get_many(self):
+        tr = fasttrie.Trie(a=1, b=None, abc=3)
+        keys = ["a", "ab", "abc", "b", uni_escape("\u0131"), ""]
+        self.assertEqual(tr.get_many(keys), [1, None, 3, None, None, None])
+        self.assertEqual(tr.get_many(tuple(keys), "foo"), 
+            [1, "foo", 3, None, "foo", "foo"])
+        self.assertEqual(tr.get_many([]), [])
+        self.assertRaises(_fasttrie.Error, tr.get_many, ["a", 5])
+        self.assertEqual(tr.contains_many(keys), b"\x01\x00\x01\x01\x00\x00")
+        self.assertEqual(tr.contains_many(["a", 5]), b"\x01\x00")
+
+        # batches are looked up interleaved, keys of any width mixed
+        corpus = _read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9")
+        tr2 = fasttrie.Trie()
+        for i, key in enumerate(corpus[::2]):
+            tr2[key] = i
+        tr2[uni_escape("testing\U00010400")] = -1
+        corpus += [uni_escape("testing\U00010400"), uni_escape("testing\u0131"), 
+            uni_escape("testing"), uni_escape("")]
+        expected = [tr2.get(k) for k in corpus]
+        self.assertEqual(tr2.get_many(corpus), expected)
+        self.assertEqual(list(tr2.contains_many(corpus)), [int(k in tr2) for k in corpus])
+        lanes = _fasttrie.batch_lanes()
+        try:
+            for n in (0, 1, 3):
+                self.assertEqual(_fasttrie.batch_lanes(n), n)
+                self.assertEqual(tr2.get_many(corpus), expected)
+        finally:
+            _fasttrie.batch_lanes(lanes)
+        self.assertEqual(_fasttrie.batch_lanes(lanes + 1), lanes)
+
+        # sorted merge walk, results in the order of the keys
+        self.assertEqual(tr2.get_many(corpus, sort=True), expected)
+        self.assertEqual(tr2.contains_many(corpus, sort=True), 
+            tr2.contains_many(corpus))
+        nearly = sorted(corpus)
+        for i in range(0, len(nearly) - 1, 50):
+            nearly[i], nearly[i + 1] = nearly[i + 1], nearly[i]
+        self.assertEqual(tr2.get_many(nearly, sort=True),
+            [tr2.get(k) for k in nearly])
+        shuffled = corpus[::-1] + ["te", "tes", "testin", "testingg", "a"] * 3
+        self.assertEqual(tr2.get_many(shuffled, sort=True), 
+            [tr2.get(k) for k in shuffled])
+        self.assertEqual(tr.get_many(keys, sort=True), [1, None, 3, None, None, None])
+        self.assertEqual(tr.get_many([], sort=True), [])
+        self.assertRaises(_fasttrie.Error, tr.get_many, ["a", 5], sort=True)
+
+        tr.freeze()
+        self.assertEqual(tr.get_many(keys, default=0), [1, 0, 3, None, 0, 0])
+        self.assertEqual(tr.contains_many(keys), b"\x01\x00\x01\x01\x00\x00")
+        self.assertEqual(tr.contains_many(keys, sort=True), 
+            b"\x01\x00\x01\x01\x00\x00")
+
     def test_copy(self):
         key = "aqswdefr"  # String unlikely to be used elsewhere, for accurate refcount tracking
         tr = fasttrie.Trie(a=1, b=None)
@@ -506,6 +612,51 @@ class TestBasic(unittest.TestCase):
         # Keys do not get stored as Python objects, and therefore shouldn't increase refcounts
         self.assertEqual(key_refcount, sys.getrefcount(key))
 
+    def test_pickle(self):
+        keys = _corpus_keys() + [uni_escape("\U00010400")]
+        tr = _corpus_trie(keys, lambda i: (i, ))
+        ptr = pickle.loads(pickle.dumps(tr, 2))
+        self.assertEqual(ptr.items(), tr.items())
+        self.assertEqual(ptr.node_count(), tr.node_count())
+        self.assertEqual(ptr[uni_escape("testing\U00010400")], (len(keys) - 3, ))
+
+        # loaded tries stay writable
+        ptr[uni_escape("testing")] = 1
+        del ptr[uni_escape("testing\u0131")]
+        self.assertEqual(len(ptr), len(tr))
+
+        # protocol 5 moves the structure out-of-band
+        if pickle.HIGHEST_PROTOCOL >= 5:
+            buffers = []
+            data = pickle.dumps(tr, 5, buffer_callback=buffers.append)
+            self.assertEqual(len(buffers), 1)
+            ptr = pickle.loads(data, buffers=[memoryview(b.raw()) for b in buffers])
+            self.assertEqual(ptr.items(), tr.items())
+
+        # deep keys do not recurse
+        tr = fasttrie.Trie()
+        tr[uni_escape("a" * 100000)] = 1
+        tr[uni_escape("a" * 50000)] = 2
+        ptr = pickle.loads(pickle.dumps(tr))
+        self.assertEqual(sorted(ptr.values()), [1, 2])
+
+        state = tr.__getstate__()
+        self.assertRaises(_fasttrie.Error, ptr.__setstate__, 
+            (state[0][:-1], state[1]))
+        self.assertRaises(_fasttrie.Error, ptr.__setstate__, 
+            (state[0], state[1][:1]))
+
+        # loading over a trie releases its values, in every form
+        value = object()
+        for kind in (None, "da", "louds", "dawg"):
+            ptr = fasttrie.Trie(a=value)
+            if kind:
+                ptr.freeze(kind)
+            refs = sys.getrefcount(value)
+            ptr.__setstate__(state)
+            self.assertEqual(sys.getrefcount(value), refs - 1)
+            self.assertEqual(sorted(ptr.values()), [1, 2])
+
     def test_update(self):
         tr = fasttrie.Trie()
         tr.update([('a', 1), ('b', 2)])
@@ -518,6 +669,742 @@ class TestBasic(unittest.TestCase):
         tr.update(tr2)
         self.assertEqual(sorted(tr.items()), [('a', 0), ('b', 3), ('c', 5), ('d', 6), ('e', 7)])
 
+    def test_from_sorted(self):
+        keys = _corpus_keys() + [uni_escape("\U00010400")]
+        pairs = sorted((key, i) for i, key in enumerate(set(keys)))
+        tr = fasttrie.Trie.from_sorted(iter(pairs))
+        tr2 = fasttrie.Trie()
+        for key, i in pairs:
+            tr2[key] = i
+        self.assertEqual(tr.items(), tr2.items())
+        self.assertEqual(tr.node_count(), tr2.node_count())
+        # the same shape, down to the serialized records
+        self.assertEqual(tr.__getstate__(), tr2.__getstate__())
+
+        # built tries stay writable
+        tr[uni_escape("testing")] = -1
+        del tr[uni_escape("testing\u0131")]
+        self.assertEqual(tr[uni_escape("testing")], -1)
+        self.assertEqual(len(fasttrie.Trie.from_sorted([])), 0)
+
+        self.assertRaises(_fasttrie.Error, fasttrie.Trie.from_sorted, 
+            [("b", 1), ("a", 2)])
+        self.assertRaises(_fasttrie.Error, fasttrie.Trie.from_sorted, 
+            [("a", 1), ("a", 2)])
+        for pairs_ in ([("", 1), ("", 2)], [("", 1), ("", 2), ("a", 3)]):
+            self.assertRaises(_fasttrie.Error, fasttrie.Trie.from_sorted, pairs_)
+            self.assertRaises(_fasttrie.Error, fasttrie.Trie.from_sorted, 
+                pairs_, threads=2)
+        self.assertRaises(_fasttrie.Error, fasttrie.Trie.from_sorted, 
+            [("ab", 1), ("a", 2)])
+        self.assertRaises(ValueError, fasttrie.Trie.from_sorted, [("a", )])
+
+        # parallel builds stitch the same trie out of per-thread subtries
+        for threads in (2, 3, 8):
+            ptr = fasttrie.Trie.from_sorted(pairs, threads=threads)
+            self.assertEqual(ptr.__getstate__(), tr2.__getstate__())
+            ptr[uni_escape("testing")] = -1
+            del ptr[uni_escape("testing\u0131")]
+            self.assertEqual(len(ptr), len(tr))
+        self.assertRaises(_fasttrie.Error, fasttrie.Trie.from_sorted, 
+            [("a", 1), ("b", 2), ("a", 3), ("c", 4)], threads=2)
+        self.assertRaises(_fasttrie.Error, fasttrie.Trie.from_sorted, 
+            [("a", 1), ("", 2)], threads=2)
+
+    def test_mem_usage(self):
+        tr = fasttrie.Trie()
+        for i in range(1000):
+            tr[str(i)] = i
+        mem_usage = tr.mem_usage()
+        self.assertTrue(mem_usage > 0)
+
+        # deleted nodes are recycled, so add/del churn should not grow the trie
+        for j in range(10):
+            for i in range(1000):
+                del tr[str(i)]
+            for i in range(1000):
+                tr[str(i)] = i
+        self.assertEqual(tr.mem_usage(), mem_usage)
+        self.assertEqual(len(tr), 1000)
+
+    def test_fanout(self):
+        # grow and shrink child containers of the root through every kind:
+        # a single page (0x00-0xff) first, then chars from many pages.
+        tr = fasttrie.Trie()
+        keys = [unichr(c) for c in range(0x20, 0x100)]
+        keys += [unichr(c) for c in range(0x4e00, 0x5000, 7)]
+        for i, key in enumerate(keys):
+            tr[key] = i
+            tr[key + uni_escape("x")] = i
+        self.assertEqual(len(tr), 2 * len(keys))
+        for i, key in enumerate(keys):
+            self.assertEqual(tr[key], i)
+            self.assertEqual(tr[key + uni_escape("x")], i)
+        self.assertEqual(tr.keys(), sorted(tr.keys()))
+        for key in keys[::-1]:
+            del tr[key + uni_escape("x")]
+            del tr[key]
+            self.assertFalse(key in tr)
+        self.assertEqual(len(tr), 0)
+        self.assertEqual(tr.node_count(), 1)
+
+    def test_char_width(self):
+        # Latin-1 keys are stored a byte per char; a wider key widens every
+        # node in place and all keys stay reachable.
+        keys = [uni_escape("http://example.com/%d/caf\u00e9" % i) 
+            for i in range(500)]
+        narrow = fasttrie.Trie()
+        for i, key in enumerate(keys):
+            narrow[key] = i
+        node_count = narrow.node_count()
+        for ch in (0x4e00, 0x10400):
+            if ch > sys.maxunicode:
+                continue
+            narrow[unichr(ch) * 9] = -1
+            self.assertEqual(narrow.node_count(), node_count + 1)
+            node_count += 1
+            for i, key in enumerate(keys):
+                self.assertEqual(narrow[key], i)
+            self.assertEqual(narrow.keys(), sorted(narrow.keys()))
+            self.assertFalse(unichr(ch) * 8 in narrow)
+
+    def test_simd_levels(self):
+        # every lookup path must agree, including misses and the lanes past
+        # child_count of a partially filled container.
+        best = _fasttrie.simd_level()
+        try:
+            # one trie per storage width
+            for base in (0x41, 0x3b1, 0x10400):
+                if base > sys.maxunicode:
+                    continue
+                tr = fasttrie.Trie()
+                for n in range(1, 17):
+                    for c in range(n):
+                        tr[unichr(0x61 + n) + unichr(base + c)] = c
+                for level in range(best + 1):
+                    self.assertEqual(_fasttrie.simd_level(level), level)
+                    for n in range(1, 17):
+                        for c in range(17):
+                            key = unichr(0x61 + n) + unichr(base + c)
+                            self.assertEqual(key in tr, c < n)
+                            if c < n:
+                                self.assertEqual(tr[key], c)
+        finally:
+            _fasttrie.simd_level(best)
+        self.assertEqual(_fasttrie.simd_level(best + 1), best)
+
+    def test_path_compression(self):
+        tr = fasttrie.Trie()
+        tr[uni_escape("http://example.com/a")] = 1
+        self.assertEqual(tr.node_count(), 2)
+        tr[uni_escape("http://example.com/b")] = 2
+        self.assertEqual(tr.node_count(), 4)
+        # key ending inside an edge splits it
+        tr[uni_escape("http://example")] = 3
+        self.assertEqual(tr.node_count(), 5)
+        self.assertFalse(uni_escape("http://exam") in tr)
+        self.assertFalse(uni_escape("http://example.com/") in tr)
+        self.assertFalse(uni_escape("http://example.com/ab") in tr)
+        self.assertEqual(tr[uni_escape("http://example")], 3)
+
+        # deleting merges the edges back
+        del tr[uni_escape("http://example.com/b")]
+        self.assertEqual(tr.node_count(), 3)
+        del tr[uni_escape("http://example")]
+        self.assertEqual(tr.node_count(), 2)
+        self.assertEqual(tr.keys(), [uni_escape("http://example.com/a")])
+
+        tr = fasttrie.Trie()
+        for line in _read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9"):
+            tr[line] = 2
+        self.assertEqual(len(tr), 82489)
+        self.assertEqual(tr.node_count(), 102610)
+
+    def test_del_shape(self):
+        # deleting keys in any order leaves the same nodes as building the
+        # remaining keys from scratch
+        keys = sorted(set(_read_lines(path="tests/out_keys_8859_9", encoding="iso-8859-9")))
+        random.Random(7).shuffle(keys)
+        tr = fasttrie.Trie()
+        for key in keys:
+            tr[key] = 1
+        for key in keys[:len(keys) // 2]:
+            if key in tr:
+                del tr[key]
+            # inner keys too, so their nodes are merged away
+            if key[:-1] in tr:
+                del tr[key[:-1]]
+        rest = fasttrie.Trie()
+        for key in tr.keys():
+            rest[key] = 1
+        self.assertEqual(tr.node_count(), rest.node_count())
+        for key in list(tr.keys()):
+            del tr[key]
+        self.assertEqual(tr.node_count(), 1)
+        self.assertEqual(len(tr), 0)
+
+    def test_freeze(self):
+        keys = _corpus_keys()
+        tr = _corpus_trie(keys)
+        items = list(tr.items())
+        mem = tr.mem_usage()
+
+        tr.freeze()
+        self.assertTrue(tr.mem_usage() < mem)
+        self.assertEqual(len(tr), len(set(keys)))
+        self.assertEqual(tr.items(), items)
+        self.assertEqual(tr.keys(uni_escape("ra")), [k for k, v in items 
+            if k.startswith(uni_escape("ra"))])
+        for key, value in items:
+            self.assertEqual(tr[key], value)
+        self.assertFalse(uni_escape("testing") in tr)
+        self.assertFalse(uni_escape("testing\u0132") in tr)
+        self.assertRaises(_fasttrie.Error, tr.__setitem__, uni_escape("a"), 1)
+        self.assertRaises(_fasttrie.Error, tr.__delitem__, keys[0])
+        self.assertRaises(_fasttrie.Error, tr.corrections, keys[0])
+        self.assertRaises(_fasttrie.Error, tr.iter_corrections, keys[0])
+
+        tr.thaw()
+        self.assertEqual(tr.items(), items)
+        tr[uni_escape("a")] = 1
+        self.assertEqual(tr[uni_escape("a")], 1)
+
+    def test_freeze_louds(self):
+        keys = _corpus_keys()
+        tr = _corpus_trie(keys)
+        items = list(tr.items())
+        tr.freeze()
+        da_mem = tr.mem_usage()
+
+        tr.freeze("louds")
+        self.assertTrue(tr.mem_usage() < da_mem)
+        self.assertEqual(tr.items(), items)
+        self.assertEqual(list(iter(tr)), [k for k, v in items])
+        # a prefix ending inside a label
+        self.assertEqual(tr.keys(uni_escape("ramaz")), [k for k, v in items 
+            if k.startswith(uni_escape("ramaz"))])
+        self.assertEqual(tr.keys(uni_escape("ra"), 2), [k for k, v in items 
+            if k.startswith(uni_escape("ra")) and len(k) <= 4])
+        for key, value in items:
+            self.assertEqual(tr[key], value)
+        self.assertFalse(uni_escape("testing") in tr)
+        self.assertRaises(_fasttrie.Error, tr.__setitem__, uni_escape("a"), 1)
+        it = iter(tr)
+        self.assertRaises(RuntimeError, tr.thaw)
+        del it
+        self.assertRaises(ValueError, tr.freeze, "foo")
+
+        tr.thaw()
+        self.assertEqual(tr.items(), items)
+
+    def test_freeze_dawg(self):
+        keys = _corpus_keys()
+        tr = _corpus_trie(keys)
+        items = list(tr.items())
+        node_count = tr.node_count()
+
+        tr.freeze("dawg")
+        # inflected words share most of their endings
+        self.assertTrue(tr.node_count() < node_count // 2)
+        self.assertEqual(tr.items(), items)
+        self.assertEqual(tr.keys(uni_escape("ramaz")), [k for k, v in items 
+            if k.startswith(uni_escape("ramaz"))])
+        for key, value in items:
+            self.assertEqual(tr[key], value)
+        self.assertFalse(uni_escape("testing") in tr)
+        self.assertRaises(_fasttrie.Error, tr.__setitem__, uni_escape("a"), 1)
+
+        # the same endings under many stems collapse into one set of states
+        tr = fasttrie.Trie()
+        for i, stem in enumerate(["stem%d" % j for j in range(100)]):
+            for j, end in enumerate(["ing", "ed", "s", "er", "ers"]):
+                tr[uni_escape(stem + end)] = i * 5 + j
+        tr.freeze("dawg")
+        self.assertTrue(tr.node_count() < 30)
+        self.assertEqual(tr[uni_escape("stem42ers")], 42 * 5 + 4)
+        self.assertEqual(len(tr.keys(uni_escape("stem4"))), 55)
+
+        tr.thaw()
+        self.assertEqual(tr[uni_escape("stem42ers")], 42 * 5 + 4)
+
+    def test_views(self):
+        keys = _corpus_keys()
+        tr = _corpus_trie(keys)
+        items = sorted((key, tr[key]) for key in set(keys))
+        ra = [(k, v) for k, v in items if k.startswith(uni_escape("ramaz"))]
+
+        for form in (None, "da", "louds", "dawg"):
+            if form:
+                tr.freeze(form)
+            keys_view = tr.keys()
+            self.assertEqual(len(keys_view), len(items))
+            self.assertEqual(list(itertools.islice(keys_view, 3)),
+                [k for k, v in items[:3]])
+            self.assertTrue(uni_escape("testing\u0131") in keys_view)
+            self.assertFalse(uni_escape("testing") in keys_view)
+            self.assertEqual(tr.items(), items)
+            self.assertEqual(list(tr.values()), [v for k, v in items])
+            self.assertTrue(items[7] in tr.items())
+            self.assertFalse((items[7][0], -1) in tr.items())
+            self.assertTrue(items[7][1] in tr.values())
+
+            view = tr.items(uni_escape("ramaz"))
+            self.assertEqual(len(view), len(ra))
+            self.assertEqual(view, ra)
+            self.assertFalse(items[0][0] in tr.keys(uni_escape("ramaz")))
+            view = tr.keys(uni_escape("ra"), 2)
+            self.assertEqual(view, [k for k, v in items
+                if k.startswith(uni_escape("ra")) and len(k) <= 4])
+            self.assertFalse(ra[-1][0] in view)
+            if form:
+                tr.thaw()
+
+        # views are live, their iterators fail once the trie changes
+        keys_view = tr.keys(uni_escape("zz"))
+        self.assertEqual(len(keys_view), 0)
+        tr[uni_escape("zzz")] = 1
+        self.assertEqual(list(keys_view), [uni_escape("zzz")])
+        it = iter(tr.keys())
+        next(it)
+        tr[uni_escape("zzzz")] = 2
+        self.assertRaises(RuntimeError, next, it)
+        self.assertRaises(RuntimeError, tr.clear)
+        del it
+        tr.clear()
+        self.assertEqual(len(keys_view), 0)
+
+    def test_chunks(self):
+        tr = fasttrie.Trie()
+        for i in range(2500):
+            tr[uni_escape("k%d" % i)] = i
+        tr[uni_escape("")] = -1
+
+        for form in (None, "da", "louds", "dawg"):
+            if form:
+                tr.freeze(form)
+            chunks = list(tr.iter_chunks())
+            self.assertEqual([len(c) for c in chunks], [1024, 1024, 453])
+            self.assertEqual(sum(chunks, []), list(tr.keys()))
+            chunks = list(tr.items_chunks(uni_escape("k1"), 7))
+            self.assertEqual(max(len(c) for c in chunks), 7)
+            self.assertEqual(sum(chunks, []), list(tr.items(uni_escape("k1"))))
+            self.assertEqual(list(tr.iter_chunks(uni_escape("k1"), max_depth=1)),
+                [[uni_escape("k1")] + [uni_escape("k1%d" % i) for i in range(10)]])
+            self.assertEqual(list(tr.iter_chunks(uni_escape("x"))), [])
+            if form:
+                tr.thaw()
+
+        self.assertRaises(ValueError, tr.iter_chunks, n=0)
+        it = tr.iter_chunks(n=5)
+        next(it)
+        tr[uni_escape("x")] = 1
+        self.assertRaises(RuntimeError, next, it)
+
+    def test_cursor(self):
+        keys = [uni_escape(k) for k in ("", "a", "ab", "abc", "b", "ba",
+            "testing\u0131", "testing\U00010400")]
+        tr = fasttrie.Trie()
+        for i, key in enumerate(keys):
+            tr[key] = i
+        items = [(key, i) for i, key in enumerate(keys)]
+
+        for form in (None, "da", "louds", "dawg"):
+            if form:
+                tr.freeze(form)
+            c = tr.cursor()
+            self.assertEqual(c.key, None)
+            got = []
+            while c.next():
+                got.append((c.key, c.value))
+            self.assertEqual(got, items)
+            got = []
+            while c.prev():
+                got.append(c.key)
+            self.assertEqual(got, keys[::-1])
+
+            self.assertTrue(c.seek(uni_escape("aa")))
+            self.assertEqual(c.key, uni_escape("ab"))
+            self.assertTrue(c.prev())
+            self.assertEqual(c.key, uni_escape("a"))
+            self.assertTrue(c.seek(uni_escape("testing")))
+            self.assertEqual(c.key, keys[6])
+            self.assertFalse(c.seek(uni_escape("z")))
+            self.assertEqual(c.value, None)
+            self.assertTrue(c.prev())
+            self.assertEqual(c.key, keys[-1])
+            self.assertTrue(c.seek(uni_escape("")))
+            self.assertEqual(c.key, uni_escape(""))
+
+            self.assertEqual(tr.range(), items)
+            self.assertEqual(tr.range(uni_escape("ab"), uni_escape("ba")),
+                items[2:5])
+            self.assertEqual(tr.range(uni_escape("a"), limit=2), items[1:3])
+            self.assertEqual(tr.range(uni_escape("b"), uni_escape("a")), [])
+            self.assertRaises(RuntimeError, tr.thaw if form else tr.freeze)
+            del c
+            if form:
+                tr.thaw()
+
+        c = tr.cursor()
+        c.next()
+        tr[uni_escape("x")] = 1
+        self.assertRaises(RuntimeError, c.next)
+        self.assertRaises(RuntimeError, getattr, c, "key")
+        self.assertTrue(c.seek(uni_escape("x")))
+        self.assertEqual(c.value, 1)
+
+    def test_mmap(self):
+        keys = _corpus_keys()
+        tr = _corpus_trie(keys)
+        mixed = [None, uni_escape("str\u0131ng"), b"bytes", (1, [2]), 1.5, 
+            2 ** 70, -3]
+        for i, value in enumerate(mixed):
+            tr[uni_escape("mixed%d" % i)] = value
+        items = sorted(tr.items())
+
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        try:
+            tr.save(path)
+            mtr = fasttrie.Trie.mmap(path)
+            self.assertEqual(len(mtr), len(items))
+            for key, value in items:
+                self.assertEqual(mtr[key], value)
+            self.assertEqual(sorted(mtr.items()), items)
+            self.assertEqual(sorted(mtr.keys(uni_escape("ramaz"))), [k for k, v 
+                in items if k.startswith(uni_escape("ramaz"))])
+            self.assertFalse(uni_escape("testing") in mtr)
+            self.assertRaises(_fasttrie.Error, mtr.__setitem__, uni_escape("a"), 1)
+
+            # paths are file system paths, as for mmap()
+            if sys.version_info >= (3, 4):
+                import pathlib
+                mtr.save(pathlib.Path(path + "2"))
+                self.assertEqual(len(fasttrie.Trie.mmap(
+                    os.fsencode(path + "2"))), len(items))
+
+            # frozen forms and mapped tries save the same file
+            tr.freeze("louds")
+            tr.save(path)
+            mtr.save(path + "2")
+            self.assertEqual(sorted(fasttrie.Trie.mmap(path).items()), items)
+            self.assertEqual(sorted(fasttrie.Trie.mmap(path + "2").items()), items)
+
+            # values are pickled while the double array cannot go away
+            test = self
+            class Thawing(object):
+                def __reduce__(self):
+                    test.assertRaises(RuntimeError, tr.freeze, "louds")
+                    test.assertRaises(RuntimeError, tr.clear)
+                    return (int, (7,))
+            tr.thaw()
+            tr[uni_escape("mixed-reduce")] = Thawing()
+            tr.save(path + "2")
+            tr.freeze()
+            tr.save(path + "2")
+            self.assertEqual(fasttrie.Trie.mmap(path + "2")[
+                uni_escape("mixed-reduce")], 7)
+
+            # nor while they are unpickled
+            tr.thaw()
+            tr[uni_escape("mixed-reduce")] = 7
+            tr[uni_escape("mixed-thaw")] = _Thawing()
+            tr.save(path + "2")
+            _mapped.append(fasttrie.Trie.mmap(path + "2"))
+            try:
+                self.assertEqual(_mapped[0][uni_escape("mixed-thaw")], 7)
+                self.assertEqual(len(_mapped[0]), len(tr))
+            finally:
+                del _mapped[:]
+            del tr[uni_escape("mixed-thaw")]
+
+            mtr.thaw()
+            mtr[uni_escape("mixed-new")] = 1
+            self.assertEqual(len(mtr), len(items) + 1)
+
+            # widths and counts that do not agree with the file
+            with open(path + "2", "rb") as f:
+                good = bytearray(f.read())
+            for offset, value in ((16, 0), (16, 3), (17, 9), (24, 0xff)):
+                bad = bytearray(good)
+                bad[offset] = value
+                with open(path, "wb") as f:
+                    f.write(bad)
+                self.assertRaises(_fasttrie.Error, fasttrie.Trie.mmap, path)
+            bad = bytearray(good)
+            bad[64:72] = b"\0" * 8 # height
+            with open(path, "wb") as f:
+                f.write(bad)
+            self.assertRaises(_fasttrie.Error, fasttrie.Trie.mmap(path).range)
+
+            # keys are walked without loading any value
+            tr = fasttrie.Trie()
+            for i in range(100):
+                tr[uni_escape("key%d" % i)] = _Counted(i)
+            tr[uni_escape("key-bad")] = _Counted(None)
+            tr.save(path)
+            mtr = fasttrie.Trie.mmap(path)
+            _loads[0] = 0
+            self.assertEqual(sorted(mtr.keys()), sorted(tr.keys()))
+            self.assertEqual(len(mtr.keys(uni_escape("key1"))), 11)
+            self.assertTrue(uni_escape("key-bad") in mtr)
+            self.assertTrue(uni_escape("key-bad") in mtr.keys())
+            self.assertEqual(mtr.contains_many([uni_escape("key1"), 
+                uni_escape("key-bad"), uni_escape("nokey")]), b"\x01\x01\x00")
+            out = io.BytesIO()
+            mtr.dump_to(out)
+            self.assertEqual(out.getvalue().decode("utf-8").splitlines(), 
+                sorted(tr.keys()))
+            self.assertEqual(_loads[0], 0)
+            self.assertEqual(mtr[uni_escape("key7")], 7)
+            self.assertEqual(_loads[0], 1)
+            self.assertRaises(ValueError, mtr.__getitem__, uni_escape("key-bad"))
+            self.assertRaises(ValueError, mtr.dump_to, io.BytesIO(), "bytes")
+            self.assertRaises(ValueError, mtr.copy)
+            self.assertRaises(ValueError, mtr.thaw)
+            self.assertRaises(ValueError, mtr.freeze, "louds")
+            _loads[0] = 0
+            mtr.clear()
+            self.assertEqual((len(mtr), _loads[0]), (0, 0))
+
+            # deletes leave the height of the trie where it was
+            tr = fasttrie.Trie()
+            tr[uni_escape("a") * 1000] = 1
+            del tr[uni_escape("a") * 1000]
+            tr[uni_escape("b")] = 2
+            tr.save(path)
+            self.assertEqual(list(fasttrie.Trie.mmap(path).items()), 
+                [(uni_escape("b"), 2)])
+
+            # damage inside the sections is found as it is read
+            tr = fasttrie.Trie()
+            for i in range(1000):
+                tr[uni_escape("key%d" % i)] = i
+            tr.save(path)
+            with open(path, "rb") as f:
+                data = bytearray(f.read())
+            # section offsets follow the widths and counts in the header
+            units, links, tails = struct.unpack_from("=3Q", data, 96)
+            leaf_count, = struct.unpack_from("=Q", data, 40)
+            for i in range(tails + 4, tails + 4 * leaf_count, 4):
+                data[i:i+4] = b"\xff\xff\xff\x7f"
+            with open(path, "wb") as f:
+                f.write(data)
+            mtr = fasttrie.Trie.mmap(path)
+            self.assertRaises(_fasttrie.Error, list, mtr.items())
+            self.assertRaises(_fasttrie.Error, len, mtr.keys(uni_escape("key")))
+            self.assertRaises(_fasttrie.Error, mtr.copy)
+            self.assertRaises(_fasttrie.Error, mtr.dump_to, io.BytesIO())
+            self.assertRaises(_fasttrie.Error, mtr.cursor().next)
+            self.assertFalse(uni_escape("key7") in mtr)
+            self.assertRaises(_fasttrie.Error, mtr.thaw)
+            del mtr
+
+            # the check of the root is read when mapping, the rest when walking
+            tr.save(path)
+            with open(path, "rb") as f:
+                saved = f.read()
+            rnd = random.Random(0)
+            for _ in range(50):
+                data = bytearray(saved)
+                for _ in range(rnd.choice([1, 8, 64])):
+                    data[rnd.randrange(units + 8, tails)] = rnd.randrange(256)
+                with open(path, "wb") as f:
+                    f.write(data)
+                mtr = fasttrie.Trie.mmap(path)
+                for f in (lambda: list(mtr.items()), mtr.copy, mtr.thaw,
+                    lambda: [mtr.get(uni_escape("key%d" % i)) for i in range(1000)],
+                    lambda: list(mtr.range(uni_escape("key5"), uni_escape("key7")))):
+                    try:
+                        f()
+                    except _fasttrie.Error:
+                        pass
+                del mtr
+
+            with open(path, "wb") as f:
+                f.write(b"not a trie" * 10)
+            self.assertRaises(_fasttrie.Error, fasttrie.Trie.mmap, path)
+            self.assertRaises(IOError, fasttrie.Trie.mmap, path + "3")
+        finally:
+            os.remove(path)
+            if os.path.exists(path + "2"):
+                os.remove(path + "2")
+
+    def test_load(self):
+        keys = _corpus_keys(empty=False)
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        try:
+            with open(path, "wb") as f:
+                f.write(uni_escape("\r\n").join(keys).encode("utf-8") + b"\n\n")
+            tr = fasttrie.Trie()
+            tr.load_lines(path)
+            self.assertEqual(tr.keys(), sorted(set(keys)))
+            self.assertEqual(set(tr.values()), set([None]))
+
+            # a trie with keys merges the lines in
+            tr = fasttrie.Trie(zzzz=1)
+            tr[keys[0]] = 2
+            tr.load_lines(path, 0)
+            self.assertEqual(len(tr), len(set(keys)) + 1)
+            self.assertEqual((tr["zzzz"], tr[keys[0]]), (1, 0))
+
+            # tsv keys cannot hold the separator
+            keys = [key for key in keys if "\t" not in key]
+            with open(path, "wb") as f:
+                for i, key in enumerate(keys):
+                    f.write(("%s\t%d\n" % (key, -i)).encode("utf-8"))
+            tr = fasttrie.Trie()
+            tr.load_tsv(path)
+            expected = dict((key, -i) for i, key in enumerate(keys))
+            self.assertEqual(dict(tr.items()), expected)
+            tr.load_tsv(path, "bytes")
+            self.assertEqual(tr[keys[1]], b"-1")
+
+            # paths are file system paths, as for mmap()
+            if sys.version_info >= (3, 4):
+                import pathlib
+                tr.load_tsv(pathlib.Path(path))
+                self.assertEqual(dict(tr.items()), expected)
+                tr2 = fasttrie.Trie()
+                tr2.load_lines(pathlib.Path(path), 0)
+                self.assertEqual(len(tr2), len(keys))
+
+            for data in (b"a\t1\nb\n", b"a\tx\n", b"\xff\t1\n",
+                b"a\t9223372036854775808\n"):
+                with open(path, "wb") as f:
+                    f.write(data)
+                self.assertRaises(_fasttrie.Error, fasttrie.Trie().load_tsv, path)
+            self.assertRaises(ValueError, tr.load_tsv, path, "float")
+            self.assertRaises(IOError, tr.load_lines, path + "2")
+
+            # a value the merge releases cannot change the trie under it
+            errors = []
+            class Probe(object):
+                def __del__(self):
+                    for f in (lambda: tr.__setitem__("c", 1), tr.freeze,
+                        tr.clear):
+                        try:
+                            f()
+                        except RuntimeError as e:
+                            errors.append(e)
+            tr = fasttrie.Trie(a=Probe())
+            with open(path, "wb") as f:
+                f.write(b"a\nb\n")
+            tr.load_lines(path, 0)
+            self.assertEqual(len(errors), 3)
+            self.assertEqual(dict(tr.items()), {"a": 0, "b": 0})
+        finally:
+            os.remove(path)
+
+    def test_dump(self):
+        keys = [key for key in _corpus_keys(empty=False) 
+            if "\t" not in key and key]
+        tr = _corpus_trie(keys, lambda i: -i)
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        try:
+            tr.dump(path)
+            with open(path, "rb") as f:
+                lines = f.read().decode("utf-8").split("\n")
+            self.assertEqual(lines, sorted(set(keys)) + [""])
+
+            # dumps are read back as they were
+            tr.dump(path, "int")
+            tr2 = fasttrie.Trie()
+            tr2.load_tsv(path)
+            self.assertEqual(tr2.items(), tr.items())
+            out = io.BytesIO()
+            tr.dump_to(out, "int")
+            with open(path, "rb") as f:
+                self.assertEqual(out.getvalue(), f.read())
+            tr.freeze("louds")
+            out = io.BytesIO()
+            tr.dump_to(out, "int")
+            with open(path, "rb") as f:
+                self.assertEqual(out.getvalue(), f.read())
+            tr.thaw()
+
+            tr = fasttrie.Trie(a=b"x", b=b"y\tz")
+            tr.dump(path, "bytes")
+            with open(path, "rb") as f:
+                self.assertEqual(f.read(), b"a\tx\nb\ty\tz\n")
+            self.assertRaises(_fasttrie.Error, tr.dump, path, "int")
+            self.assertRaises(ValueError, tr.dump, path, "float")
+            self.assertRaises(IOError, tr.dump, os.path.join(path, "x"))
+
+            # writes raise while the trie is dumped
+            class Writer(object):
+                def write(self, b):
+                    tr["c"] = b
+            self.assertRaises(RuntimeError, tr.dump_to, Writer())
+            tr["c"] = b"w\nx"
+            self.assertRaises(_fasttrie.Error, tr.dump, path, "bytes")
+            with open(path, "rb") as f:
+                self.assertEqual(f.read(), b"")
+
+            # a failed dump leaves no part of a line behind
+            tr = fasttrie.Trie(a=1)
+            tr[uni_escape("b\nc")] = 2
+            self.assertRaises(_fasttrie.Error, tr.dump, path)
+            with open(path, "rb") as f:
+                self.assertEqual(f.read(), b"")
+            out = io.BytesIO()
+            self.assertRaises(_fasttrie.Error, tr.dump_to, out)
+            self.assertEqual(out.getvalue(), b"")
+
+            # paths are file system paths, as for mmap()
+            if sys.version_info >= (3, 4):
+                import pathlib
+                tr = fasttrie.Trie(a=1)
+                tr.dump(pathlib.Path(path), "int")
+                with open(path, "rb") as f:
+                    self.assertEqual(f.read(), b"a\t1\n")
+        finally:
+            os.remove(path)
+
+    def test_build_external(self):
+        keys = _corpus_keys()
+        pairs = [(key, i) for i, key in enumerate(keys)]
+        pairs += [(key, (i, "x")) for i, key in enumerate(keys[::3])]
+        random.shuffle(pairs)
+        tr = fasttrie.Trie()
+        for key, value in pairs:
+            tr[key] = value
+        tmpdir = tempfile.mkdtemp()
+        path = os.path.join(tmpdir, "trie")
+        try:
+            # a small budget makes many runs, the last value of a key wins
+            for memory in (1 << 20, 1 << 26):
+                tr2 = fasttrie.Trie.build_external(iter(pairs), path,
+                    memory=memory, tmpdir=tmpdir)
+                self.assertEqual(len(tr2), len(tr))
+                self.assertEqual(tr2.items(), sorted(tr.items()))
+                for key in keys[::50]:
+                    self.assertEqual(tr2[key], tr[key])
+                self.assertEqual(os.listdir(tmpdir), ["trie"])
+                del tr2
+
+            tr2 = fasttrie.Trie.build_external([], path)
+            self.assertEqual(len(tr2), 0)
+            self.assertFalse("" in tr2)
+            del tr2
+
+            # paths are file system paths, as for mmap()
+            if sys.version_info >= (3, 4):
+                import pathlib
+                tr2 = fasttrie.Trie.build_external(iter(pairs),
+                    pathlib.Path(path), tmpdir=pathlib.Path(tmpdir))
+                self.assertEqual(len(tr2), len(tr))
+                del tr2
+            self.assertRaises(_fasttrie.Error, fasttrie.Trie.build_external,
+                [(1, 2)], path)
+            self.assertRaises(IOError, fasttrie.Trie.build_external,
+                [("a", 1)], os.path.join(path, "x"))
+        finally:
+            for name in os.listdir(tmpdir):
+                os.remove(os.path.join(tmpdir, name))
+            os.rmdir(tmpdir)
 
     def _test_iter(self):
         print("\nhello!")
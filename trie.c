@@ -14,7 +14,7 @@ void *TRIEMALLOC(trie_t *t, unsigned long size)
 {
     void *p;
 
-    p = PyMem_Malloc(size + sizeof(unsigned long));
+    p = TRIE_RAW_MALLOC(size + sizeof(unsigned long));
     if (!p) {
         return NULL;
     }
@@ -27,11 +27,241 @@ void *TRIEMALLOC(trie_t *t, unsigned long size)
 
 void TRIEFREE(trie_t *t, void *p)
 {
-    assert(t != NULL);
-    
     p = (char *)p - sizeof(unsigned long);
-    t->mem_usage -= *(unsigned long *)p;
-    PyMem_Free(p);
+    if (t) {
+        t->mem_usage -= *(unsigned long *)p;
+    }
+    TRIE_RAW_FREE(p);
+}
+
+int ARENACLASS(unsigned long size)
+{
+    if (size <= TRIE_ARENA_SMALL_BLOCK) {
+        return (int)((size + TRIE_ARENA_ALIGN - 1) / TRIE_ARENA_ALIGN) - 1;
+    }
+    return (TRIE_ARENA_SMALL_BLOCK / TRIE_ARENA_ALIGN) - 1 + 
+        (int)((size - TRIE_ARENA_SMALL_BLOCK + TRIE_ARENA_MEDIUM_STEP - 1) / 
+        TRIE_ARENA_MEDIUM_STEP);
+}
+
+unsigned long ARENACLASSSIZE(int c)
+{
+    if (c < TRIE_ARENA_SMALL_BLOCK / TRIE_ARENA_ALIGN) {
+        return (unsigned long)(c + 1) * TRIE_ARENA_ALIGN;
+    }
+    return TRIE_ARENA_SMALL_BLOCK + (unsigned long)(c - 
+        (TRIE_ARENA_SMALL_BLOCK / TRIE_ARENA_ALIGN) + 1) * TRIE_ARENA_MEDIUM_STEP;
+}
+
+int ARENAGROW(trie_t *t, unsigned long need)
+{
+    trie_arena_t *a = &t->arena;
+    trie_slab_t *slab;
+    unsigned long size;
+
+    // double the slab size with every new slab, so big tries end up with 
+    // few large slabs while small ones do not pay for a large first slab.
+    size = a->slabs ? a->slabs->size * 2 : TRIE_ARENA_MIN_SLAB;
+    if (size > TRIE_ARENA_MAX_SLAB) {
+        size = TRIE_ARENA_MAX_SLAB;
+    }
+    if (size < need + sizeof(trie_slab_t)) {
+        size = need + sizeof(trie_slab_t);
+    }
+
+    slab = (trie_slab_t *)TRIEMALLOC(t, size);
+    if (!slab) {
+        return 0;
+    }
+    slab->size = size;
+    slab->next = a->slabs;
+    a->slabs = slab;
+    a->slab_bytes += size;
+    a->bump = (char *)slab + sizeof(trie_slab_t);
+    a->bump_end = (char *)slab + size;
+
+    return 1;
+}
+
+void *ARENAALLOC(trie_t *t, unsigned long size)
+{
+    trie_arena_t *a = &t->arena;
+    trie_big_t *b;
+    void *p;
+    int c;
+
+    if (size > TRIE_ARENA_MAX_BLOCK) {
+        b = (trie_big_t *)TRIEMALLOC(t, sizeof(trie_big_t) + size);
+        if (!b) {
+            return NULL;
+        }
+        b->prev = NULL;
+        b->next = a->bigs;
+        if (a->bigs) {
+            a->bigs->prev = b;
+        }
+        a->bigs = b;
+        a->big_bytes += size;
+        return (char *)b + sizeof(trie_big_t);
+    }
+
+    if (!size) {
+        size = 1;
+    }
+    c = ARENACLASS(size);
+
+    // recycled block of the same size class?
+    p = a->free_lists[c];
+    if (p) {
+        a->free_lists[c] = *(void **)p;
+        return p;
+    }
+
+    // otherwise bump-allocate from the newest slab
+    size = ARENACLASSSIZE(c);
+    if ((unsigned long)(a->bump_end - a->bump) < size) {
+        if (!ARENAGROW(t, size)) {
+            return NULL;
+        }
+    }
+    p = a->bump;
+    a->bump += size;
+
+    return p;
+}
+
+// Carves count blocks of size bytes out of a slab of their own, for bulk 
+// builds that know their node count up front. The blocks are of the size 
+// class of size, so freeing one recycles it like any other block, and the 
+// newest slab keeps serving other allocations.
+void *ARENABULK(trie_t *t, unsigned long count, unsigned long size)
+{
+    trie_arena_t *a = &t->arena;
+    trie_slab_t *slab;
+    unsigned long bytes;
+
+    bytes = sizeof(trie_slab_t) + count * ARENACLASSSIZE(ARENACLASS(size));
+    slab = (trie_slab_t *)TRIEMALLOC(t, bytes);
+    if (!slab) {
+        return NULL;
+    }
+    slab->size = bytes;
+    if (a->slabs) {
+        slab->next = a->slabs->next;
+        a->slabs->next = slab;
+    } else {
+        slab->next = NULL;
+        a->slabs = slab;
+        a->bump = a->bump_end = (char *)slab + bytes;
+    }
+    a->slab_bytes += bytes;
+
+    return (char *)slab + sizeof(trie_slab_t);
+}
+
+void ARENAFREE(trie_t *t, void *p, unsigned long size)
+{
+    trie_arena_t *a = &t->arena;
+    trie_big_t *b;
+    int c;
+
+    if (!p) {
+        return;
+    }
+
+    if (size > TRIE_ARENA_MAX_BLOCK) {
+        b = (trie_big_t *)((char *)p - sizeof(trie_big_t));
+        if (b->prev) {
+            b->prev->next = b->next;
+        } else {
+            a->bigs = b->next;
+        }
+        if (b->next) {
+            b->next->prev = b->prev;
+        }
+        a->big_bytes -= size;
+        TRIEFREE(t, b);
+        return;
+    }
+
+    if (!size) {
+        size = 1;
+    }
+    c = ARENACLASS(size);
+    *(void **)p = a->free_lists[c];
+    a->free_lists[c] = p;
+}
+
+// Moves every block of from's arena to t's, for subtries built with an
+// arena of their own and then linked into t. from shall hold no other 
+// memory, its arena is left empty.
+void ARENAMERGE(trie_t *t, trie_t *from)
+{
+    trie_arena_t *a = &t->arena, *b = &from->arena;
+    trie_slab_t *slab;
+    trie_big_t *big;
+    void **p;
+    int c;
+
+    // behind t's newest slab, so that it keeps serving allocations
+    if (b->slabs) {
+        for (slab = b->slabs; slab->next; slab = slab->next)
+            ;
+        if (a->slabs) {
+            slab->next = a->slabs->next;
+            a->slabs->next = b->slabs;
+        } else {
+            a->slabs = b->slabs;
+            a->bump = b->bump;
+            a->bump_end = b->bump_end;
+        }
+    }
+    if (b->bigs) {
+        for (big = b->bigs; big->next; big = big->next)
+            ;
+        big->next = a->bigs;
+        if (a->bigs) {
+            a->bigs->prev = big;
+        }
+        a->bigs = b->bigs;
+    }
+    for (c = 0; c < TRIE_ARENA_CLASS_COUNT; c++) {
+        if (b->free_lists[c]) {
+            for (p = (void **)b->free_lists[c]; *p; p = (void **)*p)
+                ;
+            *p = a->free_lists[c];
+            a->free_lists[c] = b->free_lists[c];
+        }
+    }
+    a->slab_bytes += b->slab_bytes;
+    a->big_bytes += b->big_bytes;
+    t->mem_usage += from->mem_usage;
+    from->mem_usage = 0;
+    memset(b, 0, sizeof(trie_arena_t));
+}
+
+void ARENAINIT(trie_t *t)
+{
+    memset(&t->arena, 0, sizeof(trie_arena_t));
+}
+
+void ARENADESTROY(trie_t *t)
+{
+    trie_arena_t *a = &t->arena;
+    trie_slab_t *slab;
+    trie_big_t *b;
+
+    while (a->slabs) {
+        slab = a->slabs;
+        a->slabs = slab->next;
+        TRIEFREE(t, slab);
+    }
+    while (a->bigs) {
+        b = a->bigs;
+        a->bigs = b->next;
+        TRIEFREE(t, b);
+    }
+    ARENAINIT(t);
 }
 
 void KEY_CHAR_WRITE(trie_key_t *k, unsigned long index, TRIE_CHAR in)
@@ -68,8 +298,8 @@ void KEY_CHAR_READ(trie_key_t *k, unsigned long index, TRIE_CHAR *out)
 void KEYCPY(trie_key_t *dst, trie_key_t *src, unsigned long dst_index,
         unsigned long src_index, unsigned long length)
 {
-    unsigned int i,j;
-    char *srcb, *dstb;
+    unsigned long i;
+    TRIE_CHAR ch;
 
     if (length == 0) {
         return;
@@ -79,12 +309,10 @@ void KEYCPY(trie_key_t *dst, trie_key_t *src, unsigned long dst_index,
     assert(src_index+length-1 < src->size);
     assert(dst->char_size >= src->char_size);
 
+    // chars are zero extended to the wider char_size of dst
     for (i=0;i<length;i++) {
-        srcb = &src->s[(src_index+i) * src->char_size];
-        dstb = &dst->s[(dst_index+i) * dst->char_size];
-        for (j=0;j<src->char_size;j++) {
-            dstb[j] = srcb[j];
-        }
+        KEY_CHAR_READ(src, src_index+i, &ch);
+        KEY_CHAR_WRITE(dst, dst_index+i, ch);
     }
 }
 
@@ -167,27 +395,112 @@ iter_pos_t *PEEKI(iter_stack_t *k)
     return &k->_elems[k->index-1];
 }
 
-trie_node_t *NODECREATE(trie_t* t, TRIE_CHAR key, TRIE_DATA value)
+// Narrowest storage width that holds every char of s[0, size).
+unsigned char KEYWIDTH(const void *s, unsigned char char_size,
+    unsigned long size)
+{
+    TRIE_CHAR ch, max;
+    unsigned long i;
+
+    if (char_size == 1) {
+        return 1;
+    }
+    max = 0;
+    for (i = 0; i < size; i++) {
+        ch = WCHAR_READ(s, char_size, i);
+        if (ch > max) {
+            max = ch;
+        }
+    }
+    if (max <= 0xff) {
+        return 1;
+    }
+    return (unsigned char)(max <= 0xffff ? 2 : sizeof(TRIE_CHAR));
+}
+
+unsigned long CONTAINERSIZE(unsigned char kind, unsigned char cap_shift,
+    unsigned char w)
+{
+    switch(kind)
+    {
+        case TRIE_NODE4:
+        case TRIE_NODE16:
+        case TRIE_NODEN:
+            return (sizeof(trie_node_t *) + w) << cap_shift;
+        case TRIE_NODE48:
+            return sizeof(trie_node48_t);
+        case TRIE_NODE256:
+            return sizeof(trie_node256_t);
+    }
+    return 0;
+}
+
+#define NODECAP(nd) (1UL << (nd)->cap_shift)
+#define SORTED_CHILDREN(nd) ((trie_node_t **)(nd)->children)
+#define SORTED_KEYS(nd) ((unsigned char *)(SORTED_CHILDREN(nd) + NODECAP(nd)))
+#define PAGE_OF(ch) ((TRIE_CHAR)(ch) >> 8)
+#define PAGE_INDEX(ch) ((ch) & (TRIE_NODE_PAGE_SIZE - 1))
+
+trie_node_t *NODECREATE(trie_t* t, TRIE_DATA value)
 {
     trie_node_t *nd;
 
-    nd = (trie_node_t *)TRIEMALLOC(t, sizeof(trie_node_t));
+    nd = (trie_node_t *)ARENAALLOC(t, sizeof(trie_node_t));
     if (nd) {
-        nd->key = key;
         nd->value = value;
+        nd->children = NULL;
+        nd->label_len = 0;
         nd->child_count = 0;
-        nd->hash_size = TRIE_MIN_HASH_SIZE;
-        nd->child_hash = TRIEMALLOC(t, sizeof(trie_node_t *) * nd->hash_size);
-        nd->next = NULL;
-        for (int i = 0; i < nd->hash_size; i++) nd->child_hash[i] = NULL;
+        nd->kind = TRIE_NODE0;
+        nd->cap_shift = 0;
     }
     return nd;
 }
 
 void NODEFREE(trie_t* t, trie_node_t *nd)
 {
-    TRIEFREE(t, nd->child_hash);
-    TRIEFREE(t, nd);
+    if (nd->children) {
+        ARENAFREE(t, nd->children, CONTAINERSIZE(nd->kind, nd->cap_shift,
+            t->char_size));
+    }
+    if (nd->label_len > LABEL_INLINE(t->char_size)) {
+        ARENAFREE(t, nd->label.ext, nd->label_len * t->char_size);
+    }
+    ARENAFREE(t, nd, sizeof(trie_node_t));
+}
+
+// Replaces the label of nd with len chars from src, stored with the trie's
+// char_size. src may point into the current label. On failure the label is
+// left unchanged.
+int LABELSET(trie_t *t, trie_node_t *nd, const void *src, unsigned long len)
+{
+    void *ext, *old;
+    unsigned long old_len;
+    unsigned char w;
+
+    w = t->char_size;
+    ext = NULL;
+    if (len > LABEL_INLINE(w)) {
+        ext = ARENAALLOC(t, len * w);
+        if (!ext) {
+            return 0;
+        }
+        memcpy(ext, src, len * w);
+    }
+
+    old = nd->label_len > LABEL_INLINE(w) ? nd->label.ext : NULL;
+    old_len = nd->label_len;
+    if (ext) {
+        nd->label.ext = ext;
+    } else {
+        memmove(nd->label.inl, src, len * w);
+    }
+    nd->label_len = len;
+    if (old) {
+        ARENAFREE(t, old, old_len * w);
+    }
+
+    return 1;
 }
 
 trie_t *trie_create(void)
@@ -196,48 +509,26 @@ trie_t *trie_create(void)
 
     t = (trie_t *)TRIEMALLOC(NULL, sizeof(trie_t));
     if (t) {
-        t->mem_usage += sizeof(trie_t);
-        t->root = NODECREATE(t, (TRIE_CHAR)0, (TRIE_DATA)0); // root is a dummy node
+        t->mem_usage = 0;
+        t->char_size = 1; // widened by trie_add() as wider chars arrive
+        ARENAINIT(t);
+        t->root = NODECREATE(t, (TRIE_DATA)0); // root is a dummy node with no label
+        if (!t->root) {
+            ARENADESTROY(t);
+            TRIEFREE(t, t);
+            return NULL;
+        }
         t->node_count = 1;
         t->item_count = 0;
         t->height = 1;
-        t->dirty = 0;
-        t->mem_usage = 0;
+        t->version = 0;
     }
     return t;
 }
 
-void trie_destroy_node(trie_t *t, trie_node_t *node) {
-    trie_node_t *curr = node;
-    trie_node_t *prev;
-    // Recursively destroy all children nodes
-    while (node->child_count > 0) {
-        for (int i = 0; i < node->hash_size; i++) {
-            if (node->child_hash[i]) {
-                prev = NULL;  // Reset value of prev
-                curr = node->child_hash[i];
-                // Advance to last in linked list, if it exists
-                while (curr->next) {
-                    prev = curr;
-                    curr = curr->next;
-                }
-                // Remove reference to data being removed, either from next or child_hash
-                if (prev)
-                    prev->next = NULL;
-                else
-                    node->child_hash[i] = NULL;
-
-                trie_destroy_node(t, curr);
-                node->child_count--;
-            }
-        }
-    }
-    NODEFREE(t, node);
-    t->node_count--;
-}
-
 void trie_destroy(trie_t *t) {
-    trie_destroy_node(t, t->root);
+    // every node lives in the arena, so there is no need to walk the tree.
+    ARENADESTROY(t);
     TRIEFREE(t, t);
 }
 
@@ -246,310 +537,2073 @@ unsigned long trie_mem_usage(trie_t *t)
     return t->mem_usage;
 }
 
-trie_node_t *_trie_prefix(trie_node_t *t, trie_key_t *key)
-{
-    TRIE_CHAR ch;
-    unsigned int i;
-    trie_node_t *curr, *parent;
-
-    if (!t){
-        return NULL;
-    }
-    i = 0;
-    parent = curr = t;
-    while(i < key->size)
-    {
-        KEY_CHAR_READ(key, i, &ch);
-        curr = trie_get_child(parent, ch);
+#define SORTEDKIND(shift) ((shift) <= 2 ? TRIE_NODE4 : ((shift) <= 4 ? TRIE_NODE16 : TRIE_NODEN))
 
-        while(curr && curr->key != ch) {
-            curr = curr->next;
-        }
-        if (!curr) {
-            return NULL;
-        }
+unsigned char CAPSHIFT(unsigned long n)
+{
+    unsigned char shift = 0;
 
-        parent = curr;
-        i++;
+    while ((1UL << shift) < n) {
+        shift++;
     }
-
-    return parent;
+    return shift;
 }
 
-trie_node_t *trie_search(trie_t *t, trie_key_t *key)
-{
-    trie_node_t *r;
+// NODE16 containers are scanned with SIMD compares over the whole capacity;
+// NODE4 stays scalar since a four key loop is already as fast as the vector
+// setup. The per block masks (w bits per key) are OR-ed together and trimmed
+// to child_count before a single test, which keeps the scan free of data
+// dependent branches. Loads never go past the container capacity.
+static int _simd_level = TRIE_SIMD_NONE;
 
-    r = _trie_prefix(t->root, key);
-    if (r && !r->value)
-    {
-        return NULL;
-    }
+#ifdef TRIE_HAVE_SSE2
+#include <emmintrin.h>
 
-    return r;
-}
-trie_node_t *trie_get_child(trie_node_t *node, TRIE_CHAR ch) {
-    unsigned int pos = (int)ch % node->hash_size;
-    trie_node_t * curr = node->child_hash[pos];
-    while (curr && curr->key != ch) {
-        curr = curr->next;
+static inline uint64_t _match_mask_sse2(const void *keys, unsigned long bytes,
+    TRIE_CHAR ch, unsigned char w)
+{
+    __m128i needle, k;
+    unsigned long i;
+    uint64_t mask;
+
+    if (w == 1) {
+        needle = _mm_set1_epi8((char)ch);
+    } else if (w == 2) {
+        needle = _mm_set1_epi16((short)ch);
+    } else {
+        needle = _mm_set1_epi32((int)ch);
     }
-    return curr;
-}
-
-int trie_add_child(trie_t *t, trie_node_t *parent, trie_node_t *child) {
-
-    if ((parent->child_count + 1 > parent->hash_size) && (parent->hash_size < TRIE_MAX_HASH_SIZE)) {
-        trie_node_hash_resize(t, parent, parent->hash_size * 2);
+    mask = 0;
+    for (i = 0; i < bytes; i += 16) {
+        k = _mm_loadu_si128((const __m128i *)((const char *)keys + i));
+        if (w == 1) {
+            k = _mm_cmpeq_epi8(k, needle);
+        } else if (w == 2) {
+            k = _mm_cmpeq_epi16(k, needle);
+        } else {
+            k = _mm_cmpeq_epi32(k, needle);
+        }
+        mask |= (uint64_t)(unsigned int)_mm_movemask_epi8(k) << i;
     }
-    unsigned int pos = (int)child->key % parent->hash_size;
-    child->next = parent->child_hash[pos];
-    parent->child_hash[pos] = child;
-    parent->child_count++;
-    t->node_count++;
-    return 1;
+    return mask;
 }
+#endif
 
-int trie_remove_child(trie_t *t, trie_node_t *parent, trie_node_t *child) {
-    trie_node_t *curr, *prev = NULL;
-    unsigned int pos = (int)child->key % parent->hash_size;
-    curr = parent->child_hash[pos];
-    while (curr && curr != child) {
-        prev = curr;
-        curr = curr->next;
-    }
-    if (curr == NULL) {
-        // Not found. Can't be removed.
-        return 0;
-    }
+#ifdef TRIE_HAVE_AVX2
+#include <immintrin.h>
 
-    if (prev) {
-        prev->next = curr->next;
+__attribute__((target("avx2")))
+static uint64_t _match_mask_avx2(const void *keys, unsigned long bytes,
+    TRIE_CHAR ch, unsigned char w)
+{
+    __m256i needle, k;
+    unsigned long i;
+    uint64_t mask;
+
+    if (w == 1) {
+        needle = _mm256_set1_epi8((char)ch);
+    } else if (w == 2) {
+        needle = _mm256_set1_epi16((short)ch);
+    } else {
+        needle = _mm256_set1_epi32((int)ch);
     }
-    else {
-        parent->child_hash[pos] = curr->next;
+    mask = 0;
+    for (i = 0; i < bytes; i += 32) {
+        k = _mm256_loadu_si256((const __m256i *)((const char *)keys + i));
+        if (w == 1) {
+            k = _mm256_cmpeq_epi8(k, needle);
+        } else if (w == 2) {
+            k = _mm256_cmpeq_epi16(k, needle);
+        } else {
+            k = _mm256_cmpeq_epi32(k, needle);
+        }
+        mask |= (uint64_t)(unsigned int)_mm256_movemask_epi8(k) << i;
     }
-
-    TRIEFREE(t, child);
-    parent->child_count--;
-    t->node_count--;
-    return 1;
+    return mask;
 }
+#endif
 
-int trie_add(trie_t *t, trie_key_t *key, TRIE_DATA value)
+// Detects the best SIMD level the CPU supports and selects it. Returns the
+// selected level.
+int trie_simd_init(void)
 {
-    TRIE_CHAR ch;
-    unsigned int i;
-    trie_node_t *curr, *parent, *prev;
-
-    i = 0;
-    parent = t->root;
-    while(i < key->size)
-    {
-        prev = NULL;
-        KEY_CHAR_READ(key, i, &ch);
-
-        unsigned int pos = (int)ch % parent->hash_size;
-        curr = trie_get_child(parent, ch);
-        if (!curr) {
-            curr = NODECREATE(t, ch, (TRIE_DATA)0);
-            trie_add_child(t, parent, curr);
-        }
-
-        parent = curr;
-        i++;
+    _simd_level = TRIE_SIMD_NONE;
+#ifdef TRIE_HAVE_SSE2
+    _simd_level = TRIE_SIMD_SSE2;
+#endif
+#ifdef TRIE_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        _simd_level = TRIE_SIMD_AVX2;
     }
+#endif
+    return _simd_level;
+}
 
-    if (!parent->value) {
-        t->item_count++;
-        t->dirty = 1;
-    }
+// Selects a SIMD level no higher than what trie_simd_init() detected. A
+// negative level only queries. Returns the level in effect.
+int trie_simd_set(int level)
+{
+    int best;
 
-    if (key->size > t->height) {
-        t->height = key->size;
+    if (level < 0) {
+        return _simd_level;
     }
-
-    parent->value = value;
-    return 1;
+    best = trie_simd_init();
+    _simd_level = level < best ? level : best;
+    return _simd_level;
 }
 
-int trie_del(trie_t *t, trie_key_t *key) {
-    int i = 0, found = 1;
-    trie_node_t *curr, *prev, *parent;
-    TRIE_CHAR ch;
-    trie_node_t **parents = malloc(sizeof(trie_node_t *) * key->size + 1);
-    parents[0] = curr = t->root;
-    for(int j = 1; j < key->size; j++) parents[j] = NULL;
-
-    while(i < key->size) {
-        KEY_CHAR_READ(key, i, &ch);
-        curr = trie_get_child(curr, ch);
-        prev = NULL;
-
-        while(curr && curr->key != ch) {
-            prev = curr;
-            curr = curr->next;
-        }
-        if (!curr) {
-            found = 0;
+// A lookup of trie_search_many(), advanced a step at a time by the step
+// function matching its key and storage widths.
+typedef struct trie_lane_s {
+    trie_node_t *node; // deepest node matched so far, NULL on a miss
+    trie_node_t *child; // child whose label is matched next, if any
+    const void *s;
+    unsigned long size;
+    unsigned long index; // chars of s matched so far
+    unsigned long key; // index of the key in the batch
+    int (*step)(struct trie_lane_s *lane);
+} trie_lane_t;
+
+// Prefetches what looking up ch among the children of node reads first.
+static void _prefetch_children(trie_node_t *node, TRIE_CHAR ch)
+{
+    switch(node->kind)
+    {
+        case TRIE_NODE4:
+        case TRIE_NODE16:
+        case TRIE_NODEN:
+            TRIE_PREFETCH(SORTED_KEYS(node));
+            break;
+        case TRIE_NODE48:
+            TRIE_PREFETCH(&((trie_node48_t *)node->children)->index[PAGE_INDEX(ch)]);
+            break;
+        case TRIE_NODE256:
+            TRIE_PREFETCH(node->children);
+            TRIE_PREFETCH(&((trie_node256_t *)node->children)->children[PAGE_INDEX(ch)]);
             break;
-        }
-
-        parents[++i] = curr;
-    }
-
-    found = found && curr->value;
-    if (found) {
-        curr->value = 0;
     }
+}
 
-    if (found) {
-        t->item_count--;
-        t->dirty = 1;
+// Child lookup per storage width
+#define LABEL_T uint8_t
+#define LABEL_WIDTH 1
+#define TPL_SUFFIX _w1
+#include "trie_tpl.h"
+#define LABEL_T uint16_t
+#define LABEL_WIDTH 2
+#define TPL_SUFFIX _w2
+#include "trie_tpl.h"
+#define LABEL_T uint32_t
+#define LABEL_WIDTH 4
+#define TPL_SUFFIX _w4
+#include "trie_tpl.h"
+
+// Edge walks, adds and deletes per (key width, storage width)
+int NODESPLIT(trie_t *t, trie_node_t *nd, unsigned long len);
+int NODEMERGE(trie_t *t, trie_node_t *nd);
+
+#define KEY_T uint8_t
+#define LABEL_T uint8_t
+#define LABEL_WIDTH 1
+#define TPL_SUFFIX _k1w1
+#include "trie_tpl.h"
+#define KEY_T uint8_t
+#define LABEL_T uint16_t
+#define LABEL_WIDTH 2
+#define TPL_SUFFIX _k1w2
+#include "trie_tpl.h"
+#define KEY_T uint8_t
+#define LABEL_T uint32_t
+#define LABEL_WIDTH 4
+#define TPL_SUFFIX _k1w4
+#include "trie_tpl.h"
+#define KEY_T uint16_t
+#define LABEL_T uint8_t
+#define LABEL_WIDTH 1
+#define TPL_SUFFIX _k2w1
+#include "trie_tpl.h"
+#define KEY_T uint16_t
+#define LABEL_T uint16_t
+#define LABEL_WIDTH 2
+#define TPL_SUFFIX _k2w2
+#include "trie_tpl.h"
+#define KEY_T uint16_t
+#define LABEL_T uint32_t
+#define LABEL_WIDTH 4
+#define TPL_SUFFIX _k2w4
+#include "trie_tpl.h"
+#define KEY_T uint32_t
+#define LABEL_T uint8_t
+#define LABEL_WIDTH 1
+#define TPL_SUFFIX _k4w1
+#include "trie_tpl.h"
+#define KEY_T uint32_t
+#define LABEL_T uint16_t
+#define LABEL_WIDTH 2
+#define TPL_SUFFIX _k4w2
+#include "trie_tpl.h"
+#define KEY_T uint32_t
+#define LABEL_T uint32_t
+#define LABEL_WIDTH 4
+#define TPL_SUFFIX _k4w4
+#include "trie_tpl.h"
+
+#define WIDTHPAIR(k, w) ((k) * 8 + (w))
+
+unsigned long _sorted_lower_bound(trie_t *t, trie_node_t *node, TRIE_CHAR ch)
+{
+    switch(t->char_size)
+    {
+        case 1:
+            return _lower_bound_w1(node, ch);
+        case 2:
+            return _lower_bound_w2(node, ch);
+        default:
+            return _lower_bound_w4(node, ch);
     }
+}
 
-    while (i) {
-        curr = parents[i];
-
-        if ((!curr->child_count) && (!curr->value)) {
-            // TODO: Check response for success
-            trie_remove_child(t, parents[i-1], curr);
-        }
-        i--;
+trie_node_t *trie_get_child(trie_t *t, trie_node_t *node, TRIE_CHAR ch)
+{
+    switch(t->char_size)
+    {
+        case 1:
+            return _get_child_w1(node, ch);
+        case 2:
+            return _get_child_w2(node, ch);
+        default:
+            return _get_child_w4(node, ch);
     }
-
-    free(parents);
-    return found;
 }
 
-int trie_node_hash_resize(trie_t *t, trie_node_t *node, int new_size) {
-    TRIE_CHILD_HASH old_hash = node->child_hash;
-    unsigned short int old_size = node->hash_size;
-
-    TRIE_CHILD_HASH new_hash = TRIEMALLOC(t, sizeof(trie_node_t*) * new_size);
-    for (int i = 0; i < new_size; i++) new_hash[i] = NULL;
+#define KEY_AS(T) ((const T *)key->s)
 
-    trie_node_t ** children = trie_node_children(node);
-    unsigned short int pos;
-    trie_node_t *current;
-    for(int i = 0; i < node->child_count; i++){
-        current = children[i];
-        pos = (int) current->key % new_size;
-        current->next = new_hash[pos];
-        new_hash[pos] = current;
+// Number of leading chars of nd's label that match key chars from index on.
+unsigned long _label_common(trie_t *t, trie_node_t *nd, trie_key_t *key,
+    unsigned long index)
+{
+    switch(WIDTHPAIR(key->char_size, t->char_size))
+    {
+        case WIDTHPAIR(1, 1):
+            return _label_common_k1w1(nd, KEY_AS(uint8_t), index, key->size);
+        case WIDTHPAIR(1, 2):
+            return _label_common_k1w2(nd, KEY_AS(uint8_t), index, key->size);
+        case WIDTHPAIR(1, 4):
+            return _label_common_k1w4(nd, KEY_AS(uint8_t), index, key->size);
+        case WIDTHPAIR(2, 1):
+            return _label_common_k2w1(nd, KEY_AS(uint16_t), index, key->size);
+        case WIDTHPAIR(2, 2):
+            return _label_common_k2w2(nd, KEY_AS(uint16_t), index, key->size);
+        case WIDTHPAIR(2, 4):
+            return _label_common_k2w4(nd, KEY_AS(uint16_t), index, key->size);
+        case WIDTHPAIR(4, 1):
+            return _label_common_k4w1(nd, KEY_AS(uint32_t), index, key->size);
+        case WIDTHPAIR(4, 2):
+            return _label_common_k4w2(nd, KEY_AS(uint32_t), index, key->size);
+        case WIDTHPAIR(4, 4):
+            return _label_common_k4w4(nd, KEY_AS(uint32_t), index, key->size);
     }
-    free(children);
-    node->child_hash = new_hash;
-    node->hash_size = new_size;
-    TRIEFREE(t, old_hash);
+    assert(0 == 1); // unsupported char_size
+    return 0;
 }
 
-trie_node_t **trie_node_children(trie_node_t *node) {
-    if (node->child_count == 0) return NULL;
-    unsigned int children_offset = 0;
-    trie_node_t **children = (trie_node_t **)malloc(sizeof(trie_node_t*) * node->child_count);
-    if (!children) {
+// Descends from node along key, comparing whole edge labels. Returns the node
+// whose edge the key ends on. If rest is given, it receives the number of
+// chars of that node's label that come after the end of the key. The loop is
+// picked once per call by key and storage width, see trie_tpl.h.
+trie_node_t *_trie_prefix(trie_t *t, trie_node_t *node, trie_key_t *key,
+    unsigned long *rest)
+{
+    if (!node){
         return NULL;
     }
-    for (int i = 0; i < node->child_count; i++) children[i] = NULL;
-    trie_node_t *result_head = NULL, *current, *hash_head;
-    for(int i = 0; i < node->hash_size; i++) {
-        current = node->child_hash[i];
-        while (current) {
-            children[children_offset++] = current;
-            current = current->next;
+    if (!key->size) {
+        // an empty key may come without a char_size
+        if (rest) {
+            *rest = 0;
         }
+        return node;
     }
-    return children;
-
+    switch(WIDTHPAIR(key->char_size, t->char_size))
+    {
+        case WIDTHPAIR(1, 1):
+            return _prefix_k1w1(node, KEY_AS(uint8_t), key->size, rest);
+        case WIDTHPAIR(1, 2):
+            return _prefix_k1w2(node, KEY_AS(uint8_t), key->size, rest);
+        case WIDTHPAIR(1, 4):
+            return _prefix_k1w4(node, KEY_AS(uint8_t), key->size, rest);
+        case WIDTHPAIR(2, 1):
+            return _prefix_k2w1(node, KEY_AS(uint16_t), key->size, rest);
+        case WIDTHPAIR(2, 2):
+            return _prefix_k2w2(node, KEY_AS(uint16_t), key->size, rest);
+        case WIDTHPAIR(2, 4):
+            return _prefix_k2w4(node, KEY_AS(uint16_t), key->size, rest);
+        case WIDTHPAIR(4, 1):
+            return _prefix_k4w1(node, KEY_AS(uint32_t), key->size, rest);
+        case WIDTHPAIR(4, 2):
+            return _prefix_k4w2(node, KEY_AS(uint32_t), key->size, rest);
+        case WIDTHPAIR(4, 4):
+            return _prefix_k4w4(node, KEY_AS(uint32_t), key->size, rest);
+    }
+    assert(0 == 1); // unsupported char_size
+    return NULL;
 }
 
-int trie_node_serializer(trie_node_t *t, char *s, unsigned long *node_offset, TRIE_DATA *value_ptrs, unsigned long *value_offset) {
-    unsigned long s_offset = *node_offset * TRIE_NODE_SIZE;
-    unsigned long value_idx;
-    unsigned char child_count = t->child_count;
-    char * i_ptr = s + s_offset;
-    trie_node_t *child;
+// Search, add and delete come in one variant per key char size, so callers
+// that know the kind of their string (see _fasttrie.c) skip the key switch.
+// Each picks the loop for the storage width once per call.
+trie_node_t *trie_search_ucs1(trie_t *t, const uint8_t *s, unsigned long size)
+{
+    trie_node_t *r;
 
-    if (t->value != 0) {
-        *value_offset = *value_offset + 1;
-        value_ptrs[*value_offset] = t->value;
-        value_idx = *value_offset;
-    }
-    else {
-        value_idx = 0;
+    switch(t->char_size)
+    {
+        case 1:
+            r = _prefix_k1w1(t->root, s, size, NULL);
+            break;
+        case 2:
+            r = _prefix_k1w2(t->root, s, size, NULL);
+            break;
+        default:
+            r = _prefix_k1w4(t->root, s, size, NULL);
+            break;
     }
+    return r && r->value ? r : NULL;
+}
 
-    memcpy(i_ptr, &t->key, sizeof(char));
-    memcpy(i_ptr + 1, &value_idx, sizeof(unsigned long));
-    memcpy(i_ptr + 1 + sizeof(value_idx), &child_count, sizeof(char));
-    *node_offset = *node_offset + 1;
+trie_node_t *trie_search_ucs2(trie_t *t, const uint16_t *s, unsigned long size)
+{
+    trie_node_t *r;
 
-    trie_node_t ** children = trie_node_children(t);
-    for (int i = 0; i < child_count; i++) {
-        child = children[i];
-        trie_node_serializer(child, s, node_offset, value_ptrs, value_offset);
+    switch(t->char_size)
+    {
+        case 1:
+            r = _prefix_k2w1(t->root, s, size, NULL);
+            break;
+        case 2:
+            r = _prefix_k2w2(t->root, s, size, NULL);
+            break;
+        default:
+            r = _prefix_k2w4(t->root, s, size, NULL);
+            break;
     }
-    free(children);
-
-    return 0;
+    return r && r->value ? r : NULL;
 }
 
-trie_node_t *trie_node_deserializer(trie_t *trie, char *s, unsigned long *node_offset, TRIE_DATA *value_ptrs) {
-    unsigned long s_offset = *node_offset * TRIE_NODE_SIZE;
-    unsigned long value_idx;
-    char key;
-    char child_count;
-    char * i_ptr = s + s_offset;
-
-    memcpy(&key, i_ptr, sizeof(char));
-    memcpy(&value_idx, i_ptr + 1, sizeof(unsigned long));
-    memcpy(&child_count, i_ptr + 1 + sizeof(unsigned long), sizeof(char));
-
-    TRIE_DATA *value = value_ptrs[value_idx];
+trie_node_t *trie_search_ucs4(trie_t *t, const uint32_t *s, unsigned long size)
+{
+    trie_node_t *r;
 
-    trie_node_t *node = NODECREATE(trie, key, value);
-    for(int i = 0; i < child_count; i++) {
-        *node_offset = *node_offset + 1;
-        trie_add_child(trie, node, (trie_node_t *)trie_node_deserializer(trie, s, node_offset, value_ptrs));
+    switch(t->char_size)
+    {
+        case 1:
+            r = _prefix_k4w1(t->root, s, size, NULL);
+            break;
+        case 2:
+            r = _prefix_k4w2(t->root, s, size, NULL);
+            break;
+        default:
+            r = _prefix_k4w4(t->root, s, size, NULL);
+            break;
     }
-
-    return node;
+    return r && r->value ? r : NULL;
 }
 
-trie_serialized_t *trie_serialize(trie_t *t) {
-    trie_serialized_t *repr = (trie_serialized_t *)TRIEMALLOC(NULL, sizeof(trie_serialized_t));
-    unsigned long s_size, value_size, node_offset, value_offset;
-
-    s_size = t->node_count * TRIE_NODE_SIZE;
-    value_size = (t->item_count + 1) * sizeof(TRIE_DATA);
-    node_offset = value_offset = 0;
-
-    char *s = (char *)TRIEMALLOC(NULL, s_size);
-    TRIE_DATA *value_ptrs = (TRIE_DATA *)TRIEMALLOC(NULL, value_size);
-    value_ptrs[0] = 0;
+// Starts the lookup of keys[i] in lane.
+static void _lane_start(trie_t *t, trie_lane_t *lane, trie_key_t *keys, 
+    unsigned long i)
+{
+    lane->node = t->root;
+    lane->child = NULL;
+    lane->s = keys[i].s;
+    lane->size = keys[i].size;
+    lane->index = 0;
+    lane->key = i;
+    switch(WIDTHPAIR(keys[i].char_size, t->char_size))
+    {
+        case WIDTHPAIR(2, 1):
+            lane->step = _lane_step_k2w1;
+            break;
+        case WIDTHPAIR(2, 2):
+            lane->step = _lane_step_k2w2;
+            break;
+        case WIDTHPAIR(2, 4):
+            lane->step = _lane_step_k2w4;
+            break;
+        case WIDTHPAIR(4, 1):
+            lane->step = _lane_step_k4w1;
+            break;
+        case WIDTHPAIR(4, 2):
+            lane->step = _lane_step_k4w2;
+            break;
+        case WIDTHPAIR(4, 4):
+            lane->step = _lane_step_k4w4;
+            break;
+        default:
+            // an empty key may come without a char_size
+            lane->step = t->char_size == 1 ? _lane_step_k1w1 : 
+                (t->char_size == 2 ? _lane_step_k1w2 : _lane_step_k1w4);
+            break;
+    }
+}
+
+static unsigned long _batch_lanes = TRIE_BATCH_LANES;
+
+// Selects how many lookups trie_search_many() interleaves, at most 
+// TRIE_BATCH_LANES. 0 looks the keys up one after the other with 
+// trie_search(), for comparison. A negative count only queries. Returns the
+// count in effect.
+int trie_batch_lanes_set(int lanes)
+{
+    if (lanes >= 0) {
+        _batch_lanes = lanes < TRIE_BATCH_LANES ? lanes : TRIE_BATCH_LANES;
+    }
+    return (int)_batch_lanes;
+}
+
+// Looks up n keys at once: out[i] is the node of keys[i], NULL if it is not
+// in the trie. A lookup spends most of its time waiting for the next node
+// or container, one cache miss per edge, so up to TRIE_BATCH_LANES of them 
+// advance in lockstep, each prefetching what its next step reads. The 
+// misses of a round then overlap instead of adding up.
+void trie_search_many(trie_t *t, trie_key_t *keys, unsigned long n, 
+    trie_node_t **out)
+{
+    trie_lane_t lanes[TRIE_BATCH_LANES];
+    unsigned long next, live, i;
+
+    if (!_batch_lanes) {
+        for (i = 0; i < n; i++) {
+            out[i] = trie_search(t, &keys[i]);
+        }
+        return;
+    }
+
+    live = 0;
+    for (next = 0; next < n && live < _batch_lanes; next++) {
+        _lane_start(t, &lanes[live++], keys, next);
+    }
+
+    while (live) {
+        i = 0;
+        while (i < live) {
+            if (lanes[i].step(&lanes[i])) {
+                i++;
+                continue;
+            }
+            out[lanes[i].key] = lanes[i].node && lanes[i].node->value ? 
+                lanes[i].node : NULL;
+            if (next < n) {
+                _lane_start(t, &lanes[i], keys, next++);
+                i++;
+            } else {
+                lanes[i] = lanes[--live];
+            }
+        }
+    }
+}
+
+#define _KEY_COMMON(T) \
+    for (i = 0; i < n && ((const T *)a->s)[i] == ((const T *)b->s)[i]; i++)
+
+// Number of leading chars two keys of any char_size share. Keys of the same
+// width, the usual case in a batch, are compared without a dispatch per char.
+static unsigned long _key_common(const trie_key_t *a, const trie_key_t *b)
+{
+    unsigned long i, n;
+
+    n = a->size < b->size ? a->size : b->size;
+    if (a->char_size != b->char_size) {
+        for (i = 0; i < n; i++) {
+            if (WCHAR_READ(a->s, a->char_size, i) != WCHAR_READ(b->s, b->char_size, i)) {
+                break;
+            }
+        }
+        return i;
+    }
+    switch(a->char_size)
+    {
+        case 1:
+            _KEY_COMMON(uint8_t);
+            break;
+        case 2:
+            _KEY_COMMON(uint16_t);
+            break;
+        default:
+            _KEY_COMMON(uint32_t);
+            break;
+    }
+    return i;
+}
+
+#undef _KEY_COMMON
+
+// Code point order of two keys of any char_size.
+static int _key_cmp(const trie_key_t *ka, const trie_key_t *kb)
+{
+    unsigned long i;
+    TRIE_CHAR ca, cb;
+
+    i = _key_common(ka, kb);
+    if (i < ka->size && i < kb->size) {
+        ca = WCHAR_READ(ka->s, ka->char_size, i);
+        cb = WCHAR_READ(kb->s, kb->char_size, i);
+        return ca < cb ? -1 : 1;
+    }
+    return ka->size < kb->size ? -1 : (ka->size > kb->size);
+}
+
+#define SORT_UNSORTED 16 // over n / this keys moved, a batch is unsorted
+
+// Insertion sorts order[0, n), which costs a compare per key if the keys 
+// come sorted and little more if few are out of place. Gives up, with 
+// order[0, n) still a permutation, once more than limit keys have been 
+// moved. Returns 0 if it gave up.
+static int _sort_nearly(trie_key_t **order, unsigned long n, 
+    unsigned long limit)
+{
+    trie_key_t *x;
+    unsigned long i, j;
+
+    for (i = 1; i < n; i++) {
+        x = order[i];
+        for (j = i; j > 0 && _key_cmp(order[j - 1], x) > 0; j--) {
+            if (!limit--) {
+                order[j] = x;
+                return 0;
+            }
+            order[j] = order[j - 1];
+        }
+        order[j] = x;
+    }
+    return 1;
+}
+
+// Same as trie_search_many(), but the keys are sorted first and the trie is
+// walked once: each key starts from the deepest node on the path of the 
+// previous one that is still within their common prefix, instead of from 
+// the root. A key that shares the char the previous key failed on fails at 
+// once. Pays off for batches with long shared prefixes that come sorted 
+// or nearly so. Sorting a shuffled batch costs more per key than the walk
+// saves, so one with more than 1 in SORT_UNSORTED keys out of place is 
+// left to trie_search_many() instead. Returns 0 if out of memory.
+int trie_search_sorted(trie_t *t, trie_key_t *keys, unsigned long n, 
+    trie_node_t **out)
+{
+    trie_key_t **order, *k, *prev;
+    trie_node_t **path, *node, *child;
+    unsigned long *depth, top, lcp, fail, i, j, m;
+
+    order = (trie_key_t **)TRIEMALLOC(t, n * sizeof(trie_key_t *) + 1);
+    path = (trie_node_t **)TRIEMALLOC(t, (t->height + 2) * sizeof(trie_node_t *));
+    depth = (unsigned long *)TRIEMALLOC(t, (t->height + 2) * sizeof(unsigned long));
+    if (!order || !path || !depth) {
+        if (order) {
+            TRIEFREE(t, order);
+        }
+        if (path) {
+            TRIEFREE(t, path);
+        }
+        if (depth) {
+            TRIEFREE(t, depth);
+        }
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        order[i] = &keys[i];
+    }
+    if (!_sort_nearly(order, n, n / SORT_UNSORTED)) {
+        TRIEFREE(t, order);
+        TRIEFREE(t, path);
+        TRIEFREE(t, depth);
+        trie_search_many(t, keys, n, out);
+        return 1;
+    }
+
+    // path[0, top] are the nodes matched by the previous key, depth[i] is 
+    // the number of key chars down to the end of path[i]. fail is where the
+    // previous key stopped matching, ULONG_MAX if it did not.
+    path[0] = t->root;
+    depth[0] = 0;
+    top = 0;
+    fail = ULONG_MAX;
+    prev = NULL;
+    for (i = 0; i < n; i++) {
+        k = order[i];
+        lcp = prev ? _key_common(prev, k) : 0;
+        prev = k;
+        if (fail != ULONG_MAX && lcp > fail) {
+            out[k - keys] = NULL;
+            continue;
+        }
+        while (depth[top] > lcp) {
+            top--;
+        }
+
+        node = path[top];
+        j = depth[top];
+        fail = ULONG_MAX;
+        while (j < k->size) {
+            child = trie_get_child(t, node, WCHAR_READ(k->s, k->char_size, j));
+            if (!child) {
+                fail = j;
+                break;
+            }
+            m = _label_common(t, child, k, j);
+            if (m < child->label_len) {
+                fail = j + m;
+                break;
+            }
+            j += m;
+            node = child;
+            if (top + 1 < t->height + 2) {
+                path[++top] = node;
+                depth[top] = j;
+            }
+        }
+        out[k - keys] = fail == ULONG_MAX && node->value ? node : NULL;
+    }
+
+    TRIEFREE(t, order);
+    TRIEFREE(t, path);
+    TRIEFREE(t, depth);
+    return 1;
+}
+
+trie_node_t *trie_search(trie_t *t, trie_key_t *key)
+{
+    switch(key->char_size)
+    {
+        case 1:
+            return trie_search_ucs1(t, KEY_AS(uint8_t), key->size);
+        case 2:
+            return trie_search_ucs2(t, KEY_AS(uint16_t), key->size);
+        case 4:
+            return trie_search_ucs4(t, KEY_AS(uint32_t), key->size);
+    }
+    // an empty key may come without a char_size
+    return key->size || !t->root->value ? NULL : t->root;
+}
+
+trie_node_t *_next_child(trie_node_t *node, unsigned char w,
+    unsigned long *pos, TRIE_CHAR *key)
+{
+    trie_node48_t *n48;
+    trie_node256_t *n256;
+    unsigned char slot;
+
+    switch(node->kind)
+    {
+        case TRIE_NODE4:
+        case TRIE_NODE16:
+        case TRIE_NODEN:
+            if (*pos >= node->child_count) {
+                return NULL;
+            }
+            *key = WCHAR_READ(SORTED_KEYS(node), w, *pos);
+            return SORTED_CHILDREN(node)[(*pos)++];
+        case TRIE_NODE48:
+            n48 = (trie_node48_t *)node->children;
+            while (*pos < TRIE_NODE_PAGE_SIZE) {
+                slot = n48->index[(*pos)++];
+                if (slot) {
+                    *key = (n48->page << 8) | (TRIE_CHAR)(*pos - 1);
+                    return n48->children[slot-1];
+                }
+            }
+            return NULL;
+        case TRIE_NODE256:
+            n256 = (trie_node256_t *)node->children;
+            while (*pos < TRIE_NODE_PAGE_SIZE) {
+                if (n256->children[(*pos)++]) {
+                    *key = (n256->page << 8) | (TRIE_CHAR)(*pos - 1);
+                    return n256->children[*pos - 1];
+                }
+            }
+            return NULL;
+    }
+    return NULL;
+}
+
+// Walks the children of node in code point order without allocating. *pos 
+// shall be 0 on the first call. Returns NULL when there are no more children.
+trie_node_t *trie_node_next_child(trie_t *t, trie_node_t *node, 
+    unsigned long *pos, TRIE_CHAR *key)
+{
+    return _next_child(node, t->char_size, pos, key);
+}
+
+// Moves the children of node into a new container of the given kind.
+int NODEREPACK(trie_t *t, trie_node_t *node, unsigned char kind, 
+    unsigned char cap_shift)
+{
+    void *c;
+    trie_node48_t *n48;
+    trie_node256_t *n256;
+    trie_node_t *child, **children;
+    TRIE_CHAR ch;
+    unsigned char *keys;
+    unsigned long pos, i;
+
+    c = ARENAALLOC(t, CONTAINERSIZE(kind, cap_shift, t->char_size));
+    if (!c) {
+        return 0;
+    }
+
+    n48 = (trie_node48_t *)c;
+    n256 = (trie_node256_t *)c;
+    children = (trie_node_t **)c;
+    keys = (unsigned char *)(children + (1UL << cap_shift));
+    if (kind == TRIE_NODE48) {
+        memset(n48, 0, sizeof(trie_node48_t));
+    } else if (kind == TRIE_NODE256) {
+        memset(n256, 0, sizeof(trie_node256_t));
+    }
+
+    pos = i = 0;
+    while ((child = trie_node_next_child(t, node, &pos, &ch))) {
+        switch(kind)
+        {
+            case TRIE_NODE48:
+                n48->page = PAGE_OF(ch);
+                n48->children[i] = child;
+                n48->index[PAGE_INDEX(ch)] = (unsigned char)(i+1);
+                break;
+            case TRIE_NODE256:
+                n256->page = PAGE_OF(ch);
+                n256->children[PAGE_INDEX(ch)] = child;
+                break;
+            default:
+                children[i] = child;
+                WCHAR_WRITE(keys, t->char_size, i, ch);
+                break;
+        }
+        i++;
+    }
+
+    if (node->children) {
+        ARENAFREE(t, node->children, CONTAINERSIZE(node->kind, node->cap_shift,
+            t->char_size));
+    }
+    node->children = c;
+    node->kind = kind;
+    node->cap_shift = cap_shift;
+
+    return 1;
+}
+
+// Make room for one more child with key ch, switching to a larger or 
+// different kind of container if necessary.
+int NODEGROW(trie_t *t, trie_node_t *node, TRIE_CHAR ch)
+{
+    unsigned char *keys;
+    unsigned long n;
+
+    n = node->child_count;
+    switch(node->kind)
+    {
+        case TRIE_NODE0:
+            return NODEREPACK(t, node, TRIE_NODE4, 0);
+        case TRIE_NODE4:
+        case TRIE_NODE16:
+        case TRIE_NODEN:
+            if (n < NODECAP(node)) {
+                return 1;
+            }
+            keys = SORTED_KEYS(node);
+            if (n == TRIE_NODE16_MAX && 
+                PAGE_OF(WCHAR_READ(keys, t->char_size, 0)) == PAGE_OF(ch) && 
+                PAGE_OF(WCHAR_READ(keys, t->char_size, n-1)) == PAGE_OF(ch)) {
+                return NODEREPACK(t, node, TRIE_NODE48, 0);
+            }
+            return NODEREPACK(t, node, SORTEDKIND(node->cap_shift+1), 
+                node->cap_shift+1);
+        case TRIE_NODE48:
+            if (PAGE_OF(ch) != ((trie_node48_t *)node->children)->page) {
+                return NODEREPACK(t, node, SORTEDKIND(CAPSHIFT(n+1)), CAPSHIFT(n+1));
+            }
+            if (n == TRIE_NODE48_MAX) {
+                return NODEREPACK(t, node, TRIE_NODE256, 0);
+            }
+            return 1;
+        case TRIE_NODE256:
+            if (PAGE_OF(ch) != ((trie_node256_t *)node->children)->page) {
+                return NODEREPACK(t, node, SORTEDKIND(CAPSHIFT(n+1)), CAPSHIFT(n+1));
+            }
+            return 1;
+    }
+    return 0;
+}
+
+// Switch to a smaller container after a child is removed. Failing to do so 
+// is not an error, the current container is still valid.
+void NODESHRINK(trie_t *t, trie_node_t *node)
+{
+    unsigned long n;
+
+    n = node->child_count;
+    if (n == 0) {
+        ARENAFREE(t, node->children, CONTAINERSIZE(node->kind, node->cap_shift,
+            t->char_size));
+        node->children = NULL;
+        node->kind = TRIE_NODE0;
+        node->cap_shift = 0;
+        return;
+    }
+
+    switch(node->kind)
+    {
+        case TRIE_NODE4:
+        case TRIE_NODE16:
+        case TRIE_NODEN:
+            if (n <= NODECAP(node) / 4) {
+                NODEREPACK(t, node, SORTEDKIND(CAPSHIFT(n)), CAPSHIFT(n));
+            }
+            break;
+        case TRIE_NODE48:
+            if (n <= TRIE_NODE48_MIN) {
+                NODEREPACK(t, node, TRIE_NODE16, CAPSHIFT(TRIE_NODE16_MAX));
+            }
+            break;
+        case TRIE_NODE256:
+            if (n <= TRIE_NODE256_MIN) {
+                NODEREPACK(t, node, TRIE_NODE48, 0);
+            }
+            break;
+    }
+}
+
+int trie_add_child(trie_t *t, trie_node_t *parent, trie_node_t *child)
+{
+    trie_node48_t *n48;
+    trie_node_t **children;
+    TRIE_CHAR ch;
+    unsigned char *keys, w;
+    unsigned long i, n;
+
+    w = t->char_size;
+    ch = WCHAR_READ(NODELABEL(child, w), w, 0);
+    if (!NODEGROW(t, parent, ch)) {
+        return 0;
+    }
+
+    n = parent->child_count;
+    switch(parent->kind)
+    {
+        case TRIE_NODE4:
+        case TRIE_NODE16:
+        case TRIE_NODEN:
+            i = _sorted_lower_bound(t, parent, ch);
+            children = SORTED_CHILDREN(parent);
+            keys = SORTED_KEYS(parent);
+            memmove(&children[i+1], &children[i], (n-i) * sizeof(trie_node_t *));
+            memmove(&keys[(i+1)*w], &keys[i*w], (n-i) * w);
+            children[i] = child;
+            WCHAR_WRITE(keys, w, i, ch);
+            break;
+        case TRIE_NODE48:
+            n48 = (trie_node48_t *)parent->children;
+            for (i = 0; n48->children[i]; i++)
+                ;
+            n48->children[i] = child;
+            n48->index[PAGE_INDEX(ch)] = (unsigned char)(i+1);
+            break;
+        case TRIE_NODE256:
+            ((trie_node256_t *)parent->children)->children[PAGE_INDEX(ch)] = child;
+            break;
+    }
+
+    parent->child_count++;
+    t->node_count++;
+    return 1;
+}
+
+int trie_remove_child(trie_t *t, trie_node_t *parent, trie_node_t *child)
+{
+    trie_node48_t *n48;
+    trie_node256_t *n256;
+    trie_node_t **children;
+    TRIE_CHAR ch;
+    unsigned char *keys, w;
+    unsigned long i, n;
+    unsigned char slot;
+
+    w = t->char_size;
+    ch = WCHAR_READ(NODELABEL(child, w), w, 0);
+    n = parent->child_count;
+    switch(parent->kind)
+    {
+        case TRIE_NODE4:
+        case TRIE_NODE16:
+        case TRIE_NODEN:
+            i = _sorted_lower_bound(t, parent, ch);
+            children = SORTED_CHILDREN(parent);
+            keys = SORTED_KEYS(parent);
+            if (i >= n || children[i] != child) {
+                return 0; // Not found. Can't be removed.
+            }
+            memmove(&children[i], &children[i+1], (n-i-1) * sizeof(trie_node_t *));
+            memmove(&keys[i*w], &keys[(i+1)*w], (n-i-1) * w);
+            break;
+        case TRIE_NODE48:
+            n48 = (trie_node48_t *)parent->children;
+            if (PAGE_OF(ch) != n48->page) {
+                return 0;
+            }
+            slot = n48->index[PAGE_INDEX(ch)];
+            if (!slot || n48->children[slot-1] != child) {
+                return 0;
+            }
+            n48->children[slot-1] = NULL;
+            n48->index[PAGE_INDEX(ch)] = 0;
+            break;
+        case TRIE_NODE256:
+            n256 = (trie_node256_t *)parent->children;
+            if (PAGE_OF(ch) != n256->page || n256->children[PAGE_INDEX(ch)] != child) {
+                return 0;
+            }
+            n256->children[PAGE_INDEX(ch)] = NULL;
+            break;
+        default:
+            return 0;
+    }
+
+    NODEFREE(t, child);
+    parent->child_count--;
+    t->node_count--;
+    NODESHRINK(t, parent);
+    return 1;
+}
+
+// Splits the label of nd after its first len chars. The rest of the label, 
+// the value and the children move to a new single child of nd.
+int NODESPLIT(trie_t *t, trie_node_t *nd, unsigned long len)
+{
+    trie_node_t *lower;
+    unsigned char *label, w;
+    void *c;
+
+    assert(len > 0 && len < nd->label_len);
+
+    // allocate everything first, so that a failure leaves nd untouched.
+    w = t->char_size;
+    c = ARENAALLOC(t, CONTAINERSIZE(TRIE_NODE4, 0, w));
+    if (!c) {
+        return 0;
+    }
+    lower = NODECREATE(t, nd->value);
+    if (!lower) {
+        ARENAFREE(t, c, CONTAINERSIZE(TRIE_NODE4, 0, w));
+        return 0;
+    }
+    label = (unsigned char *)NODELABEL(nd, w);
+    if (!LABELSET(t, lower, &label[len*w], nd->label_len - len) || 
+        !LABELSET(t, nd, label, len)) {
+        NODEFREE(t, lower);
+        ARENAFREE(t, c, CONTAINERSIZE(TRIE_NODE4, 0, w));
+        return 0;
+    }
+
+    lower->children = nd->children;
+    lower->child_count = nd->child_count;
+    lower->kind = nd->kind;
+    lower->cap_shift = nd->cap_shift;
+
+    nd->value = 0;
+    nd->children = c;
+    nd->child_count = 1;
+    nd->kind = TRIE_NODE4;
+    nd->cap_shift = 0;
+    SORTED_CHILDREN(nd)[0] = lower;
+    WCHAR_WRITE(SORTED_KEYS(nd), w, 0, WCHAR_READ(NODELABEL(lower, w), w, 0));
+    t->node_count++;
+
+    return 1;
+}
+
+// Merges nd with its only child: nd keeps its place in its parent and takes
+// over the label, value and children of the child.
+int NODEMERGE(trie_t *t, trie_node_t *nd)
+{
+    trie_node_t *child;
+    TRIE_CHAR ch;
+    unsigned char *label, inl[sizeof(void *)], w;
+    unsigned long pos, len;
+
+    assert(nd->child_count == 1 && !nd->value);
+
+    w = t->char_size;
+    pos = 0;
+    child = trie_node_next_child(t, nd, &pos, &ch);
+    len = nd->label_len + child->label_len;
+
+    label = inl;
+    if (len > LABEL_INLINE(w)) {
+        label = (unsigned char *)ARENAALLOC(t, len * w);
+        if (!label) {
+            return 0;
+        }
+    }
+    memcpy(label, NODELABEL(nd, w), nd->label_len * w);
+    memcpy(&label[nd->label_len * w], NODELABEL(child, w), 
+        child->label_len * w);
+    if (nd->label_len > LABEL_INLINE(w)) {
+        ARENAFREE(t, nd->label.ext, nd->label_len * w);
+    }
+    if (len > LABEL_INLINE(w)) {
+        nd->label.ext = label;
+    } else {
+        memcpy(nd->label.inl, inl, len * w);
+    }
+    nd->label_len = len;
+
+    ARENAFREE(t, nd->children, CONTAINERSIZE(nd->kind, nd->cap_shift, w));
+    nd->value = child->value;
+    nd->children = child->children;
+    nd->child_count = child->child_count;
+    nd->kind = child->kind;
+    nd->cap_shift = child->cap_shift;
+
+    child->children = NULL;
+    NODEFREE(t, child);
+    t->node_count--;
+
+    return 1;
+}
+
+typedef enum widen_pass_e {
+    WIDEN_ALLOC = 0,
+    WIDEN_UNDO,
+    WIDEN_SWAP,
+} widen_pass_t;
+
+// Visits nodes in preorder; every node owns two slots in blocks: the new 
+// external label and the new sorted container, NULL if it needs none. 
+// Returns 0 if an allocation failed, leaving *slot at the first unused slot.
+int _widen(trie_t *t, trie_node_t *nd, unsigned char w, void **blocks, 
+    unsigned long *slot, unsigned long end, widen_pass_t pass)
+{
+    trie_node_t *child;
+    TRIE_CHAR ch;
+    unsigned char ow, *label, *keys;
+    unsigned long i, pos, lsize, csize;
+    void *old;
+
+    ow = t->char_size;
+    lsize = nd->label_len > LABEL_INLINE(w) ? nd->label_len * w : 0;
+    csize = nd->kind != TRIE_NODE48 && nd->kind != TRIE_NODE256 && nd->children ? 
+        CONTAINERSIZE(nd->kind, nd->cap_shift, w) : 0;
+
+    switch(pass)
+    {
+        case WIDEN_ALLOC:
+            blocks[*slot] = lsize ? ARENAALLOC(t, lsize) : NULL;
+            blocks[*slot+1] = csize ? ARENAALLOC(t, csize) : NULL;
+            if ((lsize && !blocks[*slot]) || (csize && !blocks[*slot+1])) {
+                if (blocks[*slot]) {
+                    ARENAFREE(t, blocks[*slot], lsize);
+                }
+                if (blocks[*slot+1]) {
+                    ARENAFREE(t, blocks[*slot+1], csize);
+                }
+                return 0;
+            }
+            break;
+        case WIDEN_UNDO:
+            if (*slot >= end) {
+                return 1;
+            }
+            if (blocks[*slot]) {
+                ARENAFREE(t, blocks[*slot], lsize);
+            }
+            if (blocks[*slot+1]) {
+                ARENAFREE(t, blocks[*slot+1], csize);
+            }
+            break;
+        case WIDEN_SWAP:
+            // chars are moved from the last one on, so that a label widened 
+            // within the inline buffer does not overwrite itself.
+            old = NODELABEL(nd, ow);
+            label = lsize ? (unsigned char *)blocks[*slot] : nd->label.inl;
+            for (i = nd->label_len; i > 0; i--) {
+                WCHAR_WRITE(label, w, i-1, WCHAR_READ(old, ow, i-1));
+            }
+            if (nd->label_len > LABEL_INLINE(ow)) {
+                ARENAFREE(t, old, nd->label_len * ow);
+            }
+            if (lsize) {
+                nd->label.ext = label;
+            }
+
+            if (csize) {
+                keys = (unsigned char *)blocks[*slot+1];
+                memcpy(keys, nd->children, NODECAP(nd) * sizeof(trie_node_t *));
+                keys += NODECAP(nd) * sizeof(trie_node_t *);
+                for (i = 0; i < nd->child_count; i++) {
+                    WCHAR_WRITE(keys, w, i, WCHAR_READ(SORTED_KEYS(nd), ow, i));
+                }
+                ARENAFREE(t, nd->children, CONTAINERSIZE(nd->kind, nd->cap_shift, ow));
+                nd->children = blocks[*slot+1];
+            }
+            break;
+    }
+    *slot += 2;
+
+    pos = 0;
+    while ((child = _next_child(nd, pass == WIDEN_SWAP ? w : ow, &pos, &ch))) {
+        if (!_widen(t, child, w, blocks, slot, end, pass)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Re-encodes the subtrees of the n nodes in roots, of at most node_count 
+// nodes in all, with char_size bytes per char.
+static int _widen_roots(trie_t *t, trie_node_t **roots, unsigned long n, 
+    unsigned long node_count, unsigned char char_size)
+{
+    void **blocks;
+    unsigned long slot, end, i;
+
+    blocks = (void **)TRIEMALLOC(t, 2 * node_count * sizeof(void *) + 1);
+    if (!blocks) {
+        return 0;
+    }
+    slot = 0;
+    for (i = 0; i < n; i++) {
+        if (!_widen(t, roots[i], char_size, blocks, &slot, 0, WIDEN_ALLOC)) {
+            end = slot;
+            slot = 0;
+            for (i = 0; i < n && slot < end; i++) {
+                _widen(t, roots[i], char_size, blocks, &slot, end, WIDEN_UNDO);
+            }
+            TRIEFREE(t, blocks);
+            return 0;
+        }
+    }
+    slot = 0;
+    for (i = 0; i < n; i++) {
+        _widen(t, roots[i], char_size, blocks, &slot, 0, WIDEN_SWAP);
+    }
+    t->char_size = char_size;
+    TRIEFREE(t, blocks);
+
+    return 1;
+}
+
+// Re-encodes every label and sorted container of the trie with char_size 
+// bytes per char. All new blocks are allocated before any node is changed, 
+// so on failure the trie is left as it was.
+int trie_widen(trie_t *t, unsigned char char_size)
+{
+    if (char_size <= t->char_size) {
+        return 1;
+    }
+    return _widen_roots(t, &t->root, 1, t->node_count, char_size);
+}
+
+int trie_add_ucs1(trie_t *t, const uint8_t *s, unsigned long size,
+    TRIE_DATA value)
+{
+    switch(t->char_size)
+    {
+        case 1:
+            return _add_k1w1(t, s, size, value);
+        case 2:
+            return _add_k1w2(t, s, size, value);
+        default:
+            return _add_k1w4(t, s, size, value);
+    }
+}
+
+int trie_add_ucs2(trie_t *t, const uint16_t *s, unsigned long size,
+    TRIE_DATA value)
+{
+    // the key may have chars the trie cannot store yet
+    if (t->char_size < 2 && !trie_widen(t, KEYWIDTH(s, 2, size))) {
+        return 0;
+    }
+    switch(t->char_size)
+    {
+        case 1:
+            return _add_k2w1(t, s, size, value);
+        case 2:
+            return _add_k2w2(t, s, size, value);
+        default:
+            return _add_k2w4(t, s, size, value);
+    }
+}
+
+int trie_add_ucs4(trie_t *t, const uint32_t *s, unsigned long size,
+    TRIE_DATA value)
+{
+    if (t->char_size < 4 && !trie_widen(t, KEYWIDTH(s, 4, size))) {
+        return 0;
+    }
+    switch(t->char_size)
+    {
+        case 1:
+            return _add_k4w1(t, s, size, value);
+        case 2:
+            return _add_k4w2(t, s, size, value);
+        default:
+            return _add_k4w4(t, s, size, value);
+    }
+}
+
+int trie_add(trie_t *t, trie_key_t *key, TRIE_DATA value)
+{
+    switch(key->char_size)
+    {
+        case 1:
+            return trie_add_ucs1(t, KEY_AS(uint8_t), key->size, value);
+        case 2:
+            return trie_add_ucs2(t, KEY_AS(uint16_t), key->size, value);
+        case 4:
+            return trie_add_ucs4(t, KEY_AS(uint32_t), key->size, value);
+    }
+    assert(0 == 1); // unsupported char_size
+    return 0;
+}
+
+int trie_del_ucs1(trie_t *t, const uint8_t *s, unsigned long size)
+{
+    switch(t->char_size)
+    {
+        case 1:
+            return _del_k1w1(t, s, size);
+        case 2:
+            return _del_k1w2(t, s, size);
+        default:
+            return _del_k1w4(t, s, size);
+    }
+}
+
+int trie_del_ucs2(trie_t *t, const uint16_t *s, unsigned long size)
+{
+    switch(t->char_size)
+    {
+        case 1:
+            return _del_k2w1(t, s, size);
+        case 2:
+            return _del_k2w2(t, s, size);
+        default:
+            return _del_k2w4(t, s, size);
+    }
+}
+
+int trie_del_ucs4(trie_t *t, const uint32_t *s, unsigned long size)
+{
+    switch(t->char_size)
+    {
+        case 1:
+            return _del_k4w1(t, s, size);
+        case 2:
+            return _del_k4w2(t, s, size);
+        default:
+            return _del_k4w4(t, s, size);
+    }
+}
+
+int trie_del(trie_t *t, trie_key_t *key)
+{
+    switch(key->char_size)
+    {
+        case 1:
+            return trie_del_ucs1(t, KEY_AS(uint8_t), key->size);
+        case 2:
+            return trie_del_ucs2(t, KEY_AS(uint16_t), key->size);
+        case 4:
+            return trie_del_ucs4(t, KEY_AS(uint32_t), key->size);
+    }
+    assert(0 == 1); // unsupported char_size
+    return 0;
+}
+
+// Note 11:
+// The serialized form is a header followed by one record per node in 
+// preorder, children in code point order:
+//   header: varint TRIE_SERIAL_VERSION, char_size byte, varint item_count, 
+//           varint node_count, varint height
+//   record: varint (child_count << 1 | has value), varint label_len, 
+//           label_len chars of char_size bytes
+// Varints are LEB128: 7 bits per byte, low bits first. Values are not part
+// of it, they are handed over separately in the order of the records that 
+// have one.
+
+// Writes v as a varint at s, if s is not NULL. Returns its size.
+static unsigned long _varint_put(unsigned char *s, uint64_t v)
+{
+    unsigned long n = 0;
+
+    do {
+        if (s) {
+            s[n] = (unsigned char)((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+        }
+        n++;
+        v >>= 7;
+    } while (v);
+    return n;
+}
+
+// Reads a varint at *p, not past end. Returns 0 if it is cut or too long.
+static int _varint_get(const unsigned char **p, const unsigned char *end, 
+    uint64_t *v)
+{
+    unsigned int shift = 0;
+
+    *v = 0;
+    while (*p < end && shift < 64) {
+        *v |= (uint64_t)(**p & 0x7f) << shift;
+        if (!(*(*p)++ & 0x80)) {
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+// Writes the record of nd at s, if s is not NULL. Returns its size.
+static unsigned long _serialize_node(trie_t *t, trie_node_t *nd, 
+    unsigned char *s)
+{
+    unsigned long n, len;
+
+    n = _varint_put(s, ((uint64_t)nd->child_count << 1) | (nd->value != 0));
+    n += _varint_put(s ? s + n : NULL, nd->label_len);
+    len = nd->label_len * t->char_size;
+    if (s) {
+        memcpy(s + n, NODELABEL(nd, t->char_size), len);
+    }
+    return n + len;
+}
+
+// Walks the trie in preorder, writing the records at s and the values to 
+// values if they are not NULL. Returns the size of the records, 0 if the 
+// walk could not be done.
+static unsigned long _serialize_nodes(trie_t *t, unsigned char *s, 
+    TRIE_DATA *values)
+{
+    iter_stack_t *stack;
+    iter_pos_t ipos, *ip;
+    trie_node_t *child;
+    unsigned long size, item;
+    TRIE_CHAR ch;
+
+    // every edge has a char at least, so a path holds at most height + 1
+    // nodes.
+    stack = STACKCREATE(t, t->height + 2);
+    if (!stack) {
+        return 0;
+    }
+    size = _serialize_node(t, t->root, s);
+    item = 0;
+    if (t->root->value && values) {
+        values[item++] = t->root->value;
+    }
+    ipos.iptr = t->root;
+    ipos.pos = 0;
+    PUSHI(stack, &ipos);
+
+    while ((ip = PEEKI(stack))) {
+        child = trie_node_next_child(t, ip->iptr, &ip->pos, &ch);
+        if (!child) {
+            POPI(stack);
+            continue;
+        }
+        size += _serialize_node(t, child, s ? s + size : NULL);
+        if (child->value && values) {
+            values[item++] = child->value;
+        }
+        if (child->child_count) {
+            if (stack->index == stack->size) {
+                STACKFREE(t, stack);
+                return 0; // height is off, the trie is corrupt
+            }
+            ipos.iptr = child;
+            ipos.pos = 0;
+            PUSHI(stack, &ipos);
+        }
+    }
+
+    STACKFREE(t, stack);
+    return size;
+}
+
+// Writes the header of the serialized form of t at head, if it is not NULL.
+// Returns its size.
+static unsigned long _serialize_head(trie_t *t, unsigned char *head)
+{
+    unsigned char buf[5 * 10 + 1];
+    unsigned long n;
+
+    n = _varint_put(buf, TRIE_SERIAL_VERSION);
+    buf[n++] = t->char_size;
+    n += _varint_put(buf + n, t->item_count);
+    n += _varint_put(buf + n, t->node_count);
+    n += _varint_put(buf + n, t->height);
+    if (head) {
+        memcpy(head, buf, n);
+    }
+    return n;
+}
+
+// Size of the serialized form of t, 0 if t cannot be walked. It is exact, 
+// so callers can serialize straight into a buffer they own.
+unsigned long trie_serialized_size(trie_t *t)
+{
+    unsigned long size;
+
+    size = _serialize_nodes(t, NULL, NULL);
+    return size ? _serialize_head(t, NULL) + size : 0;
+}
+
+// Writes the serialized form of t to s, of trie_serialized_size(t) bytes, 
+// and its item_count values to values. Returns 0 on failure.
+int trie_serialize_to(trie_t *t, char *s, TRIE_DATA *values)
+{
+    unsigned long n;
+
+    n = _serialize_head(t, (unsigned char *)s);
+    return _serialize_nodes(t, (unsigned char *)s + n, values) != 0;
+}
+
+// Gives node its n children at once, in a container of the kind and size 
+// that adding them one by one would end up with. children shall be in 
+// strictly increasing key order.
+static int NODEFILL(trie_t *t, trie_node_t *node, trie_node_t **children, 
+    unsigned long n)
+{
+    trie_node48_t *n48;
+    trie_node256_t *n256;
+    trie_node_t **dst;
+    unsigned char kind, cap_shift, *keys, w;
+    TRIE_CHAR lo, hi, ch;
+    unsigned long i;
+
+    w = t->char_size;
+    lo = WCHAR_READ(NODELABEL(children[0], w), w, 0);
+    hi = WCHAR_READ(NODELABEL(children[n-1], w), w, 0);
+    cap_shift = CAPSHIFT(n);
+    kind = SORTEDKIND(cap_shift);
+    if (n > TRIE_NODE16_MAX && PAGE_OF(lo) == PAGE_OF(hi)) {
+        kind = n > TRIE_NODE48_MAX ? TRIE_NODE256 : TRIE_NODE48;
+        cap_shift = 0;
+    }
+
+    node->children = ARENAALLOC(t, CONTAINERSIZE(kind, cap_shift, w));
+    if (!node->children) {
+        return 0;
+    }
+    node->kind = kind;
+    node->cap_shift = cap_shift;
+    node->child_count = n;
+    n48 = (trie_node48_t *)node->children;
+    n256 = (trie_node256_t *)node->children;
+    if (kind == TRIE_NODE48) {
+        memset(n48, 0, sizeof(trie_node48_t));
+        n48->page = PAGE_OF(lo);
+    } else if (kind == TRIE_NODE256) {
+        memset(n256, 0, sizeof(trie_node256_t));
+        n256->page = PAGE_OF(lo);
+    }
+    dst = SORTED_CHILDREN(node);
+    keys = SORTED_KEYS(node);
+
+    for (i = 0; i < n; i++) {
+        ch = WCHAR_READ(NODELABEL(children[i], w), w, 0);
+        if (i && ch <= WCHAR_READ(NODELABEL(children[i-1], w), w, 0)) {
+            return 0;
+        }
+        switch(kind)
+        {
+            case TRIE_NODE48:
+                n48->children[i] = children[i];
+                n48->index[PAGE_INDEX(ch)] = (unsigned char)(i+1);
+                break;
+            case TRIE_NODE256:
+                n256->children[PAGE_INDEX(ch)] = children[i];
+                break;
+            default:
+                dst[i] = children[i];
+                WCHAR_WRITE(keys, w, i, ch);
+                break;
+        }
+    }
+    return 1;
+}
+
+// Rebuilds a trie from the records of trie_serialize() without recursion:
+// the nodes are carved out of a single slab, and each node gets all of its
+// children in one container once its last child is complete. Returns NULL
+// if repr is not a valid serialized trie of this version.
+trie_t *trie_deserialize(trie_serialized_t *repr)
+{
+    const unsigned char *p, *end;
+    uint64_t version, item_count, node_count, height, head, len;
+    unsigned char char_size;
+    trie_node_t **pending, *nd;
+    iter_stack_t *stack;
+    iter_pos_t ipos, *ip;
+    unsigned long node, item, npending, stride, i;
+    uint32_t ch;
+    char *nodes;
+    trie_t *t;
+
+    p = (const unsigned char *)repr->s;
+    end = p + repr->s_length;
+    if (!_varint_get(&p, end, &version) || version != TRIE_SERIAL_VERSION || 
+        p == end) {
+        return NULL;
+    }
+    char_size = *p++;
+    if (!_varint_get(&p, end, &item_count) || 
+        !_varint_get(&p, end, &node_count) || 
+        !_varint_get(&p, end, &height) || 
+        (char_size != 1 && char_size != 2 && char_size != sizeof(TRIE_CHAR)) ||
+        item_count != repr->value_length || node_count == 0 || 
+        node_count > repr->s_length || height > repr->s_length) {
+        return NULL;
+    }
+
+    t = trie_create();
+    if (!t) {
+        return NULL;
+    }
+    if (!trie_widen(t, char_size)) {
+        trie_destroy(t);
+        return NULL;
+    }
+    t->item_count = (unsigned long)item_count;
+    t->node_count = (unsigned long)node_count;
+    t->height = (unsigned long)height;
+
+    nodes = NULL;
+    stride = ARENACLASSSIZE(ARENACLASS(sizeof(trie_node_t)));
+    if (node_count > 1) {
+        nodes = (char *)ARENABULK(t, node_count - 1, sizeof(trie_node_t));
+    }
+    pending = (trie_node_t **)TRIEMALLOC(t, node_count * sizeof(trie_node_t *));
+    stack = STACKCREATE(t, height + 2);
+    if ((node_count > 1 && !nodes) || !pending || !stack) {
+        goto fail;
+    }
+
+    // the stack holds the nodes whose children are still being read, with 
+    // the children left to read in op.auxindex and where their pointers 
+    // start in pending in op.index.
+    node = item = npending = 0;
+    nd = t->root;
+    for (;;) {
+        if (!_varint_get(&p, end, &head) || !_varint_get(&p, end, &len) || 
+            len > (unsigned long)(end - p) / char_size || 
+            (nd != t->root) != (len != 0) || (head & 1 && item == item_count)) {
+            goto fail;
+        }
+        if (nd != t->root) {
+            nd->value = 0;
+            nd->children = NULL;
+            nd->label_len = 0;
+            nd->child_count = 0;
+            nd->kind = TRIE_NODE0;
+            nd->cap_shift = 0;
+            // the records are not aligned, so chars are copied out
+            for (i = 0; char_size == 4 && i < len; i++) {
+                memcpy(&ch, p + i * 4, 4);
+                if (ch > 0x10ffff) {
+                    goto fail; // not a code point
+                }
+            }
+            if (!LABELSET(t, nd, p, (unsigned long)len)) {
+                goto fail;
+            }
+            p += len * char_size;
+            pending[npending++] = nd;
+        }
+        if (head & 1) {
+            nd->value = repr->value_ptrs[item++];
+        }
+        if (head >> 1) {
+            if (stack->index == stack->size || (head >> 1) > node_count) {
+                goto fail;
+            }
+            ipos.iptr = nd;
+            ipos.op.index = npending;
+            ipos.op.auxindex = (unsigned long)(head >> 1);
+            PUSHI(stack, &ipos);
+        }
+
+        // complete the nodes whose last child was just read
+        while ((ip = PEEKI(stack)) && ip->op.auxindex == 0) {
+            if (!NODEFILL(t, ip->iptr, pending + ip->op.index, 
+                npending - ip->op.index)) {
+                goto fail;
+            }
+            npending = ip->op.index;
+            POPI(stack);
+        }
+        if (!ip) {
+            break;
+        }
+        ip->op.auxindex--;
+        if (node == node_count - 1) {
+            goto fail;
+        }
+        nd = (trie_node_t *)(nodes + node++ * stride);
+    }
+    if (p != end || item != item_count || node != node_count - 1) {
+        goto fail;
+    }
+
+    TRIEFREE(t, pending);
+    STACKFREE(t, stack);
+    return t;
+
+fail:
+    if (pending) {
+        TRIEFREE(t, pending);
+    }
+    if (stack) {
+        STACKFREE(t, stack);
+    }
+    trie_destroy(t);
+    return NULL;
+}
+
+// Note 12:
+// trie_builder_add() takes keys in strictly increasing code point order, so
+// a key only ever branches off the path of the one before it. The builder 
+// keeps that rightmost path: nodes on it have no label and no children yet.
+// When a key leaves the path at some depth, the nodes below are complete: 
+// each gets its label from the last key and all its children at once with 
+// NODEFILL(), and moves to the pending children of its parent. A node whose
+// label the key leaves in the middle is split by putting a new node above 
+// it. Every node is created once and every container allocated once, at 
+// its final size.
+
+// Grows the array *p of *size elements of elem bytes to hold need of them.
+int TRIERESERVE(trie_t *t, void **p, unsigned long *size, unsigned long need,
+    unsigned long elem)
+{
+    unsigned long n;
+    void *q;
+
+    if (need <= *size) {
+        return 1;
+    }
+    n = *size ? *size : 16;
+    while (n < need) {
+        n *= 2;
+    }
+    q = TRIEMALLOC(t, n * elem);
+    if (!q) {
+        return 0;
+    }
+    if (*p) {
+        memcpy(q, *p, *size * elem);
+        TRIEFREE(t, *p);
+    }
+    *p = q;
+    *size = n;
+    return 1;
+}
+
+trie_builder_t *trie_builder_create(void)
+{
+    trie_builder_t *b;
+
+    b = (trie_builder_t *)TRIE_RAW_MALLOC(sizeof(trie_builder_t));
+    if (!b) {
+        return NULL;
+    }
+    memset(b, 0, sizeof(trie_builder_t));
+    b->trie = trie_create();
+    if (!b->trie || !TRIERESERVE(b->trie, (void **)&b->path, 
+        &b->path_size, 1, sizeof(trie_build_pos_t))) {
+        trie_builder_destroy(b);
+        return NULL;
+    }
+    b->path[0].node = b->trie->root;
+    b->path[0].start = b->path[0].depth = b->path[0].pending = 0;
+    b->path_len = 1;
+    return b;
+}
+
+// Frees the builder and the trie it was building, if it was not finished.
+void trie_builder_destroy(trie_builder_t *b)
+{
+    if (b->trie) {
+        trie_destroy(b->trie); // the arrays below are TRIEMALLOC'd from it
+    }
+    TRIE_RAW_FREE(b);
+}
+
+// Completes the node on top of the path, its label being the chars of the 
+// last key from start on, and moves it to the children of its parent.
+static int _build_complete(trie_builder_t *b, unsigned long start)
+{
+    trie_t *t = b->trie;
+    trie_build_pos_t *top;
+    unsigned long n;
+
+    top = &b->path[b->path_len - 1];
+    n = b->pending_len - top->pending;
+    if (!LABELSET(t, top->node, b->last + start * t->char_size, 
+        top->depth - start)) {
+        return 0;
+    }
+    if (n && !NODEFILL(t, top->node, b->pending + top->pending, n)) {
+        return 0;
+    }
+    b->pending_len = top->pending;
+    b->pending[b->pending_len++] = top->node;
+    return 1;
+}
+
+// Adds key with value, which shall not be 0. Returns 1 on success, 0 if out
+// of memory and -1 if key does not come after the last key added.
+int trie_builder_add(trie_builder_t *b, trie_key_t *key, TRIE_DATA value)
+{
+    trie_t *t = b->trie;
+    trie_build_pos_t *top;
+    trie_key_t last;
+    trie_node_t *nd;
+    unsigned long lcp, start, pending, i;
+    unsigned char w, ow;
+
+    ow = t->char_size;
+    w = KEYWIDTH(key->s, key->char_size, key->size);
+    if (w > ow) {
+        // the completed subtrees are all pending, the path has no labels
+        if (!TRIERESERVE(t, (void **)&b->last, &b->last_size, 
+            b->last_len * w + 1, 1) || 
+            !_widen_roots(t, b->pending, b->pending_len, t->node_count, w)) {
+            return 0;
+        }
+        for (i = b->last_len; i > 0; i--) {
+            WCHAR_WRITE(b->last, w, i-1, WCHAR_READ(b->last, ow, i-1));
+        }
+    }
+    w = t->char_size;
+
+    last.s = b->last;
+    last.size = b->last_len;
+    last.alloc_size = b->last_size / w;
+    last.char_size = w;
+    lcp = _key_common(&last, key);
+    if (b->item_count && (lcp == key->size || (lcp < last.size && 
+        WCHAR_READ(key->s, key->char_size, lcp) < WCHAR_READ(last.s, w, lcp)))) {
+        return -1;
+    }
+
+    // complete the nodes below the common prefix
+    while ((top = &b->path[b->path_len - 1])->depth > lcp) {
+        if (!TRIERESERVE(t, (void **)&b->pending, &b->pending_size, 
+            b->pending_len + 1, sizeof(trie_node_t *))) {
+            return 0;
+        }
+        if (top->start < lcp) {
+            // the key leaves top's label in the middle
+            nd = NODECREATE(t, 0);
+            if (!nd) {
+                return 0;
+            }
+            start = top->start;
+            pending = top->pending;
+            if (!_build_complete(b, lcp)) {
+                NODEFREE(t, nd);
+                return 0;
+            }
+            t->node_count++;
+            top->node = nd;
+            top->start = start;
+            top->depth = lcp;
+            top->pending = pending;
+            break;
+        }
+        if (!_build_complete(b, top->start)) {
+            return 0;
+        }
+        b->path_len--;
+    }
+
+    if (!TRIERESERVE(t, (void **)&b->last, &b->last_size, 
+        (key->size + 1) * w, 1)) {
+        return 0;
+    }
+    if (key->size == lcp) {
+        t->root->value = value; // the empty key, always first
+    } else {
+        if (!TRIERESERVE(t, (void **)&b->path, &b->path_size, 
+            b->path_len + 1, sizeof(trie_build_pos_t))) {
+            return 0;
+        }
+        nd = NODECREATE(t, value);
+        if (!nd) {
+            return 0;
+        }
+        t->node_count++;
+        top = &b->path[b->path_len++];
+        top->node = nd;
+        top->start = lcp;
+        top->depth = key->size;
+        top->pending = b->pending_len;
+    }
+
+    for (i = lcp; i < key->size; i++) {
+        WCHAR_WRITE(b->last, w, i, WCHAR_READ(key->s, key->char_size, i));
+    }
+    b->last_len = key->size;
+    b->item_count++;
+    t->item_count++;
+    if (key->size > t->height) {
+        t->height = key->size;
+    }
+    return 1;
+}
 
-    trie_node_serializer(t->root, s, &node_offset, value_ptrs, &value_offset);
+// Completes the path and hands over the trie, NULL if out of memory. The 
+// builder is freed either way.
+trie_t *trie_builder_finish(trie_builder_t *b)
+{
+    trie_t *t = b->trie;
+
+    while (b->path_len > 1) {
+        if (!TRIERESERVE(t, (void **)&b->pending, &b->pending_size, 
+            b->pending_len + 1, sizeof(trie_node_t *)) || 
+            !_build_complete(b, b->path[b->path_len - 1].start)) {
+            trie_builder_destroy(b);
+            return NULL;
+        }
+        b->path_len--;
+    }
+    if (b->pending_len && !NODEFILL(t, t->root, b->pending, b->pending_len)) {
+        trie_builder_destroy(b);
+        return NULL;
+    }
+
+    if (b->path) {
+        TRIEFREE(t, b->path);
+    }
+    if (b->pending) {
+        TRIEFREE(t, b->pending);
+    }
+    if (b->last) {
+        TRIEFREE(t, b->last);
+    }
+    b->trie = NULL;
+    trie_builder_destroy(b);
+    return t;
+}
 
-    repr->s = s;
-    repr->value_ptrs = value_ptrs;
-    repr->s_length = s_size;
-    repr->value_length = t->item_count + 1;
+#define _FIRSTCHAR(k) WCHAR_READ((k).s, (k).char_size, 0)
+
+// A share of a parallel build: a subtrie of keys [begin, end), built by 
+// one thread with an arena of its own.
+typedef struct trie_build_part_s {
+    trie_key_t *keys;
+    TRIE_DATA *values;
+    unsigned long begin;
+    unsigned long end;
+    trie_t *trie;
+    int status; // as trie_builder_add()
+    PyThread_type_lock done; // held until the part is built
+} trie_build_part_t;
+
+static void _build_part(void *arg)
+{
+    trie_build_part_t *part = (trie_build_part_t *)arg;
+    trie_builder_t *b;
+    unsigned long i;
 
-    return repr;
+    part->status = 0;
+    b = trie_builder_create();
+    for (i = part->begin; b && i < part->end; i++) {
+        part->status = trie_builder_add(b, &part->keys[i], part->values[i]);
+        if (part->status != 1) {
+            trie_builder_destroy(b);
+            b = NULL;
+        }
+    }
+    if (b) {
+        part->trie = trie_builder_finish(b);
+        part->status = part->trie ? 1 : 0;
+    }
+    if (part->done) {
+        PyThread_release_lock(part->done);
+    }
 }
 
-trie_t *trie_deserialize(trie_serialized_t *t) {
-    unsigned long node_offset = 0;
-    trie_node_t *root_node = trie_node_deserializer(t, t->s, &node_offset, t->value_ptrs);
-    trie_t *trie = trie_create();
-    NODEFREE(trie, trie->root);
-    trie->root = root_node;
+// Builds a trie of n keys in strictly increasing order with threads 
+// threads, which need not hold the GIL. The keys are cut into runs of 
+// distinct leading chars, one per thread, and each run is built by 
+// trie_builder_add() into a subtrie of its own. The subtries are then 
+// widened to a common char_size, their arenas moved into the trie, and their
+// root children become the children of its root. Returns NULL with *status 
+// as trie_builder_add() on failure.
+trie_t *trie_build_parallel(trie_key_t *keys, TRIE_DATA *values, 
+    unsigned long n, int threads, int *status)
+{
+    trie_build_part_t parts[TRIE_BUILD_MAX_THREADS];
+    trie_node_t **children, *child;
+    trie_t *t, *sub;
+    unsigned long first, begin, end, nchildren, pos;
+    unsigned char w;
+    TRIE_CHAR ch;
+    int nparts, i;
+
+    *status = 0;
+    t = trie_create();
+    if (!t) {
+        return NULL;
+    }
+    first = 0;
+    if (n && keys[0].size == 0) {
+        t->root->value = values[0]; // the empty key, always first
+        t->item_count = 1;
+        first = 1;
+    }
+    // a part would take a second one into the root of its subtrie
+    if (first < n && keys[first].size == 0) {
+        *status = -1;
+        trie_destroy(t);
+        return NULL;
+    }
+    if (threads > TRIE_BUILD_MAX_THREADS) {
+        threads = TRIE_BUILD_MAX_THREADS;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    // cut at the first change of leading char after each even share
+    nparts = 0;
+    for (begin = first; begin < n; begin = end) {
+        end = begin + (n - first) / threads + 1;
+        if (nparts == threads - 1 || end > n) {
+            end = n;
+        }
+        while (end < n && keys[end].size && keys[end-1].size && 
+            _FIRSTCHAR(keys[end]) == _FIRSTCHAR(keys[end-1])) {
+            end++;
+        }
+        if (end < n && (!keys[end].size || !keys[end-1].size || 
+            _FIRSTCHAR(keys[end]) < _FIRSTCHAR(keys[end-1]))) {
+            *status = -1;
+            trie_destroy(t);
+            return NULL;
+        }
+        parts[nparts].keys = keys;
+        parts[nparts].values = values;
+        parts[nparts].begin = begin;
+        parts[nparts].end = end;
+        parts[nparts].trie = NULL;
+        parts[nparts].done = NULL;
+        nparts++;
+    }
+
+    // the first part is built by this thread, the others are joined on 
+    // their lock
+    for (i = 1; i < nparts; i++) {
+        parts[i].done = PyThread_allocate_lock();
+        if (parts[i].done) {
+            PyThread_acquire_lock(parts[i].done, WAIT_LOCK);
+            if (PyThread_start_new_thread(_build_part, &parts[i]) == 
+                PYTHREAD_INVALID_THREAD_ID) {
+                PyThread_release_lock(parts[i].done);
+                PyThread_free_lock(parts[i].done);
+                parts[i].done = NULL;
+            }
+        }
+    }
+    if (nparts) {
+        _build_part(&parts[0]);
+    }
+    for (i = 1; i < nparts; i++) {
+        if (parts[i].done) {
+            PyThread_acquire_lock(parts[i].done, WAIT_LOCK);
+            PyThread_release_lock(parts[i].done);
+            PyThread_free_lock(parts[i].done);
+        } else {
+            _build_part(&parts[i]); // no thread could be started
+        }
+    }
+
+    // an unsorted part fails the build over a part out of memory
+    *status = 1;
+    w = 1;
+    nchildren = 0;
+    for (i = 0; i < nparts; i++) {
+        if (parts[i].status != 1) {
+            *status = *status == -1 ? -1 : parts[i].status;
+            continue;
+        }
+        if (parts[i].trie->char_size > w) {
+            w = parts[i].trie->char_size;
+        }
+        nchildren += parts[i].trie->root->child_count;
+    }
+    children = NULL;
+    if (*status == 1 && nchildren) {
+        children = (trie_node_t **)TRIEMALLOC(t, nchildren * sizeof(trie_node_t *));
+        *status = children ? 1 : 0;
+    }
+    for (i = 0; i < nparts && *status == 1; i++) {
+        *status = trie_widen(parts[i].trie, w);
+    }
+    if (*status != 1 || !trie_widen(t, w)) {
+        *status = *status == -1 ? -1 : 0;
+        goto fail;
+    }
 
-    return trie;
+    // stitch: the parts hold disjoint leading chars in increasing order
+    nchildren = 0;
+    for (i = 0; i < nparts; i++) {
+        sub = parts[i].trie;
+        pos = 0;
+        while ((child = trie_node_next_child(sub, sub->root, &pos, &ch))) {
+            children[nchildren++] = child;
+        }
+        ARENAMERGE(t, sub);
+        NODEFREE(t, sub->root);
+        t->node_count += sub->node_count - 1;
+        t->item_count += sub->item_count;
+        if (sub->height > t->height) {
+            t->height = sub->height;
+        }
+        trie_destroy(sub);
+        parts[i].trie = NULL;
+    }
+    if (nchildren && !NODEFILL(t, t->root, children, nchildren)) {
+        *status = 0;
+        TRIEFREE(t, children);
+        trie_destroy(t);
+        return NULL;
+    }
+    if (children) {
+        TRIEFREE(t, children);
+    }
+    *status = 1;
+    return t;
 
+fail:
+    for (i = 0; i < nparts; i++) {
+        if (parts[i].trie) {
+            trie_destroy(parts[i].trie);
+        }
+    }
+    if (children) {
+        TRIEFREE(t, children);
+    }
+    trie_destroy(t);
+    return NULL;
 }
 
+#undef _FIRSTCHAR
+
 iter_t * ITERATORCREATE(trie_t *t, trie_key_t *key, unsigned long max_depth, 
     unsigned long alloc_size, unsigned long stack_size1, unsigned long stack_size2)
 {
@@ -597,7 +2651,8 @@ iter_t * ITERATORCREATE(trie_t *t, trie_key_t *key, unsigned long max_depth,
     r->stack1 = k1;
     r->max_depth = max_depth;
     r->trie = t;
-    t->dirty = 0; // reset dirty flag just before iteration
+    r->version = t->version;
+    r->value = 0;
     r->keylen_reached = 0;
     r->depth_reached = 0;
     
@@ -619,9 +2674,30 @@ void iterator_deinit(iter_t *iter)
     ITERATORFREE(iter->trie, iter);
 }
 
-void _suffixes(trie_node_t *p, trie_key_t *key, unsigned long index, 
+// Writes label chars [from, label_len) of nd to key starting at index. 
+void KEY_LABEL_WRITE(trie_t *t, trie_key_t *key, unsigned long index, 
+    trie_node_t *nd, unsigned long from)
+{
+    void *label;
+    unsigned long i;
+
+    label = NODELABEL(nd, t->char_size);
+    for (i = from; i < nd->label_len; i++) {
+        KEY_CHAR_WRITE(key, index++, WCHAR_READ(label, t->char_size, i));
+    }
+}
+
+// Calls cbk for p and every node below it with a value, in key order. 
+// Children are visited in place with trie_node_next_child() and the path is 
+// kept on an explicit stack, so deep keys cannot overflow the C stack.
+void _suffixes(trie_t *t, trie_node_t *p, trie_key_t *key, unsigned long index, 
     trie_enum_cbk_t cbk, void* cbk_arg)
 {
+    iter_stack_t *stack;
+    iter_pos_t ipos, *ip;
+    trie_node_t *child;
+    TRIE_CHAR ch;
+
     if (p->value) {
         cbk(key, p, cbk_arg);
     }
@@ -629,14 +2705,45 @@ void _suffixes(trie_node_t *p, trie_key_t *key, unsigned long index,
     if (index == key->alloc_size) {
         return;
     }
-    trie_node_t ** children = trie_node_children(p);
-    for(int i = 0; i < p->child_count; i++) {
-        KEY_CHAR_WRITE(key, index, children[i]->key);
-        key->size = index+1;
-        
-        _suffixes(children[i], key, index+1, cbk, cbk_arg);
+
+    // every edge has a char at least, so the path holds at most 
+    // alloc_size - index nodes below p.
+    stack = STACKCREATE(t, key->alloc_size - index + 1);
+    if (!stack) {
+        return;
+    }
+    ipos.iptr = p;
+    ipos.pos = 0;
+    ipos.op.index = index;
+    PUSHI(stack, &ipos);
+
+    while ((ip = PEEKI(stack))) {
+        index = ip->op.index;
+        while ((child = trie_node_next_child(t, ip->iptr, &ip->pos, &ch))) {
+            // the whole edge has to fit in max_depth
+            if (index + child->label_len <= key->alloc_size) {
+                break;
+            }
+        }
+        if (!child) {
+            POPI(stack);
+            continue;
+        }
+
+        KEY_LABEL_WRITE(t, key, index, child, 0);
+        key->size = index + child->label_len;
+        if (child->value) {
+            cbk(key, child, cbk_arg);
+        }
+        if (key->size < key->alloc_size && child->child_count) {
+            ipos.iptr = child;
+            ipos.pos = 0;
+            ipos.op.index = key->size;
+            PUSHI(stack, &ipos);
+        }
     }
-    free(children);
+
+    STACKFREE(t, stack);
 }
 
 void trie_suffixes(trie_t *t, trie_key_t *key, unsigned long max_depth, 
@@ -644,11 +2751,11 @@ void trie_suffixes(trie_t *t, trie_key_t *key, unsigned long max_depth,
 {
     trie_key_t *kp;
     trie_node_t *prefix;
-    unsigned long index;
+    unsigned long index, rest;
 
     // first search key
-    prefix = _trie_prefix(t->root, key);
-    if (!prefix) {
+    prefix = _trie_prefix(t, t->root, key, &rest);
+    if (!prefix || rest > max_depth) {
         return;
     }
 
@@ -659,31 +2766,39 @@ void trie_suffixes(trie_t *t, trie_key_t *key, unsigned long max_depth,
     }
     KEYCPY(kp, key, 0, 0, key->size);
     kp->size = key->size;
+
+    // key may end inside an edge, complete it up to the node first.
+    KEY_LABEL_WRITE(t, kp, kp->size, prefix, prefix->label_len - rest);
+    kp->size += rest;
     
     index = 0;
     if (kp->size > 0) {
         index = kp->size;
     }
 
-    _suffixes(prefix, kp, index, cbk, cbk_arg);
+    _suffixes(t, prefix, kp, index, cbk, cbk_arg);
 
     KEYFREE(t, kp);
 }
 
+// Iterator over the same keys as trie_suffixes(), in the same order. The 
+// stack holds the path to the last key returned with the position of the 
+// next child of each node, as _suffixes() keeps it.
 iter_t *trie_itersuffixes_init(trie_t *t, trie_key_t *key, unsigned long max_depth)
 {
     iter_t *iter;
     trie_node_t *prefix;
+    unsigned long rest;
 
     // first search key
-    prefix = _trie_prefix(t->root, key);
-    if (!prefix) {
+    prefix = _trie_prefix(t, t->root, key, &rest);
+    if (!prefix || rest > max_depth) {
         return NULL;
     }
 
-    // create the iterator obj
+    // create the iterator obj, every node on the path adds a char at least
     iter = ITERATORCREATE(t, key, max_depth, (key->size + max_depth), 
-        max_depth, 0);
+        max_depth + 1, 0);
     if (!iter) {
         return NULL;
     }
@@ -701,6 +2816,7 @@ iter_t *trie_itersuffixes_reset(iter_t *iter)
 {
     trie_node_t *prefix;
     iter_pos_t ipos;
+    unsigned long rest;
 
     // pop all elems first
     while(POPI(iter->stack0))
@@ -709,111 +2825,111 @@ iter_t *trie_itersuffixes_reset(iter_t *iter)
     // return key->size to original
     iter->key->size = iter->key->alloc_size-iter->max_depth;
 
-    // get prefix in the trie
-    prefix = _trie_prefix(iter->trie->root, iter->key);
-    if (!prefix) {
-        return NULL;
+    iter->first = 1;
+    iter->last = 0;
+    iter->fail = 0;
+    iter->fail_reason = UNDEFINED;
+    iter->version = iter->trie->version;
+    iter->value = 0;
+
+    // get prefix in the trie, the key may end inside its label
+    prefix = _trie_prefix(iter->trie, iter->trie->root, iter->key, &rest);
+    if (!prefix || rest > iter->max_depth) {
+        return iter; // nothing to iterate
     }
+    KEY_LABEL_WRITE(iter->trie, iter->key, iter->key->size, prefix, 
+        prefix->label_len - rest);
+    iter->key->size += rest;
 
     // push the first iter_pos
     ipos.iptr = prefix;
     ipos.pos = 0;
-    ipos.op.index = iter->key->size-1;
+    ipos.op.index = iter->key->size;
     PUSHI(iter->stack0, &ipos);
 
-    iter->first = 1;
-    iter->last = 0;
-    iter->fail = 0;
-    iter->fail_reason = UNDEFINED;
-    iter->trie->dirty = 0;
-
     return iter;
 }
 
 iter_t *trie_itersuffixes_next(iter_t *iter)
 {
-    // iter_pos_t *ip;
-    // iter_pos_t ipos;
-    // int found;
-    // TRIE_DATA val;
-
-    // found = 0;
-    // while(1)
-    // {
-    //     // found a candidate?
-    //     if (found) {
-    //         break;
-    //     }
-
-    //     // trie changed during iteration?
-    //     if (iter->trie->dirty) {
-    //         iter->fail = 1;
-    //         iter->fail_reason = CHG_WHILE_ITER;
-    //         break;
-    //     }
+    iter_pos_t *ip;
+    iter_pos_t ipos;
+    trie_node_t *child;
+    unsigned long index;
+    TRIE_CHAR ch;
 
-    //     // start processing the stack
-    //     ip = PEEKI(iter->stack0);
-    //     if (!ip) { // no elem in stack0
-    //         iter->last = 1;
-    //         break;
-    //     }
+    // trie changed during iteration?
+    if (iter->trie->version != iter->version) {
+        iter->fail = 1;
+        iter->fail_reason = CHG_WHILE_ITER;
+        return iter;
+    }
 
-    //     // check if the search string is already in the trie.
-    //     if (iter->first) {
-    //         iter->first = 0;
-    //         val = ip->iptr->value;
-    //         ip->iptr = ip->iptr->children;
-    //         ip->op.index++;
-    //         if (val) {
-    //             break;
-    //         }
-    //     }
+    // the prefix itself may be a key
+    if (iter->first) {
+        iter->first = 0;
+        ip = PEEKI(iter->stack0);
+        if (ip && ip->iptr->value) {
+            iter->key->size = ip->op.index;
+            iter->value = ip->iptr->value;
+            return iter;
+        }
+    }
 
-    //     if (!ip->iptr) {
-    //         POPI(iter->stack0);
-    //         continue;
-    //     }
+    while ((ip = PEEKI(iter->stack0))) {
+        index = ip->op.index;
+        while ((child = trie_node_next_child(iter->trie, ip->iptr, &ip->pos, 
+            &ch))) {
+            // the whole edge has to fit in max_depth
+            if (index + child->label_len <= iter->key->alloc_size) {
+                break;
+            }
+        }
+        if (!child) {
+            POPI(iter->stack0);
+            continue;
+        }
 
-    //     KEY_CHAR_WRITE(iter->key, ip->op.index, ip->iptr->key);
-    //     iter->key->size = ip->op.index+1;
+        KEY_LABEL_WRITE(iter->trie, iter->key, index, child, 0);
+        iter->key->size = index + child->label_len;
+        if (iter->key->size < iter->key->alloc_size && child->child_count) {
+            ipos.iptr = child;
+            ipos.pos = 0;
+            ipos.op.index = iter->key->size;
+            PUSHI(iter->stack0, &ipos);
+        }
+        if (child->value) {
+            iter->value = child->value;
+            return iter;
+        }
+    }
 
-    //     if (ip->pos == 0 && ip->iptr->value) {
-    //         found = 1;
-    //     }
+    iter->last = 1;
+    return iter;
+}
 
-    //     if (ip->pos == 0) {
-    //         ip->pos = 1;
-    //         if (ip->iptr->children) {
-    //             if (ip->op.index+1 < (iter->key->alloc_size)) {
-    //                 ipos.iptr = ip->iptr->children;
-    //                 ipos.op.index = ip->op.index+1;
-    //                 ipos.pos = 0;
-    //                 PUSHI(iter->stack0, &ipos);
-    //             }
-    //         }
-    //     } else if (ip->pos == 1) {
-    //         POPI(iter->stack0);
-    //         if (ip->iptr->next) {
-    //             ipos.iptr = ip->iptr->next;
-    //             ipos.op.index = ip->op.index;
-    //             ipos.pos = 0;
-    //             PUSHI(iter->stack0, &ipos);
-    //         }
-    //     }
-    // }
+// Follows one edge from p along key chars from index on. Returns the child 
+// only if its whole label is matched by the key.
+trie_node_t *_trie_step(trie_t *t, trie_node_t *p, trie_key_t *key, 
+    unsigned long index)
+{
+    TRIE_CHAR ch;
+    trie_node_t *child;
 
-    return iter;
+    KEY_CHAR_READ(key, index, &ch);
+    child = trie_get_child(t, p, ch);
+    if (!child || _label_common(t, child, key, index) < child->label_len) {
+        return NULL;
+    }
+    return child;
 }
 
 void trie_prefixes(trie_t *t, trie_key_t *key, unsigned long max_depth, 
     trie_enum_cbk_t cbk, void* cbk_arg)
 {
     trie_key_t *kp;
-    trie_key_t k;
     trie_node_t *p;
     unsigned long i;
-    TRIE_CHAR ch;
 
     if (key->size == 0) {
         return;
@@ -825,26 +2941,25 @@ void trie_prefixes(trie_t *t, trie_key_t *key, unsigned long max_depth,
         return;
     }
     KEYCPY(kp, key, 0, 0, key->size);
-    kp->size = 1; // start from first character 
 
     p = t->root;
-    for(i=0;i<key->size;i++)
+    i = 0;
+    while(i < key->size)
     {
-        if (i == max_depth) {
+        p = _trie_step(t, p, kp, i);
+        if (!p) {
             break;
         }
-
-        KEY_CHAR_READ(kp, i, &ch);
-        k.s = (char *)&ch; k.size = 1; k.char_size = kp->char_size;
-        p = _trie_prefix(p, &k);
-        if (!p) {
+        i += p->label_len;
+        if (i > max_depth) {
             break;
         }
         if(p->value)
         {
+            kp->size = i;
             cbk(kp, p, cbk_arg);
+            kp->size = key->size;
         }
-        kp->size++;
     }
 
     KEYFREE(t, kp);
@@ -895,19 +3010,19 @@ iter_t *trie_iterprefixes_reset(iter_t *iter)
     while(POPI(iter->stack0))
         ;
 
-    // search first char
-    iter->key->size = 1;
-    prefix = _trie_prefix(iter->trie->root, iter->key);
+    // search first edge
+    iter->key->size = iter->key->alloc_size; 
+    if (!iter->key->size) {
+        return NULL;
+    }
+    prefix = _trie_step(iter->trie, iter->trie->root, iter->key, 0);
     if (!prefix) {
         return NULL;
     }
 
-    // return key->size to original
-    iter->key->size = iter->key->alloc_size; 
-
     // push the first iter_pos
     ipos.iptr = prefix;
-    ipos.op.index = 1;
+    ipos.op.index = prefix->label_len;
     ipos.pos = 0;
     PUSHI(iter->stack0, &ipos);
 
@@ -916,7 +3031,7 @@ iter_t *trie_iterprefixes_reset(iter_t *iter)
     iter->last = 0;
     iter->fail = 0;
     iter->fail_reason = UNDEFINED;
-    iter->trie->dirty = 0;
+    iter->version = iter->trie->version;
 
     return iter;
 }
@@ -924,14 +3039,12 @@ iter_t *trie_iterprefixes_reset(iter_t *iter)
 iter_t *trie_iterprefixes_next(iter_t *iter)
 {
     iter_pos_t *ip;
-    trie_key_t k;
     trie_node_t *p;
-    TRIE_CHAR ch;
 
     while(1)
     {
         // trie changed during iteration?
-        if (iter->trie->dirty) {
+        if (iter->trie->version != iter->version) {
             iter->fail = 1;
             iter->fail_reason = CHG_WHILE_ITER;
             break;
@@ -966,13 +3079,10 @@ iter_t *trie_iterprefixes_next(iter_t *iter)
         }
 
         if (ip->op.index < iter->key->size) {
-            KEY_CHAR_READ(iter->key, ip->op.index, &ch);
-
-            k.s = (char *)&ch; k.size = 1; k.char_size = iter->key->char_size;
-            p = _trie_prefix(ip->iptr, &k);
+            p = _trie_step(iter->trie, ip->iptr, iter->key, ip->op.index);
             if (p) {
                 
-                ip->op.index++;
+                ip->op.index += p->label_len;
                 ip->iptr = p;
                 ip->pos = 0;
                 PUSHI(iter->stack0, ip);
@@ -1226,7 +3336,7 @@ iter_t *trie_itercorrections_reset(iter_t *iter)
     iter->last = 0;
     iter->fail = 0;
     iter->fail_reason = UNDEFINED;
-    iter->trie->dirty = 0;
+    iter->version = iter->trie->version;
     iter->keylen_reached = 0;
     iter->depth_reached = 0;
 
@@ -1403,6 +3513,417 @@ iter_t *trie_itercorrections_next(iter_t *iter)
     // }
 }
 
+// Cursor of a pointer trie. Slots are indexes in sorted containers and 
+// char positions in the page of TRIE_NODE48 and TRIE_NODE256 ones.
+static void _cursor_root(trie_cursor_t *c, trie_cursor_frame_t *f)
+{
+    f->node = (uintptr_t)((trie_t *)c->form)->root;
+    f->index = 0;
+}
+
+static TRIE_DATA _cursor_value(trie_cursor_t *c, trie_cursor_frame_t *f)
+{
+    return ((trie_node_t *)f->node)->value;
+}
+
+static trie_node_t *_cursor_child(trie_node_t *nd, unsigned long slot)
+{
+    trie_node48_t *n48;
+
+    switch(nd->kind)
+    {
+        case TRIE_NODE48:
+            n48 = (trie_node48_t *)nd->children;
+            return n48->index[slot] ? n48->children[n48->index[slot]-1] : NULL;
+        case TRIE_NODE256:
+            return ((trie_node256_t *)nd->children)->children[slot];
+    }
+    return SORTED_CHILDREN(nd)[slot];
+}
+
+static unsigned long _cursor_edge(trie_cursor_t *c, trie_cursor_frame_t *f, 
+    unsigned long slot, int dir)
+{
+    trie_node_t *nd = (trie_node_t *)f->node;
+    unsigned long n;
+
+    if (!nd->child_count) {
+        return TRIE_CURSOR_NONE;
+    }
+    n = nd->kind == TRIE_NODE48 || nd->kind == TRIE_NODE256 ? 
+        TRIE_NODE_PAGE_SIZE : nd->child_count;
+    if (slot == TRIE_CURSOR_NONE) {
+        slot = dir > 0 ? 0 : n - 1;
+    } else if (dir > 0 ? slot + 1 >= n : slot == 0) {
+        return TRIE_CURSOR_NONE;
+    } else {
+        slot = dir > 0 ? slot + 1 : slot - 1;
+    }
+    // sorted containers have a child on every slot
+    for (;;) {
+        if (_cursor_child(nd, slot)) {
+            return slot;
+        }
+        if (dir > 0 ? slot + 1 >= n : slot == 0) {
+            return TRIE_CURSOR_NONE;
+        }
+        slot = dir > 0 ? slot + 1 : slot - 1;
+    }
+}
+
+static void _cursor_enter(trie_cursor_t *c, trie_cursor_frame_t *f, 
+    trie_cursor_frame_t *child)
+{
+    trie_t *t = (trie_t *)c->form;
+    trie_node_t *nd;
+
+    nd = _cursor_child((trie_node_t *)f->node, child->slot);
+    KEY_LABEL_WRITE(t, &c->key, f->index, nd, 0);
+    child->node = (uintptr_t)nd;
+    child->index = f->index + nd->label_len;
+}
+
+static unsigned long _cursor_height(trie_cursor_t *c)
+{
+    return ((trie_t *)c->form)->height;
+}
+
+static const trie_cursor_ops_t _cursor_ops = {
+    _cursor_root, _cursor_value, _cursor_edge, _cursor_enter, _cursor_height
+};
+
+trie_cursor_t *trie_cursor(trie_t *t)
+{
+    trie_cursor_t *c;
+
+    c = trie_cursor_create(&_cursor_ops, t);
+    if (c) {
+        c->version_at = &t->version;
+        c->version = t->version;
+    }
+    return c;
+}
+
+// Makes room for a path to the deepest key, that grows with a pointer trie.
+static int _cursor_fit(trie_cursor_t *c)
+{
+    unsigned long height;
+    TRIE_CHAR *s;
+    trie_cursor_frame_t *path;
+
+    height = c->ops->height(c);
+    if (height + 1 <= c->path_size) {
+        return 1;
+    }
+    s = (TRIE_CHAR *)PyMem_Realloc(c->key.s, (height + 1) * sizeof(TRIE_CHAR));
+    if (!s) {
+        return 0;
+    }
+    c->key.s = (char *)s;
+    c->key.alloc_size = height;
+    path = (trie_cursor_frame_t *)PyMem_Realloc(c->path, 
+        (height + 1) * sizeof(trie_cursor_frame_t));
+    if (!path) {
+        return 0;
+    }
+    c->path = path;
+    c->path_size = height + 1;
+    return 1;
+}
+
+// A cursor before the first key of form.
+trie_cursor_t *trie_cursor_create(const trie_cursor_ops_t *ops, void *form)
+{
+    trie_cursor_t *c;
+
+    c = (trie_cursor_t *)PyMem_Malloc(sizeof(trie_cursor_t));
+    if (!c) {
+        return NULL;
+    }
+    memset(c, 0, sizeof(trie_cursor_t));
+    c->ops = ops;
+    c->form = form;
+    c->key.char_size = sizeof(TRIE_CHAR);
+    if (!_cursor_fit(c)) {
+        trie_cursor_destroy(c);
+        return NULL;
+    }
+    return c;
+}
+
+void trie_cursor_destroy(trie_cursor_t *c)
+{
+    PyMem_Free(c->key.s);
+    PyMem_Free(c->path);
+    PyMem_Free(c);
+}
+
+// Enters the child on slot of the last frame, or the root. Returns 0 if the
+// form is deeper than its height, which only a damaged file can be.
+static int _cursor_push(trie_cursor_t *c, unsigned long slot)
+{
+    trie_cursor_frame_t *f;
+
+    if (c->depth == c->path_size) {
+        c->fail = 1;
+        c->fail_reason = CORRUPT_FORM;
+        return 0;
+    }
+    f = &c->path[c->depth++];
+    f->slot = slot;
+    f->rank = 0;
+    if (c->depth == 1) {
+        c->ops->root(c, f);
+    } else {
+        c->ops->enter(c, f - 1, f);
+    }
+    return !c->fail;
+}
+
+// Leaves the keys on the given side, returns 0.
+static int _cursor_off(trie_cursor_t *c, int end)
+{
+    c->depth = 0;
+    c->end = end;
+    c->key.size = 0;
+    c->value = 0;
+    return 0;
+}
+
+// Leaves the keys after a failure, returns -1.
+static int _cursor_failed(trie_cursor_t *c)
+{
+    _cursor_off(c, 0);
+    return -1;
+}
+
+// Value at the last frame, the cursor stands on it if there is one.
+static int _cursor_on(trie_cursor_t *c)
+{
+    trie_cursor_frame_t *f = &c->path[c->depth-1];
+
+    c->value = c->ops->value(c, f);
+    if (c->fail) {
+        return _cursor_failed(c);
+    }
+    if (!c->value) {
+        return 0;
+    }
+    c->key.size = f->index;
+    return 1;
+}
+
+// Climbs to the nearest frame with a child after the last one and enters 
+// that child. Returns 0 if there is none and -1 if the cursor failed.
+static int _cursor_climb_next(trie_cursor_t *c)
+{
+    unsigned long slot;
+
+    while (c->depth > 1) {
+        c->depth--;
+        slot = c->ops->edge(c, &c->path[c->depth-1], c->path[c->depth].slot, 1);
+        if (slot != TRIE_CURSOR_NONE) {
+            return _cursor_push(c, slot) ? 1 : -1;
+        }
+    }
+    return c->fail ? -1 : 0;
+}
+
+// Stands on the first key at or below the last frame, or after them.
+static int _cursor_first(trie_cursor_t *c)
+{
+    unsigned long slot;
+    int r;
+
+    for (;;) {
+        r = _cursor_on(c);
+        if (r) {
+            return r;
+        }
+        slot = c->ops->edge(c, &c->path[c->depth-1], TRIE_CURSOR_NONE, 1);
+        if (slot != TRIE_CURSOR_NONE) {
+            r = _cursor_push(c, slot) ? 1 : -1;
+        } else {
+            r = _cursor_climb_next(c);
+        }
+        if (r <= 0) {
+            return r ? _cursor_failed(c) : _cursor_off(c, 1);
+        }
+    }
+}
+
+// Stands on the last key at or below the last frame. Nodes without a key 
+// have children, so that is the last leaf.
+static int _cursor_last(trie_cursor_t *c)
+{
+    unsigned long slot;
+
+    for (;;) {
+        slot = c->ops->edge(c, &c->path[c->depth-1], TRIE_CURSOR_NONE, -1);
+        if (slot == TRIE_CURSOR_NONE) {
+            return _cursor_on(c);
+        }
+        if (!_cursor_push(c, slot)) {
+            return _cursor_failed(c);
+        }
+    }
+}
+
+// A pointer trie that changed since the last seek fails the cursor.
+static int _cursor_changed(trie_cursor_t *c)
+{
+    if (c->version_at && *c->version_at != c->version) {
+        c->fail = 1;
+        c->fail_reason = CHG_WHILE_ITER;
+        _cursor_off(c, 0);
+        return 1;
+    }
+    return 0;
+}
+
+// Moves to the next key. Returns 1 on a key, 0 after the last one and -1 if
+// the cursor failed.
+int trie_cursor_next(trie_cursor_t *c)
+{
+    unsigned long slot;
+    int r;
+
+    if (c->fail || _cursor_changed(c)) {
+        return -1;
+    }
+    if (!c->depth) {
+        if (c->end) {
+            return 0;
+        }
+        if (!_cursor_push(c, TRIE_CURSOR_NONE)) {
+            return _cursor_failed(c);
+        }
+        return _cursor_first(c);
+    }
+    slot = c->ops->edge(c, &c->path[c->depth-1], TRIE_CURSOR_NONE, 1);
+    if (slot != TRIE_CURSOR_NONE) {
+        r = _cursor_push(c, slot) ? 1 : -1;
+    } else {
+        r = _cursor_climb_next(c);
+    }
+    if (r <= 0) {
+        return r ? _cursor_failed(c) : _cursor_off(c, 1);
+    }
+    return _cursor_first(c);
+}
+
+// Moves to the previous key. Returns 1 on a key, 0 before the first one and
+// -1 if the cursor failed.
+int trie_cursor_prev(trie_cursor_t *c)
+{
+    unsigned long slot;
+    int r;
+
+    if (c->fail || _cursor_changed(c)) {
+        return -1;
+    }
+    if (!c->depth) {
+        if (!c->end) {
+            return 0;
+        }
+        if (!_cursor_push(c, TRIE_CURSOR_NONE)) {
+            return _cursor_failed(c);
+        }
+        r = _cursor_last(c);
+        return r ? r : _cursor_off(c, 0);
+    }
+    while (c->depth > 1) {
+        c->depth--;
+        slot = c->ops->edge(c, &c->path[c->depth-1], c->path[c->depth].slot, -1);
+        if (slot != TRIE_CURSOR_NONE) {
+            if (!_cursor_push(c, slot)) {
+                return _cursor_failed(c);
+            }
+            return _cursor_last(c);
+        }
+        // the parent comes before its children
+        r = _cursor_on(c);
+        if (r) {
+            return r;
+        }
+    }
+    return _cursor_off(c, 0);
+}
+
+// Moves to the first key not less than key. Returns 1 on a key, 0 if all 
+// keys are less and -1 if the cursor failed. Seeking again clears a 
+// failure.
+int trie_cursor_seek(trie_cursor_t *c, trie_key_t *key)
+{
+    trie_cursor_frame_t *f;
+    unsigned long i, slot;
+    TRIE_CHAR kc, ch;
+    int r;
+
+    c->fail = 0;
+    c->fail_reason = UNDEFINED;
+    if (c->version_at) {
+        c->version = *c->version_at;
+    }
+    if (!_cursor_fit(c)) {
+        c->fail = 1;
+        return -1;
+    }
+    c->depth = 0;
+    c->end = 0;
+    if (!_cursor_push(c, TRIE_CURSOR_NONE)) {
+        return _cursor_failed(c);
+    }
+    i = 0;
+    for (;;) {
+        // compare the label of the last frame with the key
+        f = &c->path[c->depth-1];
+        for (; i < f->index; i++) {
+            if (i == key->size) {
+                return _cursor_first(c); // the key is a prefix of them
+            }
+            KEY_CHAR_READ(key, i, &kc);
+            ch = ((TRIE_CHAR *)c->key.s)[i];
+            if (ch != kc) {
+                if (ch > kc) {
+                    return _cursor_first(c);
+                }
+                // all keys below are less
+                r = _cursor_climb_next(c);
+                if (r <= 0) {
+                    return r ? _cursor_failed(c) : _cursor_off(c, 1);
+                }
+                return _cursor_first(c);
+            }
+        }
+        if (i == key->size) {
+            return _cursor_first(c);
+        }
+
+        // the first child from the char of the key on
+        KEY_CHAR_READ(key, i, &kc);
+        slot = c->ops->edge(c, f, TRIE_CURSOR_NONE, 1);
+        while (slot != TRIE_CURSOR_NONE) {
+            if (!_cursor_push(c, slot)) {
+                return _cursor_failed(c);
+            }
+            if (((TRIE_CHAR *)c->key.s)[i] >= kc) {
+                break;
+            }
+            c->depth--;
+            slot = c->ops->edge(c, f, slot, 1);
+        }
+        if (slot == TRIE_CURSOR_NONE) {
+            // the node is a proper prefix of the key, its children are less
+            r = _cursor_climb_next(c);
+            if (r <= 0) {
+                return r ? _cursor_failed(c) : _cursor_off(c, 1);
+            }
+            return _cursor_first(c);
+        }
+    }
+}
+
 void trie_debug_print_key(trie_key_t *k)
 {
     unsigned int i;
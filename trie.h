@@ -37,34 +37,230 @@ typedef struct trie_key_s {
     unsigned char char_size; // character size of the encoding in bytes
 } trie_key_t;
 
-typedef struct trie_node_s **TRIE_CHILD_HASH;
+// Note 5:
+// The child container of a node is picked by its child count. Small and mid
+// sized fanouts are kept as sorted key arrays, dense fanouts inside a single
+// 256 char. page (ch >> 8) use indexed forms. All of them enumerate children
+// in code point order.
+typedef enum trie_node_kind_e {
+    TRIE_NODE0 = 0, // no children, no container
+    TRIE_NODE4,     // sorted keys, linear search, up to TRIE_NODE4_MAX children
+    TRIE_NODE16,    // sorted keys, linear scan, up to TRIE_NODE16_MAX children
+    TRIE_NODE48,    // per-page byte index into up to TRIE_NODE48_MAX slots
+    TRIE_NODE256,   // per-page direct indexed children
+    TRIE_NODEN,     // sorted keys, binary search, children from many pages
+} trie_node_kind_t;
+
+// Note 6:
+// Edges are path compressed: a node holds the run of chars (its label) on 
+// the edge from its parent, and label[0] is the key it is stored under in the
+// parent's container. Except for the root, a node without a value always has 
+// at least two children; trie_add splits labels and trie_del merges them 
+// back to keep it that way. Short labels are stored inline in the node.
+
+// Note 7:
+// Labels and the keys of sorted child containers are stored with the trie's 
+// char_size: 1, 2 or 4 bytes per char, the narrowest width that holds every 
+// char added so far. A key with wider chars widens all nodes in place first. 
+// So Latin-1 tries pay a byte per label char and inline labels of up to 
+// sizeof(void *) chars.
+#define LABEL_INLINE(w) (sizeof(void *) / (w))
 
 typedef struct trie_node_s {
-    TRIE_CHAR key;
     TRIE_DATA value;
-    unsigned short int child_count;
-    unsigned short int hash_size;
-    TRIE_CHILD_HASH child_hash;
-    struct trie_node_s *next;
+    void *children; // child container, layout depends on kind
+    union {
+        unsigned char inl[sizeof(void *)];
+        void *ext;
+    } label; // label_len chars of the trie's char_size
+    uint32_t label_len;
+    uint32_t child_count;
+    unsigned char kind;
+    unsigned char cap_shift; // sorted containers hold (1 << cap_shift) children
 } trie_node_t;
 
+#define NODELABEL(nd, w) ((nd)->label_len <= LABEL_INLINE(w) ? \
+    (void *)(nd)->label.inl : (nd)->label.ext)
+
+// Reads/writes the index-th char of a label or key array stored w bytes per
+// char. Frozen forms store their labels and codes the same way.
+static inline TRIE_CHAR WCHAR_READ(const void *p, unsigned char w, 
+    unsigned long index)
+{
+    switch(w)
+    {
+        case 1:
+            return ((const uint8_t *)p)[index];
+        case 2:
+            return ((const uint16_t *)p)[index];
+        default:
+            return (TRIE_CHAR)((const uint32_t *)p)[index];
+    }
+}
+
+static inline void WCHAR_WRITE(void *p, unsigned char w, unsigned long index, 
+    TRIE_CHAR ch)
+{
+    switch(w)
+    {
+        case 1:
+            ((uint8_t *)p)[index] = (uint8_t)ch;
+            break;
+        case 2:
+            ((uint16_t *)p)[index] = (uint16_t)ch;
+            break;
+        default:
+            ((uint32_t *)p)[index] = (uint32_t)ch;
+            break;
+    }
+}
+
+// Resizes an array of count elements of size bytes each to n elements and
+// accounts the difference to *mem_usage.
+static inline int TRIE_GROW(unsigned long *mem_usage, void **p, 
+    unsigned long count, unsigned long n, unsigned long size)
+{
+    void *np;
+
+    np = PyMem_Realloc(*p, n * size > 0 ? n * size : 1);
+    if (!np) {
+        return 0;
+    }
+    *mem_usage += n * size;
+    *mem_usage -= count * size;
+    *p = np;
+    return 1;
+}
+
+// Sorted containers (TRIE_NODE4, TRIE_NODE16, TRIE_NODEN) have no struct: 
+// they are an array of child pointers followed by an array of their keys, 
+// char_size bytes each.
+typedef struct trie_node48_s {
+    TRIE_CHAR page;
+    unsigned char index[TRIE_NODE_PAGE_SIZE]; // 1-based slot, 0 if no child
+    struct trie_node_s *children[TRIE_NODE48_MAX];
+} trie_node48_t;
+
+typedef struct trie_node256_s {
+    TRIE_CHAR page;
+    struct trie_node_s *children[TRIE_NODE_PAGE_SIZE];
+} trie_node256_t;
+
+// Arena structs. Nodes and child hashes are fixed-size blocks handed out from
+// slabs, so they carry no per-allocation header and are all released at once
+// by trie_destroy().
+typedef struct trie_slab_s {
+    struct trie_slab_s *next;
+    unsigned long size; // total size of the slab including this header
+} trie_slab_t;
+
+typedef struct trie_big_s {
+    struct trie_big_s *prev;
+    struct trie_big_s *next;
+} trie_big_t;
+
+typedef struct trie_arena_s {
+    trie_slab_t *slabs;
+    char *bump; // next unused byte in the newest slab
+    char *bump_end;
+    void *free_lists[TRIE_ARENA_CLASS_COUNT]; // recycled blocks per size class
+    trie_big_t *bigs; // blocks larger than TRIE_ARENA_MAX_BLOCK
+    unsigned long slab_bytes;
+    unsigned long big_bytes;
+} trie_arena_t;
+
 typedef struct trie_s {
-    int dirty; // externally reset, internally set. Used to detect if trie  
-               // changed during iteration
+    unsigned long version; // bumped when a key is added or deleted, an 
+                           // iterator of another version fails
     unsigned long node_count;
     unsigned long item_count;
     unsigned long height; // max height of the trie (max(len(string)))
     unsigned long mem_usage;
+    unsigned char char_size; // storage width of labels and keys, see Note 7
     struct trie_node_s *root;
+    trie_arena_t arena;
 } trie_t;
 
+// Note 8:
+// A frozen trie is compiled by trie_da_build() into a double array. Unit s 
+// is a state and its child on code c is unit base+c, if that unit's check is
+// s. Chars are mapped to dense codes 1.. in code point order and code 0 ends
+// a key, so children enumerate in key order, following the first child and
+// sibling links. A state with a single key below it is a leaf: the rest of 
+// that key lives in the tail array, stored with the char_size of the trie it
+// was built from.
+//
+// Every array of a double array is position independent, so trie_da_save() 
+// writes them to a file as they are, behind a versioned header, and 
+// trie_da_map() points a trie_da_t into a read-only mapping of that file. 
+// Values cannot be mapped: the file holds one packed payload per leaf and a 
+// mapped trie decodes it through load the first time the leaf is reached.
+typedef struct trie_da_unit_s {
+    int32_t base; // unit of the child on code 0, or -1 - leaf index
+    int32_t check; // parent unit, -1 if free
+} trie_da_unit_t;
+
+typedef struct trie_da_s {
+    trie_da_unit_t *units;
+    void *links; // first child and next sibling code of each unit, 0 if none
+    TRIE_DATA *values; // per leaf, 0 until loaded if mapped
+    uint32_t *tails; // tail of leaf i is tail[tails[i], tails[i+1])
+    void *tail;
+    TRIE_CHAR *alpha; // chars by code - 1
+    uint32_t lo[TRIE_NODE_PAGE_SIZE]; // codes of chars < 256, 0 if none
+    unsigned long alpha_lo; // alpha[alpha_lo, alpha_size) are chars >= 256
+    unsigned long alpha_size;
+    unsigned long unit_count;
+    unsigned long state_count;
+    unsigned long leaf_count;
+    unsigned long tail_len;
+    unsigned long item_count;
+    unsigned long height;
+    unsigned long mem_usage;
+    unsigned char char_size; // of tail chars
+    unsigned char code_size; // of links, the narrowest that holds alpha_size
+    void *map; // the file mapping the arrays point into, NULL if they are owned
+    unsigned long map_size;
+    const char *payload; // leaf i's value is payload[payload_index[i], [i+1])
+    const uint64_t *payload_index;
+    // sets values[leaf]
+    TRIE_DATA (*load)(struct trie_da_s *da, unsigned long leaf);
+    void *owner; // of the mapped trie, for load
+} trie_da_t;
+
+// Version of the serialized form, see Note 11 in trie.c.
+#define TRIE_SERIAL_VERSION 2
+
+// Input of trie_deserialize(), s may point into any buffer.
 typedef struct trie_serialized_s {
     char *s; // Serialized data string
-    TRIE_DATA *value_ptrs;
+    TRIE_DATA *value_ptrs; // values in record order
     unsigned long s_length;
     unsigned long value_length;
 } trie_serialized_t;
 
+// Builder of a trie from keys in sorted order, see Note 12 in trie.c.
+typedef struct trie_build_pos_s {
+    trie_node_t *node;
+    unsigned long start; // key length at the parent
+    unsigned long depth; // key length at the end of node's label
+    unsigned long pending; // where the completed children of node start
+} trie_build_pos_t;
+
+typedef struct trie_builder_s {
+    trie_t *trie;
+    trie_build_pos_t *path; // path of the last key, the root first
+    trie_node_t **pending; // completed children of the nodes on path
+    char *last; // last key added, of the trie's char_size
+    unsigned long path_len;
+    unsigned long path_size;
+    unsigned long pending_len;
+    unsigned long pending_size;
+    unsigned long last_len;
+    unsigned long last_size; // in bytes
+    unsigned long item_count;
+} trie_builder_t;
+
 typedef enum iter_op_type_e {
     NOOP = 0,
     DELETE,
@@ -76,7 +272,9 @@ typedef enum iter_op_type_e {
 
 typedef enum iter_fail_e {
     UNDEFINED = 0,
-    CHG_WHILE_ITER
+    CHG_WHILE_ITER,
+    LOAD_FAILED, // a mapped value could not be decoded
+    CORRUPT_FORM // a mapped file is damaged, see Note 18 in trie_da.c
 } iter_fail_t;
 
 // iterator related structs
@@ -111,6 +309,9 @@ typedef struct iter_s {
     int depth_reached; // flags used for delaying key changes
     unsigned long max_depth;
     iter_fail_t fail_reason;
+    unsigned long version; // of the trie when the iterator was reset
+    TRIE_DATA value; // of the last key returned by suffix iterators
+    int keys_only; // value is not read, a mapped trie does not load it
     trie_t *trie;
     trie_key_t *key;
     trie_node_t *prefix;
@@ -125,18 +326,328 @@ typedef iter_t *(*trie_iter_next_func_t)(iter_t *iter);
 typedef iter_t *(*trie_iter_reset_func_t)(iter_t *iter);
 typedef void (*trie_iter_deinit_func_t)(iter_t *iter);
 
+// Note 9:
+// freeze("louds") compiles a trie into a succinct form instead. Nodes are 
+// numbered in breadth first order and the shape is a LOUDS bitvector: "10" 
+// for a super root, then 1^d 0 for each node with d children. The children 
+// of node x are the nodes from select0(x+1) - x on, and their first label 
+// chars are contiguous and sorted in labels, so a step down is one select and
+// a binary search. Two more bitvectors mark the nodes holding a value and the
+// nodes with longer labels; the rest of those labels is in tail, the start of
+// each one marked by a fourth bitvector. That is about 3.5 bits plus one
+// char per node, values and tail chars aside.
+typedef struct trie_bv_s {
+    uint64_t *words;
+    uint32_t *ranks; // ones before each 512 bit block
+    unsigned long size; // in bits
+} trie_bv_t;
+
+typedef struct trie_louds_s {
+    trie_bv_t shape;
+    trie_bv_t terminal;
+    trie_bv_t multi;
+    trie_bv_t bounds; // start of each label rest in tail, and its end
+    void *labels; // first label char of each node, unused for the root
+    void *tail;
+    TRIE_DATA *values; // by rank in terminal
+    unsigned long node_count;
+    unsigned long item_count;
+    unsigned long height;
+    unsigned long mem_usage;
+    unsigned char char_size; // of labels and tail chars
+} trie_louds_t;
+
+typedef struct trie_louds_pos_s {
+    unsigned long next; // next child to visit
+    unsigned long end;
+    unsigned long index; // key length at the parent
+} trie_louds_pos_t;
+
+// Iterators over a trie_louds_t start with an iter_t so TrieIteratorType can
+// drive them like the pointer trie ones.
+typedef struct trie_louds_iter_s {
+    iter_t iter;
+    trie_louds_t *louds;
+    trie_louds_pos_t *stack;
+    unsigned long sp;
+    unsigned long node; // where the prefix ends
+    unsigned long prefix_len; // key length at node
+} trie_louds_iter_t;
+
+typedef struct trie_da_pos_s {
+    unsigned long s;
+    unsigned long index; // key length at s
+    uint32_t next; // code of the next child to visit
+    int more;
+} trie_da_pos_t;
+
+// Same, over a trie_da_t. A prefix ending in the tail of a leaf leaves st on
+// that leaf with prefix_len chars of the key before its tail.
+typedef struct trie_da_iter_s {
+    iter_t iter;
+    trie_da_t *da;
+    trie_da_pos_t *stack;
+    unsigned long sp;
+    unsigned long st; // where the prefix ends
+    unsigned long prefix_len; // key length at st
+    unsigned long leaf; // of the key last returned
+} trie_da_iter_t;
+
+// Note 10:
+// freeze("dawg") merges equal subtrees of a trie into a minimal acyclic 
+// automaton: two nodes become one state when both or neither end a key and
+// their edges have the same labels to the same states. Labels stay path 
+// compressed. A state is shared by many keys, so values are kept in key 
+// order and a key's value is found by its rank: each edge stores how many 
+// keys of its state come before the ones through it, and a walk sums those.
+typedef struct trie_dawg_s {
+    uint32_t *first; // edges of state s are [first[s], first[s+1])
+    unsigned char *final; // 1 if state s ends a key
+    uint32_t *target;
+    uint32_t *skip; // keys from the source state ordered before this edge's
+    uint32_t *tails; // label of edge e is tail[tails[e], tails[e+1])
+    void *tail;
+    TRIE_DATA *values; // in key order
+    unsigned long root;
+    unsigned long state_count;
+    unsigned long edge_count;
+    unsigned long tail_len;
+    unsigned long item_count;
+    unsigned long height;
+    unsigned long mem_usage;
+    unsigned char char_size; // of label chars
+} trie_dawg_t;
+
+typedef struct trie_dawg_pos_s {
+    unsigned long next; // next edge to follow
+    unsigned long end;
+    unsigned long index; // key length at the source state
+    unsigned long rank; // of the first key from the source state
+} trie_dawg_pos_t;
+
+typedef struct trie_dawg_iter_s {
+    iter_t iter;
+    trie_dawg_t *dawg;
+    trie_dawg_pos_t *stack;
+    unsigned long sp;
+    unsigned long st; // where the prefix ends
+    unsigned long rank; // of the first key from st
+    unsigned long prefix_len; // key length at st
+} trie_dawg_iter_t;
+
+// Note 13:
+// trie_load() reads a UTF-8 text file, one key per line, into a new trie 
+// without the GIL. Lines end with \n or \r\n, empty lines are skipped and
+// a later line of the same key wins. With TRIE_LOAD_INT or TRIE_LOAD_BYTES
+// each line is a key, a tab and a value. The values cannot be Python 
+// objects yet, so the node of the key of record i holds TRIE_LOAD_TAG(i) 
+// and the record itself is kept in ints, or in blob for bytes, for the 
+// caller to turn into objects.
+typedef enum trie_load_kind_e {
+    TRIE_LOAD_KEYS = 0,
+    TRIE_LOAD_INT,
+    TRIE_LOAD_BYTES,
+} trie_load_kind_t;
+
+typedef enum trie_load_error_e {
+    TRIE_LOAD_OK = 0,
+    TRIE_LOAD_IOERROR, // errno is set
+    TRIE_LOAD_NOMEM,
+    TRIE_LOAD_BADUTF8,
+    TRIE_LOAD_BADVALUE, // no tab, or not a 64 bit integer
+} trie_load_error_t;
+
+#define TRIE_LOAD_TAG(i) (((TRIE_DATA)(i) << 1) | 1)
+#define TRIE_LOAD_RECORD(v) ((unsigned long)((v) >> 1))
+
+typedef struct trie_load_s {
+    trie_t *trie;
+    trie_load_kind_t kind;
+    int64_t *ints; // value of each record for TRIE_LOAD_INT
+    uint64_t *offsets; // record i is blob[offsets[i], offsets[i+1])
+    char *blob;
+    unsigned long count; // records
+    unsigned long line; // where the error is
+    unsigned long ints_size;
+    unsigned long offsets_size;
+    unsigned long blob_len;
+    unsigned long blob_size;
+} trie_load_t;
+
+// Note 14:
+// A dump writes one UTF-8 line per key, as trie_load() reads them. The 
+// caller enumerates the keys and appends each line with trie_dump_key() and
+// trie_dump_bytes(); once TRIE_DUMP_FULL() the buffer is written out with 
+// trie_dump_flush(), which does not need the GIL. It is full at half its
+// size, so that the buffer grows only for lines longer than that. Keys come
+// in code point order, which is also the byte order of their UTF-8, so 
+// dumps can be merged as plain byte strings. A dump takes about 
+// TRIE_DUMP_BUFFER bytes whatever the size of the trie.
+typedef struct trie_dump_s {
+    FILE *f; // NULL if the caller writes buf out itself
+    char *buf;
+    unsigned long len;
+    unsigned long size;
+} trie_dump_t;
+
+#define TRIE_DUMP_FULL(d) ((d)->len >= TRIE_DUMP_BUFFER / 2)
+
+// Note 15:
+// trie_sorter_t sorts (key, payload) records that do not fit in memory. 
+// Records are added to a trie_t, with the payloads in an array accounted 
+// to its mem_usage, until that passes the memory budget. The trie is then
+// written out in key order as a run to a temporary file and emptied. 
+// trie_sorter_merge() merges the runs and hands every key to the caller
+// once, in code point order, with the payload it was last added with. A 
+// run record is the UTF-8 key and the payload, each behind a 32 bit length.
+typedef struct trie_sorter_s {
+    trie_t *trie; // the current run, a value is 1 + the offset of its payload
+    char *payload;
+    unsigned long payload_len;
+    unsigned long payload_size;
+    FILE **runs; // oldest first
+    unsigned long run_count;
+    unsigned long runs_size;
+    unsigned long memory;
+    const char *tmpdir; // NULL for the default temporary directory
+    trie_dump_t out; // writes the runs
+} trie_sorter_t;
+
+typedef int (*trie_sorter_cbk_t)(trie_key_t *key, const char *payload, 
+    unsigned long len, void *arg);
+
+// Writer of a double array file from keys in sorted order, see Note 16 in
+// trie_da.c.
+typedef struct trie_da_writer_s {
+    FILE *nodes; // states in post order
+    uint64_t nodes_len; // bytes
+    FILE *tail; // tail chars, 4 bytes each until they are narrowed
+    FILE *tails;
+    FILE *payload_index;
+    FILE *payload;
+    const char *tmpdir;
+    unsigned long memory;
+    uint32_t *last; // last key added
+    unsigned long last_len;
+    unsigned long last_size;
+    unsigned long last_lcp; // with the key before it
+    char *last_payload;
+    unsigned long last_payload_len;
+    unsigned long last_payload_size;
+    uint32_t *children; // (char, leaf) pairs of the states on the path
+    unsigned long children_len;
+    unsigned long children_size;
+    unsigned long *starts; // first child of the state at each depth
+    unsigned long starts_size;
+    unsigned long depth; // of the last state on the path
+    unsigned char *seen; // chars of transitions, a bit each
+    uint32_t max_char;
+    unsigned long item_count;
+    unsigned long leaf_count;
+    unsigned long tail_len;
+    unsigned long height;
+    uint64_t payload_len;
+} trie_da_writer_t;
+
+// Note 17:
+// A trie_cursor_t stands on one key of a trie in any form and moves to the 
+// next or previous key in code point order, or seeks the first key not less
+// than a given one. It keeps the path from the root to its key, a frame per
+// node, with the slot of each node among the children of its parent. So a 
+// step only climbs to the nearest node with another child on that side and
+// descends from there, and a page of n keys after a seek costs the depth of
+// the trie plus n. Each form walks its own nodes through trie_cursor_ops_t, 
+// slots are the child positions of that form.
+typedef struct trie_cursor_frame_s {
+    uintptr_t node; // node, unit or state, as the form addresses them
+    unsigned long slot; // among the children of the parent
+    unsigned long index; // key length at node
+    unsigned long rank; // of the first key at node, for dawgs
+} trie_cursor_frame_t;
+
+#define TRIE_CURSOR_NONE ((unsigned long)-1)
+
+struct trie_cursor_s;
+
+typedef struct trie_cursor_ops_s {
+    // root frame, its label written to the key
+    void (*root)(struct trie_cursor_s *c, trie_cursor_frame_t *f);
+    // value of the key ending at f, 0 if none, sets fail if it cannot load
+    TRIE_DATA (*value)(struct trie_cursor_s *c, trie_cursor_frame_t *f);
+    // slot of the first (dir > 0) or last child of f if slot is 
+    // TRIE_CURSOR_NONE, of the child after or before slot otherwise.
+    unsigned long (*edge)(struct trie_cursor_s *c, trie_cursor_frame_t *f, 
+        unsigned long slot, int dir);
+    // fills the frame of the child on child->slot, writing its label
+    void (*enter)(struct trie_cursor_s *c, trie_cursor_frame_t *f, 
+        trie_cursor_frame_t *child);
+    unsigned long (*height)(struct trie_cursor_s *c);
+} trie_cursor_ops_t;
+
+typedef struct trie_cursor_s {
+    const trie_cursor_ops_t *ops;
+    void *form; // trie_t, trie_da_t, trie_louds_t or trie_dawg_t
+    unsigned long *version_at; // of a pointer trie, NULL if it cannot change
+    unsigned long version;
+    trie_cursor_frame_t *path;
+    unsigned long depth; // frames on path, 0 while off the keys
+    unsigned long path_size;
+    trie_key_t key; // at the last frame, of TRIE_CHARs
+    TRIE_DATA value;
+    int end; // off the keys: 0 before the first, 1 after the last
+    int fail;
+    iter_fail_t fail_reason;
+} trie_cursor_t;
+
+typedef enum trie_simd_level_e {
+    TRIE_SIMD_NONE = 0,
+    TRIE_SIMD_SSE2,
+    TRIE_SIMD_AVX2,
+} trie_simd_level_t;
+
 // Basic Trie functions
+int trie_simd_init(void);
+int trie_simd_set(int level);
+int trie_batch_lanes_set(int lanes);
 trie_t *trie_create(void);
 void trie_destroy(trie_t *t);
 unsigned long trie_mem_usage(trie_t *t);
 trie_node_t *trie_search(trie_t *t, trie_key_t *key);
+void trie_search_many(trie_t *t, trie_key_t *keys, unsigned long n, 
+    trie_node_t **out);
+int trie_search_sorted(trie_t *t, trie_key_t *keys, unsigned long n, 
+    trie_node_t **out);
 int trie_add(trie_t *t, trie_key_t *key, TRIE_DATA value);
 int trie_del(trie_t *t, trie_key_t *key);
-trie_serialized_t *trie_serialize(trie_t *t);
+// Same as above for a key of size chars of the given width. 
+trie_node_t *trie_search_ucs1(trie_t *t, const uint8_t *s, unsigned long size);
+trie_node_t *trie_search_ucs2(trie_t *t, const uint16_t *s, unsigned long size);
+trie_node_t *trie_search_ucs4(trie_t *t, const uint32_t *s, unsigned long size);
+int trie_add_ucs1(trie_t *t, const uint8_t *s, unsigned long size, 
+    TRIE_DATA value);
+int trie_add_ucs2(trie_t *t, const uint16_t *s, unsigned long size, 
+    TRIE_DATA value);
+int trie_add_ucs4(trie_t *t, const uint32_t *s, unsigned long size, 
+    TRIE_DATA value);
+int trie_del_ucs1(trie_t *t, const uint8_t *s, unsigned long size);
+int trie_del_ucs2(trie_t *t, const uint16_t *s, unsigned long size);
+int trie_del_ucs4(trie_t *t, const uint32_t *s, unsigned long size);
+unsigned long trie_serialized_size(trie_t *t);
+int trie_serialize_to(trie_t *t, char *s, TRIE_DATA *values);
 trie_t *trie_deserialize(trie_serialized_t *s);
-trie_node_t *trie_get_child(trie_node_t *node, TRIE_CHAR ch);
+int trie_widen(trie_t *t, unsigned char char_size);
+// Bulk build from sorted keys, see Note 12
+trie_builder_t *trie_builder_create(void);
+int trie_builder_add(trie_builder_t *b, trie_key_t *key, TRIE_DATA value);
+trie_t *trie_builder_finish(trie_builder_t *b);
+void trie_builder_destroy(trie_builder_t *b);
+trie_t *trie_build_parallel(trie_key_t *keys, TRIE_DATA *values, 
+    unsigned long n, int threads, int *status);
+trie_node_t *trie_get_child(trie_t *t, trie_node_t *node, TRIE_CHAR ch);
 int trie_add_child(trie_t *t, trie_node_t *parent, trie_node_t *child);
-trie_node_t **trie_node_children(trie_node_t *node);
+int trie_remove_child(trie_t *t, trie_node_t *parent, trie_node_t *child);
+trie_node_t *trie_node_next_child(trie_t *t, trie_node_t *node, 
+    unsigned long *pos, TRIE_CHAR *key);
 
 // Enumeration functions
 // Suffix
@@ -160,11 +671,100 @@ iter_t *trie_itercorrections_init(trie_t *t, trie_key_t *key, unsigned long max_
 iter_t *trie_itercorrections_next(iter_t *iter);
 iter_t *trie_itercorrections_reset(iter_t *iter);
 void trie_itercorrections_deinit(iter_t *iter);
+// Cursor, see Note 17
+trie_cursor_t *trie_cursor(trie_t *t);
+trie_cursor_t *trie_cursor_create(const trie_cursor_ops_t *ops, void *form);
+void trie_cursor_destroy(trie_cursor_t *c);
+int trie_cursor_seek(trie_cursor_t *c, trie_key_t *key);
+int trie_cursor_next(trie_cursor_t *c);
+int trie_cursor_prev(trie_cursor_t *c);
+
+// Frozen double array, see Note 8
+trie_da_t *trie_da_build(trie_t *t);
+trie_t *trie_da_thaw(trie_da_t *da, int *damaged);
+void trie_da_destroy(trie_da_t *da);
+TRIE_DATA trie_da_search(trie_da_t *da, trie_key_t *key);
+int trie_da_contains(trie_da_t *da, trie_key_t *key);
+int trie_da_suffixes(trie_da_t *da, trie_key_t *key, unsigned long max_depth, 
+    int keys_only, trie_enum_cbk_t cbk, void* cbk_arg);
+TRIE_DATA trie_da_value(trie_da_t *da, unsigned long leaf);
+iter_t *trie_da_iter_init(trie_da_t *da, trie_key_t *key, 
+    unsigned long max_depth);
+iter_t *trie_da_iter_next(iter_t *iter);
+iter_t *trie_da_iter_reset(iter_t *iter);
+void trie_da_iter_deinit(iter_t *iter);
+trie_cursor_t *trie_da_cursor(trie_da_t *da);
+int trie_da_save(trie_da_t *da, const char *path, const char *payload, 
+    const uint64_t *payload_index);
+trie_da_t *trie_da_map(const char *path, int *bad_format);
+trie_da_writer_t *trie_da_writer_create(const char *tmpdir, 
+    unsigned long memory);
+int trie_da_writer_add(trie_da_writer_t *w, trie_key_t *key, 
+    const char *payload, unsigned long len);
+int trie_da_writer_finish(trie_da_writer_t *w, const char *path);
+void trie_da_writer_destroy(trie_da_writer_t *w);
+
+// Frozen LOUDS trie, see Note 9
+trie_louds_t *trie_louds_build(trie_t *t);
+trie_t *trie_louds_thaw(trie_louds_t *l);
+void trie_louds_destroy(trie_louds_t *l);
+TRIE_DATA trie_louds_search(trie_louds_t *l, trie_key_t *key);
+void trie_louds_suffixes(trie_louds_t *l, trie_key_t *key, 
+    unsigned long max_depth, trie_enum_cbk_t cbk, void* cbk_arg);
+iter_t *trie_louds_iter_init(trie_louds_t *l, trie_key_t *key, 
+    unsigned long max_depth);
+iter_t *trie_louds_iter_next(iter_t *iter);
+iter_t *trie_louds_iter_reset(iter_t *iter);
+void trie_louds_iter_deinit(iter_t *iter);
+trie_cursor_t *trie_louds_cursor(trie_louds_t *l);
+
+// Frozen minimal automaton, see Note 10
+trie_dawg_t *trie_dawg_build(trie_t *t);
+trie_t *trie_dawg_thaw(trie_dawg_t *d);
+void trie_dawg_destroy(trie_dawg_t *d);
+TRIE_DATA trie_dawg_search(trie_dawg_t *d, trie_key_t *key);
+void trie_dawg_suffixes(trie_dawg_t *d, trie_key_t *key, 
+    unsigned long max_depth, trie_enum_cbk_t cbk, void* cbk_arg);
+iter_t *trie_dawg_iter_init(trie_dawg_t *d, trie_key_t *key, 
+    unsigned long max_depth);
+iter_t *trie_dawg_iter_next(iter_t *iter);
+iter_t *trie_dawg_iter_reset(iter_t *iter);
+void trie_dawg_iter_deinit(iter_t *iter);
+trie_cursor_t *trie_dawg_cursor(trie_dawg_t *d);
+
+// Text files, see Note 13
+trie_load_error_t trie_load(const char *path, trie_load_kind_t kind, 
+    trie_load_t *l);
+void trie_load_release(trie_load_t *l);
+int trie_dump_open(trie_dump_t *d, const char *path);
+int trie_dump_key(trie_dump_t *d, trie_key_t *k);
+int trie_dump_bytes(trie_dump_t *d, const void *p, unsigned long n);
+int trie_dump_flush(trie_dump_t *d);
+int trie_dump_close(trie_dump_t *d);
+// External sort, see Note 15
+FILE *trie_tmpfile(const char *dir);
+int trie_fseek(FILE *f, uint64_t offset);
+trie_sorter_t *trie_sorter_create(const char *tmpdir, unsigned long memory);
+int trie_sorter_add(trie_sorter_t *s, trie_key_t *key, const char *payload, 
+    unsigned long len);
+int trie_sorter_full(trie_sorter_t *s);
+int trie_sorter_spill(trie_sorter_t *s);
+int trie_sorter_merge(trie_sorter_t *s, trie_sorter_cbk_t cbk, void *arg);
+void trie_sorter_destroy(trie_sorter_t *s);
 
 // Debug functions 
 void trie_debug_print_key(trie_key_t *k);
 
-trie_node_t *NODECREATE(trie_t* t, TRIE_CHAR key, TRIE_DATA value);
+trie_node_t *NODECREATE(trie_t* t, TRIE_DATA value);
+int LABELSET(trie_t *t, trie_node_t *nd, const void *src, unsigned long len);
 void NODEFREE(trie_t* t, trie_node_t *nd);
+void *TRIEMALLOC(trie_t *t, unsigned long size);
+void TRIEFREE(trie_t *t, void *p);
+void *ARENAALLOC(trie_t *t, unsigned long size);
+void *ARENABULK(trie_t *t, unsigned long count, unsigned long size);
+void ARENAFREE(trie_t *t, void *p, unsigned long size);
+void ARENAMERGE(trie_t *t, trie_t *from);
+int TRIERESERVE(trie_t *t, void **p, unsigned long *size, unsigned long need,
+    unsigned long elem);
 
 #endif
@@ -0,0 +1,2157 @@
+#include "trie.h"
+#include "string.h"
+#include "errno.h"
+#ifdef __WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Frozen double array form of a trie, see Note 8 in trie.h. It is built
+// once from a trie_t and then only read; writes go through a thaw back to a
+// trie_t.
+
+#define DA_FREE (-1)
+#define DA_ROOT_CHECK (-2) // no unit is a child of the root through its check
+#define DA_NONE ((unsigned long)-1)
+
+#define DA_IS_LEAF(da, u) ((da)->units[u].base < 0)
+#define DA_LEAF(da, u) ((unsigned long)(-1 - (long)(da)->units[u].base))
+#define DA_CHILD_CODE(da, u) \
+    ((uint32_t)WCHAR_READ((da)->links, (da)->code_size, 2*(u)))
+#define DA_SIBLING_CODE(da, u) \
+    ((uint32_t)WCHAR_READ((da)->links, (da)->code_size, 2*(u)+1))
+
+// Code of ch, 0 if it is not in the alphabet.
+static inline uint32_t DACODE(trie_da_t *da, TRIE_CHAR ch)
+{
+    unsigned long lo, hi, mid;
+
+    if (ch < TRIE_NODE_PAGE_SIZE) {
+        return da->lo[ch];
+    }
+    lo = da->alpha_lo;
+    hi = da->alpha_size;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (da->alpha[mid] < ch) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < da->alpha_size && da->alpha[lo] == ch ? (uint32_t)lo + 1 : 0;
+}
+
+// Child unit of unit s on code, DA_NONE if there is none.
+static inline unsigned long DACHILD(trie_da_t *da, unsigned long s,
+    uint32_t code)
+{
+    unsigned long u;
+
+    u = (unsigned long)da->units[s].base + code;
+    if (u >= da->unit_count || da->units[u].check != (int32_t)s) {
+        return DA_NONE;
+    }
+    return u;
+}
+
+// Leaf of the leaf unit u, DA_NONE if u is no leaf or its tail is out of
+// the tail chars. Only a damaged file has either, see Note 18.
+static inline unsigned long DALEAF(trie_da_t *da, unsigned long u)
+{
+    unsigned long leaf;
+
+    leaf = DA_LEAF(da, u);
+    if (leaf >= da->leaf_count || da->tails[leaf] > da->tails[leaf+1] ||
+        da->tails[leaf+1] > da->tail_len) {
+        return DA_NONE;
+    }
+    return leaf;
+}
+
+// Value of a leaf, loading it first in a mapped trie.
+static inline TRIE_DATA DAVALUE(trie_da_t *da, unsigned long leaf)
+{
+    if (!da->values[leaf] && da->load) {
+        return da->load(da, leaf);
+    }
+    return da->values[leaf];
+}
+
+TRIE_DATA trie_da_value(trie_da_t *da, unsigned long leaf)
+{
+    return DAVALUE(da, leaf);
+}
+
+static void _da_unmap(void *p, unsigned long size)
+{
+#ifdef __WINDOWS
+    UnmapViewOfFile(p);
+#else
+    munmap(p, size);
+#endif
+}
+
+void trie_da_destroy(trie_da_t *da)
+{
+    if (da->map) {
+        // only the values cache is ours, see trie_da_map()
+        free(da->values);
+        _da_unmap(da->map, da->map_size);
+        PyMem_Free(da);
+        return;
+    }
+    PyMem_Free(da->units);
+    PyMem_Free(da->links);
+    PyMem_Free(da->values);
+    PyMem_Free(da->tails);
+    PyMem_Free(da->tail);
+    PyMem_Free(da->alpha);
+    PyMem_Free(da);
+}
+
+// Build state. Free units are kept on a doubly linked list, so finding a
+// base only visits free units.
+typedef struct da_work_s {
+    trie_node_t *nd;
+    unsigned long s; // unit of the state
+    unsigned long j; // chars of nd's label consumed to reach s
+    unsigned long depth; // key length at s
+} da_work_t;
+
+typedef struct da_build_s {
+    trie_da_t *da;
+    trie_t *t;
+    uint32_t *next; // free list links per unit, (uint32_t)-1 if none
+    uint32_t *prev;
+    unsigned long free_head;
+    unsigned long free_tail;
+    unsigned long leaf_alloc;
+    unsigned long tail_alloc;
+    uint32_t *codes;
+    trie_node_t **targets;
+    da_work_t *work;
+    unsigned long work_size;
+    unsigned long work_alloc;
+} da_build_t;
+
+#define DA_LINK(i) ((i) == (uint32_t)-1 ? DA_NONE : (unsigned long)(i))
+
+static void _da_unlink(da_build_t *b, unsigned long u)
+{
+    unsigned long next, prev;
+
+    next = DA_LINK(b->next[u]);
+    prev = DA_LINK(b->prev[u]);
+    if (prev == DA_NONE) {
+        b->free_head = next;
+    } else {
+        b->next[prev] = (uint32_t)next;
+    }
+    if (next == DA_NONE) {
+        b->free_tail = prev;
+    } else {
+        b->prev[next] = (uint32_t)prev;
+    }
+}
+
+// Makes sure there are n units at least, new ones go to the free list.
+static int _da_reserve(da_build_t *b, unsigned long n)
+{
+    trie_da_t *da = b->da;
+    unsigned long i, old;
+
+    if (n <= da->unit_count) {
+        return 1;
+    }
+    if (n > INT32_MAX) {
+        return 0;
+    }
+    old = da->unit_count;
+    if (n < old * 2) {
+        n = old * 2 < INT32_MAX ? old * 2 : INT32_MAX;
+    }
+    if (!TRIE_GROW(&da->mem_usage, (void **)&da->units, old, n, 
+        sizeof(trie_da_unit_t)) ||
+        !TRIE_GROW(&da->mem_usage, &da->links, 2 * old, 2 * n, 
+        da->code_size) ||
+        !TRIE_GROW(&da->mem_usage, (void **)&b->next, old, n, 
+        sizeof(uint32_t)) ||
+        !TRIE_GROW(&da->mem_usage, (void **)&b->prev, old, n, 
+        sizeof(uint32_t))) {
+        return 0;
+    }
+    da->unit_count = n;
+    for (i = old; i < n; i++) {
+        da->units[i].base = 0;
+        da->units[i].check = DA_FREE;
+        WCHAR_WRITE(da->links, da->code_size, 2*i, 0);
+        WCHAR_WRITE(da->links, da->code_size, 2*i+1, 0);
+        b->next[i] = i + 1 < n ? (uint32_t)(i + 1) : (uint32_t)-1;
+        b->prev[i] = i > old ? (uint32_t)(i - 1) : (uint32_t)b->free_tail;
+    }
+    if (b->free_tail == DA_NONE) {
+        b->free_head = old;
+    } else {
+        b->next[b->free_tail] = (uint32_t)old;
+    }
+    b->free_tail = n - 1;
+    return 1;
+}
+
+// First base >= 1 that puts every code of codes[0, n) on a free unit.
+static unsigned long _da_find_base(da_build_t *b, unsigned long n)
+{
+    trie_da_t *da = b->da;
+    unsigned long pos, base, u, i;
+
+    pos = b->free_head;
+    for (;;) {
+        if (pos == DA_NONE) {
+            pos = da->unit_count;
+        }
+        if (pos >= b->codes[0] + 1) {
+            base = pos - b->codes[0];
+            for (i = 1; i < n; i++) {
+                u = base + b->codes[i];
+                if (u < da->unit_count && da->units[u].check != DA_FREE) {
+                    break;
+                }
+            }
+            if (i == n) {
+                if (!_da_reserve(b, base + b->codes[n-1] + 1)) {
+                    return DA_NONE;
+                }
+                return base;
+            }
+        }
+        pos = pos >= da->unit_count ? pos + 1 : DA_LINK(b->next[pos]);
+    }
+}
+
+// Makes unit u a leaf for value, with the label chars of nd from from on
+// as its tail. depth is the key length at u.
+static int _da_add_leaf(da_build_t *b, unsigned long u, TRIE_DATA value,
+    trie_node_t *nd, unsigned long from, unsigned long depth)
+{
+    trie_da_t *da = b->da;
+    unsigned long len, n;
+    unsigned char w;
+
+    w = da->char_size;
+    len = nd ? nd->label_len - from : 0;
+    if (da->leaf_count + 1 >= b->leaf_alloc) {
+        n = b->leaf_alloc ? b->leaf_alloc * 2 : 64;
+        if (!TRIE_GROW(&da->mem_usage, (void **)&da->values, b->leaf_alloc, n,
+            sizeof(TRIE_DATA)) ||
+            !TRIE_GROW(&da->mem_usage, (void **)&da->tails, b->leaf_alloc, n,
+            sizeof(uint32_t))) {
+            return 0;
+        }
+        b->leaf_alloc = n;
+    }
+    if (da->tail_len + len > b->tail_alloc) {
+        n = b->tail_alloc ? b->tail_alloc * 2 : 256;
+        while (n < da->tail_len + len) {
+            n *= 2;
+        }
+        if (n > UINT32_MAX || 
+            !TRIE_GROW(&da->mem_usage, &da->tail, b->tail_alloc, n, w)) {
+            return 0;
+        }
+        b->tail_alloc = n;
+    }
+    if (len) {
+        memcpy((char *)da->tail + da->tail_len * w,
+            (char *)NODELABEL(nd, w) + from * w, len * w);
+    }
+
+    da->values[da->leaf_count] = value;
+    da->tails[da->leaf_count] = (uint32_t)da->tail_len;
+    da->units[u].base = (int32_t)(-1 - (long)da->leaf_count);
+    da->leaf_count++;
+    da->tail_len += len;
+    da->tails[da->leaf_count] = (uint32_t)da->tail_len;
+    if (depth + len > da->height) {
+        da->height = depth + len;
+    }
+    return 1;
+}
+
+static int _da_push(da_build_t *b, trie_node_t *nd, unsigned long s,
+    unsigned long j, unsigned long depth)
+{
+    unsigned long n;
+
+    if (b->work_size == b->work_alloc) {
+        n = b->work_alloc ? b->work_alloc * 2 : 64;
+        if (!TRIE_GROW(&b->da->mem_usage, (void **)&b->work, b->work_alloc, n,
+            sizeof(da_work_t))) {
+            return 0;
+        }
+        b->work_alloc = n;
+    }
+    b->work[b->work_size].nd = nd;
+    b->work[b->work_size].s = s;
+    b->work[b->work_size].j = j;
+    b->work[b->work_size].depth = depth;
+    b->work_size++;
+    return 1;
+}
+
+// Places the children of state s: the next char of nd's label if j is inside
+// it, otherwise the end of key (if nd has a value) and the children of nd.
+// depth is the key length at s.
+static int _da_expand(da_build_t *b, trie_node_t *nd, unsigned long s,
+    unsigned long j, unsigned long depth)
+{
+    trie_da_t *da = b->da;
+    trie_node_t *child;
+    TRIE_CHAR ch;
+    unsigned long n, i, pos, base, u;
+    unsigned char w;
+
+    w = da->char_size;
+    n = 0;
+    if (j < nd->label_len) {
+        b->codes[n] = DACODE(da, WCHAR_READ(NODELABEL(nd, w), w, j));
+        b->targets[n++] = nd;
+    } else {
+        if (nd->value) {
+            b->codes[n] = 0;
+            b->targets[n++] = NULL;
+        }
+        pos = 0;
+        while ((child = trie_node_next_child(b->t, nd, &pos, &ch))) {
+            b->codes[n] = DACODE(da, ch);
+            b->targets[n++] = child;
+        }
+    }
+    if (!n) {
+        return 1; // an empty trie
+    }
+
+    base = _da_find_base(b, n);
+    if (base == DA_NONE) {
+        return 0;
+    }
+    da->units[s].base = (int32_t)base;
+    WCHAR_WRITE(da->links, da->code_size, 2*s, b->codes[0]);
+    for (i = 0; i < n; i++) {
+        u = base + b->codes[i];
+        _da_unlink(b, u);
+        da->units[u].base = 0;
+        da->units[u].check = (int32_t)s;
+        WCHAR_WRITE(da->links, da->code_size, 2*u+1, 
+            i + 1 < n ? b->codes[i+1] : 0);
+        da->state_count++;
+    }
+
+    // leaves right away, inner states later, smallest code on the top
+    for (i = n; i-- > 0;) {
+        u = base + b->codes[i];
+        if (!b->targets[i]) {
+            if (!_da_add_leaf(b, u, nd->value, NULL, 0, depth)) {
+                return 0;
+            }
+        } else if (b->targets[i] == nd) {
+            if (!_da_push(b, nd, u, j + 1, depth + 1)) {
+                return 0;
+            }
+        } else if (!b->targets[i]->child_count) {
+            if (!_da_add_leaf(b, u, b->targets[i]->value, b->targets[i], 1,
+                depth + 1)) {
+                return 0;
+            }
+        } else {
+            if (!_da_push(b, b->targets[i], u, 1, depth + 1)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Collects the chars that label transitions: all label chars of inner nodes
+// and the first one of leaves. The rest of a leaf label goes to the tail.
+static int _da_alphabet(trie_da_t *da, trie_t *t)
+{
+    unsigned char *seen;
+    iter_pos_t *stack;
+    unsigned long sp, i, n, max;
+    trie_node_t *nd, *child;
+    TRIE_CHAR ch;
+    unsigned char w;
+
+    w = t->char_size;
+    max = w == 1 ? 0xff : (w == 2 ? 0xffff : 0x10ffff);
+    seen = (unsigned char *)PyMem_Malloc(max / 8 + 1);
+    stack = (iter_pos_t *)PyMem_Malloc((t->height + 1) * sizeof(iter_pos_t));
+    if (!seen || !stack) {
+        PyMem_Free(seen);
+        PyMem_Free(stack);
+        return 0;
+    }
+    memset(seen, 0, max / 8 + 1);
+
+    sp = 0;
+    stack[sp].iptr = t->root;
+    stack[sp++].pos = 0;
+    while (sp) {
+        nd = stack[sp-1].iptr;
+        child = trie_node_next_child(t, nd, &stack[sp-1].pos, &ch);
+        if (!child) {
+            sp--;
+            continue;
+        }
+        n = child->child_count ? child->label_len : 1;
+        for (i = 0; i < n; i++) {
+            ch = WCHAR_READ(NODELABEL(child, w), w, i);
+            seen[ch / 8] |= 1 << (ch % 8);
+        }
+        if (child->child_count) {
+            stack[sp].iptr = child;
+            stack[sp++].pos = 0;
+        }
+    }
+
+    n = 0;
+    for (ch = 0; ch <= max; ch++) {
+        if (seen[ch / 8] & (1 << (ch % 8))) {
+            n++;
+        }
+    }
+    da->alpha = (TRIE_CHAR *)PyMem_Malloc(n ? n * sizeof(TRIE_CHAR) : 1);
+    if (!da->alpha) {
+        PyMem_Free(seen);
+        PyMem_Free(stack);
+        return 0;
+    }
+    da->mem_usage += n * sizeof(TRIE_CHAR);
+    da->alpha_size = 0;
+    for (ch = 0; ch <= max; ch++) {
+        if (seen[ch / 8] & (1 << (ch % 8))) {
+            if (ch < TRIE_NODE_PAGE_SIZE) {
+                da->lo[ch] = (uint32_t)da->alpha_size + 1;
+                da->alpha_lo = da->alpha_size + 1;
+            }
+            da->alpha[da->alpha_size++] = ch;
+        }
+    }
+    da->code_size = da->alpha_size <= 0xff ? 1 :
+        (da->alpha_size <= 0xffff ? 2 : 4);
+
+    PyMem_Free(seen);
+    PyMem_Free(stack);
+    return 1;
+}
+
+// Compiles t into a new double array. t is left unchanged and the values are
+// shared, the caller decides which of them owns the values afterwards.
+trie_da_t *trie_da_build(trie_t *t)
+{
+    trie_da_t *da;
+    da_build_t b;
+    da_work_t w;
+    unsigned long i, last;
+    int ok;
+
+    da = (trie_da_t *)PyMem_Malloc(sizeof(trie_da_t));
+    if (!da) {
+        return NULL;
+    }
+    memset(da, 0, sizeof(trie_da_t));
+    da->mem_usage = sizeof(trie_da_t);
+    da->char_size = t->char_size;
+    da->item_count = t->item_count;
+    // t->height only grows, the real height is taken while building
+
+    memset(&b, 0, sizeof(da_build_t));
+    b.da = da;
+    b.t = t;
+    b.free_head = b.free_tail = DA_NONE;
+
+    ok = _da_alphabet(da, t);
+    if (ok) {
+        b.codes = (uint32_t *)PyMem_Malloc((da->alpha_size + 1) *
+            sizeof(uint32_t));
+        b.targets = (trie_node_t **)PyMem_Malloc((da->alpha_size + 1) *
+            sizeof(trie_node_t *));
+        ok = b.codes && b.targets;
+    }
+    // the root is unit 0 and never a child: bases start from 1
+    ok = ok && _da_reserve(&b, t->node_count + t->item_count + 1);
+    if (ok) {
+        _da_unlink(&b, 0);
+        da->units[0].check = DA_ROOT_CHECK;
+        da->state_count = 1;
+        ok = _da_expand(&b, t->root, 0, 0, 0);
+    }
+    while (ok && b.work_size) {
+        w = b.work[--b.work_size];
+        ok = _da_expand(&b, w.nd, w.s, w.j, w.depth);
+    }
+
+    PyMem_Free(b.codes);
+    PyMem_Free(b.targets);
+    PyMem_Free(b.work);
+    da->mem_usage -= b.work_alloc * sizeof(da_work_t);
+    PyMem_Free(b.next);
+    PyMem_Free(b.prev);
+    da->mem_usage -= 2 * da->unit_count * sizeof(uint32_t);
+    if (!ok) {
+        trie_da_destroy(da);
+        return NULL;
+    }
+
+    // drop the unused units at the end and the slack of the other arrays
+    last = 0;
+    for (i = 0; i < da->unit_count; i++) {
+        if (da->units[i].check != DA_FREE) {
+            last = i;
+        }
+    }
+    TRIE_GROW(&da->mem_usage, (void **)&da->units, da->unit_count, last + 1,
+        sizeof(trie_da_unit_t));
+    TRIE_GROW(&da->mem_usage, &da->links, 2 * da->unit_count, 2 * (last + 1), 
+        da->code_size);
+    da->unit_count = last + 1;
+    TRIE_GROW(&da->mem_usage, (void **)&da->values, b.leaf_alloc, 
+        da->leaf_count, sizeof(TRIE_DATA));
+    TRIE_GROW(&da->mem_usage, (void **)&da->tails, b.leaf_alloc, 
+        da->leaf_count + 1, sizeof(uint32_t));
+    TRIE_GROW(&da->mem_usage, &da->tail, b.tail_alloc, da->tail_len, 
+        da->char_size);
+    da->tails[da->leaf_count] = (uint32_t)da->tail_len; // no leaves at all
+
+    return da;
+}
+
+// Matches key chars [i, size) against the tail of leaf.
+static inline int _da_tail_equal(trie_da_t *da, unsigned long leaf,
+    const void *s, unsigned char ksize, unsigned long i, unsigned long size)
+{
+    unsigned long k, from;
+
+    from = da->tails[leaf];
+    if (da->tails[leaf+1] - from != size - i) {
+        return 0;
+    }
+    for (k = 0; i + k < size; k++) {
+        if (WCHAR_READ(s, ksize, i + k) !=
+            WCHAR_READ(da->tail, da->char_size, from + k)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Leaf of the key, DA_NONE if it is not in da. ksize is a constant in each
+// of the calls below, so the key reads are specialized like the trie_tpl.h 
+// loops.
+static inline unsigned long _da_find(trie_da_t *da, const void *s,
+    const unsigned char ksize, unsigned long size)
+{
+    unsigned long i, u, st;
+    uint32_t code;
+
+    st = 0;
+    for (i = 0; i < size; i++) {
+        if (DA_IS_LEAF(da, st)) {
+            break;
+        }
+        code = DACODE(da, WCHAR_READ(s, ksize, i));
+        if (!code) {
+            return DA_NONE;
+        }
+        st = DACHILD(da, st, code);
+        if (st == DA_NONE) {
+            return DA_NONE;
+        }
+    }
+
+    if (DA_IS_LEAF(da, st)) {
+        u = DALEAF(da, st);
+        if (u == DA_NONE || !_da_tail_equal(da, u, s, ksize, i, size)) {
+            return DA_NONE;
+        }
+        return u;
+    }
+    u = DACHILD(da, st, 0);
+    return u == DA_NONE ? DA_NONE : DALEAF(da, u);
+}
+
+static unsigned long _da_search(trie_da_t *da, trie_key_t *key)
+{
+    switch(key->char_size)
+    {
+        case 1:
+            return _da_find(da, key->s, 1, key->size);
+        case 2:
+            return _da_find(da, key->s, 2, key->size);
+        case 4:
+            return _da_find(da, key->s, 4, key->size);
+    }
+    // an empty key may come without a char_size
+    return key->size ? DA_NONE : _da_find(da, key->s, 1, 0);
+}
+
+TRIE_DATA trie_da_search(trie_da_t *da, trie_key_t *key)
+{
+    unsigned long leaf;
+
+    leaf = _da_search(da, key);
+    return leaf == DA_NONE ? 0 : DAVALUE(da, leaf);
+}
+
+// Whether key is in da. Unlike trie_da_search() it never loads a value.
+int trie_da_contains(trie_da_t *da, trie_key_t *key)
+{
+    return _da_search(da, key) != DA_NONE;
+}
+
+// Fails the iterator on a damaged file. Returns 0.
+static int _da_iter_corrupt(trie_da_iter_t *it)
+{
+    it->iter.fail = 1;
+    it->iter.fail_reason = CORRUPT_FORM;
+    return 0;
+}
+
+// Completes the key of the leaf on unit u from index with its tail. Returns
+// 0 if it is deeper than max_depth, or if its mapped value failed to load or
+// the file is damaged, fail is set then. A keys_only iterator leaves mapped
+// values unloaded.
+static int _da_iter_leaf(trie_da_iter_t *it, unsigned long u,
+    unsigned long index)
+{
+    trie_da_t *da = it->da;
+    trie_key_t *kp = it->iter.key;
+    unsigned long leaf, k, from, len;
+
+    leaf = DALEAF(da, u);
+    if (leaf == DA_NONE) {
+        return _da_iter_corrupt(it);
+    }
+    from = da->tails[leaf];
+    len = da->tails[leaf+1] - from;
+    if (index + len > kp->alloc_size) {
+        return 0;
+    }
+    for (k = 0; k < len; k++) {
+        ((TRIE_CHAR *)kp->s)[index + k] = WCHAR_READ(da->tail, da->char_size,
+            from + k);
+    }
+    kp->size = index + len;
+    it->leaf = leaf;
+    if (it->iter.keys_only) {
+        it->iter.value = da->values[leaf];
+        return 1;
+    }
+    it->iter.value = DAVALUE(da, leaf);
+    if (!it->iter.value) {
+        it->iter.fail = 1;
+        it->iter.fail_reason = LOAD_FAILED;
+        return 0;
+    }
+    return 1;
+}
+
+static void _da_iter_push(trie_da_iter_t *it, unsigned long s,
+    unsigned long index)
+{
+    trie_da_pos_t *p;
+
+    p = &it->stack[it->sp++];
+    p->s = s;
+    p->index = index;
+    p->next = DA_CHILD_CODE(it->da, s);
+    // only the root of an empty trie has no children
+    p->more = DACHILD(it->da, s, p->next) != DA_NONE;
+}
+
+// Keys are returned in key order: the children of a state are visited in 
+// code order through their sibling links.
+iter_t *trie_da_iter_init(trie_da_t *da, trie_key_t *key,
+    unsigned long max_depth)
+{
+    trie_da_iter_t *it;
+    trie_key_t *kp;
+    unsigned long i, k, st, leaf;
+    uint32_t code;
+
+    kp = (trie_key_t *)PyMem_Malloc(sizeof(trie_key_t));
+    if (!kp) {
+        return NULL;
+    }
+    kp->char_size = sizeof(TRIE_CHAR);
+    kp->alloc_size = key->size + max_depth;
+    kp->s = (char *)PyMem_Malloc((kp->alloc_size + 1) * sizeof(TRIE_CHAR));
+    if (!kp->s) {
+        PyMem_Free(kp);
+        return NULL;
+    }
+    for (i = 0; i < key->size; i++) {
+        ((TRIE_CHAR *)kp->s)[i] = WCHAR_READ(key->s, key->char_size, i);
+    }
+    kp->size = key->size;
+
+    // find the state the key ends on, or the leaf whose tail it ends in
+    st = 0;
+    for (i = 0; i < key->size; i++) {
+        if (DA_IS_LEAF(da, st)) {
+            break;
+        }
+        code = DACODE(da, ((TRIE_CHAR *)kp->s)[i]);
+        st = code ? DACHILD(da, st, code) : DA_NONE;
+        if (st == DA_NONE) {
+            break;
+        }
+    }
+    if (st != DA_NONE && DA_IS_LEAF(da, st)) {
+        leaf = DALEAF(da, st);
+        for (k = 0; leaf != DA_NONE && i + k < key->size; k++) {
+            if (da->tails[leaf] + k >= da->tails[leaf+1] ||
+                ((TRIE_CHAR *)kp->s)[i + k] != WCHAR_READ(da->tail, 
+                da->char_size, da->tails[leaf] + k)) {
+                st = DA_NONE;
+                break;
+            }
+        }
+        if (leaf == DA_NONE) {
+            st = DA_NONE;
+        }
+    }
+
+    // every state below consumes a char, so the path holds at most
+    // max_depth + 1 of them.
+    it = st == DA_NONE ? NULL :
+        (trie_da_iter_t *)PyMem_Malloc(sizeof(trie_da_iter_t));
+    if (it) {
+        it->stack = (trie_da_pos_t *)PyMem_Malloc((max_depth + 1) *
+            sizeof(trie_da_pos_t));
+    }
+    if (!it || !it->stack) {
+        PyMem_Free(it);
+        PyMem_Free(kp->s);
+        PyMem_Free(kp);
+        return NULL;
+    }
+
+    memset(&it->iter, 0, sizeof(iter_t));
+    it->iter.key = kp;
+    it->iter.max_depth = max_depth;
+    it->da = da;
+    it->st = st;
+    it->prefix_len = i;
+    trie_da_iter_reset(&it->iter);
+
+    return &it->iter;
+}
+
+iter_t *trie_da_iter_reset(iter_t *iter)
+{
+    trie_da_iter_t *it = (trie_da_iter_t *)iter;
+
+    it->sp = 0;
+    it->iter.key->size = it->prefix_len;
+    it->iter.first = 1;
+    it->iter.last = 0;
+    it->iter.fail = 0;
+    it->iter.fail_reason = UNDEFINED;
+    return iter;
+}
+
+iter_t *trie_da_iter_next(iter_t *iter)
+{
+    trie_da_iter_t *it = (trie_da_iter_t *)iter;
+    trie_da_t *da = it->da;
+    trie_da_pos_t *ip;
+    unsigned long u, index;
+    uint32_t code;
+
+    if (iter->first) {
+        iter->first = 0;
+        if (DA_IS_LEAF(da, it->st)) {
+            if (_da_iter_leaf(it, it->st, it->prefix_len)) {
+                return iter;
+            }
+            iter->last = !iter->fail;
+            return iter;
+        }
+        _da_iter_push(it, it->st, it->prefix_len);
+    }
+
+    while (it->sp) {
+        ip = &it->stack[it->sp-1];
+        if (!ip->more) {
+            it->sp--;
+            continue;
+        }
+        index = ip->index;
+        code = ip->next;
+        u = DACHILD(da, ip->s, code);
+        if (u == DA_NONE || code > da->alpha_size) {
+            _da_iter_corrupt(it);
+            return iter;
+        }
+        // code 0 always comes first, so a 0 sibling means there is none.
+        // Siblings come in code order, which also keeps a damaged file from
+        // looping.
+        ip->next = DA_SIBLING_CODE(da, u);
+        ip->more = ip->next != 0;
+        if (ip->more && ip->next <= code) {
+            _da_iter_corrupt(it);
+            return iter;
+        }
+
+        if (code && index + 1 > iter->key->alloc_size) {
+            continue;
+        }
+        if (code) {
+            ((TRIE_CHAR *)iter->key->s)[index++] = da->alpha[code - 1];
+        }
+        if (!code || DA_IS_LEAF(da, u)) {
+            if (_da_iter_leaf(it, u, index) || iter->fail) {
+                return iter;
+            }
+            continue;
+        }
+        _da_iter_push(it, u, index);
+    }
+
+    iter->last = 1;
+    return iter;
+}
+
+void trie_da_iter_deinit(iter_t *iter)
+{
+    trie_da_iter_t *it = (trie_da_iter_t *)iter;
+
+    PyMem_Free(it->stack);
+    PyMem_Free(iter->key->s);
+    PyMem_Free(iter->key);
+    PyMem_Free(it);
+}
+
+// Same as trie_suffixes(): keys starting with key and at most max_depth
+// chars longer, in key order. Stops at a mapped value that fails to load, 
+// and returns 0 if it stopped on a damaged file. With keys_only the 
+// callbacks read no value and none is loaded.
+int trie_da_suffixes(trie_da_t *da, trie_key_t *key, unsigned long max_depth,
+    int keys_only, trie_enum_cbk_t cbk, void* cbk_arg)
+{
+    iter_t *iter;
+    trie_node_t nd; // callbacks only read the value
+    int ok;
+
+    iter = trie_da_iter_init(da, key, max_depth);
+    if (!iter) {
+        return 1;
+    }
+    iter->keys_only = keys_only;
+    memset(&nd, 0, sizeof(trie_node_t));
+    for (;;) {
+        trie_da_iter_next(iter);
+        if (iter->last || iter->fail) {
+            break;
+        }
+        nd.value = iter->value;
+        cbk(iter->key, &nd, cbk_arg);
+    }
+    ok = !iter->fail || iter->fail_reason != CORRUPT_FORM;
+    trie_da_iter_deinit(iter);
+    return ok;
+}
+
+// Cursor of a double array, see Note 17. Slots are codes. A key ending on a
+// state is its code 0 child, which is not a slot of its own.
+
+// Writes the tail of the leaf on u, if u is one, to the key at index. 
+// Returns the key length after it. A mapped file whose height is less than
+// that fails the cursor instead.
+static unsigned long _da_cursor_tail(trie_cursor_t *c, unsigned long u,
+    unsigned long index)
+{
+    trie_da_t *da = (trie_da_t *)c->form;
+    unsigned long leaf, k, from, len;
+
+    if (!DA_IS_LEAF(da, u)) {
+        return index;
+    }
+    leaf = DALEAF(da, u);
+    if (leaf == DA_NONE) {
+        c->fail = 1;
+        c->fail_reason = CORRUPT_FORM;
+        return index;
+    }
+    from = da->tails[leaf];
+    len = da->tails[leaf+1] - from;
+    if (index + len > c->key.alloc_size) {
+        c->fail = 1;
+        c->fail_reason = CORRUPT_FORM;
+        return index;
+    }
+    for (k = 0; k < len; k++) {
+        ((TRIE_CHAR *)c->key.s)[index + k] = WCHAR_READ(da->tail, da->char_size,
+            from + k);
+    }
+    return index + len;
+}
+
+static void _da_cursor_root(trie_cursor_t *c, trie_cursor_frame_t *f)
+{
+    f->node = 0;
+    f->index = _da_cursor_tail(c, 0, 0);
+}
+
+static TRIE_DATA _da_cursor_value(trie_cursor_t *c, trie_cursor_frame_t *f)
+{
+    trie_da_t *da = (trie_da_t *)c->form;
+    unsigned long u;
+    TRIE_DATA v;
+
+    u = f->node;
+    if (!DA_IS_LEAF(da, u)) {
+        u = DACHILD(da, u, 0);
+        if (u == DA_NONE) {
+            return 0;
+        }
+    }
+    u = DALEAF(da, u);
+    if (u == DA_NONE) {
+        c->fail = 1;
+        c->fail_reason = CORRUPT_FORM;
+        return 0;
+    }
+    v = DAVALUE(da, u);
+    if (!v) {
+        c->fail = 1;
+        c->fail_reason = LOAD_FAILED;
+    }
+    return v;
+}
+
+// Code of the sibling after the child on code of state s, 0 if there is 
+// none. Siblings come in code order; a damaged file that breaks it, or has
+// no such child, fails the cursor.
+static uint32_t _da_cursor_sibling(trie_cursor_t *c, unsigned long s,
+    uint32_t code)
+{
+    trie_da_t *da = (trie_da_t *)c->form;
+    unsigned long u;
+    uint32_t next;
+
+    u = DACHILD(da, s, code);
+    next = u == DA_NONE ? 0 : DA_SIBLING_CODE(da, u);
+    if (u == DA_NONE || code > da->alpha_size || (next && next <= code)) {
+        c->fail = 1;
+        c->fail_reason = CORRUPT_FORM;
+        return 0;
+    }
+    return next;
+}
+
+static unsigned long _da_cursor_edge(trie_cursor_t *c, trie_cursor_frame_t *f,
+    unsigned long slot, int dir)
+{
+    trie_da_t *da = (trie_da_t *)c->form;
+    unsigned long s, prev;
+    uint32_t code;
+
+    s = f->node;
+    if (DA_IS_LEAF(da, s)) {
+        return TRIE_CURSOR_NONE;
+    }
+    if (dir > 0 && slot != TRIE_CURSOR_NONE) {
+        code = _da_cursor_sibling(c, s, (uint32_t)slot);
+        return code ? code : TRIE_CURSOR_NONE;
+    }
+
+    // code 0 always comes first, skip it
+    code = DA_CHILD_CODE(da, s);
+    if (!code) {
+        if (DACHILD(da, s, 0) == DA_NONE) {
+            return TRIE_CURSOR_NONE;
+        }
+        code = _da_cursor_sibling(c, s, 0);
+        if (!code) {
+            return TRIE_CURSOR_NONE;
+        }
+    }
+    if (dir > 0) {
+        return code;
+    }
+
+    // there are no links back, walk the siblings from the first
+    prev = TRIE_CURSOR_NONE;
+    while (code && code != slot) {
+        prev = code;
+        code = _da_cursor_sibling(c, s, code);
+    }
+    return c->fail ? TRIE_CURSOR_NONE : prev;
+}
+
+static void _da_cursor_enter(trie_cursor_t *c, trie_cursor_frame_t *f,
+    trie_cursor_frame_t *child)
+{
+    trie_da_t *da = (trie_da_t *)c->form;
+    unsigned long u;
+
+    u = DACHILD(da, f->node, (uint32_t)child->slot);
+    child->node = u;
+    if (u == DA_NONE || child->slot == 0 || child->slot > da->alpha_size || 
+        f->index + 1 > c->key.alloc_size) {
+        c->fail = 1;
+        c->fail_reason = CORRUPT_FORM;
+        child->index = f->index;
+        return;
+    }
+    ((TRIE_CHAR *)c->key.s)[f->index] = da->alpha[child->slot - 1];
+    child->index = _da_cursor_tail(c, u, f->index + 1);
+}
+
+static unsigned long _da_cursor_height(trie_cursor_t *c)
+{
+    return ((trie_da_t *)c->form)->height;
+}
+
+static const trie_cursor_ops_t _da_cursor_ops = {
+    _da_cursor_root, _da_cursor_value, _da_cursor_edge, _da_cursor_enter,
+    _da_cursor_height
+};
+
+trie_cursor_t *trie_da_cursor(trie_da_t *da)
+{
+    return trie_cursor_create(&_da_cursor_ops, da);
+}
+
+// Rebuilds a trie_t holding the keys and values of da. The values move to 
+// the trie, so each leaf must be reached once: a damaged file that reaches 
+// one twice, see Note 18, fails the thaw with *damaged set.
+trie_t *trie_da_thaw(trie_da_t *da, int *damaged)
+{
+    trie_t *t;
+    trie_key_t key;
+    iter_t *iter;
+    unsigned char *seen;
+    unsigned long leaf;
+    int ok;
+
+    *damaged = 0;
+    t = trie_create();
+    if (!t) {
+        return NULL;
+    }
+    memset(&key, 0, sizeof(trie_key_t));
+    seen = (unsigned char *)PyMem_Malloc(da->leaf_count / 8 + 1);
+    iter = seen ? trie_da_iter_init(da, &key, da->height) : NULL;
+    ok = iter && trie_widen(t, da->char_size);
+    if (ok) {
+        memset(seen, 0, da->leaf_count / 8 + 1);
+    }
+    while (ok) {
+        trie_da_iter_next(iter);
+        if (iter->last || iter->fail) {
+            ok = !iter->fail;
+            *damaged = iter->fail_reason == CORRUPT_FORM;
+            break;
+        }
+        leaf = ((trie_da_iter_t *)iter)->leaf;
+        if (seen[leaf / 8] & (1 << (leaf % 8))) {
+            ok = 0;
+            *damaged = 1;
+            break;
+        }
+        seen[leaf / 8] |= 1 << (leaf % 8);
+        ok = trie_add(t, iter->key, iter->value);
+    }
+    if (iter) {
+        trie_da_iter_deinit(iter);
+    }
+    PyMem_Free(seen);
+    // keys a damaged file repeats are added once
+    if (ok && t->item_count != da->item_count) {
+        ok = 0;
+        *damaged = 1;
+    }
+    if (!ok) {
+        trie_destroy(t);
+        return NULL;
+    }
+    return t;
+}
+
+// File layout of trie_da_save(): this header, then the sections it points
+// to, each 8 byte aligned. Everything is in the byte order of the writer;
+// byte_order tells readers with another one apart.
+#define DA_FILE_MAGIC "FTRIEDA"
+#define DA_FILE_VERSION 1
+#define DA_FILE_BYTE_ORDER 0x01020304
+
+typedef struct da_file_header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint8_t char_size;
+    uint8_t code_size;
+    uint8_t trie_char_size; // sizeof(TRIE_CHAR) of alpha
+    uint8_t pad[5];
+    uint64_t unit_count;
+    uint64_t state_count;
+    uint64_t leaf_count;
+    uint64_t tail_len;
+    uint64_t item_count;
+    uint64_t height;
+    uint64_t alpha_size;
+    uint64_t alpha_lo;
+    // section offsets
+    uint64_t lo;
+    uint64_t units;
+    uint64_t links;
+    uint64_t tails;
+    uint64_t tail;
+    uint64_t alpha;
+    uint64_t payload_index;
+    uint64_t payload;
+    uint64_t size; // of the whole file
+} da_file_header_t;
+
+#define DA_ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+// Section sizes in the order they are written.
+static void _da_file_sizes(trie_da_t *da, uint64_t payload_size,
+    uint64_t *sizes)
+{
+    sizes[0] = TRIE_NODE_PAGE_SIZE * sizeof(uint32_t);
+    sizes[1] = (uint64_t)da->unit_count * sizeof(trie_da_unit_t);
+    sizes[2] = (uint64_t)da->unit_count * 2 * da->code_size;
+    sizes[3] = ((uint64_t)da->leaf_count + 1) * sizeof(uint32_t);
+    sizes[4] = (uint64_t)da->tail_len * da->char_size;
+    sizes[5] = (uint64_t)da->alpha_size * sizeof(TRIE_CHAR);
+    sizes[6] = ((uint64_t)da->leaf_count + 1) * sizeof(uint64_t);
+    sizes[7] = payload_size;
+}
+
+// Header of da with the section offsets for a payload of payload_size
+// bytes, and the section sizes.
+static void _da_file_layout(trie_da_t *da, uint64_t payload_size,
+    da_file_header_t *h, uint64_t *sizes)
+{
+    uint64_t *offsets[8], off;
+    int i;
+
+    memset(h, 0, sizeof(da_file_header_t));
+    memcpy(h->magic, DA_FILE_MAGIC, sizeof(DA_FILE_MAGIC));
+    h->version = DA_FILE_VERSION;
+    h->byte_order = DA_FILE_BYTE_ORDER;
+    h->char_size = da->char_size;
+    h->code_size = da->code_size;
+    h->trie_char_size = sizeof(TRIE_CHAR);
+    h->unit_count = da->unit_count;
+    h->state_count = da->state_count;
+    h->leaf_count = da->leaf_count;
+    h->tail_len = da->tail_len;
+    h->item_count = da->item_count;
+    h->height = da->height;
+    h->alpha_size = da->alpha_size;
+    h->alpha_lo = da->alpha_lo;
+
+    _da_file_sizes(da, payload_size, sizes);
+    offsets[0] = &h->lo;
+    offsets[1] = &h->units;
+    offsets[2] = &h->links;
+    offsets[3] = &h->tails;
+    offsets[4] = &h->tail;
+    offsets[5] = &h->alpha;
+    offsets[6] = &h->payload_index;
+    offsets[7] = &h->payload;
+    off = DA_ALIGN8(sizeof(da_file_header_t));
+    for (i = 0; i < 8; i++) {
+        *offsets[i] = off;
+        off = DA_ALIGN8(off + sizes[i]);
+    }
+    h->size = off;
+}
+
+// Pads a section of n bytes to 8 bytes.
+static int _da_pad(FILE *f, uint64_t n)
+{
+    static const char zeros[8] = {0};
+
+    return fwrite(zeros, 1, (size_t)(DA_ALIGN8(n) - n), f) == 
+        DA_ALIGN8(n) - n;
+}
+
+// Writes da to path with the values packed by the caller: the value of leaf i
+// is payload[payload_index[i], payload_index[i+1]). Returns 0 and leaves
+// errno set on failure.
+int trie_da_save(trie_da_t *da, const char *path, const char *payload,
+    const uint64_t *payload_index)
+{
+    da_file_header_t h;
+    uint64_t sizes[8];
+    const void *data[8];
+    FILE *f;
+    int i, ok;
+
+    _da_file_layout(da, payload_index[da->leaf_count], &h, sizes);
+    data[0] = da->lo;
+    data[1] = da->units;
+    data[2] = da->links;
+    data[3] = da->tails;
+    data[4] = da->tail;
+    data[5] = da->alpha;
+    data[6] = payload_index;
+    data[7] = payload;
+
+    f = fopen(path, "wb");
+    if (!f) {
+        return 0;
+    }
+    ok = fwrite(&h, sizeof(h), 1, f) == 1 && _da_pad(f, sizeof(h));
+    for (i = 0; ok && i < 8; i++) {
+        ok = fwrite(data[i], 1, sizes[i], f) == sizes[i] && 
+            _da_pad(f, sizes[i]);
+    }
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    return ok;
+}
+
+static void *_da_map_file(const char *path, unsigned long *size)
+{
+#ifdef __WINDOWS
+    HANDLE fh, mh;
+    LARGE_INTEGER li;
+    void *p;
+
+    fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    if (!GetFileSizeEx(fh, &li) || li.QuadPart == 0) {
+        CloseHandle(fh);
+        return NULL;
+    }
+    mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fh);
+    if (!mh) {
+        return NULL;
+    }
+    p = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mh); // the view keeps the mapping alive
+    *size = (unsigned long)li.QuadPart;
+    return p;
+#else
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    // shared and read-only: every process mapping the file uses the same
+    // page cache pages
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (unsigned long)st.st_size;
+    return p;
+#endif
+}
+
+#define DA_WIDTH_OK(w) ((w) == 1 || (w) == 2 || (w) == 4)
+
+// Note 18:
+// Mapping a file reads only its header, so that it takes the same time for
+// any size; see _da_file_check(). The units, links and tails in between are
+// checked as they are walked instead: a child is reached through DACHILD(), 
+// which checks both its index and its check, a leaf through DALEAF(), which
+// checks its leaf and tail bounds, and sibling codes must increase, so that
+// a damaged file cannot loop. The iterators and cursors fail with 
+// CORRUPT_FORM on such a file, and lookups do not find the keys damaged.
+// Payloads are checked as they are decoded.
+
+// Whether the header h of the size bytes at p describes a file that
+// trie_da_save() could have written: the widths and counts are in range and
+// agree with each other, the sections sit exactly where the writer puts
+// them for those counts, and the ends of the tails, payload index and lo
+// table agree with the header. It takes the same time for any size, the 
+// contents of the units, links, tails and payload index in between are 
+// checked as they are read, see Note 18.
+static int _da_file_check(const da_file_header_t *h, const char *p,
+    unsigned long size)
+{
+    trie_da_t da;
+    da_file_header_t exp;
+    uint64_t sizes[8], payload_len;
+    const uint32_t *lo, *tails;
+    const uint64_t *index;
+    const trie_da_unit_t *units;
+    int i;
+
+    if (!DA_WIDTH_OK(h->char_size) || !DA_WIDTH_OK(h->code_size) ||
+        h->unit_count == 0 || h->unit_count > size || 
+        h->leaf_count > size || h->tail_len > size || 
+        h->alpha_size > size || h->state_count > h->unit_count ||
+        h->leaf_count > h->unit_count || h->item_count != h->leaf_count ||
+        h->alpha_lo > h->alpha_size || h->alpha_lo > TRIE_NODE_PAGE_SIZE ||
+        h->height > h->unit_count + h->tail_len || (h->code_size < 4 && 
+        h->alpha_size >= ((uint64_t)1 << (8 * h->code_size)))) {
+        return 0;
+    }
+
+    memset(&da, 0, sizeof(trie_da_t));
+    da.char_size = h->char_size;
+    da.code_size = h->code_size;
+    da.unit_count = (unsigned long)h->unit_count;
+    da.leaf_count = (unsigned long)h->leaf_count;
+    da.tail_len = (unsigned long)h->tail_len;
+    da.alpha_size = (unsigned long)h->alpha_size;
+    _da_file_layout(&da, 0, &exp, sizes);
+    if (h->lo != exp.lo || h->units != exp.units || h->links != exp.links ||
+        h->tails != exp.tails || h->tail != exp.tail || 
+        h->alpha != exp.alpha || h->payload_index != exp.payload_index ||
+        h->payload != exp.payload || h->payload > size) {
+        return 0;
+    }
+
+    lo = (const uint32_t *)(p + h->lo);
+    for (i = 0; i < TRIE_NODE_PAGE_SIZE; i++) {
+        if (lo[i] > h->alpha_lo) {
+            return 0;
+        }
+    }
+    units = (const trie_da_unit_t *)(p + h->units);
+    tails = (const uint32_t *)(p + h->tails);
+    index = (const uint64_t *)(p + h->payload_index);
+    payload_len = index[h->leaf_count];
+    return units[0].check == DA_ROOT_CHECK && tails[0] == 0 &&
+        tails[h->leaf_count] == h->tail_len && index[0] == 0 &&
+        payload_len <= size - h->payload &&
+        DA_ALIGN8(h->payload + payload_len) == size;
+}
+
+// Maps a file written by trie_da_save(). Nothing is read but the header and
+// the ends of some sections, see _da_file_check(), so it takes the same time
+// for any size. Returns NULL with errno set if the file cannot be mapped, or
+// with *bad_format set if it is not a trie file this build can read. A file
+// damaged inside its sections fails later, when that part is read, see 
+// Note 18. load of the result shall be set before any lookup.
+trie_da_t *trie_da_map(const char *path, int *bad_format)
+{
+    trie_da_t *da;
+    da_file_header_t h;
+    unsigned long size;
+    char *p;
+
+    *bad_format = 0;
+    p = (char *)_da_map_file(path, &size);
+    if (!p) {
+        return NULL;
+    }
+    if (size < sizeof(h)) {
+        *bad_format = 1;
+        _da_unmap(p, size);
+        return NULL;
+    }
+    memcpy(&h, p, sizeof(h));
+    if (memcmp(h.magic, DA_FILE_MAGIC, sizeof(DA_FILE_MAGIC)) != 0 ||
+        h.version != DA_FILE_VERSION || h.byte_order != DA_FILE_BYTE_ORDER ||
+        h.trie_char_size != sizeof(TRIE_CHAR) || h.size != size ||
+        !_da_file_check(&h, p, size)) {
+        *bad_format = 1;
+        _da_unmap(p, size);
+        return NULL;
+    }
+
+    da = (trie_da_t *)PyMem_Malloc(sizeof(trie_da_t));
+    if (!da) {
+        _da_unmap(p, size);
+        return NULL;
+    }
+    memset(da, 0, sizeof(trie_da_t));
+    da->char_size = h.char_size;
+    da->code_size = h.code_size;
+    da->unit_count = (unsigned long)h.unit_count;
+    da->state_count = (unsigned long)h.state_count;
+    da->leaf_count = (unsigned long)h.leaf_count;
+    da->tail_len = (unsigned long)h.tail_len;
+    da->item_count = (unsigned long)h.item_count;
+    da->height = (unsigned long)h.height;
+    da->alpha_size = (unsigned long)h.alpha_size;
+    da->alpha_lo = (unsigned long)h.alpha_lo;
+
+    da->map = p;
+    da->map_size = size;
+    memcpy(da->lo, p + h.lo, sizeof(da->lo));
+    da->units = (trie_da_unit_t *)(p + h.units);
+    da->links = p + h.links;
+    da->tails = (uint32_t *)(p + h.tails);
+    da->tail = p + h.tail;
+    da->alpha = (TRIE_CHAR *)(p + h.alpha);
+    da->payload_index = (const uint64_t *)(p + h.payload_index);
+    da->payload = p + h.payload;
+
+    // calloc'd so the pages of values untouched by lookups are never
+    // committed
+    da->values = (TRIE_DATA *)calloc(da->leaf_count ? da->leaf_count : 1,
+        sizeof(TRIE_DATA));
+    if (!da->values) {
+        da->map = NULL;
+        PyMem_Free(da);
+        _da_unmap(p, size);
+        return NULL;
+    }
+    da->mem_usage = sizeof(trie_da_t) + da->leaf_count * sizeof(TRIE_DATA) +
+        size;
+
+    return da;
+}
+
+// Note 16:
+// trie_da_writer_t writes a double array file from keys added in increasing
+// order, holding neither the keys nor the array in memory. The leaf of a 
+// key hangs off the state of its longest common prefix with the keys next 
+// to it in order, so a key is placed once the one after it is known. The 
+// states of the path of the last key are kept with their children; a state
+// is written out to the nodes file once no later key goes through it, so 
+// the file holds the states in post order, each as its (char, leaf) 
+// children and their count. Tails and payloads go straight to their files.
+//
+// The units are placed by reading the nodes file backwards, parents before
+// their children, into a window of units sized by the memory budget. When a
+// state's children do not fit, the lower half of the window is written out 
+// and it slides up; a state placed below it gets its base patched in the 
+// written units. The file is assembled from the temporary ones last.
+#define DAW_END 0xffffffff // child on the end of a key
+#define DAW_INNER 0xffffffff // child that is a state, not a leaf
+#define DAW_SEEN(w, ch) ((w)->seen[(ch) / 8] |= 1 << ((ch) % 8))
+
+void trie_da_writer_destroy(trie_da_writer_t *w)
+{
+    FILE *files[5];
+    int i;
+
+    files[0] = w->nodes;
+    files[1] = w->tail;
+    files[2] = w->tails;
+    files[3] = w->payload_index;
+    files[4] = w->payload;
+    for (i = 0; i < 5; i++) {
+        if (files[i]) {
+            fclose(files[i]);
+        }
+    }
+    if (w->last) {
+        TRIEFREE(NULL, w->last);
+    }
+    if (w->last_payload) {
+        TRIEFREE(NULL, w->last_payload);
+    }
+    if (w->children) {
+        TRIEFREE(NULL, w->children);
+    }
+    if (w->starts) {
+        TRIEFREE(NULL, w->starts);
+    }
+    if (w->seen) {
+        TRIE_RAW_FREE(w->seen);
+    }
+    TRIE_RAW_FREE(w);
+}
+
+// A writer with temporary files in tmpdir, NULL for the default, that 
+// places units within memory bytes. Returns NULL with errno set on failure.
+trie_da_writer_t *trie_da_writer_create(const char *tmpdir, 
+    unsigned long memory)
+{
+    trie_da_writer_t *w;
+    uint32_t zero32;
+    uint64_t zero64;
+
+    w = (trie_da_writer_t *)TRIE_RAW_MALLOC(sizeof(trie_da_writer_t));
+    if (!w) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(w, 0, sizeof(trie_da_writer_t));
+    w->tmpdir = tmpdir;
+    w->memory = memory;
+    w->seen = (unsigned char *)TRIE_RAW_MALLOC(0x10ffff / 8 + 1);
+    if (!w->seen || 
+        !TRIERESERVE(NULL, (void **)&w->starts, &w->starts_size, 1, 
+        sizeof(unsigned long))) {
+        trie_da_writer_destroy(w);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(w->seen, 0, 0x10ffff / 8 + 1);
+    w->starts[0] = 0;
+
+    zero32 = 0;
+    zero64 = 0;
+    if (!(w->nodes = trie_tmpfile(tmpdir)) || 
+        !(w->tail = trie_tmpfile(tmpdir)) || 
+        !(w->tails = trie_tmpfile(tmpdir)) || 
+        !(w->payload_index = trie_tmpfile(tmpdir)) || 
+        !(w->payload = trie_tmpfile(tmpdir)) ||
+        fwrite(&zero32, sizeof(zero32), 1, w->tails) != 1 || 
+        fwrite(&zero64, sizeof(zero64), 1, w->payload_index) != 1) {
+        trie_da_writer_destroy(w);
+        return NULL;
+    }
+    return w;
+}
+
+static int _daw_child(trie_da_writer_t *w, uint32_t ch, uint32_t leaf)
+{
+    if (!TRIERESERVE(NULL, (void **)&w->children, &w->children_size, 
+        w->children_len + 2, sizeof(uint32_t))) {
+        errno = ENOMEM;
+        return 0;
+    }
+    w->children[w->children_len++] = ch;
+    w->children[w->children_len++] = leaf;
+    return 1;
+}
+
+// Places the last key now that its longest common prefix with the next one
+// is lcp, and writes out the states no later key goes through.
+static int _daw_step(trie_da_writer_t *w, unsigned long lcp)
+{
+    unsigned long d, m;
+    uint32_t ch, n, leaf, tail_end;
+    uint64_t tail_len;
+
+    // the path of the last key down to either common prefix
+    while (w->depth < lcp) {
+        ch = w->last[w->depth];
+        DAW_SEEN(w, ch);
+        if (!_daw_child(w, ch, DAW_INNER) || 
+            !TRIERESERVE(NULL, (void **)&w->starts, &w->starts_size, 
+            w->depth + 2, sizeof(unsigned long))) {
+            errno = ENOMEM;
+            return 0;
+        }
+        w->starts[++w->depth] = w->children_len;
+    }
+
+    // its leaf, with the chars after it as the tail
+    m = w->depth;
+    leaf = (uint32_t)w->leaf_count;
+    if (m == w->last_len) {
+        ch = DAW_END;
+        n = 0;
+    } else {
+        ch = w->last[m];
+        DAW_SEEN(w, ch);
+        n = (uint32_t)(w->last_len - m - 1);
+    }
+    tail_len = (uint64_t)w->tail_len + n;
+    if (w->leaf_count >= INT32_MAX || tail_len > UINT32_MAX) {
+        errno = EFBIG;
+        return 0;
+    }
+    w->tail_len = (unsigned long)tail_len;
+    tail_end = (uint32_t)tail_len;
+    w->payload_len += w->last_payload_len;
+    if (!_daw_child(w, ch, leaf) || 
+        fwrite(w->last + m + 1, sizeof(uint32_t), n, w->tail) != n || 
+        fwrite(&tail_end, sizeof(tail_end), 1, w->tails) != 1 || 
+        fwrite(w->last_payload, 1, w->last_payload_len, w->payload) != 
+        w->last_payload_len || 
+        fwrite(&w->payload_len, sizeof(uint64_t), 1, w->payload_index) != 1) {
+        return 0;
+    }
+    w->leaf_count++;
+
+    // states below the common prefix with the next key are complete
+    for (d = w->depth; d > lcp; d--) {
+        n = (uint32_t)((w->children_len - w->starts[d]) / 2);
+        if (fwrite(w->children + w->starts[d], 2 * sizeof(uint32_t), n, 
+            w->nodes) != n || fwrite(&n, sizeof(n), 1, w->nodes) != 1) {
+            return 0;
+        }
+        w->nodes_len += (uint64_t)(2 * n + 1) * sizeof(uint32_t);
+        w->children_len = w->starts[d];
+    }
+    w->depth = lcp;
+    w->last_lcp = lcp;
+    return 1;
+}
+
+// Adds key, which has to come after the last one added, with the packed 
+// payload of its value. Returns 1 if added, -1 if key is out of order and 0
+// with errno set on failure.
+int trie_da_writer_add(trie_da_writer_t *w, trie_key_t *key, 
+    const char *payload, unsigned long len)
+{
+    unsigned long i, n;
+    uint32_t ch;
+
+    if (w->item_count) {
+        n = key->size < w->last_len ? key->size : w->last_len;
+        for (i = 0; i < n; i++) {
+            if (WCHAR_READ(key->s, key->char_size, i) != w->last[i]) {
+                break;
+            }
+        }
+        if (i == key->size || 
+            (i < w->last_len && 
+            WCHAR_READ(key->s, key->char_size, i) < w->last[i])) {
+            return -1;
+        }
+        if (!_daw_step(w, i)) {
+            return 0;
+        }
+    }
+
+    if (!TRIERESERVE(NULL, (void **)&w->last, &w->last_size, key->size + 1, 
+        sizeof(uint32_t)) || 
+        !TRIERESERVE(NULL, (void **)&w->last_payload, &w->last_payload_size, 
+        len + 1, 1)) {
+        errno = ENOMEM;
+        return 0;
+    }
+    for (i = 0; i < key->size; i++) {
+        ch = WCHAR_READ(key->s, key->char_size, i);
+        w->last[i] = ch;
+        if (ch > w->max_char) {
+            w->max_char = ch;
+        }
+    }
+    w->last_len = key->size;
+    memcpy(w->last_payload, payload, len);
+    w->last_payload_len = len;
+    if (key->size > w->height) {
+        w->height = key->size;
+    }
+    w->item_count++;
+    return 1;
+}
+
+// The alphabet of da from the chars seen on transitions, as _da_alphabet()
+// makes it.
+static int _daw_alphabet(trie_da_writer_t *w, trie_da_t *da)
+{
+    unsigned long n;
+    uint32_t ch;
+
+    n = 0;
+    for (ch = 0; ch <= w->max_char; ch++) {
+        if (w->seen[ch / 8] & (1 << (ch % 8))) {
+            n++;
+        }
+    }
+    da->alpha = (TRIE_CHAR *)TRIE_RAW_MALLOC(n ? n * sizeof(TRIE_CHAR) : 1);
+    if (!da->alpha) {
+        errno = ENOMEM;
+        return 0;
+    }
+    da->alpha_size = 0;
+    for (ch = 0; ch <= w->max_char; ch++) {
+        if (w->seen[ch / 8] & (1 << (ch % 8))) {
+            if (ch < TRIE_NODE_PAGE_SIZE) {
+                da->lo[ch] = (uint32_t)da->alpha_size + 1;
+                da->alpha_lo = da->alpha_size + 1;
+            }
+            da->alpha[da->alpha_size++] = ch;
+        }
+    }
+    da->code_size = da->alpha_size <= 0xff ? 1 :
+        (da->alpha_size <= 0xffff ? 2 : 4);
+    return 1;
+}
+
+// Placement state, see Note 16. Units are addressed by their index in the
+// whole array; the window holds [lo, lo + cap) of them, those below are in 
+// the units and links files already.
+typedef struct daw_unit_s {
+    int32_t base;
+    int32_t check;
+    uint32_t child; // codes of the links
+    uint32_t sibling;
+    uint32_t next; // free list links, (uint32_t)-1 if none
+    uint32_t prev;
+} daw_unit_t;
+
+typedef struct daw_place_s {
+    trie_da_t *da;
+    FILE *units;
+    FILE *links;
+    daw_unit_t *win;
+    unsigned long cap; // a power of 2
+    unsigned long lo;
+    unsigned long free_head;
+    unsigned long free_tail;
+    unsigned long end; // past the last unit used
+    char *buf; // for writing units out
+} daw_place_t;
+
+#define DAW_UNIT(p, u) (&(p)->win[(u) & ((p)->cap - 1)])
+#define DAW_CHUNK 4096 // units converted at a time when writing out
+#define DAW_READ_BUFFER (1024*1024)
+
+static void _daw_unlink(daw_place_t *p, unsigned long u)
+{
+    unsigned long next, prev;
+
+    next = DA_LINK(DAW_UNIT(p, u)->next);
+    prev = DA_LINK(DAW_UNIT(p, u)->prev);
+    if (prev == DA_NONE) {
+        p->free_head = next;
+    } else {
+        DAW_UNIT(p, prev)->next = (uint32_t)next;
+    }
+    if (next == DA_NONE) {
+        p->free_tail = prev;
+    } else {
+        DAW_UNIT(p, next)->prev = (uint32_t)prev;
+    }
+}
+
+// Makes units [from, to) free, they go to the end of the free list.
+static void _daw_free(daw_place_t *p, unsigned long from, unsigned long to)
+{
+    daw_unit_t *x;
+    unsigned long u;
+
+    for (u = from; u < to; u++) {
+        x = DAW_UNIT(p, u);
+        x->base = 0;
+        x->check = DA_FREE;
+        x->child = 0;
+        x->sibling = 0;
+        x->next = (uint32_t)-1;
+        x->prev = (uint32_t)p->free_tail;
+        if (p->free_tail == DA_NONE) {
+            p->free_head = u;
+        } else {
+            DAW_UNIT(p, p->free_tail)->next = (uint32_t)u;
+        }
+        p->free_tail = u;
+    }
+}
+
+// Writes out units [lo, to) of the window.
+static int _daw_flush(daw_place_t *p, unsigned long to)
+{
+    trie_da_t *da = p->da;
+    trie_da_unit_t *units;
+    daw_unit_t *x;
+    char *links;
+    unsigned long u, i, n;
+
+    units = (trie_da_unit_t *)p->buf;
+    links = p->buf + DAW_CHUNK * sizeof(trie_da_unit_t);
+    for (u = p->lo; u < to; u += n) {
+        n = to - u < DAW_CHUNK ? to - u : DAW_CHUNK;
+        for (i = 0; i < n; i++) {
+            x = DAW_UNIT(p, u + i);
+            units[i].base = x->base;
+            units[i].check = x->check;
+            WCHAR_WRITE(links, da->code_size, 2*i, x->child);
+            WCHAR_WRITE(links, da->code_size, 2*i+1, x->sibling);
+        }
+        if (fwrite(units, sizeof(trie_da_unit_t), n, p->units) != n || 
+            fwrite(links, 2 * da->code_size, n, p->links) != n) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Writes out the lower half of the window and moves it up by as much.
+static int _daw_slide(daw_place_t *p)
+{
+    unsigned long half;
+
+    half = p->cap / 2;
+    if (p->lo + p->cap + half > INT32_MAX) {
+        errno = EFBIG;
+        return 0;
+    }
+    if (!_daw_flush(p, p->lo + half)) {
+        return 0;
+    }
+    while (p->free_head != DA_NONE && p->free_head < p->lo + half) {
+        _daw_unlink(p, p->free_head);
+    }
+    _daw_free(p, p->lo + p->cap, p->lo + p->cap + half);
+    p->lo += half;
+    return 1;
+}
+
+// First base >= 1 that puts every code of codes[0, n) on a free unit of the
+// window, sliding it up if there is none.
+static unsigned long _daw_find_base(daw_place_t *p, const uint32_t *codes, 
+    unsigned long n)
+{
+    unsigned long pos, base, i;
+
+    for (;;) {
+        for (pos = p->free_head; pos != DA_NONE; 
+            pos = DA_LINK(DAW_UNIT(p, pos)->next)) {
+            if (pos < codes[0] + 1) {
+                continue;
+            }
+            base = pos - codes[0];
+            if (base + codes[n-1] >= p->lo + p->cap) {
+                break;
+            }
+            for (i = 1; i < n; i++) {
+                if (DAW_UNIT(p, base + codes[i])->check != DA_FREE) {
+                    break;
+                }
+            }
+            if (i == n) {
+                return base;
+            }
+        }
+        if (!_daw_slide(p)) {
+            return DA_NONE;
+        }
+    }
+}
+
+// Sets the base and first child code of unit u, in the units written out 
+// already if it is below the window.
+static int _daw_set_base(daw_place_t *p, unsigned long u, unsigned long base,
+    uint32_t child)
+{
+    unsigned char w;
+    int32_t b;
+    char code[4];
+
+    if (u >= p->lo) {
+        DAW_UNIT(p, u)->base = (int32_t)base;
+        DAW_UNIT(p, u)->child = child;
+        return 1;
+    }
+    w = p->da->code_size;
+    b = (int32_t)base;
+    WCHAR_WRITE(code, w, 0, child);
+    return trie_fseek(p->units, (uint64_t)u * sizeof(trie_da_unit_t)) && 
+        fwrite(&b, sizeof(b), 1, p->units) == 1 && 
+        trie_fseek(p->units, (uint64_t)p->lo * sizeof(trie_da_unit_t)) && 
+        trie_fseek(p->links, (uint64_t)u * 2 * w) && 
+        fwrite(code, w, 1, p->links) == 1 && 
+        trie_fseek(p->links, (uint64_t)p->lo * 2 * w);
+}
+
+typedef struct daw_reader_s {
+    FILE *f;
+    uint64_t pos; // where what is left to read ends
+    uint64_t start; // of the bytes in buf
+    unsigned long len;
+    char *buf;
+} daw_reader_t;
+
+// Reads the n bytes before the read position and moves it back by as much.
+static int _daw_read_back(daw_reader_t *r, void *out, unsigned long n)
+{
+    uint64_t from;
+
+    if (n > r->pos) {
+        errno = EIO;
+        return 0;
+    }
+    from = r->pos - n;
+    if (from < r->start) {
+        if (n > DAW_READ_BUFFER) {
+            // a state larger than the buffer
+            if (!trie_fseek(r->f, from) || fread(out, 1, n, r->f) != n) {
+                errno = EIO;
+                return 0;
+            }
+            r->pos = r->start = from;
+            r->len = 0;
+            return 1;
+        }
+        r->start = r->pos > DAW_READ_BUFFER ? r->pos - DAW_READ_BUFFER : 0;
+        r->len = (unsigned long)(r->pos - r->start);
+        if (!trie_fseek(r->f, r->start) || 
+            fread(r->buf, 1, r->len, r->f) != r->len) {
+            errno = EIO;
+            return 0;
+        }
+    }
+    memcpy(out, r->buf + (unsigned long)(from - r->start), n);
+    r->pos = from;
+    return 1;
+}
+
+// Places the states of the nodes file, parents first, into the units and 
+// links files.
+static int _daw_place(trie_da_writer_t *w, daw_place_t *p)
+{
+    trie_da_t *da = p->da;
+    daw_reader_t r;
+    daw_unit_t *x;
+    uint32_t *entries, *codes, count, ch, leaf;
+    unsigned long *stack, stack_len, stack_size, i, u, v, base, max;
+    int ok;
+
+    max = da->alpha_size + 1; // children of a state at most
+    entries = (uint32_t *)TRIEMALLOC(NULL, 2 * max * sizeof(uint32_t));
+    codes = (uint32_t *)TRIEMALLOC(NULL, max * sizeof(uint32_t));
+    r.buf = (char *)TRIE_RAW_MALLOC(DAW_READ_BUFFER);
+    stack = NULL;
+    stack_size = 0;
+    ok = entries && codes && r.buf && 
+        TRIERESERVE(NULL, (void **)&stack, &stack_size, 1, 
+        sizeof(unsigned long));
+    if (!ok) {
+        errno = ENOMEM;
+    }
+    r.f = w->nodes;
+    r.pos = r.start = w->nodes_len;
+    r.len = 0;
+    ok = ok && fflush(w->nodes) == 0;
+
+    // the root is unit 0 and never a child: bases start from 1
+    stack_len = 0;
+    if (ok) {
+        _daw_unlink(p, 0);
+        DAW_UNIT(p, 0)->check = DA_ROOT_CHECK;
+        da->state_count = 1;
+        stack[stack_len++] = 0;
+    }
+    while (ok && r.pos) {
+        ok = _daw_read_back(&r, &count, sizeof(count));
+        if (ok && (count > max || !stack_len)) {
+            errno = EIO;
+            ok = 0;
+        }
+        ok = ok && _daw_read_back(&r, entries, count * 2 * sizeof(uint32_t));
+        if (!ok) {
+            break;
+        }
+        u = stack[--stack_len];
+        if (!count) {
+            continue; // the root of an empty trie
+        }
+        for (i = 0; i < count; i++) {
+            ch = entries[2*i];
+            codes[i] = ch == DAW_END ? 0 : DACODE(da, ch);
+        }
+        base = _daw_find_base(p, codes, count);
+        if (base == DA_NONE || !_daw_set_base(p, u, base, codes[0])) {
+            ok = 0;
+            break;
+        }
+        if (!TRIERESERVE(NULL, (void **)&stack, &stack_size, 
+            stack_len + count, sizeof(unsigned long))) {
+            errno = ENOMEM;
+            ok = 0;
+            break;
+        }
+        // children to the left are placed later, the rightmost on the top
+        for (i = 0; i < count; i++) {
+            v = base + codes[i];
+            _daw_unlink(p, v);
+            x = DAW_UNIT(p, v);
+            leaf = entries[2*i+1];
+            x->base = leaf == DAW_INNER ? 0 : (int32_t)(-1 - (long)leaf);
+            x->check = (int32_t)u;
+            x->sibling = i + 1 < count ? codes[i+1] : 0;
+            if (leaf == DAW_INNER) {
+                stack[stack_len++] = v;
+            }
+        }
+        if (base + codes[count-1] + 1 > p->end) {
+            p->end = base + codes[count-1] + 1;
+        }
+        da->state_count += count;
+    }
+    if (ok && stack_len) {
+        errno = EIO; // a state without its children
+        ok = 0;
+    }
+    ok = ok && _daw_flush(p, p->end > p->lo ? p->end : p->lo);
+    da->unit_count = p->end;
+
+    if (entries) {
+        TRIEFREE(NULL, entries);
+    }
+    if (codes) {
+        TRIEFREE(NULL, codes);
+    }
+    if (stack) {
+        TRIEFREE(NULL, stack);
+    }
+    if (r.buf) {
+        TRIE_RAW_FREE(r.buf);
+    }
+    return ok;
+}
+
+// Copies the first n bytes of the temporary file in to out.
+static int _daw_copy(FILE *out, FILE *in, uint64_t n, char *buf)
+{
+    unsigned long k;
+
+    if (fflush(in) != 0) {
+        return 0;
+    }
+    rewind(in);
+    while (n) {
+        k = n < DAW_READ_BUFFER ? (unsigned long)n : DAW_READ_BUFFER;
+        if (fread(buf, 1, k, in) != k) {
+            errno = EIO;
+            return 0;
+        }
+        if (fwrite(buf, 1, k, out) != k) {
+            return 0;
+        }
+        n -= k;
+    }
+    return 1;
+}
+
+// Copies the tail file to out narrowing its chars to the char_size of da.
+static int _daw_copy_tail(trie_da_t *da, FILE *out, FILE *in, char *buf)
+{
+    uint32_t *chars;
+    unsigned long n, k, i, max;
+
+    if (fflush(in) != 0) {
+        return 0;
+    }
+    rewind(in);
+    max = DAW_READ_BUFFER / 2 / sizeof(uint32_t);
+    chars = (uint32_t *)(buf + DAW_READ_BUFFER / 2);
+    for (n = da->tail_len; n; n -= k) {
+        k = n < max ? n : max;
+        if (fread(chars, sizeof(uint32_t), k, in) != k) {
+            errno = EIO;
+            return 0;
+        }
+        for (i = 0; i < k; i++) {
+            WCHAR_WRITE(buf, da->char_size, i, chars[i]);
+        }
+        if (fwrite(buf, da->char_size, k, out) != k) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Writes the double array file at path. Returns 0 with errno set on failure.
+int trie_da_writer_finish(trie_da_writer_t *w, const char *path)
+{
+    trie_da_t da;
+    daw_place_t p;
+    da_file_header_t h;
+    uint64_t sizes[8];
+    unsigned long root;
+    uint32_t n;
+    FILE *f;
+    int ok;
+
+    // the last key and the root
+    if (w->item_count && !_daw_step(w, 0)) {
+        return 0;
+    }
+    root = w->children_len / 2;
+    n = (uint32_t)root;
+    if (fwrite(w->children, 2 * sizeof(uint32_t), root, w->nodes) != root || 
+        fwrite(&n, sizeof(n), 1, w->nodes) != 1) {
+        return 0;
+    }
+    w->nodes_len += (uint64_t)(2 * root + 1) * sizeof(uint32_t);
+
+    memset(&da, 0, sizeof(trie_da_t));
+    da.char_size = w->max_char <= 0xff ? 1 : (w->max_char <= 0xffff ? 2 : 4);
+    da.leaf_count = w->leaf_count;
+    da.tail_len = w->tail_len;
+    da.item_count = w->item_count;
+    da.height = w->height;
+    if (!_daw_alphabet(w, &da)) {
+        return 0;
+    }
+
+    // the window takes the memory budget, and two states' children at least
+    memset(&p, 0, sizeof(daw_place_t));
+    p.da = &da;
+    p.cap = 1024;
+    while (p.cap < 2 * (da.alpha_size + 1) || (p.cap < (1UL << 30) && 
+        p.cap * 2 * sizeof(daw_unit_t) <= w->memory)) {
+        p.cap *= 2;
+    }
+    p.free_head = p.free_tail = DA_NONE;
+    p.win = (daw_unit_t *)TRIE_RAW_MALLOC(p.cap * sizeof(daw_unit_t));
+    p.buf = (char *)TRIE_RAW_MALLOC(DAW_CHUNK * 
+        (sizeof(trie_da_unit_t) + 2 * sizeof(uint32_t)));
+    p.units = trie_tmpfile(w->tmpdir);
+    p.links = p.units ? trie_tmpfile(w->tmpdir) : NULL;
+    ok = p.win && p.buf;
+    if (!ok) {
+        errno = ENOMEM;
+    }
+    ok = ok && p.units && p.links;
+    if (ok) {
+        _daw_free(&p, 0, p.cap);
+        p.end = 1;
+        ok = _daw_place(w, &p);
+    }
+    if (p.win) {
+        TRIE_RAW_FREE(p.win);
+    }
+    if (p.buf) {
+        TRIE_RAW_FREE(p.buf);
+    }
+
+    // the file, from the temporary ones
+    f = NULL;
+    if (ok) {
+        _da_file_layout(&da, w->payload_len, &h, sizes);
+        p.buf = (char *)TRIE_RAW_MALLOC(DAW_READ_BUFFER);
+        f = p.buf ? fopen(path, "wb") : NULL;
+        if (!p.buf) {
+            errno = ENOMEM;
+        }
+        ok = f && fwrite(&h, sizeof(h), 1, f) == 1 && _da_pad(f, sizeof(h)) &&
+            fwrite(da.lo, 1, sizes[0], f) == sizes[0] && 
+            _da_pad(f, sizes[0]) &&
+            _daw_copy(f, p.units, sizes[1], p.buf) && _da_pad(f, sizes[1]) &&
+            _daw_copy(f, p.links, sizes[2], p.buf) && _da_pad(f, sizes[2]) &&
+            _daw_copy(f, w->tails, sizes[3], p.buf) && 
+            _da_pad(f, sizes[3]) &&
+            _daw_copy_tail(&da, f, w->tail, p.buf) && _da_pad(f, sizes[4]) &&
+            fwrite(da.alpha, 1, sizes[5], f) == sizes[5] && 
+            _da_pad(f, sizes[5]) &&
+            _daw_copy(f, w->payload_index, sizes[6], p.buf) && 
+            _da_pad(f, sizes[6]) &&
+            _daw_copy(f, w->payload, sizes[7], p.buf) && _da_pad(f, sizes[7]);
+        if (f && fclose(f) != 0) {
+            ok = 0;
+        }
+        if (p.buf) {
+            TRIE_RAW_FREE(p.buf);
+        }
+    }
+    if (p.units) {
+        fclose(p.units);
+    }
+    if (p.links) {
+        fclose(p.links);
+    }
+    TRIE_RAW_FREE(da.alpha);
+    return ok;
+}
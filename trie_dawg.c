@@ -0,0 +1,715 @@
+#include "trie.h"
+#include "string.h"
+
+// Frozen minimal automaton form of a trie, see Note 10 in trie.h. Built once
+// from a trie_t by merging equal subtrees bottom up, then only read.
+
+#define DAWG_NONE ((unsigned long)-1)
+
+void trie_dawg_destroy(trie_dawg_t *d)
+{
+    PyMem_Free(d->first);
+    PyMem_Free(d->final);
+    PyMem_Free(d->target);
+    PyMem_Free(d->skip);
+    PyMem_Free(d->tails);
+    PyMem_Free(d->tail);
+    PyMem_Free(d->values);
+    PyMem_Free(d);
+}
+
+// Build state. Nodes are visited in post order; a finished node leaves its
+// state on the result stack, where its parent finds the states of all of its
+// children in key order.
+typedef struct dawg_frame_s {
+    trie_node_t *nd;
+    unsigned long pos; // child cursor
+    unsigned long base; // results of nd's children start here
+} dawg_frame_t;
+
+typedef struct dawg_result_s {
+    trie_node_t *nd; // for the label of the edge to it
+    uint32_t state;
+} dawg_result_t;
+
+typedef struct dawg_build_s {
+    trie_dawg_t *d;
+    unsigned char w;
+    unsigned long state_alloc;
+    unsigned long edge_alloc;
+    unsigned long tail_alloc;
+    unsigned long item_alloc;
+    uint32_t *counts; // keys accepted from each state
+    uint32_t *hashes; // of each state
+    uint32_t *table; // open addressing, state + 1 or 0 if empty
+    unsigned long table_size;
+    dawg_result_t *res;
+    unsigned long res_size;
+    unsigned long res_alloc;
+} dawg_build_t;
+
+static uint32_t _dawg_hash(dawg_build_t *b, int final, dawg_result_t *res,
+    unsigned long n)
+{
+    uint64_t h;
+    unsigned long i, k;
+    void *label;
+
+    h = 0xcbf29ce484222325ULL ^ (uint64_t)final;
+    for (i = 0; i < n; i++) {
+        h = (h ^ res[i].state) * 0x100000001b3ULL;
+        label = NODELABEL(res[i].nd, b->w);
+        for (k = 0; k < res[i].nd->label_len; k++) {
+            h = (h ^ WCHAR_READ(label, b->w, k)) * 0x100000001b3ULL;
+        }
+        h = (h ^ 0xff) * 0x100000001b3ULL;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// 1 if state s has exactly the given finality and edges.
+static int _dawg_equal(dawg_build_t *b, unsigned long s, int final,
+    dawg_result_t *res, unsigned long n)
+{
+    trie_dawg_t *d = b->d;
+    unsigned long i, e, len;
+
+    if (d->final[s] != final || d->first[s+1] - d->first[s] != n) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        e = d->first[s] + i;
+        len = d->tails[e+1] - d->tails[e];
+        if (d->target[e] != res[i].state || len != res[i].nd->label_len ||
+            memcmp((char *)d->tail + d->tails[e] * b->w,
+            NODELABEL(res[i].nd, b->w), len * b->w)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int _dawg_rehash(dawg_build_t *b, unsigned long size)
+{
+    uint32_t *table;
+    unsigned long s, i;
+
+    table = (uint32_t *)PyMem_Malloc(size * sizeof(uint32_t));
+    if (!table) {
+        return 0;
+    }
+    memset(table, 0, size * sizeof(uint32_t));
+    for (s = 0; s < b->d->state_count; s++) {
+        i = b->hashes[s] & (size - 1);
+        while (table[i]) {
+            i = (i + 1) & (size - 1);
+        }
+        table[i] = (uint32_t)s + 1;
+    }
+    PyMem_Free(b->table);
+    b->table = table;
+    b->table_size = size;
+    return 1;
+}
+
+// State for a node that ends a key or not and has the given children
+// results, an existing one if there is an equal state already.
+static unsigned long _dawg_state(dawg_build_t *b, int final,
+    dawg_result_t *res, unsigned long n)
+{
+    trie_dawg_t *d = b->d;
+    unsigned long i, s, e, len, count, need;
+    uint32_t h;
+
+    h = _dawg_hash(b, final, res, n);
+    i = h & (b->table_size - 1);
+    while (b->table[i]) {
+        s = b->table[i] - 1;
+        if (b->hashes[s] == h && _dawg_equal(b, s, final, res, n)) {
+            return s;
+        }
+        i = (i + 1) & (b->table_size - 1);
+    }
+
+    // a new state, its edges go to the end of the edge arrays
+    s = d->state_count;
+    if (s + 2 > b->state_alloc) {
+        need = b->state_alloc * 2;
+        if (!TRIE_GROW(&d->mem_usage, (void **)&d->first, b->state_alloc, need,
+            sizeof(uint32_t)) ||
+            !TRIE_GROW(&d->mem_usage, (void **)&d->final, b->state_alloc, need,
+            1) ||
+            !TRIE_GROW(&d->mem_usage, (void **)&b->counts, b->state_alloc, need,
+            sizeof(uint32_t)) ||
+            !TRIE_GROW(&d->mem_usage, (void **)&b->hashes, b->state_alloc, need,
+            sizeof(uint32_t))) {
+            return DAWG_NONE;
+        }
+        b->state_alloc = need;
+    }
+    if (d->edge_count + n + 1 > b->edge_alloc) {
+        need = b->edge_alloc * 2;
+        while (need < d->edge_count + n + 1) {
+            need *= 2;
+        }
+        if (!TRIE_GROW(&d->mem_usage, (void **)&d->target, b->edge_alloc, need,
+            sizeof(uint32_t)) ||
+            !TRIE_GROW(&d->mem_usage, (void **)&d->skip, b->edge_alloc, need,
+            sizeof(uint32_t)) ||
+            !TRIE_GROW(&d->mem_usage, (void **)&d->tails, b->edge_alloc, need,
+            sizeof(uint32_t))) {
+            return DAWG_NONE;
+        }
+        b->edge_alloc = need;
+    }
+
+    d->final[s] = (unsigned char)final;
+    count = final;
+    for (i = 0; i < n; i++) {
+        e = d->edge_count++;
+        len = res[i].nd->label_len;
+        if (d->tail_len + len > b->tail_alloc) {
+            need = b->tail_alloc * 2;
+            while (need < d->tail_len + len) {
+                need *= 2;
+            }
+            if (need > UINT32_MAX ||
+                !TRIE_GROW(&d->mem_usage, &d->tail, b->tail_alloc, need, 
+                b->w)) {
+                return DAWG_NONE;
+            }
+            b->tail_alloc = need;
+        }
+        memcpy((char *)d->tail + d->tail_len * b->w,
+            NODELABEL(res[i].nd, b->w), len * b->w);
+        d->tails[e] = (uint32_t)d->tail_len;
+        d->tail_len += len;
+        d->tails[e+1] = (uint32_t)d->tail_len;
+        d->target[e] = res[i].state;
+        d->skip[e] = (uint32_t)count;
+        count += b->counts[res[i].state];
+    }
+    d->first[s+1] = (uint32_t)d->edge_count;
+    b->counts[s] = (uint32_t)count;
+    b->hashes[s] = h;
+    d->state_count++;
+
+    if (d->state_count * 2 > b->table_size &&
+        !_dawg_rehash(b, b->table_size * 2)) {
+        return DAWG_NONE;
+    }
+    i = h & (b->table_size - 1);
+    while (b->table[i]) {
+        i = (i + 1) & (b->table_size - 1);
+    }
+    b->table[i] = (uint32_t)s + 1;
+    return s;
+}
+
+static int _dawg_push_result(dawg_build_t *b, trie_node_t *nd,
+    unsigned long s)
+{
+    unsigned long n;
+
+    if (b->res_size == b->res_alloc) {
+        n = b->res_alloc * 2;
+        if (!TRIE_GROW(&b->d->mem_usage, (void **)&b->res, b->res_alloc, n,
+            sizeof(dawg_result_t))) {
+            return 0;
+        }
+        b->res_alloc = n;
+    }
+    b->res[b->res_size].nd = nd;
+    b->res[b->res_size].state = (uint32_t)s;
+    b->res_size++;
+    return 1;
+}
+
+// Compiles t into a new automaton. t is left unchanged and the values are
+// shared, the caller decides which of them owns the values afterwards.
+trie_dawg_t *trie_dawg_build(trie_t *t)
+{
+    trie_dawg_t *d;
+    dawg_build_t b;
+    dawg_frame_t *stack, *f;
+    trie_node_t *child;
+    unsigned long sp, s, items;
+    TRIE_CHAR ch;
+    int ok;
+
+    d = (trie_dawg_t *)PyMem_Malloc(sizeof(trie_dawg_t));
+    if (!d) {
+        return NULL;
+    }
+    memset(d, 0, sizeof(trie_dawg_t));
+    d->mem_usage = sizeof(trie_dawg_t);
+    d->char_size = t->char_size;
+    d->item_count = t->item_count;
+    d->height = t->height;
+
+    memset(&b, 0, sizeof(dawg_build_t));
+    b.d = d;
+    b.w = t->char_size;
+    b.state_alloc = b.edge_alloc = b.tail_alloc = b.res_alloc = 64;
+    ok = TRIE_GROW(&d->mem_usage, (void **)&d->first, 0, b.state_alloc, 
+            sizeof(uint32_t)) &&
+        TRIE_GROW(&d->mem_usage, (void **)&d->final, 0, b.state_alloc, 1) &&
+        TRIE_GROW(&d->mem_usage, (void **)&b.counts, 0, b.state_alloc, 
+            sizeof(uint32_t)) &&
+        TRIE_GROW(&d->mem_usage, (void **)&b.hashes, 0, b.state_alloc, 
+            sizeof(uint32_t)) &&
+        TRIE_GROW(&d->mem_usage, (void **)&d->target, 0, b.edge_alloc, 
+            sizeof(uint32_t)) &&
+        TRIE_GROW(&d->mem_usage, (void **)&d->skip, 0, b.edge_alloc, 
+            sizeof(uint32_t)) &&
+        TRIE_GROW(&d->mem_usage, (void **)&d->tails, 0, b.edge_alloc, 
+            sizeof(uint32_t)) &&
+        TRIE_GROW(&d->mem_usage, &d->tail, 0, b.tail_alloc, b.w) &&
+        TRIE_GROW(&d->mem_usage, (void **)&d->values, 0, t->item_count, 
+            sizeof(TRIE_DATA)) &&
+        TRIE_GROW(&d->mem_usage, (void **)&b.res, 0, b.res_alloc, 
+            sizeof(dawg_result_t)) &&
+        _dawg_rehash(&b, 64);
+    d->first[0] = 0;
+    d->tails[0] = 0;
+
+    // every node on the path consumes a char, but the root
+    stack = (dawg_frame_t *)PyMem_Malloc((t->height + 2) *
+        sizeof(dawg_frame_t));
+    ok = ok && stack;
+
+    items = 0;
+    sp = 0;
+    if (ok) {
+        stack[sp].nd = t->root;
+        stack[sp].pos = 0;
+        stack[sp++].base = 0;
+        if (t->root->value) {
+            d->values[items++] = t->root->value;
+        }
+    }
+    while (ok && sp) {
+        f = &stack[sp-1];
+        child = trie_node_next_child(t, f->nd, &f->pos, &ch);
+        if (child) {
+            // pre order is key order: collect the values here
+            if (child->value) {
+                d->values[items++] = child->value;
+            }
+            stack[sp].nd = child;
+            stack[sp].pos = 0;
+            stack[sp++].base = b.res_size;
+            continue;
+        }
+
+        s = _dawg_state(&b, f->nd->value != 0, &b.res[f->base],
+            b.res_size - f->base);
+        if (s == DAWG_NONE) {
+            ok = 0;
+            break;
+        }
+        b.res_size = f->base;
+        ok = _dawg_push_result(&b, f->nd, s);
+        sp--;
+    }
+    if (ok) {
+        d->root = b.res[0].state;
+        ok = items == t->item_count;
+    }
+
+    PyMem_Free(stack);
+    PyMem_Free(b.table);
+    PyMem_Free(b.res);
+    d->mem_usage -= b.res_alloc * sizeof(dawg_result_t);
+    PyMem_Free(b.counts);
+    PyMem_Free(b.hashes);
+    d->mem_usage -= 2 * b.state_alloc * sizeof(uint32_t);
+    if (!ok) {
+        trie_dawg_destroy(d);
+        return NULL;
+    }
+
+    // drop the slack
+    TRIE_GROW(&d->mem_usage, (void **)&d->first, b.state_alloc, 
+        d->state_count + 1, sizeof(uint32_t));
+    TRIE_GROW(&d->mem_usage, (void **)&d->final, b.state_alloc, 
+        d->state_count, 1);
+    TRIE_GROW(&d->mem_usage, (void **)&d->target, b.edge_alloc, d->edge_count,
+        sizeof(uint32_t));
+    TRIE_GROW(&d->mem_usage, (void **)&d->skip, b.edge_alloc, d->edge_count,
+        sizeof(uint32_t));
+    TRIE_GROW(&d->mem_usage, (void **)&d->tails, b.edge_alloc, 
+        d->edge_count + 1, sizeof(uint32_t));
+    TRIE_GROW(&d->mem_usage, &d->tail, b.tail_alloc, d->tail_len, b.w);
+
+    return d;
+}
+
+// Edge of state s whose label starts with ch, DAWG_NONE if there is none.
+static inline unsigned long DAWGEDGE(const trie_dawg_t *d, unsigned long s,
+    TRIE_CHAR ch)
+{
+    unsigned long lo, hi, mid;
+    TRIE_CHAR c;
+
+    lo = d->first[s];
+    hi = d->first[s+1];
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        c = WCHAR_READ(d->tail, d->char_size, d->tails[mid]);
+        if (c < ch) {
+            lo = mid + 1;
+        } else if (c > ch) {
+            hi = mid;
+        } else {
+            return mid;
+        }
+    }
+    return DAWG_NONE;
+}
+
+// Follows the edge on s[*i] and its label. Returns the edge and moves *i
+// past the label, DAWG_NONE if the key leaves the automaton. If partial is
+// given, a key ending inside the label is accepted too and *partial set.
+static inline unsigned long _dawg_step(const trie_dawg_t *d, unsigned long st,
+    const void *s, const unsigned char ksize, unsigned long *i,
+    unsigned long size, int *partial)
+{
+    unsigned long e, k, from, len;
+
+    e = DAWGEDGE(d, st, WCHAR_READ(s, ksize, *i));
+    if (e == DAWG_NONE) {
+        return DAWG_NONE;
+    }
+    from = d->tails[e];
+    len = d->tails[e+1] - from;
+    for (k = 1; k < len; k++) {
+        if (*i + k == size) {
+            if (!partial) {
+                return DAWG_NONE;
+            }
+            *partial = 1;
+            return e;
+        }
+        if (WCHAR_READ(s, ksize, *i + k) != WCHAR_READ(d->tail, d->char_size,
+            from + k)) {
+            return DAWG_NONE;
+        }
+    }
+    *i += len;
+    return e;
+}
+
+static inline TRIE_DATA _dawg_search(const trie_dawg_t *d, const void *s,
+    const unsigned char ksize, unsigned long size)
+{
+    unsigned long i, e, st, rank;
+
+    st = d->root;
+    rank = 0;
+    i = 0;
+    while (i < size) {
+        e = _dawg_step(d, st, s, ksize, &i, size, NULL);
+        if (e == DAWG_NONE) {
+            return 0;
+        }
+        rank += d->skip[e];
+        st = d->target[e];
+    }
+    return d->final[st] ? d->values[rank] : 0;
+}
+
+TRIE_DATA trie_dawg_search(trie_dawg_t *d, trie_key_t *key)
+{
+    switch(key->char_size)
+    {
+        case 1:
+            return _dawg_search(d, key->s, 1, key->size);
+        case 2:
+            return _dawg_search(d, key->s, 2, key->size);
+        case 4:
+            return _dawg_search(d, key->s, 4, key->size);
+    }
+    // an empty key may come without a char_size
+    return key->size ? 0 : _dawg_search(d, key->s, 1, 0);
+}
+
+// Writes the label of edge e to key at index. Returns the key length after
+// it, or DAWG_NONE if it does not fit.
+static unsigned long _dawg_write_label(const trie_dawg_t *d, unsigned long e,
+    trie_key_t *key, unsigned long index)
+{
+    unsigned long k, from, len;
+
+    from = d->tails[e];
+    len = d->tails[e+1] - from;
+    if (index + len > key->alloc_size) {
+        return DAWG_NONE;
+    }
+    for (k = 0; k < len; k++) {
+        ((TRIE_CHAR *)key->s)[index + k] = WCHAR_READ(d->tail, d->char_size,
+            from + k);
+    }
+    return index + len;
+}
+
+static void _dawg_iter_push(trie_dawg_iter_t *it, unsigned long st,
+    unsigned long index, unsigned long rank)
+{
+    trie_dawg_pos_t *p;
+
+    p = &it->stack[it->sp++];
+    p->next = it->dawg->first[st];
+    p->end = it->dawg->first[st+1];
+    p->index = index;
+    p->rank = rank;
+}
+
+// Keys are returned in key order, values are found by the rank of the key
+// as in _dawg_search().
+iter_t *trie_dawg_iter_init(trie_dawg_t *d, trie_key_t *key,
+    unsigned long max_depth)
+{
+    trie_dawg_iter_t *it;
+    trie_key_t *kp;
+    unsigned long i, e, st, rank, index;
+    int partial;
+
+    kp = (trie_key_t *)PyMem_Malloc(sizeof(trie_key_t));
+    if (!kp) {
+        return NULL;
+    }
+    kp->char_size = sizeof(TRIE_CHAR);
+    kp->alloc_size = key->size + max_depth;
+    kp->s = (char *)PyMem_Malloc((kp->alloc_size + 1) * sizeof(TRIE_CHAR));
+    if (!kp->s) {
+        PyMem_Free(kp);
+        return NULL;
+    }
+    for (i = 0; i < key->size; i++) {
+        ((TRIE_CHAR *)kp->s)[i] = WCHAR_READ(key->s, key->char_size, i);
+    }
+    kp->size = key->size;
+
+    // walk the prefix, completing the label it may end in
+    st = d->root;
+    rank = 0;
+    i = 0;
+    partial = 0;
+    while (i < key->size) {
+        index = i;
+        e = _dawg_step(d, st, kp->s, sizeof(TRIE_CHAR), &i, key->size,
+            &partial);
+        if (e == DAWG_NONE) {
+            st = DAWG_NONE;
+            break;
+        }
+        if (partial) {
+            i = _dawg_write_label(d, e, kp, index);
+            if (i == DAWG_NONE) {
+                st = DAWG_NONE;
+                break;
+            }
+        }
+        rank += d->skip[e];
+        st = d->target[e];
+    }
+
+    it = st == DAWG_NONE ? NULL :
+        (trie_dawg_iter_t *)PyMem_Malloc(sizeof(trie_dawg_iter_t));
+    if (it) {
+        it->stack = (trie_dawg_pos_t *)PyMem_Malloc((max_depth + 2) *
+            sizeof(trie_dawg_pos_t));
+    }
+    if (!it || !it->stack) {
+        PyMem_Free(it);
+        PyMem_Free(kp->s);
+        PyMem_Free(kp);
+        return NULL;
+    }
+
+    memset(&it->iter, 0, sizeof(iter_t));
+    it->iter.key = kp;
+    it->iter.max_depth = max_depth;
+    it->dawg = d;
+    it->st = st;
+    it->rank = rank;
+    it->prefix_len = i;
+    trie_dawg_iter_reset(&it->iter);
+
+    return &it->iter;
+}
+
+iter_t *trie_dawg_iter_reset(iter_t *iter)
+{
+    trie_dawg_iter_t *it = (trie_dawg_iter_t *)iter;
+
+    it->sp = 0;
+    it->iter.key->size = it->prefix_len;
+    it->iter.first = 1;
+    it->iter.last = 0;
+    it->iter.fail = 0;
+    it->iter.fail_reason = UNDEFINED;
+    return iter;
+}
+
+iter_t *trie_dawg_iter_next(iter_t *iter)
+{
+    trie_dawg_iter_t *it = (trie_dawg_iter_t *)iter;
+    trie_dawg_t *d = it->dawg;
+    trie_dawg_pos_t *p;
+    unsigned long e, st, rank, index;
+
+    if (iter->first) {
+        iter->first = 0;
+        _dawg_iter_push(it, it->st, it->prefix_len, it->rank);
+        if (d->final[it->st]) {
+            iter->key->size = it->prefix_len;
+            iter->value = d->values[it->rank];
+            return iter;
+        }
+    }
+
+    while (it->sp) {
+        p = &it->stack[it->sp-1];
+        if (p->next == p->end) {
+            it->sp--;
+            continue;
+        }
+        e = p->next++;
+        index = _dawg_write_label(d, e, iter->key, p->index);
+        if (index == DAWG_NONE) {
+            continue; // deeper than max_depth
+        }
+        rank = p->rank + d->skip[e];
+        st = d->target[e];
+        _dawg_iter_push(it, st, index, rank);
+        if (d->final[st]) {
+            iter->key->size = index;
+            iter->value = d->values[rank];
+            return iter;
+        }
+    }
+
+    iter->last = 1;
+    return iter;
+}
+
+void trie_dawg_iter_deinit(iter_t *iter)
+{
+    trie_dawg_iter_t *it = (trie_dawg_iter_t *)iter;
+
+    PyMem_Free(it->stack);
+    PyMem_Free(iter->key->s);
+    PyMem_Free(iter->key);
+    PyMem_Free(it);
+}
+
+// Same as trie_suffixes(): keys starting with key and at most max_depth
+// chars longer, in key order.
+void trie_dawg_suffixes(trie_dawg_t *d, trie_key_t *key,
+    unsigned long max_depth, trie_enum_cbk_t cbk, void* cbk_arg)
+{
+    iter_t *iter;
+    trie_node_t nd; // callbacks only read the value
+
+    iter = trie_dawg_iter_init(d, key, max_depth);
+    if (!iter) {
+        return;
+    }
+    memset(&nd, 0, sizeof(trie_node_t));
+    for (;;) {
+        trie_dawg_iter_next(iter);
+        if (iter->last) {
+            break;
+        }
+        nd.value = iter->value;
+        cbk(iter->key, &nd, cbk_arg);
+    }
+    trie_dawg_iter_deinit(iter);
+}
+
+// Cursor of a dawg, see Note 17. Slots are edge numbers, the edges of a 
+// state are consecutive. Frames carry the rank of their first key.
+static void _dawg_cursor_root(trie_cursor_t *c, trie_cursor_frame_t *f)
+{
+    f->node = ((trie_dawg_t *)c->form)->root;
+    f->index = 0;
+}
+
+static TRIE_DATA _dawg_cursor_value(trie_cursor_t *c, trie_cursor_frame_t *f)
+{
+    trie_dawg_t *d = (trie_dawg_t *)c->form;
+
+    return d->final[f->node] ? d->values[f->rank] : 0;
+}
+
+static unsigned long _dawg_cursor_edge(trie_cursor_t *c,
+    trie_cursor_frame_t *f, unsigned long slot, int dir)
+{
+    trie_dawg_t *d = (trie_dawg_t *)c->form;
+    unsigned long first, end;
+
+    first = d->first[f->node];
+    end = d->first[f->node+1];
+    if (slot == TRIE_CURSOR_NONE) {
+        slot = dir > 0 ? first : end - 1;
+    } else {
+        slot = dir > 0 ? slot + 1 : slot - 1;
+    }
+    return first < end && slot >= first && slot < end ? slot :
+        TRIE_CURSOR_NONE;
+}
+
+static void _dawg_cursor_enter(trie_cursor_t *c, trie_cursor_frame_t *f,
+    trie_cursor_frame_t *child)
+{
+    trie_dawg_t *d = (trie_dawg_t *)c->form;
+
+    child->node = d->target[child->slot];
+    child->rank = f->rank + d->skip[child->slot];
+    child->index = _dawg_write_label(d, child->slot, &c->key, f->index);
+}
+
+static unsigned long _dawg_cursor_height(trie_cursor_t *c)
+{
+    return ((trie_dawg_t *)c->form)->height;
+}
+
+static const trie_cursor_ops_t _dawg_cursor_ops = {
+    _dawg_cursor_root, _dawg_cursor_value, _dawg_cursor_edge,
+    _dawg_cursor_enter, _dawg_cursor_height
+};
+
+trie_cursor_t *trie_dawg_cursor(trie_dawg_t *d)
+{
+    return trie_cursor_create(&_dawg_cursor_ops, d);
+}
+
+static int _dawg_thaw_add(trie_key_t *key, trie_node_t *node, void *arg)
+{
+    return trie_add((trie_t *)arg, key, node->value);
+}
+
+// Rebuilds a trie_t holding the keys and values of d.
+trie_t *trie_dawg_thaw(trie_dawg_t *d)
+{
+    trie_t *t;
+    trie_key_t key;
+
+    t = trie_create();
+    if (!t) {
+        return NULL;
+    }
+    if (!trie_widen(t, d->char_size)) {
+        trie_destroy(t);
+        return NULL;
+    }
+    memset(&key, 0, sizeof(trie_key_t));
+    trie_dawg_suffixes(d, &key, d->height, _dawg_thaw_add, t);
+    if (t->item_count != d->item_count) {
+        trie_destroy(t);
+        return NULL;
+    }
+    return t;
+}
@@ -0,0 +1,943 @@
+#include "trie.h"
+#include "string.h"
+#include "errno.h"
+#ifndef __WINDOWS
+#include <unistd.h>
+#endif
+
+// Decodes the UTF-8 chars of s[0, len) to out, which holds len chars at 
+// least. Returns the number of chars, or -1 if s is not valid UTF-8: 
+// overlong forms, surrogates and code points above 0x10ffff included.
+static long _utf8_decode(const unsigned char *s, unsigned long len, 
+    uint32_t *out)
+{
+    unsigned long i, n, k;
+    uint32_t ch, min;
+
+    n = 0;
+    for (i = 0; i < len; n++) {
+        ch = s[i++];
+        if (ch < 0x80) {
+            out[n] = ch;
+            continue;
+        }
+        if (ch >= 0xf0 && ch <= 0xf4) {
+            k = 3;
+            ch &= 0x07;
+            min = 0x10000;
+        } else if (ch >= 0xe0) {
+            k = 2;
+            ch &= 0x0f;
+            min = 0x800;
+        } else if (ch >= 0xc2 && ch < 0xe0) {
+            k = 1;
+            ch &= 0x1f;
+            min = 0x80;
+        } else {
+            return -1;
+        }
+        if (len - i < k || ch > 0x10ffff) {
+            return -1;
+        }
+        for (; k > 0; k--) {
+            if ((s[i] & 0xc0) != 0x80) {
+                return -1;
+            }
+            ch = (ch << 6) | (s[i++] & 0x3f);
+        }
+        if (ch < min || ch > 0x10ffff || (ch >= 0xd800 && ch <= 0xdfff)) {
+            return -1;
+        }
+        out[n] = ch;
+    }
+    return (long)n;
+}
+
+// Parses a signed decimal 64 bit integer that spans all of s[0, len).
+static int _parse_int(const char *s, unsigned long len, int64_t *v)
+{
+    uint64_t u, limit;
+    unsigned long i;
+    int neg;
+
+    i = 0;
+    neg = len && s[0] == '-';
+    if (len && (s[0] == '-' || s[0] == '+')) {
+        i++;
+    }
+    if (i == len) {
+        return 0;
+    }
+    limit = neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    u = 0;
+    for (; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9' || u > (limit - (s[i] - '0')) / 10) {
+            return 0;
+        }
+        u = u * 10 + (s[i] - '0');
+    }
+    *v = neg ? (int64_t)(0 - u) : (int64_t)u;
+    return 1;
+}
+
+// Adds one line, without its line end, as record l->count.
+static trie_load_error_t _load_line(trie_load_t *l, const char *s, 
+    unsigned long len, uint32_t **chars, unsigned long *chars_size)
+{
+    trie_t *t = l->trie;
+    const char *tab;
+    unsigned long klen, i;
+    long n;
+    int ascii;
+
+    klen = len;
+    tab = NULL;
+    if (l->kind != TRIE_LOAD_KEYS) {
+        tab = (const char *)memchr(s, '\t', len);
+        if (!tab) {
+            return TRIE_LOAD_BADVALUE;
+        }
+        klen = tab - s;
+        tab++;
+    }
+
+    switch(l->kind)
+    {
+        case TRIE_LOAD_INT:
+            if (!TRIERESERVE(t, (void **)&l->ints, &l->ints_size, l->count + 1,
+                sizeof(int64_t))) {
+                return TRIE_LOAD_NOMEM;
+            }
+            if (!_parse_int(tab, len - klen - 1, &l->ints[l->count])) {
+                return TRIE_LOAD_BADVALUE;
+            }
+            break;
+        case TRIE_LOAD_BYTES:
+            if (!TRIERESERVE(t, (void **)&l->offsets, &l->offsets_size, 
+                l->count + 2, sizeof(uint64_t)) || 
+                !TRIERESERVE(t, (void **)&l->blob, &l->blob_size, 
+                l->blob_len + len - klen, 1)) {
+                return TRIE_LOAD_NOMEM;
+            }
+            memcpy(l->blob + l->blob_len, tab, len - klen - 1);
+            l->offsets[l->count] = l->blob_len;
+            l->blob_len += len - klen - 1;
+            l->offsets[l->count + 1] = l->blob_len;
+            break;
+        default:
+            break;
+    }
+
+    // ASCII keys are added straight from the buffer
+    ascii = 1;
+    for (i = 0; i < klen && ascii; i++) {
+        ascii = !(s[i] & 0x80);
+    }
+    if (ascii) {
+        if (!trie_add_ucs1(t, (const uint8_t *)s, klen, TRIE_LOAD_TAG(l->count))) {
+            return TRIE_LOAD_NOMEM;
+        }
+    } else {
+        if (!TRIERESERVE(t, (void **)chars, chars_size, klen, sizeof(uint32_t))) {
+            return TRIE_LOAD_NOMEM;
+        }
+        n = _utf8_decode((const unsigned char *)s, klen, *chars);
+        if (n < 0) {
+            return TRIE_LOAD_BADUTF8;
+        }
+        if (!trie_add_ucs4(t, *chars, (unsigned long)n, TRIE_LOAD_TAG(l->count))) {
+            return TRIE_LOAD_NOMEM;
+        }
+    }
+    l->count++;
+    return TRIE_LOAD_OK;
+}
+
+// Reads the file at path into l->trie, see Note 13. The file is read 
+// TRIE_LOAD_BUFFER bytes at a time and keys are decoded into a buffer that
+// is reused for every line. On failure l->line is the line at fault and 
+// l->trie is NULL; either way l is to be released by trie_load_release().
+trie_load_error_t trie_load(const char *path, trie_load_kind_t kind, 
+    trie_load_t *l)
+{
+    trie_load_error_t err;
+    FILE *f;
+    char *buf, *p, *nl;
+    uint32_t *chars;
+    unsigned long size, have, got, start, len, chars_size;
+    int eof, saved_errno;
+
+    memset(l, 0, sizeof(trie_load_t));
+    l->kind = kind;
+    f = fopen(path, "rb");
+    if (!f) {
+        return TRIE_LOAD_IOERROR;
+    }
+    l->trie = trie_create();
+    buf = NULL;
+    chars = NULL;
+    size = chars_size = 0;
+    err = TRIE_LOAD_NOMEM;
+    if (!l->trie || !TRIERESERVE(l->trie, (void **)&buf, &size, 
+        TRIE_LOAD_BUFFER, 1)) {
+        goto out;
+    }
+
+    err = TRIE_LOAD_OK;
+    have = 0;
+    eof = 0;
+    while (!eof && err == TRIE_LOAD_OK) {
+        got = (unsigned long)fread(buf + have, 1, size - have, f);
+        if (got < size - have) {
+            if (ferror(f)) {
+                err = TRIE_LOAD_IOERROR;
+                break;
+            }
+            eof = 1;
+        }
+        have += got;
+
+        // whole lines, and at the end of the file the last one too
+        start = 0;
+        while (err == TRIE_LOAD_OK && start < have) {
+            p = buf + start;
+            nl = (char *)memchr(p, '\n', have - start);
+            if (!nl && !eof) {
+                break;
+            }
+            len = nl ? (unsigned long)(nl - p) : have - start;
+            start += len + (nl != NULL);
+            l->line++;
+            if (len && p[len-1] == '\r') {
+                len--;
+            }
+            if (len) {
+                err = _load_line(l, p, len, &chars, &chars_size);
+            }
+        }
+
+        // keep the partial line, growing the buffer if it fills it
+        memmove(buf, buf + start, have - start);
+        have -= start;
+        if (have == size && !TRIERESERVE(l->trie, (void **)&buf, &size, 
+            size + 1, 1)) {
+            err = TRIE_LOAD_NOMEM;
+        }
+    }
+
+out:
+    saved_errno = errno; // for TRIE_LOAD_IOERROR, fclose may change it
+    fclose(f);
+    if (buf) {
+        TRIEFREE(l->trie, buf);
+    }
+    if (chars) {
+        TRIEFREE(l->trie, chars);
+    }
+    if (err != TRIE_LOAD_OK && l->trie) {
+        trie_load_release(l);
+        trie_destroy(l->trie);
+        l->trie = NULL;
+    }
+    errno = saved_errno;
+    return err;
+}
+
+// Frees the records of l, they are accounted to its trie. The trie itself
+// is the caller's.
+void trie_load_release(trie_load_t *l)
+{
+    if (!l->trie) {
+        return; // a failed load released them already
+    }
+    if (l->ints) {
+        TRIEFREE(l->trie, l->ints);
+    }
+    if (l->offsets) {
+        TRIEFREE(l->trie, l->offsets);
+    }
+    if (l->blob) {
+        TRIEFREE(l->trie, l->blob);
+    }
+    l->ints = NULL;
+    l->offsets = NULL;
+    l->blob = NULL;
+}
+
+// Makes room for n more bytes in the buffer of d.
+static int _dump_reserve(trie_dump_t *d, unsigned long n)
+{
+    unsigned long size;
+    char *buf;
+
+    if (d->len + n <= d->size) {
+        return 1;
+    }
+    size = d->size;
+    while (size < d->len + n) {
+        size *= 2;
+    }
+    buf = (char *)TRIE_RAW_MALLOC(size);
+    if (!buf) {
+        return 0;
+    }
+    memcpy(buf, d->buf, d->len);
+    TRIE_RAW_FREE(d->buf);
+    d->buf = buf;
+    d->size = size;
+    return 1;
+}
+
+// Starts a dump to the file at path, or one whose buffer the caller writes
+// out if path is NULL, see Note 14. Returns 0 with errno set on failure.
+int trie_dump_open(trie_dump_t *d, const char *path)
+{
+    memset(d, 0, sizeof(trie_dump_t));
+    d->buf = (char *)TRIE_RAW_MALLOC(TRIE_DUMP_BUFFER);
+    if (!d->buf) {
+        errno = ENOMEM;
+        return 0;
+    }
+    d->size = TRIE_DUMP_BUFFER;
+    if (path) {
+        d->f = fopen(path, "wb");
+        if (!d->f) {
+            TRIE_RAW_FREE(d->buf);
+            d->buf = NULL;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Appends k as UTF-8. Returns 0 if out of memory and -1 if k holds a lone
+// surrogate, which UTF-8 cannot encode; either way nothing is appended.
+int trie_dump_key(trie_dump_t *d, trie_key_t *k)
+{
+    unsigned long i;
+    uint32_t ch;
+    unsigned char *p;
+#ifndef IS_PEP393_AVAILABLE
+    uint32_t lo;
+#endif
+
+    if (!_dump_reserve(d, k->size * 4)) {
+        return 0;
+    }
+    p = (unsigned char *)d->buf + d->len;
+    for (i = 0; i < k->size; i++) {
+        switch(k->char_size)
+        {
+            case 1:
+                ch = ((const uint8_t *)k->s)[i];
+                break;
+            case 2:
+                ch = ((const uint16_t *)k->s)[i];
+                break;
+            default:
+                ch = ((const uint32_t *)k->s)[i];
+                break;
+        }
+#ifndef IS_PEP393_AVAILABLE
+        // UTF-16 keys hold astral chars as surrogate pairs, see Note 2
+        if (ch >= 0xd800 && ch <= 0xdbff && i + 1 < k->size) {
+            lo = k->char_size == 2 ? ((const uint16_t *)k->s)[i+1] : 
+                ((const uint32_t *)k->s)[i+1];
+            if (lo >= 0xdc00 && lo <= 0xdfff) {
+                ch = 0x10000 + ((ch - 0xd800) << 10) + (lo - 0xdc00);
+                i++;
+            }
+        }
+#endif
+        if (ch < 0x80) {
+            *p++ = (unsigned char)ch;
+        } else if (ch < 0x800) {
+            *p++ = (unsigned char)(0xc0 | (ch >> 6));
+            *p++ = (unsigned char)(0x80 | (ch & 0x3f));
+        } else if (ch < 0x10000) {
+            if (ch >= 0xd800 && ch <= 0xdfff) {
+                return -1;
+            }
+            *p++ = (unsigned char)(0xe0 | (ch >> 12));
+            *p++ = (unsigned char)(0x80 | ((ch >> 6) & 0x3f));
+            *p++ = (unsigned char)(0x80 | (ch & 0x3f));
+        } else {
+            *p++ = (unsigned char)(0xf0 | (ch >> 18));
+            *p++ = (unsigned char)(0x80 | ((ch >> 12) & 0x3f));
+            *p++ = (unsigned char)(0x80 | ((ch >> 6) & 0x3f));
+            *p++ = (unsigned char)(0x80 | (ch & 0x3f));
+        }
+    }
+    d->len = (unsigned long)(p - (unsigned char *)d->buf);
+    return 1;
+}
+
+int trie_dump_bytes(trie_dump_t *d, const void *p, unsigned long n)
+{
+    if (!_dump_reserve(d, n)) {
+        return 0;
+    }
+    memcpy(d->buf + d->len, p, n);
+    d->len += n;
+    return 1;
+}
+
+// Writes the buffered lines to the file and empties the buffer. Returns 0 
+// with errno set on a write error.
+int trie_dump_flush(trie_dump_t *d)
+{
+    unsigned long len;
+
+    len = d->len;
+    d->len = 0;
+    if (len && fwrite(d->buf, 1, len, d->f) != len) {
+        return 0;
+    }
+    return 1;
+}
+
+// Ends the dump, writing out what is left for a file. Returns 0 with errno
+// set if that or closing the file fails.
+int trie_dump_close(trie_dump_t *d)
+{
+    int ok, saved_errno;
+
+    ok = 1;
+    if (d->f) {
+        ok = trie_dump_flush(d);
+        saved_errno = errno;
+        if (fclose(d->f) != 0 && ok) {
+            ok = 0;
+            saved_errno = errno;
+        }
+        errno = saved_errno;
+        d->f = NULL;
+    }
+    if (d->buf) {
+        TRIE_RAW_FREE(d->buf);
+        d->buf = NULL;
+    }
+    return ok;
+}
+
+// A new temporary file in dir, or in the default directory if dir is NULL,
+// that is removed when it is closed. Returns NULL with errno set.
+FILE *trie_tmpfile(const char *dir)
+{
+#ifdef __WINDOWS
+    char *name;
+    FILE *f;
+
+    if (!dir) {
+        return tmpfile();
+    }
+    name = _tempnam(dir, "ftrie");
+    if (!name) {
+        return NULL;
+    }
+    f = fopen(name, "w+bD"); // D: deleted when closed
+    free(name);
+    return f;
+#else
+    char *name;
+    size_t len;
+    FILE *f;
+    int fd;
+
+    if (!dir) {
+        return tmpfile();
+    }
+    len = strlen(dir);
+    name = (char *)TRIE_RAW_MALLOC(len + sizeof("/fasttrie-XXXXXX"));
+    if (!name) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memcpy(name, dir, len);
+    memcpy(name + len, "/fasttrie-XXXXXX", sizeof("/fasttrie-XXXXXX"));
+    fd = mkstemp(name);
+    if (fd < 0) {
+        TRIE_RAW_FREE(name);
+        return NULL;
+    }
+    unlink(name); // the open file lives on without a name
+    TRIE_RAW_FREE(name);
+    f = fdopen(fd, "w+b");
+    if (!f) {
+        close(fd);
+    }
+    return f;
+#endif
+}
+
+// fseek() to a 64 bit offset from the start of f.
+int trie_fseek(FILE *f, uint64_t offset)
+{
+#ifdef __WINDOWS
+    return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+trie_sorter_t *trie_sorter_create(const char *tmpdir, unsigned long memory)
+{
+    trie_sorter_t *s;
+
+    s = (trie_sorter_t *)TRIE_RAW_MALLOC(sizeof(trie_sorter_t));
+    if (!s) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(trie_sorter_t));
+    s->memory = memory < TRIE_EXTERNAL_MIN_MEMORY ? TRIE_EXTERNAL_MIN_MEMORY : 
+        memory;
+    s->tmpdir = tmpdir;
+    s->trie = trie_create();
+    if (!s->trie || !trie_dump_open(&s->out, NULL)) {
+        trie_sorter_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+void trie_sorter_destroy(trie_sorter_t *s)
+{
+    unsigned long i;
+
+    for (i = 0; i < s->run_count; i++) {
+        fclose(s->runs[i]);
+    }
+    if (s->runs) {
+        TRIEFREE(NULL, s->runs);
+    }
+    if (s->trie) {
+        if (s->payload) {
+            TRIEFREE(s->trie, s->payload);
+        }
+        trie_destroy(s->trie);
+    }
+    s->out.f = NULL; // the runs are closed above
+    trie_dump_close(&s->out);
+    TRIE_RAW_FREE(s);
+}
+
+// Adds a record, replacing the payload of key if the current run has it. 
+// Returns 0 with errno set on failure.
+int trie_sorter_add(trie_sorter_t *s, trie_key_t *key, const char *payload, 
+    unsigned long len)
+{
+    uint32_t n;
+
+    if (len > UINT32_MAX) {
+        errno = EFBIG;
+        return 0;
+    }
+    if (!TRIERESERVE(s->trie, (void **)&s->payload, &s->payload_size, 
+        s->payload_len + sizeof(n) + len, 1) || 
+        !trie_add(s->trie, key, (TRIE_DATA)s->payload_len + 1)) {
+        errno = ENOMEM;
+        return 0;
+    }
+    n = (uint32_t)len;
+    memcpy(s->payload + s->payload_len, &n, sizeof(n));
+    memcpy(s->payload + s->payload_len + sizeof(n), payload, len);
+    s->payload_len += sizeof(n) + len;
+    return 1;
+}
+
+// Whether the current run takes the memory budget, trie_sorter_spill() it 
+// then.
+int trie_sorter_full(trie_sorter_t *s)
+{
+    return s->trie->mem_usage >= s->memory;
+}
+
+typedef struct {
+    trie_sorter_t *s;
+    int failed;
+} _SpillArg;
+
+static int _spill_record(trie_key_t *k, trie_node_t *n, void *arg)
+{
+    _SpillArg *a = (_SpillArg *)arg;
+    trie_dump_t *d = &a->s->out;
+    const char *p;
+    unsigned long start;
+    uint32_t len;
+    int r;
+
+    if (a->failed) {
+        return 0;
+    }
+    start = d->len;
+    len = 0;
+    if (!trie_dump_bytes(d, &len, sizeof(len))) {
+        errno = ENOMEM;
+        a->failed = 1;
+        return 0;
+    }
+    r = trie_dump_key(d, k);
+    if (r <= 0) {
+        errno = r ? EILSEQ : ENOMEM;
+        a->failed = 1;
+        return 0;
+    }
+    len = (uint32_t)(d->len - start - sizeof(len));
+    memcpy(d->buf + start, &len, sizeof(len));
+
+    p = a->s->payload + (n->value - 1);
+    memcpy(&len, p, sizeof(len));
+    if (!trie_dump_bytes(d, p, sizeof(len) + len)) {
+        errno = ENOMEM;
+        a->failed = 1;
+        return 0;
+    }
+    if (TRIE_DUMP_FULL(d) && !trie_dump_flush(d)) {
+        a->failed = 1;
+    }
+    return 0;
+}
+
+// A run file and its last record, for the merge. 
+typedef struct sorter_run_s {
+    FILE *f;
+    unsigned long index; // of the run, a later one wins on equal keys
+    char *key; // UTF-8
+    unsigned long key_len;
+    unsigned long key_size;
+    char *payload;
+    unsigned long payload_len;
+    unsigned long payload_size;
+} sorter_run_t;
+
+// Reads a field behind its 32 bit length. Returns 0 at the end of the run
+// and -1 with errno set on failure.
+static int _run_field(FILE *f, char **p, unsigned long *len, 
+    unsigned long *size)
+{
+    uint32_t n;
+
+    if (fread(&n, sizeof(n), 1, f) != 1) {
+        return ferror(f) ? -1 : 0;
+    }
+    if (!TRIERESERVE(NULL, (void **)p, size, n ? n : 1, 1)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (n && fread(*p, 1, n, f) != n) {
+        if (!ferror(f)) {
+            errno = EIO; // a truncated run
+        }
+        return -1;
+    }
+    *len = n;
+    return 1;
+}
+
+// Reads the next record of r. Returns 0 at the end of the run and -1 with
+// errno set on failure.
+static int _run_next(sorter_run_t *r)
+{
+    int ok;
+
+    ok = _run_field(r->f, &r->key, &r->key_len, &r->key_size);
+    if (ok == 1) {
+        ok = _run_field(r->f, &r->payload, &r->payload_len, &r->payload_size);
+        if (ok == 0) {
+            errno = EIO; // a key without a payload
+            ok = -1;
+        }
+    }
+    return ok;
+}
+
+// Whether run a comes before run b in the merge: smaller key first, and of
+// equal keys the one of the later run.
+static int _run_before(sorter_run_t *a, sorter_run_t *b)
+{
+    unsigned long n;
+    int c;
+
+    n = a->key_len < b->key_len ? a->key_len : b->key_len;
+    c = memcmp(a->key, b->key, n);
+    if (c) {
+        return c < 0;
+    }
+    if (a->key_len != b->key_len) {
+        return a->key_len < b->key_len;
+    }
+    return a->index > b->index;
+}
+
+static void _run_sift(sorter_run_t **heap, unsigned long n, unsigned long i)
+{
+    sorter_run_t *tmp;
+    unsigned long c;
+
+    for (;;) {
+        c = 2 * i + 1;
+        if (c >= n) {
+            break;
+        }
+        if (c + 1 < n && _run_before(heap[c+1], heap[c])) {
+            c++;
+        }
+        if (!_run_before(heap[c], heap[i])) {
+            break;
+        }
+        tmp = heap[i];
+        heap[i] = heap[c];
+        heap[c] = tmp;
+        i = c;
+    }
+}
+
+typedef int (*_run_emit_t)(sorter_run_t *r, void *arg);
+
+// Merges runs[0, n) calling emit once for each key, with the record of the
+// latest run that has it. Returns 0 with errno set on failure.
+static int _runs_merge(FILE **runs, unsigned long n, _run_emit_t emit, 
+    void *arg)
+{
+    sorter_run_t *rs, **heap, *top;
+    char *prev;
+    unsigned long i, count, prev_len, prev_size;
+    int ok, r;
+
+    rs = (sorter_run_t *)TRIEMALLOC(NULL, n * sizeof(sorter_run_t));
+    heap = (sorter_run_t **)TRIEMALLOC(NULL, n * sizeof(sorter_run_t *));
+    if (!rs || !heap) {
+        if (rs) {
+            TRIEFREE(NULL, rs);
+        }
+        errno = ENOMEM;
+        return 0;
+    }
+    memset(rs, 0, n * sizeof(sorter_run_t));
+    prev = NULL;
+    prev_len = prev_size = 0;
+
+    ok = 1;
+    count = 0;
+    for (i = 0; i < n && ok; i++) {
+        rs[i].f = runs[i];
+        rs[i].index = i;
+        rewind(rs[i].f);
+        setvbuf(rs[i].f, NULL, _IOFBF, TRIE_SORTER_READ_BUFFER);
+        r = _run_next(&rs[i]);
+        if (r < 0) {
+            ok = 0;
+        } else if (r) {
+            heap[count++] = &rs[i];
+        }
+    }
+    for (i = count / 2; i-- > 0;) {
+        _run_sift(heap, count, i);
+    }
+
+    // of equal keys the latest run comes first, the others are skipped
+    while (ok && count) {
+        top = heap[0];
+        if (!prev || top->key_len != prev_len || 
+            memcmp(top->key, prev, prev_len) != 0) {
+            if (!emit(top, arg)) {
+                ok = 0;
+                break;
+            }
+            if (!TRIERESERVE(NULL, (void **)&prev, &prev_size, 
+                top->key_len + 1, 1)) {
+                errno = ENOMEM;
+                ok = 0;
+                break;
+            }
+            memcpy(prev, top->key, top->key_len);
+            prev_len = top->key_len;
+        }
+        r = _run_next(top);
+        if (r < 0) {
+            ok = 0;
+        } else if (!r) {
+            heap[0] = heap[--count];
+        }
+        _run_sift(heap, count, 0);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (rs[i].key) {
+            TRIEFREE(NULL, rs[i].key);
+        }
+        if (rs[i].payload) {
+            TRIEFREE(NULL, rs[i].payload);
+        }
+    }
+    if (prev) {
+        TRIEFREE(NULL, prev);
+    }
+    TRIEFREE(NULL, heap);
+    TRIEFREE(NULL, rs);
+    return ok;
+}
+
+static int _write_record(sorter_run_t *r, void *arg)
+{
+    trie_dump_t *d = (trie_dump_t *)arg;
+    uint32_t n;
+
+    n = (uint32_t)r->key_len;
+    if (!trie_dump_bytes(d, &n, sizeof(n)) || 
+        !trie_dump_bytes(d, r->key, r->key_len)) {
+        errno = ENOMEM;
+        return 0;
+    }
+    n = (uint32_t)r->payload_len;
+    if (!trie_dump_bytes(d, &n, sizeof(n)) || 
+        !trie_dump_bytes(d, r->payload, r->payload_len)) {
+        errno = ENOMEM;
+        return 0;
+    }
+    if (TRIE_DUMP_FULL(d)) {
+        return trie_dump_flush(d);
+    }
+    return 1;
+}
+
+// Merges all runs into one, which keeps the number of files open and the 
+// read buffers of the final merge bounded.
+static int _sorter_compact(trie_sorter_t *s)
+{
+    FILE *f;
+    unsigned long i;
+    int ok;
+
+    f = trie_tmpfile(s->tmpdir);
+    if (!f) {
+        return 0;
+    }
+    s->out.f = f;
+    s->out.len = 0;
+    ok = _runs_merge(s->runs, s->run_count, _write_record, &s->out) && 
+        trie_dump_flush(&s->out) && fflush(f) == 0;
+    s->out.f = NULL;
+    if (!ok) {
+        fclose(f);
+        return 0;
+    }
+    for (i = 0; i < s->run_count; i++) {
+        fclose(s->runs[i]);
+    }
+    s->runs[0] = f;
+    s->run_count = 1;
+    return 1;
+}
+
+// Writes the current run to a temporary file and starts an empty one. Does
+// not need the GIL. Returns 0 with errno set on failure.
+int trie_sorter_spill(trie_sorter_t *s)
+{
+    _SpillArg a;
+    trie_key_t k;
+    trie_t *t;
+    FILE *f;
+
+    if (s->run_count == TRIE_SORTER_MAX_RUNS && !_sorter_compact(s)) {
+        return 0;
+    }
+    if (!TRIERESERVE(NULL, (void **)&s->runs, &s->runs_size, 
+        s->run_count + 1, sizeof(FILE *))) {
+        errno = ENOMEM;
+        return 0;
+    }
+    f = trie_tmpfile(s->tmpdir);
+    if (!f) {
+        return 0;
+    }
+
+    a.s = s;
+    a.failed = 0;
+    k.s = NULL;
+    k.size = 0;
+    k.alloc_size = 0;
+    k.char_size = 1;
+    s->out.f = f;
+    s->out.len = 0;
+    trie_suffixes(s->trie, &k, s->trie->height, _spill_record, &a);
+    if (a.failed || !trie_dump_flush(&s->out) || fflush(f) != 0) {
+        s->out.f = NULL;
+        fclose(f);
+        return 0;
+    }
+    s->out.f = NULL;
+    s->runs[s->run_count++] = f;
+
+    t = trie_create();
+    if (!t) {
+        errno = ENOMEM;
+        return 0;
+    }
+    if (s->payload) {
+        TRIEFREE(s->trie, s->payload);
+        s->payload = NULL;
+    }
+    s->payload_len = s->payload_size = 0;
+    trie_destroy(s->trie);
+    s->trie = t;
+    return 1;
+}
+
+typedef struct {
+    trie_sorter_cbk_t cbk;
+    void *arg;
+    uint32_t *chars;
+    unsigned long chars_size;
+} _MergeArg;
+
+static int _merge_record(sorter_run_t *r, void *arg)
+{
+    _MergeArg *a = (_MergeArg *)arg;
+    trie_key_t k;
+    long n;
+
+    if (!TRIERESERVE(NULL, (void **)&a->chars, &a->chars_size, 
+        r->key_len + 1, sizeof(uint32_t))) {
+        errno = ENOMEM;
+        return 0;
+    }
+    n = _utf8_decode((const unsigned char *)r->key, r->key_len, a->chars);
+    if (n < 0) {
+        errno = EILSEQ;
+        return 0;
+    }
+    k.s = (char *)a->chars;
+    k.size = (unsigned long)n;
+    k.alloc_size = a->chars_size;
+    k.char_size = sizeof(uint32_t);
+    return a->cbk(&k, r->payload, r->payload_len, a->arg);
+}
+
+// Hands every key added to cbk once, in code point order, with the payload
+// it was last added with; the sorter is empty afterwards. cbk returns 0 
+// with errno set to stop the merge. Does not need the GIL. Returns 0 with 
+// errno set on failure.
+int trie_sorter_merge(trie_sorter_t *s, trie_sorter_cbk_t cbk, void *arg)
+{
+    _MergeArg a;
+    unsigned long i;
+    int ok;
+
+    if ((s->trie->item_count || !s->run_count) && !trie_sorter_spill(s)) {
+        return 0;
+    }
+    a.cbk = cbk;
+    a.arg = arg;
+    a.chars = NULL;
+    a.chars_size = 0;
+    ok = _runs_merge(s->runs, s->run_count, _merge_record, &a);
+    if (a.chars) {
+        TRIEFREE(NULL, a.chars);
+    }
+    for (i = 0; i < s->run_count; i++) {
+        fclose(s->runs[i]);
+    }
+    s->run_count = 0;
+    return ok;
+}
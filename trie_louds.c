@@ -0,0 +1,626 @@
+#include "trie.h"
+#include "string.h"
+
+// Frozen LOUDS form of a trie, see Note 9 in trie.h. Like the double array
+// it is built once from a trie_t and only read afterwards.
+
+#define LOUDS_BLOCK 512
+#define LOUDS_NONE ((unsigned long)-1)
+
+static void *LOUDSMALLOC(trie_louds_t *l, unsigned long size)
+{
+    void *p;
+
+    p = PyMem_Malloc(size ? size : 1);
+    if (p) {
+        l->mem_usage += size;
+    }
+    return p;
+}
+
+// Allocates a zeroed bitvector of size bits, padded to whole blocks.
+static int BVCREATE(trie_louds_t *l, trie_bv_t *bv, unsigned long size)
+{
+    unsigned long nb;
+
+    nb = size / LOUDS_BLOCK + 1;
+    bv->size = size;
+    bv->words = (uint64_t *)LOUDSMALLOC(l, nb * (LOUDS_BLOCK / 64) *
+        sizeof(uint64_t));
+    bv->ranks = (uint32_t *)LOUDSMALLOC(l, (nb + 1) * sizeof(uint32_t));
+    if (!bv->words || !bv->ranks) {
+        return 0;
+    }
+    memset(bv->words, 0, nb * (LOUDS_BLOCK / 64) * sizeof(uint64_t));
+    return 1;
+}
+
+static void BVFREE(trie_bv_t *bv)
+{
+    PyMem_Free(bv->words);
+    PyMem_Free(bv->ranks);
+}
+
+static inline void BVSET(trie_bv_t *bv, unsigned long i)
+{
+    bv->words[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static inline int BVGET(const trie_bv_t *bv, unsigned long i)
+{
+    return (bv->words[i / 64] >> (i % 64)) & 1;
+}
+
+// Fills the rank directory once all bits are set.
+static void BVINDEX(trie_bv_t *bv)
+{
+    unsigned long nb, b, i, r;
+
+    nb = bv->size / LOUDS_BLOCK + 1;
+    r = 0;
+    for (b = 0; b < nb; b++) {
+        bv->ranks[b] = (uint32_t)r;
+        for (i = b * (LOUDS_BLOCK / 64); i < (b + 1) * (LOUDS_BLOCK / 64); i++) {
+            r += TRIE_POPCOUNT64(bv->words[i]);
+        }
+    }
+    bv->ranks[nb] = (uint32_t)r;
+}
+
+// Ones in [0, i).
+static inline unsigned long BVRANK(const trie_bv_t *bv, unsigned long i)
+{
+    unsigned long j, r;
+
+    r = bv->ranks[i / LOUDS_BLOCK];
+    for (j = (i / LOUDS_BLOCK) * (LOUDS_BLOCK / 64); j < i / 64; j++) {
+        r += TRIE_POPCOUNT64(bv->words[j]);
+    }
+    if (i % 64) {
+        r += TRIE_POPCOUNT64(bv->words[i / 64] &
+            (((uint64_t)1 << (i % 64)) - 1));
+    }
+    return r;
+}
+
+// bits equal to bit in blocks [0, b)
+static inline unsigned long BVBEFORE(const trie_bv_t *bv, unsigned long b,
+    int bit)
+{
+    return bit ? bv->ranks[b] : b * LOUDS_BLOCK - bv->ranks[b];
+}
+
+// Position of the k-th (from 1) bit equal to bit, which shall exist.
+static unsigned long BVSELECT(const trie_bv_t *bv, unsigned long k, int bit)
+{
+    unsigned long lo, hi, mid, i, c;
+    uint64_t w;
+
+    // the last block with fewer than k such bits before it
+    lo = 0;
+    hi = bv->size / LOUDS_BLOCK + 1;
+    while (hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if (BVBEFORE(bv, mid, bit) < k) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    k -= BVBEFORE(bv, lo, bit);
+    for (i = lo * (LOUDS_BLOCK / 64);; i++) {
+        w = bit ? bv->words[i] : ~bv->words[i];
+        c = TRIE_POPCOUNT64(w);
+        if (c >= k) {
+            break;
+        }
+        k -= c;
+    }
+    while (--k) {
+        w &= w - 1;
+    }
+    return i * 64 + TRIE_POPCOUNT64((w & (~w + 1)) - 1);
+}
+
+// Position of the first 0 at or after i.
+static inline unsigned long BVNEXT0(const trie_bv_t *bv, unsigned long i)
+{
+    uint64_t w;
+
+    w = ~bv->words[i / 64] >> (i % 64);
+    while (!w) {
+        i = (i / 64 + 1) * 64;
+        w = ~bv->words[i / 64];
+    }
+    return i + TRIE_POPCOUNT64((w & (~w + 1)) - 1);
+}
+
+// Children of node x are the nodes [*first, *end).
+static inline void LOUDSCHILDREN(const trie_louds_t *l, unsigned long x,
+    unsigned long *first, unsigned long *end)
+{
+    unsigned long p;
+
+    p = BVSELECT(&l->shape, x + 1, 0);
+    *first = p - x;
+    *end = *first + (BVNEXT0(&l->shape, p + 1) - (p + 1));
+}
+
+// The label of node x past its first char is tail[*from, *from + *len).
+static inline void LOUDSREST(const trie_louds_t *l, unsigned long x,
+    unsigned long *from, unsigned long *len)
+{
+    unsigned long r;
+
+    if (!BVGET(&l->multi, x)) {
+        *from = *len = 0;
+        return;
+    }
+    r = BVRANK(&l->multi, x);
+    *from = BVSELECT(&l->bounds, r + 1, 1);
+    *len = BVSELECT(&l->bounds, r + 2, 1) - *from;
+}
+
+// Child of x whose label starts with ch, LOUDS_NONE if there is none.
+static inline unsigned long LOUDSCHILD(const trie_louds_t *l, unsigned long x,
+    TRIE_CHAR ch)
+{
+    unsigned long lo, hi, mid;
+    TRIE_CHAR c;
+
+    LOUDSCHILDREN(l, x, &lo, &hi);
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        c = WCHAR_READ(l->labels, l->char_size, mid);
+        if (c < ch) {
+            lo = mid + 1;
+        } else if (c > ch) {
+            hi = mid;
+        } else {
+            return mid;
+        }
+    }
+    return LOUDS_NONE;
+}
+
+static inline TRIE_DATA LOUDSVALUE(const trie_louds_t *l, unsigned long x)
+{
+    return BVGET(&l->terminal, x) ? l->values[BVRANK(&l->terminal, x)] : 0;
+}
+
+void trie_louds_destroy(trie_louds_t *l)
+{
+    BVFREE(&l->shape);
+    BVFREE(&l->terminal);
+    BVFREE(&l->multi);
+    BVFREE(&l->bounds);
+    PyMem_Free(l->labels);
+    PyMem_Free(l->tail);
+    PyMem_Free(l->values);
+    PyMem_Free(l);
+}
+
+// Compiles t into a new LOUDS trie. t is left unchanged and the values are
+// shared, the caller decides which of them owns the values afterwards.
+trie_louds_t *trie_louds_build(trie_t *t)
+{
+    trie_louds_t *l;
+    trie_node_t **order, *nd, *child;
+    unsigned long head, n, i, pos, tail_len, item;
+    TRIE_CHAR ch;
+    unsigned char w;
+    int ok;
+
+    l = (trie_louds_t *)PyMem_Malloc(sizeof(trie_louds_t));
+    if (!l) {
+        return NULL;
+    }
+    memset(l, 0, sizeof(trie_louds_t));
+    l->mem_usage = sizeof(trie_louds_t);
+    l->char_size = w = t->char_size;
+    l->item_count = t->item_count;
+    l->height = t->height;
+
+    // breadth first order, children in key order
+    order = (trie_node_t **)PyMem_Malloc(t->node_count * sizeof(trie_node_t *));
+    if (!order) {
+        PyMem_Free(l);
+        return NULL;
+    }
+    order[0] = t->root;
+    n = 1;
+    tail_len = 0;
+    for (head = 0; head < n; head++) {
+        pos = 0;
+        while ((child = trie_node_next_child(t, order[head], &pos, &ch))) {
+            order[n++] = child;
+            tail_len += child->label_len - 1;
+        }
+    }
+    l->node_count = n;
+
+    ok = BVCREATE(l, &l->shape, 2 * n + 1) &&
+        BVCREATE(l, &l->terminal, n) &&
+        BVCREATE(l, &l->multi, n) &&
+        BVCREATE(l, &l->bounds, tail_len + 1);
+    if (ok) {
+        l->labels = LOUDSMALLOC(l, n * w);
+        l->tail = LOUDSMALLOC(l, tail_len * w);
+        l->values = (TRIE_DATA *)LOUDSMALLOC(l, t->item_count *
+            sizeof(TRIE_DATA));
+        ok = l->labels && l->tail && l->values;
+    }
+    if (!ok) {
+        PyMem_Free(order);
+        trie_louds_destroy(l);
+        return NULL;
+    }
+
+    BVSET(&l->shape, 0);
+    pos = 2;
+    tail_len = 0;
+    item = 0;
+    WCHAR_WRITE(l->labels, w, 0, 0);
+    for (i = 0; i < n; i++) {
+        nd = order[i];
+        for (head = 0; head < nd->child_count; head++) {
+            BVSET(&l->shape, pos++);
+        }
+        pos++;
+
+        if (nd->value) {
+            BVSET(&l->terminal, i);
+            l->values[item++] = nd->value;
+        }
+        if (i == 0) {
+            continue;
+        }
+        WCHAR_WRITE(l->labels, w, i, WCHAR_READ(NODELABEL(nd, w), w, 0));
+        if (nd->label_len > 1) {
+            BVSET(&l->multi, i);
+            BVSET(&l->bounds, tail_len);
+            memcpy((char *)l->tail + tail_len * w,
+                (char *)NODELABEL(nd, w) + w, (nd->label_len - 1) * w);
+            tail_len += nd->label_len - 1;
+        }
+    }
+    BVSET(&l->bounds, tail_len);
+    PyMem_Free(order);
+
+    BVINDEX(&l->shape);
+    BVINDEX(&l->terminal);
+    BVINDEX(&l->multi);
+    BVINDEX(&l->bounds);
+
+    return l;
+}
+
+// Matches s[*i, size) against the rest of x's label. Returns 1 and moves *i
+// past it on a full match, 2 if s ends inside the label (*i is left as is).
+static inline int _louds_rest(const trie_louds_t *l, unsigned long x,
+    const void *s, const unsigned char ksize, unsigned long *i,
+    unsigned long size)
+{
+    unsigned long from, len, k;
+
+    LOUDSREST(l, x, &from, &len);
+    for (k = 0; k < len; k++) {
+        if (*i + k == size) {
+            return 2;
+        }
+        if (WCHAR_READ(s, ksize, *i + k) != WCHAR_READ(l->tail, l->char_size,
+            from + k)) {
+            return 0;
+        }
+    }
+    *i += len;
+    return 1;
+}
+
+// Node that key s ends on, LOUDS_NONE if it is not in the trie. If at is 
+// given, a key ending inside a label is matched too: *at is set to where the
+// label of the returned node starts in s, LOUDS_NONE on an exact match.
+static inline unsigned long _louds_walk(const trie_louds_t *l, const void *s,
+    const unsigned char ksize, unsigned long size, unsigned long *at)
+{
+    unsigned long i, x;
+    int r;
+
+    if (at) {
+        *at = LOUDS_NONE;
+    }
+    x = 0;
+    i = 0;
+    while (i < size) {
+        x = LOUDSCHILD(l, x, WCHAR_READ(s, ksize, i));
+        if (x == LOUDS_NONE) {
+            return LOUDS_NONE;
+        }
+        i++;
+        r = _louds_rest(l, x, s, ksize, &i, size);
+        if (r == 2 && at) {
+            *at = i - 1;
+            return x;
+        }
+        if (r != 1) {
+            return LOUDS_NONE;
+        }
+    }
+    return x;
+}
+
+TRIE_DATA trie_louds_search(trie_louds_t *l, trie_key_t *key)
+{
+    unsigned long x;
+
+    switch(key->char_size)
+    {
+        case 1:
+            x = _louds_walk(l, key->s, 1, key->size, NULL);
+            break;
+        case 2:
+            x = _louds_walk(l, key->s, 2, key->size, NULL);
+            break;
+        case 4:
+            x = _louds_walk(l, key->s, 4, key->size, NULL);
+            break;
+        default:
+            // an empty key may come without a char_size
+            x = key->size ? LOUDS_NONE : 0;
+            break;
+    }
+    return x == LOUDS_NONE ? 0 : LOUDSVALUE(l, x);
+}
+
+// Writes the label of x to key at index. Returns the key length after it,
+// or LOUDS_NONE if it does not fit.
+static unsigned long _louds_write_label(const trie_louds_t *l, unsigned long x,
+    trie_key_t *key, unsigned long index)
+{
+    unsigned long from, len, k;
+
+    LOUDSREST(l, x, &from, &len);
+    if (index + 1 + len > key->alloc_size) {
+        return LOUDS_NONE;
+    }
+    ((TRIE_CHAR *)key->s)[index] = WCHAR_READ(l->labels, l->char_size, x);
+    for (k = 0; k < len; k++) {
+        ((TRIE_CHAR *)key->s)[index + 1 + k] = WCHAR_READ(l->tail, l->char_size,
+            from + k);
+    }
+    return index + 1 + len;
+}
+
+static void _louds_push(trie_louds_iter_t *it, unsigned long x,
+    unsigned long index)
+{
+    trie_louds_pos_t *p;
+
+    p = &it->stack[it->sp++];
+    LOUDSCHILDREN(it->louds, x, &p->next, &p->end);
+    p->index = index;
+}
+
+// Keys are returned in key order: a node before its children, the children
+// in label order.
+iter_t *trie_louds_iter_init(trie_louds_t *l, trie_key_t *key,
+    unsigned long max_depth)
+{
+    trie_louds_iter_t *it;
+    trie_key_t *kp;
+    unsigned long i, x, at, prefix_len;
+
+    // walk the prefix on a UCS4 copy, it becomes the start of every key
+    kp = (trie_key_t *)PyMem_Malloc(sizeof(trie_key_t));
+    if (!kp) {
+        return NULL;
+    }
+    kp->char_size = sizeof(TRIE_CHAR);
+    kp->alloc_size = key->size + max_depth;
+    kp->s = (char *)PyMem_Malloc((kp->alloc_size + 1) * sizeof(TRIE_CHAR));
+    if (!kp->s) {
+        PyMem_Free(kp);
+        return NULL;
+    }
+    for (i = 0; i < key->size; i++) {
+        ((TRIE_CHAR *)kp->s)[i] = WCHAR_READ(key->s, key->char_size, i);
+    }
+    kp->size = key->size;
+
+    x = _louds_walk(l, kp->s, sizeof(TRIE_CHAR), key->size, &at);
+    prefix_len = key->size;
+    if (x != LOUDS_NONE && at != LOUDS_NONE) {
+        // the prefix ends inside the label of x, complete it
+        prefix_len = _louds_write_label(l, x, kp, at);
+        if (prefix_len == LOUDS_NONE) {
+            x = LOUDS_NONE;
+        }
+    }
+    it = x == LOUDS_NONE ? NULL :
+        (trie_louds_iter_t *)PyMem_Malloc(sizeof(trie_louds_iter_t));
+    if (it) {
+        it->stack = (trie_louds_pos_t *)PyMem_Malloc((max_depth + 2) *
+            sizeof(trie_louds_pos_t));
+    }
+    if (!it || !it->stack) {
+        PyMem_Free(it);
+        PyMem_Free(kp->s);
+        PyMem_Free(kp);
+        return NULL;
+    }
+
+    memset(&it->iter, 0, sizeof(iter_t));
+    it->iter.key = kp;
+    it->iter.max_depth = max_depth;
+    it->louds = l;
+    it->node = x;
+    it->prefix_len = prefix_len;
+    trie_louds_iter_reset(&it->iter);
+
+    return &it->iter;
+}
+
+iter_t *trie_louds_iter_reset(iter_t *iter)
+{
+    trie_louds_iter_t *it = (trie_louds_iter_t *)iter;
+
+    it->sp = 0;
+    it->iter.key->size = it->prefix_len;
+    it->iter.first = 1;
+    it->iter.last = 0;
+    it->iter.fail = 0;
+    it->iter.fail_reason = UNDEFINED;
+    return iter;
+}
+
+iter_t *trie_louds_iter_next(iter_t *iter)
+{
+    trie_louds_iter_t *it = (trie_louds_iter_t *)iter;
+    trie_louds_pos_t *p;
+    unsigned long x, index;
+
+    if (iter->first) {
+        iter->first = 0;
+        _louds_push(it, it->node, it->prefix_len);
+        it->iter.value = LOUDSVALUE(it->louds, it->node);
+        if (it->iter.value) {
+            iter->key->size = it->prefix_len;
+            return iter;
+        }
+    }
+
+    while (it->sp) {
+        p = &it->stack[it->sp-1];
+        if (p->next == p->end) {
+            it->sp--;
+            continue;
+        }
+        x = p->next++;
+        index = _louds_write_label(it->louds, x, iter->key, p->index);
+        if (index == LOUDS_NONE) {
+            continue; // deeper than max_depth
+        }
+        _louds_push(it, x, index);
+        it->iter.value = LOUDSVALUE(it->louds, x);
+        if (it->iter.value) {
+            iter->key->size = index;
+            return iter;
+        }
+    }
+
+    iter->last = 1;
+    return iter;
+}
+
+void trie_louds_iter_deinit(iter_t *iter)
+{
+    trie_louds_iter_t *it = (trie_louds_iter_t *)iter;
+
+    PyMem_Free(it->stack);
+    PyMem_Free(iter->key->s);
+    PyMem_Free(iter->key);
+    PyMem_Free(it);
+}
+
+// Same as trie_suffixes(): keys starting with key and at most max_depth
+// chars longer, in key order.
+void trie_louds_suffixes(trie_louds_t *l, trie_key_t *key, 
+    unsigned long max_depth, trie_enum_cbk_t cbk, void* cbk_arg)
+{
+    iter_t *iter;
+    trie_node_t nd; // callbacks only read the value
+
+    iter = trie_louds_iter_init(l, key, max_depth);
+    if (!iter) {
+        return;
+    }
+    memset(&nd, 0, sizeof(trie_node_t));
+    for (;;) {
+        trie_louds_iter_next(iter);
+        if (iter->last) {
+            break;
+        }
+        nd.value = iter->value;
+        cbk(iter->key, &nd, cbk_arg);
+    }
+    trie_louds_iter_deinit(iter);
+}
+
+// Cursor of a LOUDS trie, see Note 17. Slots are node numbers, the 
+// children of a node are consecutive.
+static void _louds_cursor_root(trie_cursor_t *c, trie_cursor_frame_t *f)
+{
+    f->node = 0;
+    f->index = 0;
+}
+
+static TRIE_DATA _louds_cursor_value(trie_cursor_t *c, trie_cursor_frame_t *f)
+{
+    return LOUDSVALUE((trie_louds_t *)c->form, f->node);
+}
+
+static unsigned long _louds_cursor_edge(trie_cursor_t *c,
+    trie_cursor_frame_t *f, unsigned long slot, int dir)
+{
+    unsigned long first, end;
+
+    LOUDSCHILDREN((trie_louds_t *)c->form, f->node, &first, &end);
+    if (slot == TRIE_CURSOR_NONE) {
+        slot = dir > 0 ? first : end - 1;
+    } else {
+        slot = dir > 0 ? slot + 1 : slot - 1;
+    }
+    return first < end && slot >= first && slot < end ? slot :
+        TRIE_CURSOR_NONE;
+}
+
+static void _louds_cursor_enter(trie_cursor_t *c, trie_cursor_frame_t *f,
+    trie_cursor_frame_t *child)
+{
+    child->node = child->slot;
+    child->index = _louds_write_label((trie_louds_t *)c->form, child->slot,
+        &c->key, f->index);
+}
+
+static unsigned long _louds_cursor_height(trie_cursor_t *c)
+{
+    return ((trie_louds_t *)c->form)->height;
+}
+
+static const trie_cursor_ops_t _louds_cursor_ops = {
+    _louds_cursor_root, _louds_cursor_value, _louds_cursor_edge,
+    _louds_cursor_enter, _louds_cursor_height
+};
+
+trie_cursor_t *trie_louds_cursor(trie_louds_t *l)
+{
+    return trie_cursor_create(&_louds_cursor_ops, l);
+}
+
+static int _louds_thaw_add(trie_key_t *key, trie_node_t *node, void *arg)
+{
+    return trie_add((trie_t *)arg, key, node->value);
+}
+
+// Rebuilds a trie_t holding the keys and values of l.
+trie_t *trie_louds_thaw(trie_louds_t *l)
+{
+    trie_t *t;
+    trie_key_t key;
+
+    t = trie_create();
+    if (!t) {
+        return NULL;
+    }
+    if (!trie_widen(t, l->char_size)) {
+        trie_destroy(t);
+        return NULL;
+    }
+    memset(&key, 0, sizeof(trie_key_t));
+    trie_louds_suffixes(l, &key, l->height, _louds_thaw_add, t);
+    if (t->item_count != l->item_count) {
+        trie_destroy(t);
+        return NULL;
+    }
+    return t;
+}
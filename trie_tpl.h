@@ -0,0 +1,346 @@
+
+// Width specialized trie loops. This file has no include guard: trie.c
+// includes it once per storage width with LABEL_T and TPL_SUFFIX defined,
+// and once per (key width, storage width) pair with KEY_T defined as well.
+// Chars are read through typed pointers, so there is no char_size switch
+// inside the loops; the trie_search/add/del entry points pick a variant once
+// per call.
+
+#define TPL_CAT(a, b) a##b
+#define TPL_XCAT(a, b) TPL_CAT(a, b)
+#define FN(name) TPL_XCAT(name, TPL_SUFFIX)
+#define LW sizeof(LABEL_T)
+
+#ifndef KEY_T
+
+// index of ch in the keys of a NODE4/NODE16 container or child_count.
+static unsigned long FN(_find_key)(trie_node_t *node, TRIE_CHAR ch)
+{
+    LABEL_T *keys;
+    unsigned long i, n;
+#ifdef TRIE_HAVE_SSE2
+    uint64_t mask;
+#endif
+
+    keys = (LABEL_T *)SORTED_KEYS(node);
+    n = node->child_count;
+#ifdef TRIE_HAVE_SSE2
+    if (node->kind == TRIE_NODE16 && _simd_level != TRIE_SIMD_NONE &&
+        NODECAP(node) * LW >= 16) {
+#ifdef TRIE_HAVE_AVX2
+        if (_simd_level == TRIE_SIMD_AVX2 && NODECAP(node) * LW >= 32) {
+            mask = _match_mask_avx2(keys, NODECAP(node) * LW, ch, LW);
+        } else
+#endif
+        mask = _match_mask_sse2(keys, NODECAP(node) * LW, ch, LW);
+        if (n * LW < 64) {
+            mask &= ((uint64_t)1 << (n * LW)) - 1;
+        }
+        return mask ? (unsigned long)TRIE_CTZ64(mask) / LW : n;
+    }
+#endif
+    for (i = 0; i < n; i++) {
+        if (keys[i] == ch) {
+            break;
+        }
+    }
+    return i;
+}
+
+// index of the first key >= ch in a sorted container
+static unsigned long FN(_lower_bound)(trie_node_t *node, TRIE_CHAR ch)
+{
+    LABEL_T *keys;
+    unsigned long lo, hi, mid;
+
+    keys = (LABEL_T *)SORTED_KEYS(node);
+    lo = 0;
+    hi = node->child_count;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (keys[mid] < ch) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static trie_node_t *FN(_get_child)(trie_node_t *node, TRIE_CHAR ch)
+{
+    trie_node48_t *n48;
+    trie_node256_t *n256;
+    unsigned long i;
+    unsigned char slot;
+
+    if ((TRIE_CHAR)(LABEL_T)ch != ch) {
+        return NULL; // wider than any char stored in the trie
+    }
+
+    switch(node->kind)
+    {
+        case TRIE_NODE4:
+        case TRIE_NODE16:
+            i = FN(_find_key)(node, ch);
+            return i < node->child_count ? SORTED_CHILDREN(node)[i] : NULL;
+        case TRIE_NODEN:
+            i = FN(_lower_bound)(node, ch);
+            if (i < node->child_count && ((LABEL_T *)SORTED_KEYS(node))[i] == ch) {
+                return SORTED_CHILDREN(node)[i];
+            }
+            return NULL;
+        case TRIE_NODE48:
+            n48 = (trie_node48_t *)node->children;
+            if (PAGE_OF(ch) != n48->page) {
+                return NULL;
+            }
+            slot = n48->index[PAGE_INDEX(ch)];
+            return slot ? n48->children[slot-1] : NULL;
+        case TRIE_NODE256:
+            n256 = (trie_node256_t *)node->children;
+            if (PAGE_OF(ch) != n256->page) {
+                return NULL;
+            }
+            return n256->children[PAGE_INDEX(ch)];
+    }
+    return NULL;
+}
+
+#else // KEY_T
+
+#define GET_CHILD TPL_XCAT(_get_child_w, LABEL_WIDTH)
+
+// Number of leading chars of nd's label that match s[index, size).
+static unsigned long FN(_label_common)(trie_node_t *nd, const KEY_T *s,
+    unsigned long index, unsigned long size)
+{
+    LABEL_T *label;
+    unsigned long i, n;
+
+    label = (LABEL_T *)NODELABEL(nd, LW);
+    n = size - index;
+    if (n > nd->label_len) {
+        n = nd->label_len;
+    }
+    for (i = 0; i < n; i++) {
+        if ((TRIE_CHAR)s[index+i] != (TRIE_CHAR)label[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
+// see _trie_prefix()
+static trie_node_t *FN(_prefix)(trie_node_t *node, const KEY_T *s,
+    unsigned long size, unsigned long *rest)
+{
+    unsigned long i, n;
+    trie_node_t *curr;
+
+    i = 0;
+    while(i < size)
+    {
+        curr = GET_CHILD(node, (TRIE_CHAR)s[i]);
+        if (!curr) {
+            return NULL;
+        }
+
+        n = FN(_label_common)(curr, s, i, size);
+        if (n < curr->label_len) {
+            if (i + n < size || !rest) {
+                return NULL;
+            }
+            *rest = curr->label_len - n;
+            return curr;
+        }
+
+        node = curr;
+        i += n;
+    }
+
+    if (rest) {
+        *rest = 0;
+    }
+    return node;
+}
+
+// A step of a trie_search_many() lane: looks up the child to follow, or 
+// matches the label of the child found by the previous step, and prefetches
+// what the next step reads. Returns 0 once the lookup is over.
+static int FN(_lane_step)(trie_lane_t *lane)
+{
+    const KEY_T *s = (const KEY_T *)lane->s;
+    trie_node_t *c;
+    unsigned long n;
+
+    c = lane->child;
+    if (!c) {
+        if (lane->index == lane->size) {
+            return 0;
+        }
+        c = GET_CHILD(lane->node, (TRIE_CHAR)s[lane->index]);
+        if (!c) {
+            lane->node = NULL;
+            return 0;
+        }
+        lane->child = c;
+        TRIE_PREFETCH(c);
+        return 1;
+    }
+
+    n = FN(_label_common)(c, s, lane->index, lane->size);
+    if (n < c->label_len) {
+        lane->node = NULL;
+        return 0;
+    }
+    lane->index += n;
+    lane->node = c;
+    lane->child = NULL;
+    if (lane->index < lane->size && c->children) {
+        _prefetch_children(c, (TRIE_CHAR)s[lane->index]);
+    }
+    return 1;
+}
+
+// Sets the label of a new node from s[0, len).
+static int FN(_label_from_key)(trie_t *t, trie_node_t *nd, const KEY_T *s,
+    unsigned long len)
+{
+    LABEL_T *label;
+    unsigned long i;
+
+    assert(nd->label_len == 0);
+
+    if (len > LABEL_INLINE(LW)) {
+        label = (LABEL_T *)ARENAALLOC(t, len * LW);
+        if (!label) {
+            return 0;
+        }
+        nd->label.ext = label;
+    } else {
+        label = (LABEL_T *)nd->label.inl;
+    }
+    for (i = 0; i < len; i++) {
+        label[i] = (LABEL_T)s[i];
+    }
+    nd->label_len = len;
+
+    return 1;
+}
+
+// see trie_add(). Every char of s shall fit in LABEL_T.
+static int FN(_add)(trie_t *t, const KEY_T *s, unsigned long size,
+    TRIE_DATA value)
+{
+    unsigned long i, n;
+    trie_node_t *curr, *parent;
+
+    i = 0;
+    parent = t->root;
+    while(i < size)
+    {
+        curr = GET_CHILD(parent, (TRIE_CHAR)s[i]);
+        if (!curr) {
+            // the rest of the key becomes the label of a single new leaf
+            curr = NODECREATE(t, (TRIE_DATA)0);
+            if (!curr) {
+                return 0;
+            }
+            if (!FN(_label_from_key)(t, curr, &s[i], size - i) ||
+                !trie_add_child(t, parent, curr)) {
+                NODEFREE(t, curr);
+                return 0;
+            }
+            parent = curr;
+            break;
+        }
+
+        // key diverges from (or ends inside) the label: split the edge there
+        n = FN(_label_common)(curr, s, i, size);
+        if (n < curr->label_len) {
+            if (!NODESPLIT(t, curr, n)) {
+                return 0;
+            }
+        }
+
+        parent = curr;
+        i += n;
+    }
+
+    if (!parent->value) {
+        t->item_count++;
+        t->version++;
+    }
+
+    if (size > t->height) {
+        t->height = size;
+    }
+
+    parent->value = value;
+    return 1;
+}
+
+// see trie_del()
+static int FN(_del)(trie_t *t, const KEY_T *s, unsigned long size)
+{
+    unsigned long i, n;
+    trie_node_t *curr, *parent;
+
+    i = 0;
+    parent = NULL;
+    curr = t->root;
+    while(i < size) {
+        parent = curr;
+        curr = GET_CHILD(curr, (TRIE_CHAR)s[i]);
+        if (!curr) {
+            return 0;
+        }
+        n = FN(_label_common)(curr, s, i, size);
+        if (n < curr->label_len) {
+            return 0;
+        }
+        i += n;
+    }
+
+    if (!curr->value) {
+        return 0;
+    }
+    curr->value = 0;
+    t->item_count--;
+    t->version++;
+
+    if (!parent) {
+        return 1; // the empty key lives on the root, which is never merged
+    }
+
+    // A node without a value has two children at least (see Note 6), so 
+    // only curr and its parent can be left breaking that: drop curr if it 
+    // has no children, or merge it with its only child. Dropping curr may 
+    // leave the parent with a single child in turn, but nothing above it 
+    // changes. So no path needs to be kept.
+    if (!curr->child_count) {
+        // TODO: Check response for success
+        trie_remove_child(t, parent, curr);
+        if (parent != t->root && !parent->value && parent->child_count == 1) {
+            NODEMERGE(t, parent);
+        }
+    } else if (curr->child_count == 1) {
+        NODEMERGE(t, curr);
+    }
+
+    return 1;
+}
+
+#undef GET_CHILD
+#undef KEY_T
+
+#endif // KEY_T
+
+#undef LW
+#undef FN
+#undef TPL_XCAT
+#undef TPL_CAT
+#undef TPL_SUFFIX
+#undef LABEL_T
+#undef LABEL_WIDTH